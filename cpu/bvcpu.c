@@ -0,0 +1,1055 @@
+/*
+ * bvcpu.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the entry points of the BLTsville CPU implementation
+ * (bltsville_cpu) and the validation of the bv_blt() parameters.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bvcpu.h"
+
+const struct bvcpu_kernels *bvcpu_kern;
+unsigned int bvcpu_ncpus = 1;
+unsigned int bvcpu_mapslot = BVBUFFMAP_FIRST_CPU;
+static int bvcpu_mapped;		/* bvcpu_mapslot is in use */
+
+/*
+ * bvcpu_init() - Library initialization.  If it fails, bvcpu_kern stays 0
+ * and every entry point returns BVERR_RSRC.  BVCPU_THREADS may set the
+ * number of threads used instead of the CPUs online.
+ */
+static void __attribute__((constructor)) bvcpu_init(void)
+{
+	const char *threads = getenv("BVCPU_THREADS");
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (threads && *threads)
+		n = strtol(threads, NULL, 10);
+
+	if (n > 1)
+		bvcpu_ncpus = n < BVCPU_MAXTHREADS ? (unsigned int)n :
+			BVCPU_MAXTHREADS;
+	bvcpu_kern = bvcpu_selectkernels();
+}
+
+/*
+ * BVCPU_FLAGS_SUPPORTED - bvbltparams.flags understood by this
+ * implementation.  Anything else results in BVERR_FLAGS.
+ */
+#define BVCPU_FLAGS_SUPPORTED \
+	(BVFLAG_OP_MASK | \
+	 BVFLAG_KEY_SRC | BVFLAG_KEY_DST | \
+	 BVFLAG_CLIP | \
+	 BVFLAG_HORZ_FLIP_SRC1 | BVFLAG_VERT_FLIP_SRC1 | \
+	 BVFLAG_HORZ_FLIP_SRC2 | BVFLAG_VERT_FLIP_SRC2 | \
+	 BVFLAG_HORZ_FLIP_MASK | BVFLAG_VERT_FLIP_MASK | \
+	 BVFLAG_SRCMASK | \
+	 BVFLAG_TILE_SRC1 | BVFLAG_TILE_SRC2 | BVFLAG_TILE_MASK | \
+	 BVFLAG_SRC2_AUXDSTRECT | BVFLAG_MASK_AUXDSTRECT | \
+	 BVFLAG_BATCH_MASK | \
+	 BVFLAG_ASYNC | \
+	 BVFLAG_SCALE_RETURN | \
+	 BVFLAG_DITHER_RETURN | \
+	 BVFLAG_TESTPARAMS_NOP)
+
+/*
+ * bvcpu_inerrs - The error codes reported for each of the surfaces of a
+ * BLT, so that a single routine can validate all of them.
+ */
+struct bvcpu_inerrs {
+	enum bverror desc;
+	enum bverror descvers;
+	enum bverror virtaddr;
+	enum bverror len;
+	enum bverror geom;
+	enum bverror geomvers;
+	enum bverror format;
+	enum bverror stride;
+	enum bverror rect;
+	enum bverror horzscale;
+	enum bverror vertscale;
+	enum bverror rot;
+	enum bverror tilevers;
+	enum bverror tileflags;
+	enum bverror tileaddr;
+	enum bverror tilesize;
+};
+
+static const struct bvcpu_inerrs bvcpu_dsterrs = {
+	BVERR_DSTDESC, BVERR_DSTDESC_VERS, BVERR_DSTDESC_VIRTADDR,
+	BVERR_DSTDESC_LEN, BVERR_DSTGEOM, BVERR_DSTGEOM_VERS,
+	BVERR_DSTGEOM_FORMAT, BVERR_DSTGEOM_STRIDE, BVERR_DSTRECT,
+	BVERR_DSTRECT, BVERR_DSTRECT, BVERR_DSTGEOM, BVERR_FLAGS,
+	BVERR_FLAGS, BVERR_FLAGS, BVERR_FLAGS,
+};
+
+static const struct bvcpu_inerrs bvcpu_src1errs = {
+	BVERR_SRC1DESC, BVERR_SRC1DESC_VERS, BVERR_SRC1DESC_VIRTADDR,
+	BVERR_SRC1DESC_LEN, BVERR_SRC1GEOM, BVERR_SRC1GEOM_VERS,
+	BVERR_SRC1GEOM_FORMAT, BVERR_SRC1GEOM_STRIDE, BVERR_SRC1RECT,
+	BVERR_SRC1_HORZSCALE, BVERR_SRC1_VERTSCALE, BVERR_SRC1_ROT,
+	BVERR_SRC1_TILE_VERS, BVERR_SRC1_TILE_FLAGS, BVERR_SRC1_TILE_VIRTADDR,
+	BVERR_SRC1_TILE_SIZE,
+};
+
+static const struct bvcpu_inerrs bvcpu_src2errs = {
+	BVERR_SRC2DESC, BVERR_SRC2DESC_VERS, BVERR_SRC2DESC_VIRTADDR,
+	BVERR_SRC2DESC_LEN, BVERR_SRC2GEOM, BVERR_SRC2GEOM_VERS,
+	BVERR_SRC2GEOM_FORMAT, BVERR_SRC2GEOM_STRIDE, BVERR_SRC2RECT,
+	BVERR_SRC2_HORZSCALE, BVERR_SRC2_VERTSCALE, BVERR_SRC2_ROT,
+	BVERR_SRC2_TILE_VERS, BVERR_SRC2_TILE_FLAGS, BVERR_SRC2_TILE_VIRTADDR,
+	BVERR_SRC2_TILE_SIZE,
+};
+
+static const struct bvcpu_inerrs bvcpu_maskerrs = {
+	BVERR_MASKDESC, BVERR_MASKDESC_VERS, BVERR_MASKDESC_VIRTADDR,
+	BVERR_MASKDESC_LEN, BVERR_MASKGEOM, BVERR_MASKGEOM_VERS,
+	BVERR_MASKGEOM_FORMAT, BVERR_MASKGEOM_STRIDE, BVERR_MASKRECT,
+	BVERR_MASK_HORZSCALE, BVERR_MASK_VERTSCALE, BVERR_MASK_ROT,
+	BVERR_MASK_TILE_VERS, BVERR_MASK_TILE_FLAGS, BVERR_MASK_TILE_VIRTADDR,
+	BVERR_MASK_TILE_SIZE,
+};
+
+/*
+ * bvcpu_intersect() - Clip rect to clip.  Returns 0 if nothing is left.
+ */
+static int bvcpu_intersect(struct bvrect *rect, const struct bvrect *clip)
+{
+	long left = rect->left > clip->left ? rect->left : clip->left;
+	long top = rect->top > clip->top ? rect->top : clip->top;
+	long right = (long)rect->left + rect->width;
+	long bottom = (long)rect->top + rect->height;
+	long cright = (long)clip->left + clip->width;
+	long cbottom = (long)clip->top + clip->height;
+
+	if (cright < right)
+		right = cright;
+	if (cbottom < bottom)
+		bottom = cbottom;
+	if (right <= left || bottom <= top) {
+		rect->width = rect->height = 0;
+		return 0;
+	}
+
+	rect->left = (int)left;
+	rect->top = (int)top;
+	rect->width = (unsigned int)(right - left);
+	rect->height = (unsigned int)(bottom - top);
+	return 1;
+}
+
+static int bvcpu_inside(const struct bvcpu_surf *surf, long x, long y,
+			unsigned int width, unsigned int height)
+{
+	return x >= 0 && y >= 0 &&
+		x + (long)width <= (long)surf->width &&
+		y + (long)height <= (long)surf->height;
+}
+
+/*
+ * bvcpu_tomem() - Map the coordinates of a pixel in the image of a surface
+ * turned rot quarter turns, lw x lh pixels, to memory.
+ */
+static void bvcpu_tomem(unsigned int rot, unsigned int lw, unsigned int lh,
+			long *x, long *y)
+{
+	long lx = *x, ly = *y;
+
+	switch (rot) {
+	case 1:
+		*x = (long)lh - 1 - ly;
+		*y = lx;
+		break;
+	case 2:
+		*x = (long)lw - 1 - lx;
+		*y = (long)lh - 1 - ly;
+		break;
+	case 3:
+		*x = ly;
+		*y = (long)lw - 1 - lx;
+		break;
+	}
+}
+
+/*
+ * bvcpu_toimage() - The inverse of bvcpu_tomem().
+ */
+static void bvcpu_toimage(unsigned int rot, unsigned int lw, unsigned int lh,
+			  long *x, long *y)
+{
+	long mx = *x, my = *y;
+
+	switch (rot) {
+	case 1:
+		*x = my;
+		*y = (long)lh - 1 - mx;
+		break;
+	case 2:
+		*x = (long)lw - 1 - mx;
+		*y = (long)lh - 1 - my;
+		break;
+	case 3:
+		*x = (long)lw - 1 - my;
+		*y = mx;
+		break;
+	}
+}
+
+/*
+ * bvcpu_rectmem() - Map a rectangle in the image of a surface to memory.
+ */
+static void bvcpu_rectmem(const struct bvcpu_surf *surf,
+			  const struct bvrect *rect, struct bvrect *mem)
+{
+	unsigned int lw = surf->rot & 1 ? surf->height : surf->width;
+	unsigned int lh = surf->rot & 1 ? surf->width : surf->height;
+	long x0 = rect->left, y0 = rect->top;
+	long x1 = x0 + (long)rect->width - 1;
+	long y1 = y0 + (long)rect->height - 1;
+
+	bvcpu_tomem(surf->rot, lw, lh, &x0, &y0);
+	bvcpu_tomem(surf->rot, lw, lh, &x1, &y1);
+	mem->left = (int)(x0 < x1 ? x0 : x1);
+	mem->top = (int)(y0 < y1 ? y0 : y1);
+	mem->width = surf->rot & 1 ? rect->height : rect->width;
+	mem->height = surf->rot & 1 ? rect->width : rect->height;
+}
+
+/*
+ * bvcpu_inputbox() - Find the part of the memory of a scaled input that
+ * holds the width x height pixels from (a, b) of its view.
+ */
+void bvcpu_inputbox(const struct bvcpu_input *in, int a, int b,
+		    unsigned int width, unsigned int height,
+		    struct bvrect *box)
+{
+	long x0 = in->x + (long)a * in->ux + (long)b * in->vx;
+	long y0 = in->y + (long)a * in->uy + (long)b * in->vy;
+	long x1 = x0 + ((long)width - 1) * in->ux +
+		((long)height - 1) * in->vx;
+	long y1 = y0 + ((long)width - 1) * in->uy +
+		((long)height - 1) * in->vy;
+
+	box->left = (int)(x0 < x1 ? x0 : x1);
+	box->top = (int)(y0 < y1 ? y0 : y1);
+	box->width = (unsigned int)(x0 < x1 ? x1 - x0 : x0 - x1) + 1;
+	box->height = (unsigned int)(y0 < y1 ? y1 - y0 : y0 - y1) + 1;
+}
+
+/*
+ * bvcpu_readbox() - Find the part of the memory of an input a BLT reads.
+ */
+void bvcpu_readbox(const struct bvcpu_blt *blt, const struct bvcpu_input *in,
+		   struct bvrect *box)
+{
+	if (in->tile)
+		bvcpu_inputbox(in, 0, 0, in->tw, in->th, box);
+	else if (in->scaled)
+		bvcpu_inputbox(in, 0, 0, in->width, in->height, box);
+	else
+		bvcpu_inputbox(in, 0, 0, blt->width, blt->height, box);
+}
+
+void bvcpu_area(const struct bvcpu_surf *surf, const struct bvrect *rect,
+		struct bvcpu_area *area)
+{
+	const unsigned char *first = bvcpu_pixaddr(surf, rect->left,
+						   rect->top);
+	const unsigned char *last = bvcpu_pixaddr(surf, rect->left,
+						  rect->top +
+						  (int)rect->height - 1);
+	unsigned long row = (unsigned long)rect->width * surf->fmt->bpp;
+
+	area->start = first < last ? first : last;
+	area->end = (first < last ? last : first) + row;
+	area->surf = surf;
+	area->rect = *rect;
+}
+
+int bvcpu_areasmeet(const struct bvcpu_area *a, const struct bvcpu_area *b)
+{
+	const struct bvcpu_surf *as = a->surf, *bs = b->surf;
+
+	if (a->start >= b->end || b->start >= a->end)
+		return 0;
+
+	/* pixels laid out alike only share bytes where the rectangles meet */
+	if (as->virtaddr == bs->virtaddr && as->stride == bs->stride &&
+	    as->fmt->bpp == bs->fmt->bpp)
+		return a->rect.left < b->rect.left + (int)b->rect.width &&
+			b->rect.left < a->rect.left + (int)a->rect.width &&
+			a->rect.top < b->rect.top + (int)b->rect.height &&
+			b->rect.top < a->rect.top + (int)a->rect.height;
+	return 1;
+}
+
+/*
+ * bvcpu_overlap() - Report whether rectangles of two surfaces share any
+ * bytes.
+ */
+int bvcpu_overlap(const struct bvcpu_surf *a, const struct bvrect *ar,
+		  const struct bvcpu_surf *b, const struct bvrect *br)
+{
+	struct bvcpu_area aa, ba;
+
+	bvcpu_area(a, ar, &aa);
+	bvcpu_area(b, br, &ba);
+	return bvcpu_areasmeet(&aa, &ba);
+}
+
+/*
+ * bvcpu_inplace() - Whether an input read in place is read at the very
+ * pixels written, so that each pixel is read before it is written.
+ */
+int bvcpu_inplace(const struct bvcpu_blt *blt, const struct bvcpu_input *in)
+{
+	return !in->scaled && in->surf.stride == blt->dst.stride &&
+		in->surf.fmt->bpp == blt->dst.fmt->bpp &&
+		bvcpu_pixaddr(&in->surf, in->x, in->y) ==
+		bvcpu_pixaddr(&blt->dst, blt->dstx, blt->dsty);
+}
+
+/*
+ * bvcpu_hazard() - Check whether an input shares bytes with the region of
+ * the destination written.  Returns 0 if it does not, -1 if the input
+ * starts below the destination's first line in the order lines are
+ * written (so lines must be processed from the bottom up), and 1
+ * otherwise.
+ */
+int bvcpu_hazard(const struct bvcpu_blt *blt, const struct bvcpu_input *in)
+{
+	struct bvrect ir = { in->x, in->y, blt->width, blt->height };
+	struct bvrect dr = { blt->dstx, blt->dsty, blt->width, blt->height };
+	const unsigned char *s, *d;
+
+	if (!bvcpu_overlap(&in->surf, &ir, &blt->dst, &dr))
+		return 0;
+	s = bvcpu_pixaddr(&in->surf, in->x, in->y);
+	d = bvcpu_pixaddr(&blt->dst, blt->dstx, blt->dsty);
+	/* lines run up through memory on bottom-up destinations */
+	if (blt->dst.stride > 0 ? s < d : s > d)
+		return -1;
+	return 1;
+}
+
+/*
+ * bvcpu_getsurf() - Validate a buffer descriptor and geometry.  fmt is the
+ * format of the geometry if the shape of the BLT is known, or 0.
+ */
+static enum bverror bvcpu_getsurf(struct bvbltparams *params,
+				  struct bvbuffdesc *desc,
+				  struct bvsurfgeom *geom,
+				  const struct bvcpu_inerrs *errs,
+				  const struct bvcpu_format *fmt,
+				  struct bvcpu_surf *surf)
+{
+	unsigned long rowbytes, stride;
+	unsigned int width, height;
+	int rot;
+
+	if (!desc)
+		return bvcpu_err(params, errs->desc, "bvbuffdesc missing");
+	if (desc->structsize < BVCPU_BUFFDESC_MINSIZE)
+		return bvcpu_err(params, errs->descvers,
+				 "bvbuffdesc.structsize too small");
+	if (!desc->virtaddr)
+		return bvcpu_err(params, errs->virtaddr,
+				 "bvbuffdesc.virtaddr required");
+
+	if (!geom)
+		return bvcpu_err(params, errs->geom, "bvsurfgeom missing");
+	if (geom->structsize < BVCPU_SURFGEOM_MINSIZE)
+		return bvcpu_err(params, errs->geomvers,
+				 "bvsurfgeom.structsize too small");
+	if (!fmt)
+		fmt = bvcpu_getformat(geom->format);
+	if (!fmt)
+		return bvcpu_err(params, errs->format,
+				 "bvsurfgeom.format not supported");
+	rot = (geom->orientation % 360 + 360) % 360;
+	if (rot % 90 != 0)
+		return bvcpu_err(params, errs->rot,
+				 "bvsurfgeom.orientation not supported");
+
+	/* the lines of a surface turned a quarter are its image's columns */
+	width = rot % 180 ? geom->height : geom->width;
+	height = rot % 180 ? geom->width : geom->height;
+	rowbytes = (unsigned long)width * fmt->bpp;
+	stride = geom->virtstride < 0 ? -(unsigned long)geom->virtstride :
+		(unsigned long)geom->virtstride;
+	if (!stride || stride < rowbytes)
+		return bvcpu_err(params, errs->stride,
+				 "bvsurfgeom.virtstride not supported");
+	if (height && stride * (height - 1) + rowbytes > desc->length)
+		return bvcpu_err(params, errs->len,
+				 "bvbuffdesc.length too small for surface");
+
+	surf->fmt = fmt;
+	surf->virtaddr = desc->virtaddr;
+	surf->stride = geom->virtstride;
+	/* the buffer of a bottom-up surface starts with its last line */
+	if (geom->virtstride < 0 && height)
+		surf->virtaddr += stride * (height - 1);
+	surf->width = width;
+	surf->height = height;
+	surf->rot = (unsigned int)rot / 90;
+	return BVERR_NONE;
+}
+
+/*
+ * bvcpu_gettile() - Finish mapping a tiled input, whose mapping locates
+ * the tile.  The plane filled with it is srcwidth x srcheight pixels
+ * stretched over the rectangle the input maps onto, or the same size when
+ * those are 0.  A tile of one pixel fills any plane the same, so is not
+ * scaled.
+ */
+static enum bverror bvcpu_gettile(struct bvbltparams *params,
+				  struct bvcpu_blt *blt,
+				  const struct bvcpu_inerrs *errs,
+				  struct bvcpu_input *in)
+{
+	const struct bvtileparams *tp = in->tile;
+	struct bvrect plane = { 0, 0, 0, 0 };
+	struct bvrect box;
+	enum bverror err;
+
+	if (!in->width || !in->height)
+		return bvcpu_err(params, errs->tilesize,
+				 "tile rectangle empty");
+	bvcpu_inputbox(in, 0, 0, in->width, in->height, &box);
+	if (!bvcpu_inside(&in->surf, box.left, box.top, box.width,
+			  box.height))
+		return bvcpu_err(params, errs->rect,
+				 "rectangle exceeds surface");
+
+	in->tw = in->width;
+	in->th = in->height;
+	plane.width = tp->srcwidth && in->tw * in->th > 1 ?
+		tp->srcwidth : in->dstrect.width;
+	plane.height = tp->srcheight && in->tw * in->th > 1 ?
+		tp->srcheight : in->dstrect.height;
+	in->width = plane.width;
+	in->height = plane.height;
+	if (plane.width != in->dstrect.width ||
+	    plane.height != in->dstrect.height) {
+		err = bvcpu_scalemode(blt, &plane, &in->dstrect);
+		if (err != BVERR_NONE)
+			return err;
+	}
+
+	/* the tile is unpacked before anything is written */
+	in->scaled = 1;
+	return BVERR_NONE;
+}
+
+/*
+ * bvcpu_getinput() - Validate the surface of one source, or its tile.
+ */
+static enum bverror bvcpu_getinput(struct bvbltparams *params,
+				   struct bvcpu_blt *blt,
+				   union bvinbuff *buff,
+				   struct bvsurfgeom *geom,
+				   unsigned long tileflag,
+				   const struct bvcpu_inerrs *errs,
+				   const struct bvcpu_format *fmt,
+				   struct bvcpu_input *in)
+{
+	struct bvbuffdesc tiledesc = { 0 };
+	struct bvbuffdesc *desc = buff->desc;
+	const struct bvtileparams *tp;
+
+	if (params->flags & tileflag) {
+		tp = buff->tileparams;
+		if (!tp)
+			return bvcpu_err(params, errs->desc,
+					 "bvtileparams missing");
+		if (tp->structsize < BVCPU_TILEPARAMS_MINSIZE)
+			return bvcpu_err(params, errs->tilevers,
+					 "bvtileparams.structsize too small");
+		if (tp->flags & ~(unsigned long)(BVTILE_LEFT_MIRROR |
+						 BVTILE_TOP_MIRROR |
+						 BVTILE_RIGHT_MIRROR |
+						 BVTILE_BOTTOM_MIRROR))
+			return bvcpu_err(params, errs->tileflags,
+					 "bvtileparams.flags not supported");
+		if (!tp->virtaddr)
+			return bvcpu_err(params, errs->tileaddr,
+					 "bvtileparams.virtaddr required");
+		if (blt->dst.rot)
+			return bvcpu_err(params, errs->rot,
+					 "tiles on turned destinations not supported");
+		/* the brush has no length; its rectangle is the tile */
+		tiledesc.structsize = sizeof(tiledesc);
+		tiledesc.virtaddr = tp->virtaddr;
+		tiledesc.length = ~0UL;
+		desc = &tiledesc;
+		in->tile = tp;
+	}
+
+	return bvcpu_getsurf(params, desc, geom, errs, fmt, &in->surf);
+}
+
+/*
+ * bvcpu_mapinput() - Locate the pixel of a source which maps to the first
+ * destination pixel written.  The source rectangle maps onto dstrect,
+ * which is bvbltparams.dstrect unless the input has an auxiliary one, and
+ * must hold the region written.  A source with a rectangle of a different
+ * size is scaled, and keeps its whole rectangle, as does one turned or
+ * mirrored relative to the destination.
+ */
+static enum bverror bvcpu_mapinput(struct bvbltparams *params,
+				   struct bvcpu_blt *blt,
+				   const struct bvrect *rect,
+				   const struct bvrect *dstrect,
+				   unsigned long hflipflag,
+				   unsigned long vflipflag,
+				   const struct bvcpu_inerrs *errs,
+				   struct bvcpu_input *in)
+{
+	unsigned int rot = blt->dst.rot;
+	struct bvrect dr = {
+		blt->dstx, blt->dsty, blt->width, blt->height
+	};
+	int a, b;
+	unsigned int lw, lh;
+	long x[3], y[3];
+	struct bvrect box;
+	enum bverror err;
+	int i;
+
+	bvcpu_rectmem(&blt->dst, dstrect, &in->dstrect);
+	a = blt->dstx - in->dstrect.left;
+	b = blt->dsty - in->dstrect.top;
+	if (a < 0 || b < 0 ||
+	    (unsigned long)a + blt->width > in->dstrect.width ||
+	    (unsigned long)b + blt->height > in->dstrect.height)
+		return bvcpu_err(params, errs->rect,
+				 "auxdstrect does not hold the region written");
+
+	/*
+	 * Map the corner of the rectangle and its neighbors on the next
+	 * pixel and line, in the order destination memory is written, into
+	 * the memory of the source.  Flips mirror the rectangle as it is
+	 * read.
+	 */
+	lw = in->surf.rot & 1 ? in->surf.height : in->surf.width;
+	lh = in->surf.rot & 1 ? in->surf.width : in->surf.height;
+	for (i = 0; i < 3; i++) {
+		x[i] = i == 1;
+		y[i] = i == 2;
+		bvcpu_toimage(rot, rect->width, rect->height, &x[i], &y[i]);
+		if (blt->flags & hflipflag)
+			x[i] = (long)rect->width - 1 - x[i];
+		if (blt->flags & vflipflag)
+			y[i] = (long)rect->height - 1 - y[i];
+		x[i] += rect->left;
+		y[i] += rect->top;
+		bvcpu_tomem(in->surf.rot, lw, lh, &x[i], &y[i]);
+	}
+	in->x = (int)x[0];
+	in->y = (int)y[0];
+	in->ux = (int)(x[1] - x[0]);
+	in->uy = (int)(y[1] - y[0]);
+	in->vx = (int)(x[2] - x[0]);
+	in->vy = (int)(y[2] - y[0]);
+	in->width = rot & 1 ? rect->height : rect->width;
+	in->height = rot & 1 ? rect->width : rect->height;
+
+	if (in->tile)
+		return bvcpu_gettile(params, blt, errs, in);
+
+	if (rect->width != dstrect->width ||
+	    rect->height != dstrect->height) {
+		if (!rect->width)
+			return bvcpu_err(params, errs->horzscale,
+					 "cannot scale from zero width");
+		if (!rect->height)
+			return bvcpu_err(params, errs->vertscale,
+					 "cannot scale from zero height");
+		err = bvcpu_scalemode(blt, rect, dstrect);
+		if (err != BVERR_NONE)
+			return err;
+		in->scaled = 1;
+		bvcpu_inputbox(in, 0, 0, in->width, in->height, &box);
+	} else {
+		/* only the part written is read */
+		bvcpu_inputbox(in, a, b, blt->width, blt->height, &box);
+		in->scaled = in->ux != 1;
+	}
+
+	if (!bvcpu_inside(&in->surf, box.left, box.top, box.width,
+			  box.height))
+		return bvcpu_err(params, errs->rect,
+				 "rectangle exceeds surface");
+	if (in->scaled)
+		return BVERR_NONE;
+
+	/*
+	 * A source read in place lines up with the destination.  One flipped
+	 * vertically is read up through memory, which the kernels see as a
+	 * surface starting at its first line with the stride negated.  The
+	 * lines of sources overlapping the destination in a different order
+	 * are copied by the scaler first.
+	 */
+	if (in->vy * in->surf.stride != blt->dst.stride &&
+	    bvcpu_overlap(&in->surf, &box, &blt->dst, &dr)) {
+		in->scaled = 1;
+		return BVERR_NONE;
+	}
+	in->x += a;
+	in->y += in->vy * b;
+	if (in->vy < 0) {
+		in->surf.virtaddr = bvcpu_pixaddr(&in->surf, 0, in->y);
+		in->surf.stride = -in->surf.stride;
+		in->surf.height = box.height;
+		in->y = 0;
+		in->vy = 1;
+	}
+
+	return BVERR_NONE;
+}
+
+/*
+ * bvcpu_validatestate() - Only the buffers of a BLT of a shape validated
+ * before are checked.  Those of others are checked in the same order.
+ */
+enum bverror bvcpu_validatestate(struct bvbltparams *params,
+				 struct bvcpu_blt *blt)
+{
+	unsigned long flags = params->flags;
+	const struct bvcpu_shape *shape;
+	struct bvcpu_shapekey key;
+	enum bverror err;
+
+	memset(blt, 0, sizeof(*blt));
+	blt->params = params;
+	blt->flags = flags;
+
+	shape = bvcpu_shapefind(params, &key);
+	if (shape) {
+		blt->uses = shape->uses;
+		blt->blend = shape->blend;
+	} else {
+		if (flags & ~BVCPU_FLAGS_SUPPORTED)
+			return bvcpu_err(params, BVERR_FLAGS,
+					 "bvbltparams.flags not supported");
+
+		switch (flags & BVFLAG_OP_MASK) {
+		case BVFLAG_ROP:
+			blt->uses = bvcpu_ropuses(params->op.rop);
+			break;
+		case BVFLAG_BLEND:
+			err = bvcpu_blendvalidate(blt);
+			if (err != BVERR_NONE)
+				return err;
+			break;
+		case BVFLAG_FILTER:
+			return bvcpu_err(params, BVERR_FILTER,
+					 "filtering not supported");
+		default:
+			return bvcpu_err(params, BVERR_OP,
+					 "operation not supported");
+		}
+	}
+
+	err = bvcpu_getsurf(params, params->dstdesc, params->dstgeom,
+			    &bvcpu_dsterrs, shape ? shape->fmt[0] : NULL,
+			    &blt->dst);
+	if (err != BVERR_NONE)
+		return err;
+	if (shape) {
+		blt->dither = shape->dither;
+		memcpy(blt->dbias, shape->dbias, sizeof(blt->dbias));
+		if (flags & BVFLAG_DITHER_RETURN)
+			params->dithermode = shape->dithermode;
+	} else {
+		err = bvcpu_dithermode(blt);
+		if (err != BVERR_NONE)
+			return err;
+	}
+
+	/* the auxiliary rectangles follow the fields every version has */
+	if ((flags & (BVFLAG_SRC2_AUXDSTRECT | BVFLAG_MASK_AUXDSTRECT)) &&
+	    params->structsize < offsetof(struct bvbltparams, maskauxdstrect) +
+	    sizeof(params->maskauxdstrect))
+		return bvcpu_err(params, BVERR_BLTPARAMS_VERS,
+				 "bvbltparams.structsize too small");
+
+	if (blt->uses & BVCPU_USES_SRC1) {
+		err = bvcpu_getinput(params, blt, &params->src1,
+				     params->src1geom, BVFLAG_TILE_SRC1,
+				     &bvcpu_src1errs,
+				     shape ? shape->fmt[1] : NULL, &blt->src1);
+		if (err != BVERR_NONE)
+			return err;
+	}
+	if (blt->uses & BVCPU_USES_SRC2) {
+		err = bvcpu_getinput(params, blt, &params->src2,
+				     params->src2geom, BVFLAG_TILE_SRC2,
+				     &bvcpu_src2errs,
+				     shape ? shape->fmt[2] : NULL, &blt->src2);
+		if (err != BVERR_NONE)
+			return err;
+	}
+	if (blt->uses & BVCPU_USES_MASK) {
+		err = bvcpu_getinput(params, blt, &params->mask,
+				     params->maskgeom, BVFLAG_TILE_MASK,
+				     &bvcpu_maskerrs,
+				     shape ? shape->fmt[3] : NULL, &blt->mask);
+		if (err != BVERR_NONE)
+			return err;
+	}
+
+	if (!shape)
+		bvcpu_shapeadd(&key, blt);
+	return BVERR_NONE;
+}
+
+enum bverror bvcpu_validaterects(struct bvbltparams *params,
+				 struct bvcpu_blt *blt)
+{
+	unsigned long flags = blt->flags;
+	struct bvrect rect, mem;
+	const struct bvrect *src2dst = &params->dstrect;
+	const struct bvrect *maskdst = &params->dstrect;
+	enum bverror err;
+
+	blt->params = params;
+	if (flags & BVFLAG_SRC2_AUXDSTRECT)
+		src2dst = &params->src2auxdstrect;
+	if (flags & BVFLAG_MASK_AUXDSTRECT)
+		maskdst = &params->maskauxdstrect;
+
+	rect = params->dstrect;
+	if ((flags & BVFLAG_CLIP) && !bvcpu_intersect(&rect, &params->cliprect))
+		return BVERR_NONE;
+	if (!rect.width || !rect.height)
+		return BVERR_NONE;
+	bvcpu_rectmem(&blt->dst, &rect, &mem);
+	if (!bvcpu_inside(&blt->dst, mem.left, mem.top, mem.width,
+			  mem.height))
+		return bvcpu_err(params, BVERR_DSTRECT,
+				 "dstrect exceeds surface");
+	blt->dstx = mem.left;
+	blt->dsty = mem.top;
+	blt->width = mem.width;
+	blt->height = mem.height;
+
+	if (blt->uses & BVCPU_USES_SRC1) {
+		err = bvcpu_mapinput(params, blt, &params->src1rect,
+				     &params->dstrect,
+				     BVFLAG_HORZ_FLIP_SRC1,
+				     BVFLAG_VERT_FLIP_SRC1, &bvcpu_src1errs,
+				     &blt->src1);
+		if (err != BVERR_NONE)
+			return err;
+	}
+	if (blt->uses & BVCPU_USES_SRC2) {
+		err = bvcpu_mapinput(params, blt, &params->src2rect, src2dst,
+				     BVFLAG_HORZ_FLIP_SRC2,
+				     BVFLAG_VERT_FLIP_SRC2, &bvcpu_src2errs,
+				     &blt->src2);
+		if (err != BVERR_NONE)
+			return err;
+	}
+	if (blt->uses & BVCPU_USES_MASK) {
+		err = bvcpu_mapinput(params, blt, &params->maskrect, maskdst,
+				     BVFLAG_HORZ_FLIP_MASK,
+				     BVFLAG_VERT_FLIP_MASK, &bvcpu_maskerrs,
+				     &blt->mask);
+		if (err != BVERR_NONE)
+			return err;
+	}
+
+	return bvcpu_keyvalidate(blt);
+}
+
+/*
+ * bvcpu_keeptile() - Point a tiled input at a copy of its tile.
+ */
+static void bvcpu_keeptile(struct bvcpu_input *in, struct bvtileparams *tile)
+{
+	unsigned long size;
+
+	if (!in->tile)
+		return;
+	size = in->tile->structsize < sizeof(*tile) ?
+		in->tile->structsize : sizeof(*tile);
+	memset(tile, 0, sizeof(*tile));
+	memcpy(tile, in->tile, size);
+	in->tile = tile;
+}
+
+/*
+ * bvcpu_hold() - Hold the map of a buffer, if this implementation mapped
+ * it.
+ */
+static struct bvcpu_map *bvcpu_hold(struct bvbuffdesc *desc)
+{
+	struct bvcpu_map *m;
+
+	m = (struct bvcpu_map *)bvbuffmap_find(desc, bvcpu_mapslot, bv_unmap);
+	if (m)
+		__atomic_fetch_add(&m->refs, 1, __ATOMIC_RELAXED);
+	return m;
+}
+
+static void bvcpu_mapput(struct bvcpu_map *m)
+{
+	if (m && !__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL))
+		free(m);
+}
+
+void bvcpu_keep(struct bvcpu_blt *blt, struct bvbltparams *params,
+		struct bvtileparams tile[3])
+{
+	unsigned long size;
+
+	size = blt->params->structsize < sizeof(*params) ?
+		blt->params->structsize : sizeof(*params);
+	memset(params, 0, sizeof(*params));
+	memcpy(params, blt->params, size);
+	blt->params = params;
+	bvcpu_keeptile(&blt->src1, &tile[0]);
+	bvcpu_keeptile(&blt->src2, &tile[1]);
+	bvcpu_keeptile(&blt->mask, &tile[2]);
+
+	/* tiles are given by address, not by buffer */
+	blt->held[0] = bvcpu_hold(params->dstdesc);
+	if ((blt->uses & BVCPU_USES_SRC1) && !blt->src1.tile)
+		blt->held[1] = bvcpu_hold(params->src1.desc);
+	if ((blt->uses & BVCPU_USES_SRC2) && !blt->src2.tile)
+		blt->held[2] = bvcpu_hold(params->src2.desc);
+	if ((blt->uses & BVCPU_USES_MASK) && !blt->mask.tile)
+		blt->held[3] = bvcpu_hold(params->mask.desc);
+}
+
+void bvcpu_drop(struct bvcpu_blt *blt)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		bvcpu_mapput(blt->held[i]);
+		blt->held[i] = NULL;
+	}
+}
+
+/*
+ * bvcpu_run() - Run a BLT, or a chain of layers, or one band of either.
+ */
+static enum bverror bvcpu_run(struct bvcpu_blt *blt, unsigned int count)
+{
+	enum bverror err;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		err = bvcpu_scalestart(&blt[i]);
+		if (err != BVERR_NONE) {
+			while (i--)
+				bvcpu_scaleend(&blt[i]);
+			return err;
+		}
+	}
+
+	if (count > 1) {
+		err = bvcpu_blendlayers(blt, count);
+	} else {
+		switch (blt->flags & BVFLAG_OP_MASK) {
+		case BVFLAG_ROP:
+			err = bvcpu_rop(blt);
+			break;
+		case BVFLAG_BLEND:
+			err = bvcpu_blend(blt);
+			break;
+		default:
+			err = BVERR_OP;
+			break;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		bvcpu_scaleend(&blt[i]);
+	return err;
+}
+
+enum bverror bvcpu_execute(struct bvcpu_blt *blt, unsigned int count)
+{
+	if (!blt->width || !blt->height)
+		return BVERR_NONE;
+	return bvcpu_bandrun(blt, count, bvcpu_run);
+}
+
+void bv_mapslot(unsigned int slot)
+{
+	if (slot < BVBUFFMAP_SLOTS &&
+	    !__atomic_load_n(&bvcpu_mapped, __ATOMIC_ACQUIRE))
+		bvcpu_mapslot = slot;
+}
+
+enum bverror bv_map(struct bvbuffdesc *buffdesc)
+{
+	struct bvbuffmap *map;
+	struct bvcpu_map *m;
+
+	if (!bvcpu_kern)
+		return BVERR_RSRC;
+	if (!buffdesc)
+		return BVERR_BUFFERDESC;
+	if (buffdesc->structsize < BVCPU_BUFFDESC_MINSIZE)
+		return BVERR_BUFFERDESC_VERS;
+	if (!buffdesc->virtaddr)
+		return BVERR_BUFFERDESC_VIRTADDR;
+
+	if (bvbuffmap_find(buffdesc, bvcpu_mapslot, bv_unmap))
+		return BVERR_NONE;
+
+	/* The CPU needs no resources; the entry marks the buffer mapped. */
+	m = malloc(sizeof(*m));
+	if (!m)
+		return BVERR_OOM;
+	m->refs = 1;
+	map = &m->map;
+	map->structsize = sizeof(*map);
+	map->bv_unmap = bv_unmap;
+	map->handle = 0;
+	map->slot = bvcpu_mapslot;
+	__atomic_store_n(&bvcpu_mapped, 1, __ATOMIC_RELEASE);
+	bvbuffmap_add(buffdesc, map);
+
+	return BVERR_NONE;
+}
+
+/*
+ * bvcpu_asyncblt - An asynchronous BLT, with copies of what it was
+ * validated from.
+ */
+struct bvcpu_asyncblt {
+	struct bvcpu_async async;
+	struct bvbltparams params;
+	struct bvtileparams tile[3];	/* src1, src2, mask */
+	struct bvcpu_blt blt;
+};
+
+static void bvcpu_asyncrun(struct bvcpu_async *job)
+{
+	struct bvcpu_asyncblt *ab = (struct bvcpu_asyncblt *)job;
+
+	job->err = bvcpu_execute(&ab->blt, 1);
+	job->errdesc = ab->params.errdesc;
+}
+
+static void bvcpu_asyncfree(struct bvcpu_async *job)
+{
+	bvcpu_drop(&((struct bvcpu_asyncblt *)job)->blt);
+	free(job);
+}
+
+/*
+ * bvcpu_bltasync() - Validate a BLT and queue it.  Empty BLTs are queued
+ * too, so that their callbacks come in order.
+ */
+static enum bverror bvcpu_bltasync(struct bvbltparams *params)
+{
+	struct bvcpu_asyncblt *ab;
+	enum bverror err;
+
+	ab = malloc(sizeof(*ab));
+	if (!ab)
+		return bvcpu_err(params, BVERR_OOM,
+				 "out of memory for asynchronous BLT");
+	err = bvcpu_validatestate(params, &ab->blt);
+	if (err == BVERR_NONE)
+		err = bvcpu_validaterects(params, &ab->blt);
+	if (err != BVERR_NONE) {
+		free(ab);
+		return err;
+	}
+
+	bvcpu_keep(&ab->blt, &ab->params, ab->tile);
+	ab->async.run = bvcpu_asyncrun;
+	ab->async.release = bvcpu_asyncfree;
+	ab->async.callbackfn = params->callbackfn;
+	ab->async.callbackdata = params->callbackdata;
+	bvcpu_asyncsubmit(&ab->async);
+	return BVERR_NONE;
+}
+
+enum bverror bv_blt(struct bvbltparams *bltparams)
+{
+	struct bvcpu_blt blt;
+	enum bverror err;
+
+	if (!bvcpu_kern)
+		return BVERR_RSRC;
+	if (!bltparams || bltparams->structsize < BVCPU_BLTPARAMS_MINSIZE)
+		return BVERR_BLTPARAMS_VERS;
+	bltparams->errdesc = NULL;
+
+	if ((bltparams->flags & BVFLAG_BATCH_MASK) != BVFLAG_BATCH_NONE)
+		return bvcpu_batch(bltparams);
+
+	/* NOPs only order BLTs, so their surfaces are not even looked at */
+	if ((bltparams->flags & BVFLAG_OP_MASK) == BVFLAG_ROP &&
+	    bltparams->op.rop == BVCPU_ROP_NOP &&
+	    !(bltparams->flags & ~BVCPU_FLAGS_SUPPORTED)) {
+		if (bltparams->flags & BVFLAG_TESTPARAMS_NOP)
+			return BVERR_NONE;
+		return bvcpu_asyncnop(bltparams);
+	}
+	if ((bltparams->flags & (BVFLAG_ASYNC | BVFLAG_TESTPARAMS_NOP)) ==
+	    BVFLAG_ASYNC)
+		return bvcpu_bltasync(bltparams);
+
+	err = bvcpu_validatestate(bltparams, &blt);
+	if (err == BVERR_NONE)
+		err = bvcpu_validaterects(bltparams, &blt);
+	if (err != BVERR_NONE || (bltparams->flags & BVFLAG_TESTPARAMS_NOP))
+		return err;
+
+	/* BLTs complete in order, so earlier asynchronous ones go first */
+	bvcpu_asyncwait();
+	return bvcpu_execute(&blt, 1);
+}
+
+enum bverror bv_unmap(struct bvbuffdesc *buffdesc)
+{
+	struct bvbuffmap *map;
+
+	/* without bvcpu_kern nothing was mapped here, but others may have */
+	if (!buffdesc)
+		return BVERR_BUFFERDESC;
+	if (buffdesc->structsize < BVCPU_BUFFDESC_MINSIZE)
+		return BVERR_BUFFERDESC_VERS;
+
+	/* BLTs queued with the buffer hold its map until they are done */
+	map = bvbuffmap_find(buffdesc, bvcpu_mapslot, bv_unmap);
+	if (map) {
+		bvbuffmap_remove(buffdesc, map);
+		bvcpu_mapput((struct bvcpu_map *)map);
+	}
+
+	/*
+	 * One bv_unmap() releases the buffer from every implementation.  A
+	 * map of this one left in the chain would make that recurse.
+	 */
+	if (buffdesc->map && buffdesc->map->bv_unmap != bv_unmap)
+		return buffdesc->map->bv_unmap(buffdesc);
+
+	return BVERR_NONE;
+}
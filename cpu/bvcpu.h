@@ -0,0 +1,792 @@
+/*
+ * bvcpu.h
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the private definitions shared by the source files of
+ * the BLTsville CPU implementation (bltsville_cpu).  It should not be used
+ * by clients.
+ */
+
+#ifndef BVCPU_H
+#define BVCPU_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "bltsville.h"
+#include "bvinternal.h"
+#include "bvcpuext.h"
+
+/*
+ * Exported entry points (see bventry.h for the function types,
+ * bvinternal.h for bv_mapslot(), and bvcpuext.h for the extensions).
+ */
+enum bverror bv_map(struct bvbuffdesc *buffdesc);
+enum bverror bv_blt(struct bvbltparams *bltparams);
+enum bverror bv_unmap(struct bvbuffdesc *buffdesc);
+void bv_mapslot(unsigned int slot);
+
+/*
+ * BVCPU_BLTPARAMS_MINSIZE - Smallest bvbltparams accepted.  Clients built
+ * against 2.1 headers do not have the aux destination rectangles.
+ */
+#define BVCPU_BLTPARAMS_MINSIZE	offsetof(struct bvbltparams, src2auxdstrect)
+#define BVCPU_BUFFDESC_MINSIZE	offsetof(struct bvbuffdesc, auxtype)
+#define BVCPU_SURFGEOM_MINSIZE	sizeof(struct bvsurfgeom)
+#define BVCPU_TILEPARAMS_MINSIZE	sizeof(struct bvtileparams)
+
+/*
+ * bvcpu_mapslot - The bvbuffmap slot of this implementation, given by
+ * bv_mapslot(), or BVBUFFMAP_FIRST_CPU.  It does not change once a buffer
+ * has been mapped, so that every map is found in the slot it was added
+ * to.
+ */
+extern unsigned int bvcpu_mapslot;
+
+/*
+ * bvcpu_map - The bvbuffmap of a buffer mapped by this implementation.
+ * BLTs kept to run later hold it, so that bv_unmap() need not wait for
+ * them: it takes the map out of the buffer, and whichever of it and the
+ * BLTs lets go last frees it.
+ */
+struct bvcpu_map {
+	struct bvbuffmap map;
+	unsigned long refs;		/* the mapping, and BLTs holding it */
+};
+
+/*
+ * Internal pixel format.  Unpacked pixels are held as one 32-bit word per
+ * pixel, 0xAARRGGBB, with the premultiplication state of the source format
+ * preserved.
+ */
+#define BVCPU_A(p)	((p) >> 24)
+#define BVCPU_R(p)	(((p) >> 16) & 0xFF)
+#define BVCPU_G(p)	(((p) >> 8) & 0xFF)
+#define BVCPU_B(p)	((p) & 0xFF)
+#define BVCPU_ARGB(a, r, g, b) \
+	(((unsigned int)(a) << 24) | ((unsigned int)(r) << 16) | \
+	 ((unsigned int)(g) << 8) | (unsigned int)(b))
+
+/*
+ * bvcpu_div255() - Exact round(x / 255) for 0 <= x <= 255 * 255.
+ */
+static inline unsigned int bvcpu_div255(unsigned int x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/*
+ * bvcpu_floordiv() - a / b rounded down, for b > 0.
+ */
+static inline long long bvcpu_floordiv(long long a, long long b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/*
+ * bvcpu_format - Description of a color format supported by this
+ * implementation.
+ */
+#define BVCPU_FMT_ALPHA		0x01	/* format carries alpha */
+#define BVCPU_FMT_NONPREMULT	0x02	/* colors not premultiplied */
+#define BVCPU_FMT_ALPHAONLY	0x04	/* no color components */
+#define BVCPU_FMT_NATIVE	0x08	/* same as the internal format */
+#define BVCPU_FMT_REDUCED	0x10	/* fewer than 8 bits per color */
+
+struct bvcpu_format;
+typedef void (*bvcpu_unpackfn)(const struct bvcpu_format *fmt,
+			       const unsigned char *src, unsigned int *dst,
+			       unsigned int count);
+typedef void (*bvcpu_packfn)(const struct bvcpu_format *fmt,
+			     const unsigned int *src, unsigned char *dst,
+			     unsigned int count);
+
+struct bvcpu_format {
+	enum ocdformat format;
+	unsigned int bpp;		/* bytes per pixel */
+	unsigned int flags;		/* BVCPU_FMT_* */
+	signed char aoff;		/* byte offsets of 8-bit components; */
+	signed char roff;		/* -1 when not present */
+	signed char goff;
+	signed char boff;
+	bvcpu_unpackfn unpack;		/* format -> 0xAARRGGBB */
+	bvcpu_packfn pack;		/* 0xAARRGGBB -> format */
+	unsigned int pack16;		/* BVCPU_PACK16_*, when REDUCED */
+};
+
+/*
+ * BVCPU_PACK16_* - Layouts of the reduced formats, for the kernel that
+ * packs them with ordered dithering.
+ */
+#define BVCPU_PACK16_RGB565	0
+#define BVCPU_PACK16_BGR565	1
+#define BVCPU_PACK16_XRGB4444	2
+
+const struct bvcpu_format *bvcpu_getformat(enum ocdformat format);
+void bvcpu_premultiply(unsigned int *pix, unsigned int count);
+void bvcpu_unpremultiply(unsigned int *pix, unsigned int count);
+void bvcpu_pack(const struct bvcpu_format *fmt, const unsigned int *src,
+		unsigned char *dst, unsigned int count,
+		const unsigned int *bias);
+int bvcpu_alphafix(const struct bvcpu_format *srcfmt,
+		   const struct bvcpu_format *dstfmt);
+void bvcpu_unpackfor(const struct bvcpu_format *srcfmt,
+		     const unsigned char *src,
+		     const struct bvcpu_format *dstfmt,
+		     unsigned int *dst, unsigned int count);
+void bvcpu_convert(const struct bvcpu_format *srcfmt,
+		   const unsigned char *src,
+		   const struct bvcpu_format *dstfmt,
+		   unsigned char *dst, unsigned int *tmp,
+		   unsigned int count, const unsigned int *bias);
+
+/*
+ * bvcpu_surf - A validated surface: buffer, geometry and format.  The size
+ * is that of the surface in memory.  A surface turned by its orientation
+ * holds its image turned that far clockwise in memory, and its rectangles
+ * are given in the coordinates of the image (see bvcpu_tomem()).
+ */
+struct bvcpu_surf {
+	const struct bvcpu_format *fmt;
+	unsigned char *virtaddr;	/* start of the first line */
+	long stride;			/* bytes from one line to the next,
+					   negative for bottom-up surfaces */
+	unsigned int width;		/* surface size in pixels */
+	unsigned int height;
+	unsigned int rot;		/* quarter turns, 0 to 3 */
+};
+
+static inline unsigned char *bvcpu_pixaddr(const struct bvcpu_surf *surf,
+					   int x, int y)
+{
+	return surf->virtaddr + (long)y * surf->stride +
+		(long)x * (long)surf->fmt->bpp;
+}
+
+/*
+ * bvcpu_pixload() - A pixel of bpp bytes as a number, the way the kernels
+ * load it: a word of its own size, or 3 bytes in little-endian order.
+ */
+static inline unsigned int bvcpu_pixload(const unsigned char *p,
+					 unsigned int bpp)
+{
+	unsigned short h;
+	unsigned int w;
+
+	switch (bpp) {
+	case 1:
+		return p[0];
+	case 2:
+		memcpy(&h, p, 2);
+		return h;
+	case 3:
+		return p[0] | (p[1] << 8) | ((unsigned int)p[2] << 16);
+	default:
+		memcpy(&w, p, 4);
+		return w;
+	}
+}
+
+/*
+ * bvcpu_input - One input (source 1, source 2 or mask) of a BLT, with the
+ * location of the pixel that maps to the first destination pixel written.
+ *
+ * An input that is scaled, or turned or mirrored relative to the
+ * destination, is read through a scaler while the BLT runs.  It instead
+ * holds its whole rectangle, as seen in the order destination pixels are
+ * written in memory: pixel (a, b) of that view is at (x, y) + a x (ux, uy)
+ * + b x (vx, vy) in the memory of the input.  Inputs only flipped
+ * vertically are read in place, through a surface with the stride negated.
+ *
+ * A tiled input is also read through a scaler, from a plane of width x
+ * height pixels filled with the tile.  Its mapping locates pixel (a, b)
+ * of the tile, which is tw x th pixels.
+ */
+struct bvcpu_scaler;
+
+struct bvcpu_input {
+	struct bvcpu_surf surf;
+	int x;
+	int y;
+	int scaled;			/* read through a scaler */
+	unsigned int width;		/* rectangle size when scaled */
+	unsigned int height;
+	int ux, uy;			/* memory step along a line */
+	int vx, vy;			/* memory step to the next line */
+	struct bvrect dstrect;		/* what it maps onto, in dst memory */
+	const struct bvtileparams *tile;
+	unsigned int tw;		/* tile size */
+	unsigned int th;
+	struct bvcpu_scaler *scaler;
+};
+
+void bvcpu_inputbox(const struct bvcpu_input *in, int a, int b,
+		    unsigned int width, unsigned int height,
+		    struct bvrect *box);
+
+/*
+ * Scratch lines are allocated with this alignment and padded to it, so the
+ * kernels can start every line on a cache line boundary.
+ */
+#define BVCPU_ROWALIGN	64
+#define BVCPU_ROWSIZE(n) \
+	(((n) + BVCPU_ROWALIGN - 1) & ~(unsigned long)(BVCPU_ROWALIGN - 1))
+
+/*
+ * BVCPU_USES_* - Inputs referenced by the operation.
+ */
+#define BVCPU_USES_DST		0x01
+#define BVCPU_USES_SRC1		0x02
+#define BVCPU_USES_SRC2		0x04
+#define BVCPU_USES_MASK		0x08
+
+/*
+ * Blending.
+ */
+
+/*
+ * bvcpu_factor - One decoded BVBLENDDEF_FORMAT_CLASSIC constant (K1-K4).
+ * x and y use the BVBLENDDEF_NORM_* encoding (C1, A1, C2, A2).
+ */
+#define BVCPU_FOP_ZERO	0
+#define BVCPU_FOP_ONE	1
+#define BVCPU_FOP_NORM	2		/* x */
+#define BVCPU_FOP_INV	3		/* 1 - y */
+#define BVCPU_FOP_MIN	4		/* min(x, 1 - y) */
+#define BVCPU_FOP_MAX	5		/* max(x, 1 - y) */
+
+struct bvcpu_factor {
+	unsigned char op;		/* BVCPU_FOP_* */
+	unsigned char x;
+	unsigned char y;
+};
+
+/*
+ * BVCPU_AFACTORS - The constants that are the same for all four components
+ * of a pixel.  Blends whose constants all come from this list, with K3 equal
+ * to K1 and K4 equal to K2 (all the Porter-Duff blends), have a dedicated
+ * kernel for each K1, K2 pair.
+ */
+#define BVCPU_AFACTORS(X) X(ZERO) X(ONE) X(A1) X(A2) X(IA1) X(IA2)
+
+#define BVCPU_AFENUM(f)	BVCPU_AF_##f,
+enum bvcpu_afactor {
+	BVCPU_AFACTORS(BVCPU_AFENUM)
+	BVCPU_AF_COUNT
+};
+#undef BVCPU_AFENUM
+
+/*
+ * BVCPU_ESSENTIALS - The BVBLENDDEF_FORMAT_ESSENTIAL blends, in the order
+ * of enum bvblend.  The separable blend function B() of each is applied to
+ * the unpremultiplied colors and composited as
+ *
+ *   Cd = (1 - A2) x C1 + (1 - A1) x C2 + A1 x A2 x B(C1 / A1, C2 / A2)
+ *   Ad = A1 + (1 - A1) x A2
+ *
+ * which reduces to Cd = B(C1, C2) when both sources are opaque.  The modes
+ * listed in BVCPU_ESSLUT divide, and read B() from a 256 x 256 table.
+ */
+#define BVCPU_ESSENTIALS(X) \
+	X(NORMAL) X(LIGHTEN) X(DARKEN) X(MULTIPLY) X(AVERAGE) X(ADD) \
+	X(SUBTRACT) X(DIFFERENCE) X(NEGATE) X(SCREEN) X(EXCLUSION) \
+	X(OVERLAY) X(SOFT_LIGHT) X(HARD_LIGHT) X(COLOR_DODGE) \
+	X(COLOR_BURN) X(LINEAR_LIGHT) X(VIVID_LIGHT) X(PIN_LIGHT) \
+	X(HARD_MIX) X(REFLECT) X(GLOW) X(PHOENIX) X(ALPHA)
+
+#define BVCPU_ESSENUM(m)	BVCPU_ESS_##m,
+enum bvcpu_essential {
+	BVCPU_ESSENTIALS(BVCPU_ESSENUM)
+	BVCPU_ESS_COUNT
+};
+#undef BVCPU_ESSENUM
+
+#define BVCPU_ESSLUT(m) \
+	((m) == BVCPU_ESS_SOFT_LIGHT || (m) == BVCPU_ESS_COLOR_DODGE || \
+	 (m) == BVCPU_ESS_COLOR_BURN || (m) == BVCPU_ESS_VIVID_LIGHT || \
+	 (m) == BVCPU_ESS_HARD_MIX || (m) == BVCPU_ESS_REFLECT || \
+	 (m) == BVCPU_ESS_GLOW)
+
+/*
+ * BVCPU_MOD_* - How source 1 is modulated before a blend: by nothing, by
+ * the global alpha, by the remote alpha, or by both.
+ */
+#define BVCPU_MOD_NONE		0
+#define BVCPU_MOD_GLOBAL	1
+#define BVCPU_MOD_REMOTE	2
+#define BVCPU_MOD_BOTH		3
+#define BVCPU_MOD_COUNT		4
+
+/*
+ * bvcpu_blendfn - Blend count unpacked, premultiplied pixels.  k holds the
+ * K1-K4 factor lines for kernels that take per-component factors.  The
+ * essential blend kernels take the unpremultiplied sources in k[0] and
+ * k[1], and the table of B() in k[2].  The alpha factor kernels modulate
+ * source 1 by the remote alpha line ar and the global alpha ag.
+ */
+typedef void (*bvcpu_blendfn)(unsigned int *dst, const unsigned int *src1,
+			      const unsigned int *src2,
+			      const unsigned int *const *k,
+			      const unsigned char *ar, unsigned int ag,
+			      unsigned int count);
+
+typedef void (*bvcpu_factorfn)(unsigned int *dst, const unsigned int *x,
+			       const unsigned int *y, unsigned int count);
+
+/*
+ * bvcpu_blend - A blend decoded by validation.
+ */
+struct bvcpu_blend {
+	bvcpu_blendfn fn[BVCPU_MOD_COUNT];	/* by modulation of source 1 */
+	int generic;			/* fn takes factor lines */
+	unsigned int mod;		/* BVCPU_MOD_* */
+	unsigned int ga;		/* global alpha, 0 to 255 */
+	int keep2;			/* transparent source 1 leaves source 2 */
+	struct bvcpu_factor k[4];
+	const bvcpu_blendfn *essential;	/* essential kernels, or 0 */
+	const unsigned char *lut;	/* table of B() for BVCPU_ESSLUT */
+};
+
+/*
+ * bvcpu_key - A color key decoded by validation.  Destination pixels are
+ * written where the keyed surface has the key (BVFLAG_KEY_DST) or does not
+ * (BVFLAG_KEY_SRC).  Pixels are compared as bvcpu_pixload() reads them, in
+ * the bits that hold a component; source 1 read through a scaler is
+ * compared as its lines come out, with the key unpacked the same way.
+ */
+struct bvcpu_key {
+	const struct bvcpu_input *in;	/* source 1, or 0 for the dst */
+	unsigned int bpp;		/* 0 when not keyed */
+	unsigned int value;
+	unsigned int care;
+	int match;			/* write where equal */
+	unsigned long pitch;		/* bytes per line saved */
+	unsigned int *mask;		/* ~0 for pixels written */
+	unsigned char *save;		/* destination before the BLT */
+};
+
+/*
+ * bvcpu_blt - A BLT after validation; all rectangles have been clipped and
+ * translated into the memory coordinates of their surfaces.
+ */
+struct bvcpu_blt {
+	struct bvbltparams *params;
+	unsigned long flags;		/* bvbltparams.flags */
+	unsigned int uses;		/* BVCPU_USES_* */
+
+	struct bvcpu_surf dst;
+	int dstx;			/* first destination pixel written */
+	int dsty;
+	unsigned int width;		/* size of the region written */
+	unsigned int height;
+
+	struct bvcpu_input src1;
+	struct bvcpu_input src2;
+	struct bvcpu_input mask;
+
+	int scaled;			/* scale filters decoded */
+	unsigned char hfilter;		/* BVSCALEDEF_NEAREST_NEIGHBOR... */
+	unsigned char vfilter;
+	unsigned char dither;		/* BVCPU_DITHER_* */
+	unsigned int dbias[4][8];	/* ordered dither thresholds */
+
+	struct bvcpu_blend blend;	/* BVFLAG_BLEND */
+	struct bvcpu_key key;		/* BVFLAG_KEY_* */
+
+	struct bvcpu_map *held[4];	/* dst, src1, src2, mask, once kept */
+};
+
+/*
+ * Validation.  bvcpu_validatestate() checks everything in the bvbltparams
+ * but the rectangles and starts the bvcpu_blt, and bvcpu_validaterects()
+ * maps the rectangles into it; a copy of the state can be mapped for each
+ * BLT of a batch that only moves them.  bvcpu_execute() runs a BLT, or a
+ * chain of count BLTs blending layers over the first.
+ */
+enum bverror bvcpu_validatestate(struct bvbltparams *params,
+				 struct bvcpu_blt *blt);
+enum bverror bvcpu_validaterects(struct bvbltparams *params,
+				 struct bvcpu_blt *blt);
+enum bverror bvcpu_execute(struct bvcpu_blt *blt, unsigned int count);
+
+/*
+ * Shapes.  A shape is what bvcpu_validatestate() decodes from everything
+ * but the buffers and rectangles of a bvbltparams.  bvcpu_shapefind()
+ * builds the key of a bvbltparams, and returns its shape if the thread
+ * validated one like it recently; bvcpu_shapeadd() records the shape of a
+ * BLT validated under a key.
+ */
+struct bvcpu_shapegeom {
+	unsigned int structsize;
+	enum ocdformat format;
+	int orientation;
+};
+
+struct bvcpu_shapekey {
+	unsigned long flags;		/* less those not about the BLT */
+	unsigned long op;
+	unsigned int globalalpha;	/* as the blend reads it */
+	unsigned int dithermode;
+	unsigned int structsize;
+	struct bvcpu_shapegeom dst;
+};
+
+struct bvcpu_shape {
+	struct bvcpu_shapekey key;
+	struct bvcpu_shapegeom in[3];	/* src1, src2, mask, if used */
+	unsigned long stamp;		/* last use, 0 if free */
+	unsigned int uses;
+	const struct bvcpu_format *fmt[4];	/* dst, src1, src2, mask */
+	enum bvdithermode dithermode;	/* for BVFLAG_DITHER_RETURN */
+	unsigned char dither;
+	unsigned int dbias[4][8];
+	struct bvcpu_blend blend;
+};
+
+const struct bvcpu_shape *bvcpu_shapefind(const struct bvbltparams *params,
+					  struct bvcpu_shapekey *key);
+void bvcpu_shapeadd(const struct bvcpu_shapekey *key,
+		    const struct bvcpu_blt *blt);
+
+/*
+ * bvcpu_area - The bytes of a surface between the first and last of a
+ * rectangle, to find which rectangles share bytes: bvcpu_areasmeet()
+ * reports whether two do.  The first line is the last in memory on
+ * bottom-up surfaces.
+ */
+struct bvcpu_area {
+	const unsigned char *start;
+	const unsigned char *end;
+	const struct bvcpu_surf *surf;
+	struct bvrect rect;
+};
+
+void bvcpu_area(const struct bvcpu_surf *surf, const struct bvrect *rect,
+		struct bvcpu_area *area);
+int bvcpu_areasmeet(const struct bvcpu_area *a, const struct bvcpu_area *b);
+
+void bvcpu_readbox(const struct bvcpu_blt *blt, const struct bvcpu_input *in,
+		   struct bvrect *box);
+int bvcpu_overlap(const struct bvcpu_surf *a, const struct bvrect *ar,
+		  const struct bvcpu_surf *b, const struct bvrect *br);
+int bvcpu_inplace(const struct bvcpu_blt *blt, const struct bvcpu_input *in);
+int bvcpu_hazard(const struct bvcpu_blt *blt, const struct bvcpu_input *in);
+
+/*
+ * Raster operations.
+ */
+
+/*
+ * BVCPU_ROP_* - Named ROP4 codes with dedicated kernels.
+ */
+#define BVCPU_ROP_BLACKNESS	0x0000
+#define BVCPU_ROP_DSTINVERT	0x5555
+#define BVCPU_ROP_PATINVERT	0x5A5A
+#define BVCPU_ROP_SRCINVERT	0x6666
+#define BVCPU_ROP_NOP		0xAAAA
+#define BVCPU_ROP_SRCCOPY	0xCCCC
+#define BVCPU_ROP_PATCOPY	0xF0F0
+#define BVCPU_ROP_WHITENESS	0xFFFF
+
+unsigned int bvcpu_ropuses(unsigned short rop);
+enum bverror bvcpu_rop(struct bvcpu_blt *blt);
+
+enum bverror bvcpu_blendvalidate(struct bvcpu_blt *blt);
+enum bverror bvcpu_blend(struct bvcpu_blt *blt);
+
+/*
+ * Layers.  bvcpu_blendlayer() reports whether blt blends source 1 over
+ * what base writes, in place, so that bvcpu_blendlayers() can run a chain
+ * of up to BVCPU_MAXLAYERS such BLTs in one pass over the destination.
+ */
+#define BVCPU_MAXLAYERS		8
+
+int bvcpu_blendlayer(const struct bvcpu_blt *base,
+		     const struct bvcpu_blt *blt);
+enum bverror bvcpu_blendlayers(struct bvcpu_blt *blts, unsigned int count);
+
+/*
+ * Scaling.  Filter weights are signed fixed point, with BVCPU_SCALEONE
+ * standing for 1.0.  bvcpu_scaleline() returns line y of the BLT from an
+ * input read through a scaler; it stays valid until the next call.  Lines
+ * are premultiplied for blends.  For ROPs they keep the premultiplication
+ * of the input format, so that pixels only moved are copied exactly.
+ * bvcpu_scalepacked() returns the same line already packed into fmt, when
+ * the input is a tile only repeated; otherwise 0.
+ */
+#define BVCPU_SCALEBITS	14
+#define BVCPU_SCALEONE	(1 << BVCPU_SCALEBITS)
+
+enum bverror bvcpu_scalemode(struct bvcpu_blt *blt,
+			     const struct bvrect *rect,
+			     const struct bvrect *dstrect);
+enum bverror bvcpu_scalestart(struct bvcpu_blt *blt);
+void bvcpu_scaleend(struct bvcpu_blt *blt);
+const unsigned int *bvcpu_scaleline(const struct bvcpu_input *in, int y);
+const unsigned char *bvcpu_scalepacked(const struct bvcpu_input *in, int y,
+				       const struct bvcpu_format *fmt);
+unsigned int bvcpu_scaletaps(unsigned char filter, unsigned int src,
+			     unsigned int dst);
+
+/*
+ * Tiles.  The plane of a tiled input holds the tile at the alignment
+ * location, repeated or mirrored away from it on each side.  A line of the
+ * plane only depends on the line of the tile it crosses, so each is
+ * expanded once per BLT into a span, which bvcpu_tileline() returns; it
+ * stays valid until the next call.  bvcpu_tilepacked() returns the same
+ * span packed into fmt, with the alpha fixed up as bvcpu_alphafix() says.
+ */
+struct bvcpu_tile;
+
+struct bvcpu_tile *bvcpu_tilenew(const struct bvcpu_blt *blt,
+				 const struct bvcpu_input *in, int x0,
+				 unsigned int nx, unsigned int ny, int premul);
+void bvcpu_tilefree(struct bvcpu_tile *tile);
+const unsigned int *bvcpu_tileline(struct bvcpu_tile *tile, int y);
+const unsigned char *bvcpu_tilepacked(struct bvcpu_tile *tile, int y,
+				      const struct bvcpu_format *fmt,
+				      int fix);
+
+/*
+ * Color keys.  The operations keep nslot lines of the destination: before
+ * line y is written, bvcpu_keyget() saves it in a slot and works out which
+ * pixels the key lets through; once written, bvcpu_keyput() puts the rest
+ * back.
+ */
+enum bverror bvcpu_keyvalidate(struct bvcpu_blt *blt);
+enum bverror bvcpu_keystart(struct bvcpu_blt *blt, unsigned int nslot);
+void bvcpu_keyget(struct bvcpu_blt *blt, int y, unsigned int slot);
+void bvcpu_keyput(struct bvcpu_blt *blt, int y, unsigned int slot);
+void bvcpu_keyend(struct bvcpu_blt *blt);
+int bvcpu_keycopy(struct bvcpu_blt *blt);
+
+/*
+ * Dithering.  BVCPU_DITHER_* is the dithering applied when packing the
+ * destination.  The ordered dithers keep the thresholds of each
+ * destination line and column modulo 4, twice over, with the red, green
+ * and blue thresholds in the color bytes of each word.  They are aligned
+ * to destination coordinates, so split and clipped BLTs dither as one.
+ */
+#define BVCPU_DITHER_NONE	0
+#define BVCPU_DITHER_2X2	1
+#define BVCPU_DITHER_4X4	2
+#define BVCPU_DITHER_2X2_4X4	3	/* 2x2 for 6 bits, 4x4 for fewer */
+#define BVCPU_DITHER_DIFFUSED	4	/* Floyd-Steinberg, see below */
+#define BVCPU_DITHER_COUNT	5
+
+enum bverror bvcpu_dithermode(struct bvcpu_blt *blt);
+
+/*
+ * bvcpu_ditherbias() - The ordered dither thresholds for line y of the
+ * BLT, for bvcpu_pack(); 0 when not dithering.
+ */
+static inline const unsigned int *bvcpu_ditherbias(const struct bvcpu_blt *blt,
+						   int y)
+{
+	if (blt->dither == BVCPU_DITHER_NONE ||
+	    blt->dither == BVCPU_DITHER_DIFFUSED)
+		return NULL;
+	return &blt->dbias[(blt->dsty + y) & 3][blt->dstx & 3];
+}
+
+/*
+ * Error diffusion is not done by bvcpu_pack().  The operations render the
+ * BLT unpacked into a buffer of width x height pixels, which
+ * bvcpu_diffuse() packs into the destination.
+ */
+enum bverror bvcpu_diffuse(const struct bvcpu_format *fmt,
+			   const unsigned int *src, unsigned char *dst,
+			   long stride, unsigned int width, unsigned int height,
+			   unsigned int threads);
+
+/*
+ * Cost model.  The implicit scale and dither modes are resolved from a
+ * table of kernel throughputs, measured the first time it is needed or
+ * read from the file named by BVCPU_COSTS.
+ */
+void bvcpu_choosescale(unsigned long mode, unsigned int srcw,
+		       unsigned int srch, unsigned int dstw,
+		       unsigned int dsth, unsigned char *hfilter,
+		       unsigned char *vfilter);
+unsigned char bvcpu_choosedither(unsigned long mode,
+				 const struct bvcpu_format *fmt);
+
+/*
+ * bvcpu_ropconst - The 16 truth table entries of a ROP4, expanded once per
+ * BLT into the leaf terms used by the generic kernels.  leaf[i] selects
+ * between the entries for dst = 0 and dst = 1 as c0[i] ^ (cx[i] & dst).
+ */
+struct bvcpu_ropconst {
+	unsigned char c0[8];
+	unsigned char cx[8];
+};
+
+typedef void (*bvcpu_ropfn)(unsigned char *dst, const unsigned char *src1,
+			    const unsigned char *src2,
+			    const unsigned char *mask, unsigned long count,
+			    const struct bvcpu_ropconst *rc);
+
+/*
+ * bvcpu_kernels - Pixel processing kernels, one set per instruction set
+ * extension.  The set is chosen once by bvcpu_init() using the CPU
+ * features reported at run time.
+ */
+struct bvcpu_kernels {
+	const char *name;
+	bvcpu_ropfn rop3;		/* generic, mask ignored */
+	bvcpu_ropfn rop4;		/* generic */
+	bvcpu_ropfn copy;		/* dst = src1 */
+	bvcpu_ropfn xor;		/* dst ^= src1 */
+	bvcpu_ropfn not;		/* dst = ~dst */
+	void (*fill)(unsigned char *dst, unsigned char value,
+		     unsigned long count);
+	/* count bytes of one pixel of bpp bytes, repeated */
+	void (*broadcast)(unsigned char *dst, const unsigned char *pixel,
+			  unsigned int bpp, unsigned long count);
+
+	/* [(BVCPU_MOD_* * BVCPU_AF_COUNT + K1) * BVCPU_AF_COUNT + K2] */
+	const bvcpu_blendfn *blend;
+	bvcpu_blendfn blendk;		/* per-component K1-K4 */
+	bvcpu_factorfn kinv;		/* ~y */
+	bvcpu_factorfn kmin;		/* min(x, ~y) per byte */
+	bvcpu_factorfn kmax;		/* max(x, ~y) per byte */
+	bvcpu_factorfn kalpha;		/* alpha of x in every byte */
+	void (*kmod)(unsigned int *dst, const unsigned int *src,
+		     const unsigned char *ar, unsigned int ag,
+		     unsigned int count);
+
+	/* [essential * 2 + opaque] */
+	const bvcpu_blendfn *essential;
+
+	/* dst[i] = sum of w[i * taps + t] x src[start[i] + t] */
+	void (*scaleh)(unsigned int *dst, const unsigned int *src,
+		       const int *start, const short *w, unsigned int taps,
+		       unsigned int count);
+	/* dst[i] = sum of w[t] x rows[t][i] */
+	void (*scalev)(unsigned int *dst, const unsigned int *const *rows,
+		       const short *w, unsigned int taps, unsigned int count);
+	/* dst[i] = src[idx[i]] */
+	void (*scalenn)(unsigned int *dst, const unsigned int *src,
+			const int *idx, unsigned int count);
+	/* dst[i] = src[(phase + i) / factor], factor 2-4 */
+	void (*scalerep)(unsigned int *dst, const unsigned int *src,
+			 unsigned int factor, unsigned int phase,
+			 unsigned int count);
+	/* dst[i] = src[2 * i] */
+	void (*scalehalf)(unsigned int *dst, const unsigned int *src,
+			  unsigned int count);
+
+	/* dst[x * dstride + y] = src[y * sstride + x], strides in pixels */
+	void (*transpose)(unsigned int *dst, long dstride,
+			  const unsigned int *src, long sstride,
+			  unsigned int w, unsigned int h);
+	/* dst[i] = src[count - 1 - i] */
+	void (*reverse)(unsigned int *dst, const unsigned int *src,
+			unsigned int count);
+
+	/* m[i] = ~0 if (((pixel i ^ key) & care) == 0) == match, else 0 */
+	void (*keycmp)(unsigned int *m, const unsigned char *src,
+		       unsigned int bpp, unsigned int key, unsigned int care,
+		       int match, unsigned int count);
+	/* pixel i of dst = m[i] ? dst : save */
+	void (*keysel)(unsigned char *dst, const unsigned char *save,
+		       const unsigned int *m, unsigned int bpp,
+		       unsigned int count);
+
+	/* pack a BVCPU_PACK16_* format with the thresholds of one line */
+	void (*pack16)(unsigned short *dst, const unsigned int *src,
+		       const unsigned int *bias, unsigned int layout,
+		       unsigned int count);
+};
+
+extern const struct bvcpu_kernels *bvcpu_kern;
+
+/*
+ * bvcpu_ncpus - CPUs online when the library was loaded, or the number in
+ * BVCPU_THREADS, up to BVCPU_MAXTHREADS: the most threads work is split
+ * across.
+ */
+#define BVCPU_MAXTHREADS	64
+
+extern unsigned int bvcpu_ncpus;
+
+/*
+ * Threads.  bvcpu_poolrun() runs fn(arg) on the calling thread and on up to
+ * threads - 1 pool workers at once, and returns once all of them have
+ * returned; fn shares out the work itself.  bvcpu_bandrun() runs count
+ * BLTs writing the same region through run, split into bands of lines run
+ * in parallel when they are large enough and the bands do not read each
+ * other's pixels.
+ */
+void bvcpu_poolrun(void (*fn)(void *arg), void *arg, unsigned int threads);
+enum bverror bvcpu_bandrun(struct bvcpu_blt *blt, unsigned int count,
+			   enum bverror (*run)(struct bvcpu_blt *blt,
+					       unsigned int count));
+
+/*
+ * Batches.  bvcpu_batch() takes a BLT with BVFLAG_BATCH_BEGIN, _CONTINUE
+ * or _END set.  BLTs are validated as they are submitted and run when the
+ * batch ends.
+ */
+enum bverror bvcpu_batch(struct bvbltparams *params);
+
+/*
+ * bvcpu_keep() - Point a validated BLT at copies of the client's
+ * bvbltparams and tiles, which may change before the BLT is run, and hold
+ * the maps of its buffers.  bvcpu_drop() lets them go once it has run;
+ * copies of the bvcpu_blt made since must not be dropped.
+ */
+void bvcpu_keep(struct bvcpu_blt *blt, struct bvbltparams *params,
+		struct bvtileparams tile[3]);
+void bvcpu_drop(struct bvcpu_blt *blt);
+
+/*
+ * Asynchronous BLTs.  bvcpu_asyncsubmit() queues a job for the engine's
+ * thread, which calls run to do the work and set err and errdesc.  Jobs
+ * run in the order they are submitted.  Their callbacks are then called
+ * from the callback thread, after which release frees the job.
+ * bvcpu_asyncwait() returns once every job submitted before it has run.
+ * bvcpu_asyncnop() completes a NOP BLT as a fence.
+ */
+struct bvcpu_async {
+	struct bvcpu_async *next;
+	unsigned long ticket;		/* order it completes in */
+	void (*run)(struct bvcpu_async *job);
+	void (*release)(struct bvcpu_async *job);
+	void (*callbackfn)(struct bvcallbackerror *err,
+			   unsigned long callbackdata);
+	unsigned long callbackdata;
+	enum bverror err;
+	char *errdesc;
+};
+
+void bvcpu_asyncsubmit(struct bvcpu_async *job);
+void bvcpu_asyncwait(void);
+enum bverror bvcpu_asyncnop(struct bvbltparams *params);
+
+const struct bvcpu_kernels *bvcpu_selectkernels(void);
+
+/*
+ * Error reporting.
+ */
+static inline enum bverror bvcpu_err(struct bvbltparams *params,
+				     enum bverror err, const char *desc)
+{
+	params->errdesc = (char *)desc;
+	return err;
+}
+
+#endif /* BVCPU_H */
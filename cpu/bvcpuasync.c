@@ -0,0 +1,368 @@
+/*
+ * bvcpuasync.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the engine behind BVFLAG_ASYNC.  An asynchronous BLT
+ * is validated by the caller, as any other, and then copied into a job
+ * that is queued for the engine's thread, so that bv_blt() returns without
+ * touching a pixel.  The engine runs the jobs one after the other, each
+ * spread over the worker pool as a synchronous BLT would be, so they
+ * complete in the order they were submitted.  Callbacks are called from a
+ * thread of their own, also in order, so a slow callback does not hold up
+ * the BLTs behind it.
+ *
+ * Jobs are queued without locks: a submitter takes a ticket, swaps its
+ * job in as the tail of the queue and then links the old tail to it.  Only
+ * one thread takes jobs off each queue.  The lock of a queue is only taken
+ * to wake its thread when it has gone to sleep.  Submitters racing each
+ * other may queue their jobs out of the order of their tickets, so the
+ * engine holds back a job until those with earlier tickets have run: the
+ * tickets are the order BLTs complete in.
+ *
+ * Synchronous BLTs wait for the asynchronous ones submitted before them,
+ * since they may read what those write.
+ *
+ * The tickets of the jobs run are the timeline of bvcpuext.h.  NOP BLTs
+ * are fences: they only wait for, or take the point of, the BLTs before
+ * them, and are queued only when they have a callback to call in order.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "bvcpu.h"
+
+/*
+ * bvcpu_asyncq - A queue of jobs taken by one thread.  head and taken are
+ * only used by that thread.  A stub job stands in when the queue is empty,
+ * so submitters always have a tail to link to.
+ */
+struct bvcpu_asyncq {
+	struct bvcpu_async *head;
+	struct bvcpu_async *tail;
+	struct bvcpu_async stub;
+	unsigned long pushed;		/* jobs linked in */
+	unsigned long taken;
+	int idle;			/* the thread is going to sleep */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+static struct bvcpu_asyncq bvcpu_runq;	/* jobs to run */
+static struct bvcpu_asyncq bvcpu_doneq;	/* jobs to call back */
+static pthread_once_t bvcpu_asynconce = PTHREAD_ONCE_INIT;
+static int bvcpu_asyncstarted;
+
+/* the last tickets taken and run, and the callers waiting for them */
+static unsigned long bvcpu_asyncticket;
+static unsigned long bvcpu_asyncdone;
+static unsigned int bvcpu_asyncwaiters;
+static pthread_mutex_t bvcpu_asynclock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bvcpu_asyncwake = PTHREAD_COND_INITIALIZER;
+
+/* the last ticket the thread took or waited for */
+static __thread unsigned long bvcpu_asyncpoint;
+
+/* serializes jobs when there is no engine to run them */
+static pthread_mutex_t bvcpu_asyncinline = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * bvcpu_asynclink() - Put a job at the tail of a queue.  Until the old tail
+ * is linked to it, the job cannot be taken.
+ */
+static void bvcpu_asynclink(struct bvcpu_asyncq *q, struct bvcpu_async *job)
+{
+	struct bvcpu_async *prev;
+
+	__atomic_store_n(&job->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&q->tail, job, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, job, __ATOMIC_RELEASE);
+}
+
+/*
+ * bvcpu_asyncpush() - Queue a job, and wake the queue's thread if it is
+ * asleep.
+ */
+static void bvcpu_asyncpush(struct bvcpu_asyncq *q, struct bvcpu_async *job)
+{
+	bvcpu_asynclink(q, job);
+	__atomic_fetch_add(&q->pushed, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_signal(&q->wake);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+/*
+ * bvcpu_asyncpop() - Take the job at the head of a queue, or return 0 if
+ * there is none, or the next is still being linked in.
+ */
+static struct bvcpu_async *bvcpu_asyncpop(struct bvcpu_asyncq *q)
+{
+	struct bvcpu_async *head = q->head;
+	struct bvcpu_async *next;
+
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if (head == &q->stub) {
+		if (!next)
+			return NULL;
+		q->head = head = next;
+		next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		q->head = next;
+		return head;
+	}
+
+	/* the last job can only go once the stub is queued behind it */
+	if (head != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	bvcpu_asynclink(q, &q->stub);
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		q->head = next;
+		return head;
+	}
+	return NULL;
+}
+
+/*
+ * bvcpu_asyncnext() - Take the next job off a queue, sleeping until there
+ * is one.  The thread says it is going to sleep before looking at the
+ * queue for the last time, and submitters look at that after queueing, so
+ * either the thread sees the job or the submitter wakes it.
+ */
+static struct bvcpu_async *bvcpu_asyncnext(struct bvcpu_asyncq *q)
+{
+	struct bvcpu_async *job;
+
+	for (;;) {
+		job = bvcpu_asyncpop(q);
+		if (job)
+			break;
+		if ((long)(__atomic_load_n(&q->pushed, __ATOMIC_SEQ_CST) -
+			   q->taken) > 0) {
+			sched_yield();
+			continue;
+		}
+
+		pthread_mutex_lock(&q->lock);
+		__atomic_store_n(&q->idle, 1, __ATOMIC_SEQ_CST);
+		while (!(job = bvcpu_asyncpop(q)) &&
+		       (long)(__atomic_load_n(&q->pushed, __ATOMIC_SEQ_CST) -
+			      q->taken) <= 0)
+			pthread_cond_wait(&q->wake, &q->lock);
+		__atomic_store_n(&q->idle, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&q->lock);
+		if (job)
+			break;
+	}
+	q->taken++;
+	return job;
+}
+
+/*
+ * bvcpu_asynccall() - Call a job's callback, with the error it ran into,
+ * and free it.
+ */
+static void bvcpu_asynccall(struct bvcpu_async *job)
+{
+	struct bvcallbackerror err;
+
+	if (job->callbackfn) {
+		err.structsize = sizeof(err);
+		err.error = job->err;
+		err.errdesc = job->errdesc;
+		job->callbackfn(job->err != BVERR_NONE ? &err : NULL,
+				job->callbackdata);
+	}
+	job->release(job);
+}
+
+/*
+ * bvcpu_asyncran() - Record that the job with a ticket has run, and wake
+ * those waiting for it.
+ */
+static void bvcpu_asyncran(unsigned long ticket)
+{
+	__atomic_store_n(&bvcpu_asyncdone, ticket, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&bvcpu_asyncwaiters, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&bvcpu_asynclock);
+		pthread_cond_broadcast(&bvcpu_asyncwake);
+		pthread_mutex_unlock(&bvcpu_asynclock);
+	}
+}
+
+static void *bvcpu_asyncrunner(void *arg)
+{
+	struct bvcpu_async *held = NULL;	/* queued early, by ticket */
+	struct bvcpu_async *job, **link;
+	unsigned long next = 1;
+
+	for (;;) {
+		if (held && held->ticket == next) {
+			job = held;
+			held = job->next;
+		} else {
+			job = bvcpu_asyncnext(&bvcpu_runq);
+			if (job->ticket != next) {
+				for (link = &held; *link &&
+				     (*link)->ticket < job->ticket;
+				     link = &(*link)->next)
+					;
+				job->next = *link;
+				*link = job;
+				continue;
+			}
+		}
+
+		job->run(job);
+		bvcpu_asyncran(next++);
+
+		if (job->callbackfn)
+			bvcpu_asyncpush(&bvcpu_doneq, job);
+		else
+			job->release(job);
+	}
+
+	return NULL;
+}
+
+static void *bvcpu_asynccaller(void *arg)
+{
+	for (;;)
+		bvcpu_asynccall(bvcpu_asyncnext(&bvcpu_doneq));
+
+	return NULL;
+}
+
+static void bvcpu_asyncqinit(struct bvcpu_asyncq *q)
+{
+	q->head = &q->stub;
+	q->tail = &q->stub;
+	q->stub.next = NULL;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->wake, NULL);
+}
+
+/*
+ * bvcpu_asyncinit() - Start the engine's threads.  If they cannot be
+ * started, asynchronous BLTs are run as they are submitted.
+ */
+static void bvcpu_asyncinit(void)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	bvcpu_asyncqinit(&bvcpu_runq);
+	bvcpu_asyncqinit(&bvcpu_doneq);
+	if (pthread_attr_init(&attr))
+		return;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (!pthread_create(&tid, &attr, bvcpu_asynccaller, NULL) &&
+	    !pthread_create(&tid, &attr, bvcpu_asyncrunner, NULL))
+		bvcpu_asyncstarted = 1;
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * bvcpu_asyncsubmit() - Queue a job.  If the engine could not be started,
+ * jobs are run as they are submitted, one at a time.
+ */
+void bvcpu_asyncsubmit(struct bvcpu_async *job)
+{
+	pthread_once(&bvcpu_asynconce, bvcpu_asyncinit);
+	if (!bvcpu_asyncstarted) {
+		pthread_mutex_lock(&bvcpu_asyncinline);
+		job->ticket = ++bvcpu_asyncticket;
+		bvcpu_asyncpoint = job->ticket;
+		job->run(job);
+		bvcpu_asyncran(job->ticket);
+		pthread_mutex_unlock(&bvcpu_asyncinline);
+		bvcpu_asynccall(job);
+		return;
+	}
+	job->ticket = __atomic_add_fetch(&bvcpu_asyncticket, 1,
+					 __ATOMIC_SEQ_CST);
+	bvcpu_asyncpoint = job->ticket;
+	bvcpu_asyncpush(&bvcpu_runq, job);
+}
+
+void bvcpu_asyncwait(void)
+{
+	bvcpu_timelinewait(__atomic_load_n(&bvcpu_asyncticket,
+					   __ATOMIC_SEQ_CST));
+}
+
+static void bvcpu_asyncnoprun(struct bvcpu_async *job)
+{
+	job->err = BVERR_NONE;
+}
+
+static void bvcpu_asyncnopfree(struct bvcpu_async *job)
+{
+	free(job);
+}
+
+enum bverror bvcpu_asyncnop(struct bvbltparams *params)
+{
+	struct bvcpu_async *job;
+	unsigned long ticket;
+
+	if (!(params->flags & BVFLAG_ASYNC) || !params->callbackfn) {
+		ticket = __atomic_load_n(&bvcpu_asyncticket, __ATOMIC_SEQ_CST);
+		if (!(params->flags & BVFLAG_ASYNC))
+			bvcpu_timelinewait(ticket);
+		bvcpu_asyncpoint = ticket;
+		return BVERR_NONE;
+	}
+
+	job = malloc(sizeof(*job));
+	if (!job)
+		return bvcpu_err(params, BVERR_OOM, "out of memory for NOP");
+	job->run = bvcpu_asyncnoprun;
+	job->release = bvcpu_asyncnopfree;
+	job->callbackfn = params->callbackfn;
+	job->callbackdata = params->callbackdata;
+	bvcpu_asyncsubmit(job);
+	return BVERR_NONE;
+}
+
+unsigned long bvcpu_timeline(void)
+{
+	return __atomic_load_n(&bvcpu_asyncdone, __ATOMIC_ACQUIRE);
+}
+
+unsigned long bvcpu_timelinepoint(void)
+{
+	return bvcpu_asyncpoint;
+}
+
+void bvcpu_timelinewait(unsigned long point)
+{
+	if ((long)(point - __atomic_load_n(&bvcpu_asyncdone,
+					   __ATOMIC_ACQUIRE)) <= 0)
+		return;
+
+	__atomic_fetch_add(&bvcpu_asyncwaiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&bvcpu_asynclock);
+	while ((long)(point - __atomic_load_n(&bvcpu_asyncdone,
+					      __ATOMIC_SEQ_CST)) > 0)
+		pthread_cond_wait(&bvcpu_asyncwake, &bvcpu_asynclock);
+	pthread_mutex_unlock(&bvcpu_asynclock);
+	__atomic_fetch_sub(&bvcpu_asyncwaiters, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,560 @@
+/*
+ * bvcpubatch.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains batches.  Each BLT of a batch is validated as it is
+ * submitted, so errors are reported against the BLT that caused them, and
+ * the validated BLTs are run when the batch ends, or earlier once enough
+ * of them are held.  They may run in any order, but BLTs that read or
+ * write what an earlier one writes, or write what it reads, run after it,
+ * so the result is the same as running them in order.  A batch ended with
+ * BVFLAG_ASYNC is run by the asynchronous engine instead.
+ *
+ * Validation is split at the rectangles.  Everything else, the operation,
+ * the surfaces and their formats, is validated into a state, which the
+ * batch keeps with a copy of the parameters it was built from.  A BLT
+ * whose bvbltparams.batchflags only name rectangles, the color key or the
+ * scale mode maps its rectangles onto a copy of the last state, which
+ * skips the surface and format lookups that dominate small BLTs such as
+ * glyphs.  Any other change builds a new state.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * BVCPU_BATCH_REMAP - Changes that only need the rectangles mapped again.
+ * The color key and scale mode are decoded with the rectangles, since the
+ * key depends on whether source 1 is scaled.
+ */
+#define BVCPU_BATCH_REMAP \
+	(BVBATCH_KEY | BVBATCH_SCALE | \
+	 BVBATCH_DSTRECT_ORIGIN | BVBATCH_DSTRECT_SIZE | \
+	 BVBATCH_SRC1RECT_ORIGIN | BVBATCH_SRC1RECT_SIZE | \
+	 BVBATCH_SRC2RECT_ORIGIN | BVBATCH_SRC2RECT_SIZE | \
+	 BVBATCH_MASKRECT_ORIGIN | BVBATCH_MASKRECT_SIZE | \
+	 BVBATCH_CLIPRECT)
+
+#define BVCPU_BATCH_SUPPORTED \
+	(BVCPU_BATCH_REMAP | \
+	 BVBATCH_OP | BVBATCH_MISCFLAGS | BVBATCH_ALPHA | BVBATCH_DITHER | \
+	 BVBATCH_DST | BVBATCH_SRC1 | BVBATCH_SRC2 | BVBATCH_MASK | \
+	 BVBATCH_TILE_SRC1 | BVBATCH_TILE_SRC2 | BVBATCH_TILE_MASK | \
+	 BVBATCH_ENDNOP)
+
+/*
+ * BVCPU_BATCH_SAMEFLAGS - bvbltparams.flags which differ between BLTs
+ * sharing a state.
+ */
+#define BVCPU_BATCH_SAMEFLAGS \
+	(~(unsigned long)(BVFLAG_BATCH_MASK | BVFLAG_ASYNC | \
+			  BVFLAG_TESTPARAMS_NOP))
+
+/*
+ * BVCPU_BATCH_MINBLTS - BLTs a batch first makes room for.
+ * BVCPU_BATCH_MAXBLTS - BLTs held before the batch runs them, so that long
+ * batches run while their BLTs are still in the cache.
+ */
+#define BVCPU_BATCH_MINBLTS	16
+#define BVCPU_BATCH_MAXBLTS	256
+
+/*
+ * BVCPU_BATCH_PARMIN - Pixels the BLTs held must write to be run at the
+ * same time.
+ * BVCPU_BATCH_PAIRPIXELS - Pixels the BLTs held must write for each pair
+ * of them compared to find the ones which depend on each other; below
+ * that, the comparisons cost more than the threads save, and small BLTs
+ * are run in order.
+ * BVCPU_BATCH_TILE - Size of the destination tiles BLTs run at the same
+ * time are ordered by.
+ */
+#define BVCPU_BATCH_PARMIN	(64 * 1024)
+#define BVCPU_BATCH_PAIRPIXELS	256
+#define BVCPU_BATCH_TILE	64
+
+/*
+ * bvcpu_batchstate - A BLT validated up to its rectangles.  The copies of
+ * the parameters and tiles stand in for the client's, which may change
+ * before the batch is run.
+ */
+struct bvcpu_batchstate {
+	struct bvcpu_batchstate *next;
+	struct bvbltparams params;
+	struct bvtileparams tile[3];	/* src1, src2, mask */
+	struct bvcpu_blt blt;
+};
+
+/*
+ * bvcpu_batchitem - A BLT, run of merged BLTs or chain of layers, as it is
+ * scheduled.
+ */
+struct bvcpu_batchitem {
+	struct bvcpu_blt *blt;
+	unsigned int layers;		/* BLTs from blt run as one */
+	unsigned int index;		/* position in the batch */
+	unsigned int level;		/* BLTs it depends on run before */
+	unsigned int tile;		/* destination tile it starts in */
+	enum bverror err;
+	struct bvcpu_area write;
+	struct bvcpu_area reads[3];
+	unsigned int nreads;
+};
+
+struct bvbatch {
+	struct bvcpu_async async;	/* when it ends asynchronously */
+	struct bvcpu_batchstate *states;	/* newest first */
+	int valid;			/* states is the last BLT's */
+	struct bvcpu_blt *blts;		/* BLTs to run, in order */
+	unsigned int count;
+	unsigned int size;
+	enum bverror err;		/* first error running them */
+	char *errdesc;
+	struct bvcpu_batchitem items[BVCPU_BATCH_MAXBLTS];
+};
+
+/*
+ * bvcpu_batchstate() - Validate everything but the rectangles of a BLT
+ * into a new state.
+ */
+static enum bverror bvcpu_batchstate(struct bvbatch *batch,
+				     struct bvbltparams *params)
+{
+	struct bvcpu_batchstate *st;
+	enum bverror err;
+
+	batch->valid = 0;
+	st = malloc(sizeof(*st));
+	if (!st)
+		return bvcpu_err(params, BVERR_OOM, "out of memory for batch");
+	err = bvcpu_validatestate(params, &st->blt);
+	if (err != BVERR_NONE) {
+		free(st);
+		return err;
+	}
+
+	bvcpu_keep(&st->blt, &st->params, st->tile);
+
+	st->next = batch->states;
+	batch->states = st;
+	batch->valid = 1;
+	return BVERR_NONE;
+}
+
+/*
+ * bvcpu_batchread() - Add the bytes an input reads to those of a BLT,
+ * unless it is read in place, at the bytes written.
+ */
+static void bvcpu_batchread(struct bvcpu_batchitem *item,
+			    const struct bvcpu_input *in)
+{
+	struct bvrect box;
+
+	if (bvcpu_inplace(item->blt, in))
+		return;
+	bvcpu_readbox(item->blt, in, &box);
+	bvcpu_area(&in->surf, &box, &item->reads[item->nreads++]);
+}
+
+/*
+ * bvcpu_batchareas() - Find the bytes a BLT writes and those it reads.  The
+ * destination is only read where it is written.
+ */
+static void bvcpu_batchareas(struct bvcpu_batchitem *item)
+{
+	const struct bvcpu_blt *blt = item->blt;
+	struct bvrect rect = {
+		blt->dstx, blt->dsty, blt->width, blt->height
+	};
+
+	bvcpu_area(&blt->dst, &rect, &item->write);
+	item->nreads = 0;
+	if (blt->uses & BVCPU_USES_SRC1)
+		bvcpu_batchread(item, &blt->src1);
+	if (blt->uses & BVCPU_USES_SRC2)
+		bvcpu_batchread(item, &blt->src2);
+	if (blt->uses & BVCPU_USES_MASK)
+		bvcpu_batchread(item, &blt->mask);
+}
+
+/*
+ * bvcpu_batchdep() - Whether b must run after a: either writes what the
+ * other reads or writes.  Chains of layers read more than the areas hold,
+ * and are ordered against every other BLT.
+ */
+static int bvcpu_batchdep(const struct bvcpu_batchitem *a,
+			  const struct bvcpu_batchitem *b)
+{
+	unsigned int i;
+
+	if (a->layers > 1 || b->layers > 1)
+		return 1;
+	if (bvcpu_areasmeet(&a->write, &b->write))
+		return 1;
+	for (i = 0; i < b->nreads; i++)
+		if (bvcpu_areasmeet(&a->write, &b->reads[i]))
+			return 1;
+	for (i = 0; i < a->nreads; i++)
+		if (bvcpu_areasmeet(&a->reads[i], &b->write))
+			return 1;
+	return 0;
+}
+
+/*
+ * bvcpu_batchnext() - Whether an input of b continues the same input of a
+ * along the lines: both are read in place, from neighboring pixels.
+ */
+static int bvcpu_batchnext(const struct bvcpu_blt *a,
+			   const struct bvcpu_input *ai,
+			   const struct bvcpu_input *bi)
+{
+	return !ai->scaled && !bi->scaled &&
+		bi->x == ai->x + (int)a->width && bi->y == ai->y &&
+		bi->surf.virtaddr == ai->surf.virtaddr &&
+		bi->surf.stride == ai->surf.stride &&
+		bi->surf.height == ai->surf.height;
+}
+
+/*
+ * bvcpu_batchclear() - Whether an input read in place is read at the
+ * pixels written, or clear of them.
+ */
+static int bvcpu_batchclear(const struct bvcpu_blt *blt,
+			    const struct bvcpu_input *in)
+{
+	return bvcpu_inplace(blt, in) || !bvcpu_hazard(blt, in);
+}
+
+/*
+ * bvcpu_batchmerge() - Merge b into a, which it follows on the same lines,
+ * if the two are built from one state and every pixel of either is
+ * computed from the pixels at the same place.  Neither reads what the
+ * other writes when the merged BLT reads each input at the pixels it
+ * writes or clear of them.  Runs of glyphs, spans and fills are merged
+ * this way.  Error diffusion carries between the pixels of a line, so it
+ * is never merged.  Returns 0 if b is left alone.
+ */
+static int bvcpu_batchmerge(struct bvcpu_blt *a, const struct bvcpu_blt *b)
+{
+	unsigned int uses = a->uses;
+
+	if (b->params != a->params || b->dsty != a->dsty ||
+	    b->height != a->height || b->dstx != a->dstx + (int)a->width ||
+	    a->dither == BVCPU_DITHER_DIFFUSED ||
+	    b->key.value != a->key.value)
+		return 0;
+	if (((uses & BVCPU_USES_SRC1) &&
+	     !bvcpu_batchnext(a, &a->src1, &b->src1)) ||
+	    ((uses & BVCPU_USES_SRC2) &&
+	     !bvcpu_batchnext(a, &a->src2, &b->src2)) ||
+	    ((uses & BVCPU_USES_MASK) &&
+	     !bvcpu_batchnext(a, &a->mask, &b->mask)))
+		return 0;
+
+	a->width += b->width;
+	if (((uses & BVCPU_USES_SRC1) && !bvcpu_batchclear(a, &a->src1)) ||
+	    ((uses & BVCPU_USES_SRC2) && !bvcpu_batchclear(a, &a->src2)) ||
+	    ((uses & BVCPU_USES_MASK) && !bvcpu_batchclear(a, &a->mask))) {
+		a->width -= b->width;
+		return 0;
+	}
+	return 1;
+}
+
+static int bvcpu_batchcmp(const void *p, const void *q)
+{
+	const struct bvcpu_batchitem *a = p, *b = q;
+	unsigned long ad = (unsigned long)a->blt->dst.virtaddr;
+	unsigned long bd = (unsigned long)b->blt->dst.virtaddr;
+
+	if (a->level != b->level)
+		return a->level < b->level ? -1 : 1;
+	if (ad != bd)
+		return ad < bd ? -1 : 1;
+	if (a->tile != b->tile)
+		return a->tile < b->tile ? -1 : 1;
+	return a->index < b->index ? -1 : a->index > b->index;
+}
+
+/*
+ * bvcpu_batchlevels() - Sort the BLTs into levels, each BLT one level past
+ * the last BLT before it that it depends on, so the BLTs of a level are
+ * independent of each other.  Within a level, BLTs are ordered by the
+ * destination tiles they start in.
+ */
+static void bvcpu_batchlevels(struct bvcpu_batchitem *items,
+			      unsigned int count)
+{
+	unsigned int i, j;
+
+	for (j = 0; j < count; j++) {
+		const struct bvcpu_blt *blt = items[j].blt;
+
+		bvcpu_batchareas(&items[j]);
+		items[j].level = 0;
+		items[j].tile = (unsigned int)(blt->dsty / BVCPU_BATCH_TILE) <<
+			16 | (unsigned int)(blt->dstx / BVCPU_BATCH_TILE);
+		for (i = 0; i < j; i++)
+			if (items[i].level >= items[j].level &&
+			    bvcpu_batchdep(&items[i], &items[j]))
+				items[j].level = items[i].level + 1;
+	}
+	qsort(items, count, sizeof(*items), bvcpu_batchcmp);
+}
+
+/*
+ * bvcpu_batchlevel - The BLTs of a level, taken in order by the threads
+ * running them.
+ */
+struct bvcpu_batchlevel {
+	struct bvcpu_batchitem *items;
+	unsigned int count;
+	unsigned int next;
+};
+
+static void bvcpu_batchworker(void *arg)
+{
+	struct bvcpu_batchlevel *lv = arg;
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&lv->next, 1, __ATOMIC_RELAXED)) <
+	       lv->count)
+		lv->items[i].err = bvcpu_execute(lv->items[i].blt,
+						   lv->items[i].layers);
+}
+
+/*
+ * bvcpu_batchlayers() - The number of BLTs from blt on that blend layers
+ * over it, up to the last of n BLTs held, and including blt.
+ */
+static unsigned int bvcpu_batchlayers(const struct bvcpu_blt *blt,
+				      unsigned int n)
+{
+	unsigned int count = 1;
+
+	while (count < n && count < BVCPU_MAXLAYERS &&
+	       bvcpu_blendlayer(blt, &blt[count]))
+		count++;
+	return count;
+}
+
+/*
+ * bvcpu_batchrun() - Run the BLTs held by a batch, keeping the first
+ * error.  Neighboring BLTs are merged where they can be, and chains of
+ * BLTs compositing layers onto the same region are run in one pass.  When
+ * the BLTs write enough pixels to pay for finding which of them depend on
+ * which, independent BLTs are run at the same time, and in the order of
+ * the destination tiles they write.
+ */
+static void bvcpu_batchrun(struct bvbatch *batch)
+{
+	struct bvcpu_batchitem *items = batch->items;
+	struct bvcpu_batchitem *first = NULL;
+	struct bvcpu_blt *prev = NULL;
+	struct bvcpu_batchlevel lv;
+	unsigned long pixels = 0, pairs;
+	unsigned int count = 0, layers, i, j;
+
+	for (i = 0; i < batch->count; i += layers) {
+		struct bvcpu_blt *blt = &batch->blts[i];
+
+		/* the BLTs were moved as the batch grew */
+		if (blt->key.in)
+			blt->key.in = &blt->src1;
+		layers = 1;
+		if (prev && bvcpu_batchmerge(prev, blt)) {
+			pixels += (unsigned long)blt->width * blt->height;
+			continue;
+		}
+		layers = bvcpu_batchlayers(blt, batch->count - i);
+		items[count].blt = blt;
+		items[count].layers = layers;
+		items[count].index = count;
+		items[count].err = BVERR_NONE;
+		pixels += (unsigned long)blt->width * blt->height * layers;
+		prev = layers > 1 ? NULL : blt;
+		count++;
+	}
+	batch->count = 0;
+
+	pairs = (unsigned long)count * (count - 1) / 2;
+	if (bvcpu_ncpus < 2 || count < 2 || pixels < BVCPU_BATCH_PARMIN ||
+	    pixels < pairs * BVCPU_BATCH_PAIRPIXELS) {
+		for (i = 0; i < count; i++)
+			items[i].err = bvcpu_execute(items[i].blt,
+						     items[i].layers);
+	} else {
+		bvcpu_batchlevels(items, count);
+		for (i = 0; i < count; i = j) {
+			for (j = i + 1; j < count; j++)
+				if (items[j].level != items[i].level)
+					break;
+			lv.items = &items[i];
+			lv.count = j - i;
+			lv.next = 0;
+			bvcpu_poolrun(bvcpu_batchworker, &lv, lv.count);
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		if (items[i].err != BVERR_NONE &&
+		    (!first || items[i].index < first->index))
+			first = &items[i];
+	if (first && batch->err == BVERR_NONE) {
+		batch->err = first->err;
+		batch->errdesc = first->blt->params->errdesc;
+	}
+}
+
+/*
+ * bvcpu_batchadd() - Validate a BLT and add it to the batch.  changed holds
+ * the BVBATCH_* flags naming what differs from the previous BLT.
+ */
+static enum bverror bvcpu_batchadd(struct bvbatch *batch,
+				   struct bvbltparams *params,
+				   unsigned long changed)
+{
+	struct bvcpu_batchstate *st = batch->states;
+	struct bvcpu_blt *blt;
+	enum bverror err;
+
+	/* BVBATCH_TILE_MASK has the value of BVBATCH_CLIPRECT_ORIGIN */
+	if (!batch->valid || (changed & ~BVCPU_BATCH_REMAP) ||
+	    ((params->flags & BVFLAG_TILE_MASK) &&
+	     (changed & BVBATCH_TILE_MASK)) ||
+	    ((params->flags ^ st->blt.flags) & BVCPU_BATCH_SAMEFLAGS)) {
+		err = bvcpu_batchstate(batch, params);
+		if (err != BVERR_NONE)
+			return err;
+		st = batch->states;
+	}
+
+	if (batch->count == BVCPU_BATCH_MAXBLTS) {
+		bvcpu_asyncwait();
+		bvcpu_batchrun(batch);
+	}
+	if (batch->count == batch->size) {
+		unsigned int size = batch->size ?
+			batch->size * 2 : BVCPU_BATCH_MINBLTS;
+		blt = realloc(batch->blts, size * sizeof(*blt));
+		if (!blt)
+			return bvcpu_err(params, BVERR_OOM,
+					 "out of memory for batch");
+		batch->blts = blt;
+		batch->size = size;
+	}
+
+	blt = &batch->blts[batch->count];
+	*blt = st->blt;
+	err = bvcpu_validaterects(params, blt);
+	if (err != BVERR_NONE || !blt->width || !blt->height ||
+	    (params->flags & BVFLAG_TESTPARAMS_NOP))
+		return err;
+	blt->params = &st->params;
+	batch->count++;
+	return BVERR_NONE;
+}
+
+static void bvcpu_batchfree(struct bvbatch *batch)
+{
+	struct bvcpu_batchstate *st;
+
+	while ((st = batch->states) != NULL) {
+		batch->states = st->next;
+		bvcpu_drop(&st->blt);
+		free(st);
+	}
+	free(batch->blts);
+	free(batch);
+}
+
+/*
+ * bvcpu_batchasync() - Run a batch ended with BVFLAG_ASYNC, from the
+ * asynchronous engine.
+ */
+static void bvcpu_batchasync(struct bvcpu_async *job)
+{
+	struct bvbatch *batch = (struct bvbatch *)job;
+
+	bvcpu_batchrun(batch);
+	job->err = batch->err;
+	job->errdesc = batch->errdesc;
+}
+
+static void bvcpu_batchrelease(struct bvcpu_async *job)
+{
+	bvcpu_batchfree((struct bvbatch *)job);
+}
+
+enum bverror bvcpu_batch(struct bvbltparams *params)
+{
+	unsigned long op = params->flags & BVFLAG_BATCH_MASK;
+	unsigned long changed = params->batchflags;
+	struct bvbatch *batch;
+	enum bverror err;
+
+	if (op == BVFLAG_BATCH_BEGIN) {
+		batch = malloc(sizeof(*batch));
+		params->batch = batch;
+		if (!batch)
+			return bvcpu_err(params, BVERR_OOM,
+					 "out of memory for batch");
+		memset(batch, 0, offsetof(struct bvbatch, items));
+		err = bvcpu_batchadd(batch, params, 0);
+		if (err != BVERR_NONE) {
+			/* no batch was begun, so none will be ended */
+			bvcpu_batchfree(batch);
+			params->batch = NULL;
+		}
+		return err;
+	}
+
+	batch = params->batch;
+	if (!batch)
+		return bvcpu_err(params, BVERR_BATCH,
+				 "bvbltparams.batch required");
+	if ((changed & ~(unsigned long)BVCPU_BATCH_SUPPORTED) ||
+	    ((changed & BVBATCH_ENDNOP) && op != BVFLAG_BATCH_END))
+		err = bvcpu_err(params, BVERR_BATCH_FLAGS,
+				"bvbltparams.batchflags not supported");
+	else if (changed & BVBATCH_ENDNOP)
+		err = BVERR_NONE;
+	else
+		err = bvcpu_batchadd(batch, params, changed);
+	if (op != BVFLAG_BATCH_END)
+		return err;
+
+	/*
+	 * The batch ends even if its last BLT was rejected.  Only the
+	 * callback of the BLT ending the batch is called.
+	 */
+	if (params->flags & BVFLAG_ASYNC) {
+		batch->async.run = bvcpu_batchasync;
+		batch->async.release = bvcpu_batchrelease;
+		batch->async.callbackfn = params->callbackfn;
+		batch->async.callbackdata = params->callbackdata;
+		bvcpu_asyncsubmit(&batch->async);
+		return err;
+	}
+
+	bvcpu_asyncwait();
+	bvcpu_batchrun(batch);
+	if (batch->err != BVERR_NONE && err == BVERR_NONE)
+		err = bvcpu_err(params, batch->err, batch->errdesc);
+	bvcpu_batchfree(batch);
+
+	return err;
+}
@@ -0,0 +1,1018 @@
+/*
+ * bvcpublend.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the blends (BVFLAG_BLEND).  The blend is decoded once
+ * by validation into a kernel and, for blends that need them, the K1-K4
+ * factors or the table of an essential blend.  Execution then works a line
+ * at a time: the sources are unpacked to premultiplied 0xAARRGGBB, blended,
+ * and packed into the destination.  Global and remote alpha are applied to
+ * source 1 inside the blend kernels, in the same pass.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * bvcpu_decodek() - Decode one 6-bit constant field.  Returns 0 for the
+ * combinations bvblend.h leaves undefined.
+ */
+static int bvcpu_decodek(unsigned int field, struct bvcpu_factor *k)
+{
+	unsigned int norm = (field & BVBLENDDEF_NORM_MASK) >>
+		BVBLENDDEF_NORM_SHIFT;
+	unsigned int inv = (field & BVBLENDDEF_INV_MASK) >>
+		BVBLENDDEF_INV_SHIFT;
+	int normok, invok;
+
+	k->x = (unsigned char)norm;
+	k->y = (unsigned char)inv;
+
+	switch (field & BVBLENDDEF_MODE_MASK) {
+	case BVBLENDDEF_ONLY_A:
+		if (field == BVBLENDDEF_ZERO) {
+			k->op = BVCPU_FOP_ZERO;
+			return 1;
+		}
+		/* only A1 (01) and A2 (11) are valid */
+		normok = norm & 1;
+		invok = inv & 1;
+		break;
+	case BVBLENDDEF_ONLY_C:
+		if (field == BVBLENDDEF_ONE) {
+			k->op = BVCPU_FOP_ONE;
+			return 1;
+		}
+		/* only C1 (00) and C2 (10) are valid */
+		normok = !(norm & 1);
+		invok = !(inv & 1);
+		break;
+	case BVBLENDDEF_MIN:
+		k->op = BVCPU_FOP_MIN;
+		return 1;
+	default:
+		k->op = BVCPU_FOP_MAX;
+		return 1;
+	}
+
+	if (normok == invok)
+		return 0;
+	k->op = normok ? BVCPU_FOP_NORM : BVCPU_FOP_INV;
+	return 1;
+}
+
+/*
+ * bvcpu_afactor() - Map a constant to BVCPU_AFACTORS, or -1 if it is not
+ * one of them.
+ */
+static int bvcpu_afactor(const struct bvcpu_factor *k)
+{
+	switch (k->op) {
+	case BVCPU_FOP_ZERO:
+		return BVCPU_AF_ZERO;
+	case BVCPU_FOP_ONE:
+		return BVCPU_AF_ONE;
+	case BVCPU_FOP_NORM:
+		if (k->x == BVBLENDDEF_NORM_A1)
+			return BVCPU_AF_A1;
+		if (k->x == BVBLENDDEF_NORM_A2)
+			return BVCPU_AF_A2;
+		break;
+	case BVCPU_FOP_INV:
+		if (k->y == BVBLENDDEF_NORM_A1)
+			return BVCPU_AF_IA1;
+		if (k->y == BVBLENDDEF_NORM_A2)
+			return BVCPU_AF_IA2;
+		break;
+	}
+	return -1;
+}
+
+/*
+ * bvcpu_kuses() - The sources a constant reads, as BVCPU_USES_SRC1/SRC2.
+ */
+static unsigned int bvcpu_kuses(const struct bvcpu_factor *k)
+{
+	unsigned int uses = 0;
+
+	switch (k->op) {
+	case BVCPU_FOP_MIN:
+	case BVCPU_FOP_MAX:
+		uses |= (k->y & 2) ? BVCPU_USES_SRC2 : BVCPU_USES_SRC1;
+		/* fall through */
+	case BVCPU_FOP_NORM:
+		uses |= (k->x & 2) ? BVCPU_USES_SRC2 : BVCPU_USES_SRC1;
+		break;
+	case BVCPU_FOP_INV:
+		uses |= (k->y & 2) ? BVCPU_USES_SRC2 : BVCPU_USES_SRC1;
+		break;
+	}
+	return uses;
+}
+
+/*
+ * bvcpu_globalalpha() - Convert the global alpha to 0 to 255.  The float
+ * form is converted once per BLT, so the kernels only see integers.
+ */
+static unsigned int bvcpu_globalalpha(const struct bvbltparams *params,
+				      unsigned long global)
+{
+	float fp;
+
+	switch (global) {
+	case BVBLENDDEF_GLOBAL_UCHAR:
+		return params->globalalpha.size8;
+	case BVBLENDDEF_GLOBAL_FLOAT:
+		fp = params->globalalpha.fp;
+		if (!(fp > 0.0f))
+			return 0;
+		if (fp >= 1.0f)
+			return 255;
+		return (unsigned int)(fp * 255.0f + 0.5f);
+	default:
+		return 255;
+	}
+}
+
+/*
+ * bvcpu_keeps() - Report whether a constant is 1 when source 1 is
+ * transparent, so that a transparent source 1 leaves source 2 alone.
+ */
+static int bvcpu_keeps(const struct bvcpu_factor *k)
+{
+	return k->op == BVCPU_FOP_ONE ||
+		(k->op == BVCPU_FOP_INV && !(k->y & 2));
+}
+
+static enum bverror bvcpu_classic(struct bvcpu_blt *blt, unsigned long op)
+{
+	struct bvbltparams *params = blt->params;
+	struct bvcpu_blend *blend = &blt->blend;
+	unsigned long global = op & BVBLENDDEF_GLOBAL_MASK;
+	int af[4];
+	int i, m;
+
+	if ((op & ~(unsigned long)(BVBLENDDEF_CLASSIC_EQUATION_MASK |
+				   BVBLENDDEF_REMOTE |
+				   BVBLENDDEF_GLOBAL_MASK)) ||
+	    global == (2 << BVBLENDDEF_GLOBAL_SHIFT))
+		return bvcpu_err(params, BVERR_BLEND, "invalid blend");
+
+	for (i = 0; i < 4; i++) {
+		unsigned int field = (op >> (18 - 6 * i)) & BVBLENDDEF_K_MASK;
+		if (!bvcpu_decodek(field, &blend->k[i]))
+			return bvcpu_err(params, BVERR_BLEND,
+					 "undefined blend constant");
+		af[i] = bvcpu_afactor(&blend->k[i]);
+	}
+
+	/* sources are read when their term is used or a constant needs them */
+	blt->uses = 0;
+	if (blend->k[0].op != BVCPU_FOP_ZERO ||
+	    blend->k[2].op != BVCPU_FOP_ZERO)
+		blt->uses |= BVCPU_USES_SRC1;
+	if (blend->k[1].op != BVCPU_FOP_ZERO ||
+	    blend->k[3].op != BVCPU_FOP_ZERO)
+		blt->uses |= BVCPU_USES_SRC2;
+	for (i = 0; i < 4; i++)
+		blt->uses |= bvcpu_kuses(&blend->k[i]);
+
+	/*
+	 * Global and remote alpha scale source 1, local alpha included,
+	 * before it is blended.  A global alpha of 0 makes source 1
+	 * transparent, and the mask is not needed.
+	 */
+	blend->mod = BVCPU_MOD_NONE;
+	blend->ga = bvcpu_globalalpha(params, global);
+	blend->keep2 = bvcpu_keeps(&blend->k[1]) && bvcpu_keeps(&blend->k[3]);
+	if (blt->uses & BVCPU_USES_SRC1) {
+		if (blend->ga && blend->ga != 255)
+			blend->mod |= BVCPU_MOD_GLOBAL;
+		if ((op & BVBLENDDEF_REMOTE) && blend->ga) {
+			blend->mod |= BVCPU_MOD_REMOTE;
+			blt->uses |= BVCPU_USES_MASK;
+		}
+	}
+
+	if (af[0] >= 0 && af[1] >= 0 && af[2] == af[0] && af[3] == af[1]) {
+		for (m = 0; m < BVCPU_MOD_COUNT; m++)
+			blend->fn[m] = bvcpu_kern->blend[(m * BVCPU_AF_COUNT +
+							  af[0]) *
+							 BVCPU_AF_COUNT + af[1]];
+		blend->generic = 0;
+	} else {
+		for (m = 0; m < BVCPU_MOD_COUNT; m++)
+			blend->fn[m] = bvcpu_kern->blendk;
+		blend->generic = 1;
+	}
+
+	return BVERR_NONE;
+}
+
+/*
+ * The essential modes are numbered in the order of BVCPU_ESSENTIALS.
+ */
+#define BVCPU_ESSCHECK(m) \
+	_Static_assert(BVBLEND_##m == \
+		       BVBLENDDEF_FORMAT_ESSENTIAL + BVCPU_ESS_##m, \
+		       "BVCPU_ESSENTIALS out of order");
+BVCPU_ESSENTIALS(BVCPU_ESSCHECK)
+#undef BVCPU_ESSCHECK
+
+/*
+ * B() of the modes in BVCPU_ESSLUT, as defined by the BLTsville
+ * documentation.
+ */
+static unsigned int bvcpu_dodge(unsigned int a, unsigned int b)
+{
+	unsigned int r;
+
+	if (b == 255)
+		return b;
+	r = (a << 8) / (255 - b);
+	return r > 255 ? 255 : r;
+}
+
+static unsigned int bvcpu_burn(unsigned int a, unsigned int b)
+{
+	unsigned int r;
+
+	if (b == 0)
+		return b;
+	r = ((255 - a) << 8) / b;
+	return r > 255 ? 0 : 255 - r;
+}
+
+static unsigned int bvcpu_vivid(unsigned int a, unsigned int b)
+{
+	return b < 128 ? bvcpu_burn(a, 2 * b) : bvcpu_dodge(a, 2 * (b - 128));
+}
+
+static unsigned int bvcpu_reflect(unsigned int a, unsigned int b)
+{
+	unsigned int r;
+
+	if (b == 255)
+		return b;
+	r = a * a / (255 - b);
+	return r > 255 ? 255 : r;
+}
+
+static unsigned int bvcpu_softlight(unsigned int a, unsigned int b)
+{
+	unsigned int m = (a >> 1) + 64;
+	float r;
+
+	if (b < 128)
+		r = 2 * m * ((float)b / 255);
+	else
+		r = 255 - 2 * (255 - m) * ((float)(255 - b) / 255);
+	return r >= 255 ? 255 : (unsigned int)(r + 0.5f);
+}
+
+static unsigned int bvcpu_essb(int mode, unsigned int a, unsigned int b)
+{
+	switch (mode) {
+	case BVCPU_ESS_SOFT_LIGHT:
+		return bvcpu_softlight(a, b);
+	case BVCPU_ESS_COLOR_DODGE:
+		return bvcpu_dodge(a, b);
+	case BVCPU_ESS_COLOR_BURN:
+		return bvcpu_burn(a, b);
+	case BVCPU_ESS_VIVID_LIGHT:
+		return bvcpu_vivid(a, b);
+	case BVCPU_ESS_HARD_MIX:
+		return bvcpu_vivid(a, b) < 128 ? 0 : 255;
+	case BVCPU_ESS_REFLECT:
+		return bvcpu_reflect(a, b);
+	default:
+		return bvcpu_reflect(b, a);	/* GLOW */
+	}
+}
+
+/*
+ * bvcpu_esslut() - Get the table of B(src1, src2) for a mode, building it
+ * on first use.  Tables are never freed.
+ */
+static const unsigned char *bvcpu_esslut(int mode)
+{
+	static unsigned char *luts[BVCPU_ESS_COUNT];
+	unsigned char *lut = __atomic_load_n(&luts[mode], __ATOMIC_ACQUIRE);
+	unsigned char *prev = NULL;
+	unsigned int a, b;
+
+	if (lut)
+		return lut;
+
+	lut = malloc(256 * 256);
+	if (!lut)
+		return NULL;
+	for (a = 0; a < 256; a++)
+		for (b = 0; b < 256; b++)
+			lut[a * 256 + b] = (unsigned char)bvcpu_essb(mode, a, b);
+
+	if (!__atomic_compare_exchange_n(&luts[mode], &prev, lut, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(lut);
+		lut = prev;
+	}
+	return lut;
+}
+
+static enum bverror bvcpu_essential(struct bvcpu_blt *blt, unsigned long op)
+{
+	struct bvcpu_blend *blend = &blt->blend;
+	unsigned long mode = op & ((1UL << BVBLENDDEF_FORMAT_SHIFT) - 1);
+
+	if (mode >= BVCPU_ESS_COUNT)
+		return bvcpu_err(blt->params, BVERR_BLEND, "invalid blend");
+
+	blt->uses = BVCPU_USES_SRC1 | BVCPU_USES_SRC2;
+	blend->ga = 255;
+	blend->essential = &bvcpu_kern->essential[mode * 2];
+	if (BVCPU_ESSLUT(mode)) {
+		blend->lut = bvcpu_esslut((int)mode);
+		if (!blend->lut)
+			return bvcpu_err(blt->params, BVERR_OOM,
+					 "out of memory for blend table");
+	}
+
+	return BVERR_NONE;
+}
+
+enum bverror bvcpu_blendvalidate(struct bvcpu_blt *blt)
+{
+	unsigned long op = (unsigned long)blt->params->op.blend;
+
+	switch (op >> BVBLENDDEF_FORMAT_SHIFT) {
+	case BVBLENDDEF_FORMAT_CLASSIC >> BVBLENDDEF_FORMAT_SHIFT:
+		return bvcpu_classic(blt, op);
+	case BVBLENDDEF_FORMAT_ESSENTIAL >> BVBLENDDEF_FORMAT_SHIFT:
+		return bvcpu_essential(blt, op);
+	default:
+		return bvcpu_err(blt->params, BVERR_BLEND,
+				 "blend format not supported");
+	}
+}
+
+/*
+ * bvcpu_direct() - Report whether a surface can be used by the kernels in
+ * place, without unpacking or packing.
+ */
+static int bvcpu_direct(const struct bvcpu_surf *surf, int x, int y)
+{
+	return (surf->fmt->flags & BVCPU_FMT_NATIVE) &&
+		!(surf->stride & 3) &&
+		!((unsigned long)bvcpu_pixaddr(surf, x, y) & 3);
+}
+
+/*
+ * bvcpu_blendsrc - Line source for one blend input.  row is 0 when the
+ * input is read in place.
+ */
+struct bvcpu_blendsrc {
+	const struct bvcpu_input *in;
+	unsigned int *row;
+};
+
+/*
+ * bvcpu_blendfetch() - Get a line of a source, premultiplied.  If u is not
+ * 0, it also receives the line unpremultiplied.
+ */
+static const unsigned int *bvcpu_blendfetch(struct bvcpu_blt *blt,
+					    struct bvcpu_blendsrc *src, int y,
+					    unsigned int *u)
+{
+	const struct bvcpu_input *in = src->in;
+	const struct bvcpu_format *fmt = in->surf.fmt;
+	const unsigned char *p;
+	unsigned int n = blt->width;
+	const unsigned int *row;
+
+	if (in->scaler) {
+		row = bvcpu_scaleline(in, y);
+		if (u) {
+			memcpy(u, row, n * 4);
+			bvcpu_unpremultiply(u, n);
+		}
+		return row;
+	}
+
+	p = bvcpu_pixaddr(&in->surf, in->x, in->y + y);
+	row = (const unsigned int *)p;
+	if (src->row) {
+		fmt->unpack(fmt, p, src->row, n);
+		row = src->row;
+		if (fmt->flags & BVCPU_FMT_NONPREMULT) {
+			if (u)
+				memcpy(u, row, n * 4);
+			bvcpu_premultiply(src->row, n);
+			return row;
+		}
+	}
+	if (u) {
+		memcpy(u, row, n * 4);
+		bvcpu_unpremultiply(u, n);
+	}
+	return row;
+}
+
+/*
+ * bvcpu_blendmask() - Get a line of the remote alpha, one byte per pixel.
+ * ALPHA8 masks are read in place when row is 0; tmp is set when the mask
+ * needs unpacking.
+ */
+static const unsigned char *bvcpu_blendmask(struct bvcpu_blt *blt, int y,
+					    unsigned char *row,
+					    unsigned int *tmp)
+{
+	const struct bvcpu_input *in = &blt->mask;
+	const struct bvcpu_format *fmt = in->surf.fmt;
+	const unsigned int *line = tmp;
+	const unsigned char *p;
+	unsigned int i;
+
+	if (in->scaler) {
+		line = bvcpu_scaleline(in, y);
+	} else {
+		p = bvcpu_pixaddr(&in->surf, in->x, in->y + y);
+		if (!row)
+			return p;
+		if (!tmp) {
+			memcpy(row, p, blt->width);
+			return row;
+		}
+		fmt->unpack(fmt, p, tmp, blt->width);
+	}
+	for (i = 0; i < blt->width; i++)
+		row[i] = (unsigned char)BVCPU_A(line[i]);
+	return row;
+}
+
+/*
+ * Runs of remote alpha are classified BVCPU_SPANCHUNK pixels at a time, so
+ * that transparent and opaque parts of the mask avoid the modulation.
+ */
+#define BVCPU_SPANCHUNK		32
+
+#define BVCPU_SPAN_CLEAR	0
+#define BVCPU_SPAN_OPAQUE	1
+#define BVCPU_SPAN_MIXED	2
+
+static int bvcpu_spankind(const unsigned char *ar, unsigned int n)
+{
+	unsigned long long any = 0, all = ~0ULL, w;
+	unsigned int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&w, ar + i, 8);
+		any |= w;
+		all &= w;
+	}
+	for (; i < n; i++) {
+		any |= ar[i];
+		all &= ar[i] | ~0xFFULL;
+	}
+
+	if (!any)
+		return BVCPU_SPAN_CLEAR;
+	if (all == ~0ULL)
+		return BVCPU_SPAN_OPAQUE;
+	return BVCPU_SPAN_MIXED;
+}
+
+/*
+ * bvcpu_blendspans() - Blend a line with remote alpha.  Transparent spans
+ * blend a transparent source 1, or are skipped when that leaves the
+ * destination as it is, and opaque spans drop the remote alpha.
+ */
+static void bvcpu_blendspans(struct bvcpu_blt *blt, unsigned int *dst,
+			     const unsigned int *src1,
+			     const unsigned int *src2,
+			     const unsigned char *ar, const unsigned int *zero,
+			     int keep)
+{
+	const struct bvcpu_blend *blend = &blt->blend;
+	unsigned int n = blt->width;
+	unsigned int x = 0, e, c;
+	int kind, next;
+
+	kind = bvcpu_spankind(ar, n < BVCPU_SPANCHUNK ? n : BVCPU_SPANCHUNK);
+	while (x < n) {
+		e = x;
+		next = kind;
+		do {
+			c = n - e < BVCPU_SPANCHUNK ? n - e : BVCPU_SPANCHUNK;
+			e += c;
+			if (e < n) {
+				c = n - e < BVCPU_SPANCHUNK ?
+					n - e : BVCPU_SPANCHUNK;
+				next = bvcpu_spankind(ar + e, c);
+			}
+		} while (e < n && next == kind);
+
+		switch (kind) {
+		case BVCPU_SPAN_CLEAR:
+			if (!keep)
+				blend->fn[BVCPU_MOD_NONE](dst + x, zero + x,
+							  src2 + x, NULL, NULL,
+							  255, e - x);
+			break;
+		case BVCPU_SPAN_OPAQUE:
+			blend->fn[blend->mod & BVCPU_MOD_GLOBAL](
+				dst + x, src1 + x, src2 + x, NULL, NULL,
+				blend->ga, e - x);
+			break;
+		default:
+			blend->fn[blend->mod](dst + x, src1 + x, src2 + x,
+					      NULL, ar + x, blend->ga, e - x);
+			break;
+		}
+
+		x = e;
+		kind = next;
+	}
+}
+
+enum bverror bvcpu_blend(struct bvcpu_blt *blt)
+{
+	struct bvcpu_blend *blend = &blt->blend;
+	const struct bvcpu_format *dfmt = blt->dst.fmt;
+	unsigned long rowsize = BVCPU_ROWSIZE((unsigned long)blt->width * 4);
+	struct bvcpu_blendsrc src[2] = { { 0 } };
+	unsigned int *alpha[2] = { NULL, NULL };
+	unsigned int *krow[4] = { NULL, NULL, NULL, NULL };
+	unsigned int *zero = NULL;
+	unsigned int *ones = NULL;
+	unsigned int *out = NULL;
+	unsigned int *mrow = NULL;
+	unsigned int *mtmp = NULL;
+	unsigned int *stage = NULL;
+	unsigned int nrows = 0;
+	unsigned int mod = blend->mod;
+	bvcpu_blendfn fn = blend->fn[mod];
+	int dstdirect;
+	int keep = 0;
+	int bottomup = 0;
+	unsigned char *scratch;
+	enum bverror err;
+	unsigned int i, n;
+	int y, yend, ystep;
+
+	/*
+	 * Lines are blended straight into destinations in the internal
+	 * format, and otherwise into a line that is packed into the
+	 * destination; or, for error diffusion, into a buffer holding the
+	 * whole BLT.
+	 */
+	dstdirect = bvcpu_direct(&blt->dst, blt->dstx, blt->dsty);
+	if (blt->dither == BVCPU_DITHER_DIFFUSED) {
+		stage = malloc((size_t)blt->width * blt->height * 4);
+		if (!stage)
+			return bvcpu_err(blt->params, BVERR_OOM,
+					 "out of memory for error diffusion");
+	} else if (!dstdirect) {
+		nrows++;
+	}
+
+	/*
+	 * Sources are read in place when they are already in the internal
+	 * format, unless they overlap the destination anywhere but at the
+	 * same pixels.  A source 1 made transparent by the global alpha is
+	 * not read at all.
+	 */
+	if ((blt->uses & BVCPU_USES_SRC1) && blend->ga)
+		src[0].in = &blt->src1;
+	if (blt->uses & BVCPU_USES_SRC2)
+		src[1].in = &blt->src2;
+	for (i = 0; i < 2; i++) {
+		const struct bvcpu_input *in = src[i].in;
+		int hazard;
+		if (!in) {
+			zero = (unsigned int *)1;
+			continue;
+		}
+		if (in->scaler)
+			continue;
+		hazard = bvcpu_hazard(blt, in);
+		if (hazard < 0)
+			bottomup = 1;
+		if (!bvcpu_direct(&in->surf, in->x, in->y) ||
+		    (hazard && (!dstdirect ||
+				in->surf.stride != blt->dst.stride ||
+				bvcpu_pixaddr(&in->surf, in->x, in->y) !=
+				bvcpu_pixaddr(&blt->dst, blt->dstx,
+					      blt->dsty)))) {
+			src[i].row = (unsigned int *)1;
+			nrows++;
+		} else if (i == 1 && hazard) {
+			keep = blend->keep2;
+		}
+	}
+
+	/* the generic kernels take source 1 already modulated */
+	if (blend->generic && mod != BVCPU_MOD_NONE && !src[0].row) {
+		src[0].row = (unsigned int *)1;
+		nrows++;
+	}
+
+	/* nothing to do if source 1 is transparent and source 2 stays */
+	if (!src[0].in && keep && !blend->essential) {
+		free(stage);
+		return BVERR_NONE;
+	}
+
+	/*
+	 * The remote alpha is read in place from ALPHA8 masks that do not
+	 * overlap the destination and are not scaled, and extracted into a
+	 * line of bytes otherwise.  Transparent spans need a transparent
+	 * source 1.
+	 */
+	if (mod & BVCPU_MOD_REMOTE) {
+		const struct bvcpu_input *in = &blt->mask;
+		int hazard = 0;
+		if (!in->scaler) {
+			hazard = bvcpu_hazard(blt, in);
+			if (hazard < 0)
+				bottomup = 1;
+			if (!(in->surf.fmt->flags & BVCPU_FMT_ALPHAONLY) ||
+			    in->surf.fmt->bpp != 1) {
+				mtmp = (unsigned int *)1;
+				nrows++;
+			}
+		}
+		if (in->scaler || mtmp || hazard) {
+			mrow = (unsigned int *)1;
+			nrows++;
+		}
+		if (!blend->generic)
+			zero = (unsigned int *)1;
+	}
+
+	/* the essential blends also need sources with alpha unpremultiplied */
+	if (blend->essential) {
+		int opaque = 1;
+		for (i = 0; i < 2; i++) {
+			if (src[i].in->surf.fmt->flags & BVCPU_FMT_ALPHA) {
+				krow[i] = (unsigned int *)1;
+				nrows++;
+				opaque = 0;
+			}
+		}
+		fn = blend->essential[opaque];
+	}
+
+	if (blend->generic) {
+		for (i = 0; i < 4; i++) {
+			const struct bvcpu_factor *k = &blend->k[i];
+			switch (k->op) {
+			case BVCPU_FOP_ZERO:
+				zero = (unsigned int *)1;
+				break;
+			case BVCPU_FOP_ONE:
+				ones = (unsigned int *)1;
+				break;
+			case BVCPU_FOP_NORM:
+				if (k->x & 1)
+					alpha[k->x >> 1] = (unsigned int *)1;
+				break;
+			default:
+				if (k->op != BVCPU_FOP_INV && (k->x & 1))
+					alpha[k->x >> 1] = (unsigned int *)1;
+				if (k->y & 1)
+					alpha[k->y >> 1] = (unsigned int *)1;
+				krow[i] = (unsigned int *)1;
+				nrows++;
+				break;
+			}
+		}
+		nrows += !!alpha[0] + !!alpha[1] + !!ones;
+	}
+	nrows += !!zero;
+
+	scratch = NULL;
+	if (nrows) {
+		unsigned char *next;
+		scratch = aligned_alloc(BVCPU_ROWALIGN, nrows * rowsize);
+		if (!scratch) {
+			free(stage);
+			return bvcpu_err(blt->params, BVERR_OOM,
+					 "out of memory for line buffers");
+		}
+		next = scratch;
+#define BVCPU_TAKEROW(p) \
+		do { \
+			if (p) { \
+				(p) = (unsigned int *)next; \
+				next += rowsize; \
+			} \
+		} while (0)
+		if (!dstdirect && !stage)
+			out = (unsigned int *)1;
+		BVCPU_TAKEROW(out);
+		BVCPU_TAKEROW(src[0].row);
+		BVCPU_TAKEROW(src[1].row);
+		BVCPU_TAKEROW(alpha[0]);
+		BVCPU_TAKEROW(alpha[1]);
+		for (i = 0; i < 4; i++)
+			BVCPU_TAKEROW(krow[i]);
+		BVCPU_TAKEROW(zero);
+		BVCPU_TAKEROW(ones);
+		BVCPU_TAKEROW(mrow);
+		BVCPU_TAKEROW(mtmp);
+#undef BVCPU_TAKEROW
+		if (zero)
+			memset(zero, 0x00, blt->width * 4);
+		if (ones)
+			memset(ones, 0xFF, blt->width * 4);
+	}
+
+	/* keyed lines are put back once diffused, so all are kept */
+	err = bvcpu_keystart(blt, stage ? blt->height : 1);
+	if (err != BVERR_NONE) {
+		free(scratch);
+		free(stage);
+		return err;
+	}
+
+	if (bottomup) {
+		y = (int)blt->height - 1;
+		yend = -1;
+		ystep = -1;
+	} else {
+		y = 0;
+		yend = (int)blt->height;
+		ystep = 1;
+	}
+
+	n = blt->width;
+	for (; y != yend; y += ystep) {
+		unsigned char *d = bvcpu_pixaddr(&blt->dst, blt->dstx,
+						 blt->dsty + y);
+		const unsigned int *s[2] = { zero, zero };
+		const unsigned int *k[4] = { NULL, NULL, NULL, NULL };
+		const unsigned char *ar = NULL;
+		unsigned int *o = dstdirect ? (unsigned int *)d : out;
+
+		if (stage)
+			o = stage + (unsigned long)y * n;
+		bvcpu_keyget(blt, y, stage ? (unsigned int)y : 0);
+
+		for (i = 0; i < 2; i++)
+			if (src[i].in)
+				s[i] = bvcpu_blendfetch(blt, &src[i], y,
+							blend->essential ?
+							krow[i] : NULL);
+		if (mod & BVCPU_MOD_REMOTE)
+			ar = bvcpu_blendmask(blt, y, (unsigned char *)mrow,
+					     mtmp);
+
+		if (blend->essential) {
+			k[0] = krow[0] ? krow[0] : s[0];
+			k[1] = krow[1] ? krow[1] : s[1];
+			k[2] = (const unsigned int *)blend->lut;
+		}
+
+		if (blend->generic) {
+			/* lines indexed by the BVBLENDDEF_NORM_* encoding */
+			const unsigned int *in[4];
+			if (mod != BVCPU_MOD_NONE) {
+				bvcpu_kern->kmod(src[0].row, s[0], ar,
+						 blend->ga, n);
+				s[0] = src[0].row;
+			}
+			in[0] = s[0];
+			in[1] = alpha[0];
+			in[2] = s[1];
+			in[3] = alpha[1];
+			for (i = 0; i < 2; i++)
+				if (alpha[i])
+					bvcpu_kern->kalpha(alpha[i], s[i], NULL,
+							   n);
+			for (i = 0; i < 4; i++) {
+				const struct bvcpu_factor *f = &blend->k[i];
+				switch (f->op) {
+				case BVCPU_FOP_ZERO:
+					k[i] = zero;
+					break;
+				case BVCPU_FOP_ONE:
+					k[i] = ones;
+					break;
+				case BVCPU_FOP_NORM:
+					k[i] = in[f->x];
+					break;
+				case BVCPU_FOP_INV:
+					bvcpu_kern->kinv(krow[i], NULL,
+							 in[f->y], n);
+					k[i] = krow[i];
+					break;
+				case BVCPU_FOP_MIN:
+					bvcpu_kern->kmin(krow[i], in[f->x],
+							 in[f->y], n);
+					k[i] = krow[i];
+					break;
+				default:
+					bvcpu_kern->kmax(krow[i], in[f->x],
+							 in[f->y], n);
+					k[i] = krow[i];
+					break;
+				}
+			}
+			fn(o, s[0], s[1], k, NULL, 255, n);
+		} else if (mod & BVCPU_MOD_REMOTE) {
+			bvcpu_blendspans(blt, o, s[0], s[1], ar, zero, keep);
+		} else {
+			fn(o, s[0], s[1], k, NULL, blend->ga, n);
+		}
+
+		if (!dstdirect && !stage) {
+			if (dfmt->flags & BVCPU_FMT_NONPREMULT)
+				bvcpu_unpremultiply(o, n);
+			bvcpu_pack(dfmt, o, d, n, bvcpu_ditherbias(blt, y));
+		}
+		if (!stage)
+			bvcpu_keyput(blt, y, 0);
+	}
+
+	free(scratch);
+
+	if (stage) {
+		err = bvcpu_diffuse(dfmt, stage,
+				    bvcpu_pixaddr(&blt->dst, blt->dstx,
+						  blt->dsty),
+				    blt->dst.stride, blt->width, blt->height, 0);
+		free(stage);
+		if (err != BVERR_NONE) {
+			bvcpu_keyend(blt);
+			return bvcpu_err(blt->params, err,
+					 "out of memory for error diffusion");
+		}
+		for (y = 0; y < (int)blt->height; y++)
+			bvcpu_keyput(blt, y, (unsigned int)y);
+	}
+
+	bvcpu_keyend(blt);
+	return BVERR_NONE;
+}
+
+/*
+ * Layers.  A stack of layers is composited by a chain of BLTs blending
+ * source 1 over the destination, each reading back what the one before
+ * wrote.  When the destination gives back exactly the pixels written to
+ * it, a line can be carried from one layer to the next without being
+ * written and read again, so the chain reads each layer once and writes
+ * the destination once, with the same result.
+ */
+
+/*
+ * bvcpu_blendapart() - Report whether an input shares no bytes with the
+ * region of the destination written.
+ */
+static int bvcpu_blendapart(const struct bvcpu_blt *blt,
+			    const struct bvcpu_input *in)
+{
+	struct bvrect dr = {
+		blt->dstx, blt->dsty, blt->width, blt->height
+	};
+	struct bvrect box;
+
+	bvcpu_readbox(blt, in, &box);
+	return !bvcpu_overlap(&in->surf, &box, &blt->dst, &dr);
+}
+
+/*
+ * bvcpu_blendover() - Report whether a BLT blends source 1 over source 2,
+ * with at most a global alpha, into a format that keeps 8 bits of each
+ * premultiplied component, and without reading source 1 from the region
+ * it writes.
+ */
+static int bvcpu_blendover(const struct bvcpu_blt *blt)
+{
+	unsigned long op = (unsigned long)blt->params->op.blend;
+
+	return (blt->flags & (BVFLAG_OP_MASK | BVFLAG_KEY_SRC |
+			      BVFLAG_KEY_DST)) == BVFLAG_BLEND &&
+		(op & ~(unsigned long)BVBLENDDEF_GLOBAL_MASK) ==
+		BVBLEND_SRC1OVER &&
+		blt->blend.ga &&
+		(blt->dst.fmt->flags & (BVCPU_FMT_ALPHA |
+					BVCPU_FMT_NONPREMULT |
+					BVCPU_FMT_ALPHAONLY |
+					BVCPU_FMT_REDUCED)) ==
+		BVCPU_FMT_ALPHA &&
+		bvcpu_blendapart(blt, &blt->src1);
+}
+
+int bvcpu_blendlayer(const struct bvcpu_blt *base,
+		     const struct bvcpu_blt *blt)
+{
+	if (blt->dstx != base->dstx || blt->dsty != base->dsty ||
+	    blt->width != base->width || blt->height != base->height ||
+	    blt->dst.virtaddr != base->dst.virtaddr ||
+	    blt->dst.stride != base->dst.stride ||
+	    blt->dst.fmt != base->dst.fmt)
+		return 0;
+	return bvcpu_blendover(blt) && bvcpu_inplace(blt, &blt->src2) &&
+		bvcpu_blendover(base) &&
+		(bvcpu_inplace(base, &base->src2) ||
+		 bvcpu_blendapart(base, &base->src2));
+}
+
+enum bverror bvcpu_blendlayers(struct bvcpu_blt *blts, unsigned int count)
+{
+	struct bvcpu_blt *base = &blts[0];
+	const struct bvcpu_format *dfmt = base->dst.fmt;
+	unsigned long rowsize = BVCPU_ROWSIZE((unsigned long)base->width * 4);
+	const unsigned int *const k[4] = { NULL, NULL, NULL, NULL };
+	struct bvcpu_blendsrc under = { &base->src2, NULL };
+	struct bvcpu_blendsrc src[BVCPU_MAXLAYERS];
+	unsigned int *out = NULL;
+	unsigned int *row = NULL;
+	unsigned char *scratch = NULL;
+	unsigned int nrows = 0;
+	unsigned int n = base->width;
+	int dstdirect;
+	unsigned int i;
+	int y;
+
+	/*
+	 * The layers are blended into the destination when it is in the
+	 * internal format, and otherwise into a line packed into it.  The
+	 * layers which need unpacking share one line, as each is blended as
+	 * soon as it is read.
+	 */
+	dstdirect = bvcpu_direct(&base->dst, base->dstx, base->dsty);
+	if (!dstdirect)
+		out = (unsigned int *)1;
+	if (!under.in->scaler &&
+	    !bvcpu_direct(&under.in->surf, under.in->x, under.in->y))
+		under.row = (unsigned int *)1;
+	for (i = 0; i < count; i++) {
+		const struct bvcpu_input *in = &blts[i].src1;
+		src[i].in = in;
+		src[i].row = NULL;
+		if (!in->scaler && !bvcpu_direct(&in->surf, in->x, in->y))
+			src[i].row = row = (unsigned int *)1;
+	}
+	nrows = !!out + !!under.row + !!row;
+
+	if (nrows) {
+		unsigned char *next;
+		scratch = aligned_alloc(BVCPU_ROWALIGN, nrows * rowsize);
+		if (!scratch)
+			return bvcpu_err(base->params, BVERR_OOM,
+					 "out of memory for line buffers");
+		next = scratch;
+#define BVCPU_TAKEROW(p) \
+		do { \
+			if (p) { \
+				(p) = (unsigned int *)next; \
+				next += rowsize; \
+			} \
+		} while (0)
+		BVCPU_TAKEROW(out);
+		BVCPU_TAKEROW(under.row);
+		BVCPU_TAKEROW(row);
+#undef BVCPU_TAKEROW
+	}
+	for (i = 0; i < count; i++)
+		if (src[i].row)
+			src[i].row = row;
+
+	for (y = 0; y < (int)base->height; y++) {
+		unsigned char *d = bvcpu_pixaddr(&base->dst, base->dstx,
+						 base->dsty + y);
+		unsigned int *o = dstdirect ? (unsigned int *)d : out;
+		const unsigned int *s2;
+
+		s2 = bvcpu_blendfetch(base, &under, y, NULL);
+		for (i = 0; i < count; i++) {
+			const struct bvcpu_blend *blend = &blts[i].blend;
+			const unsigned int *s1;
+
+			s1 = bvcpu_blendfetch(&blts[i], &src[i], y, NULL);
+			blend->fn[blend->mod](o, s1, i ? o : s2, k, NULL,
+					      blend->ga, n);
+		}
+
+		if (!dstdirect)
+			bvcpu_pack(dfmt, o, d, n, NULL);
+	}
+
+	free(scratch);
+	return BVERR_NONE;
+}
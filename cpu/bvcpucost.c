@@ -0,0 +1,528 @@
+/*
+ * bvcpucost.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the cost model used to resolve the implicit scale and
+ * dither modes.  Each candidate algorithm has a quality rank, which depends
+ * on the type of image, and a cost, predicted from the throughput of the
+ * kernels it runs.  The quality requested sets a budget between the cost
+ * of the cheapest candidate and that of the best one, and the best
+ * candidate within the budget is used.
+ *
+ * The throughputs are measured on the kernels selected for this CPU the
+ * first time an implicit mode is resolved.  A file named by BVCPU_COSTS can
+ * supply them instead, one "name value..." line per entry:
+ *
+ *   scaleh <ns per output pixel> <ns per output pixel per tap>
+ *   scalev <ns per output pixel> <ns per output pixel per tap>
+ *   scalenn <ns per output pixel>
+ *   pack16 <ns per pixel, packing a 16-bit format>
+ *   dither16 <ns per pixel, packing a 16-bit format with ordered dither>
+ *   diffuse16 <ns per pixel, packing a 16-bit format with error diffusion
+ *             on one CPU>
+ *
+ * Entries missing from the file are measured.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bvcpu.h"
+
+/*
+ * bvcpu_costtab - Kernel throughputs, in nanoseconds per output pixel.
+ * The filtering kernels cost base + pertap x taps.
+ */
+struct bvcpu_costtab {
+	double scaleh[2];		/* base, per tap */
+	double scalev[2];
+	double scalenn;
+	double pack16;
+	double dither16;
+	double diffuse16;		/* one thread */
+};
+
+/*
+ * bvcpu_costkeys - The entries of the table, by name in the BVCPU_COSTS
+ * file.
+ */
+#define BVCPU_COST_SCALEH	0
+#define BVCPU_COST_SCALEV	1
+#define BVCPU_COST_SCALENN	2
+#define BVCPU_COST_PACK16	3
+#define BVCPU_COST_DITHER16	4
+#define BVCPU_COST_DIFFUSE16	5
+#define BVCPU_COST_COUNT	6
+
+static const struct {
+	const char *name;
+	size_t offset;
+	int values;
+} bvcpu_costkeys[BVCPU_COST_COUNT] = {
+	{ "scaleh", offsetof(struct bvcpu_costtab, scaleh), 2 },
+	{ "scalev", offsetof(struct bvcpu_costtab, scalev), 2 },
+	{ "scalenn", offsetof(struct bvcpu_costtab, scalenn), 1 },
+	{ "pack16", offsetof(struct bvcpu_costtab, pack16), 1 },
+	{ "dither16", offsetof(struct bvcpu_costtab, dither16), 1 },
+	{ "diffuse16", offsetof(struct bvcpu_costtab, diffuse16), 1 },
+};
+
+static struct bvcpu_costtab bvcpu_costs;
+static pthread_once_t bvcpu_costonce = PTHREAD_ONCE_INIT;
+
+#define BVCPU_COSTPIX	1024		/* pixels per timed call */
+#define BVCPU_COSTRUNS	5		/* the fastest run is kept */
+#define BVCPU_COSTTAPS	8		/* largest tap count timed */
+
+static double bvcpu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * bvcpu_timescale() - Time one scaling kernel on BVCPU_COSTPIX outputs,
+ * with taps taps, in nanoseconds per output pixel.  taps 0 times the
+ * nearest neighbor kernel.
+ */
+static double bvcpu_timescale(int vert, unsigned int taps,
+			      unsigned int *src, unsigned int *dst,
+			      int *start, short *w)
+{
+	const unsigned int *rows[BVCPU_COSTTAPS];
+	double best = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < BVCPU_COSTTAPS; i++)
+		rows[i] = src + i;
+
+	for (i = 0; i < BVCPU_COSTRUNS; i++) {
+		double t = bvcpu_now();
+		if (!taps)
+			bvcpu_kern->scalenn(dst, src, start, BVCPU_COSTPIX);
+		else if (vert)
+			bvcpu_kern->scalev(dst, rows, w, taps, BVCPU_COSTPIX);
+		else
+			bvcpu_kern->scaleh(dst, src, start, w, taps,
+					   BVCPU_COSTPIX);
+		t = bvcpu_now() - t;
+		if (!i || t < best)
+			best = t;
+	}
+
+	return best / BVCPU_COSTPIX;
+}
+
+/*
+ * bvcpu_fitscale() - Fit base + pertap x taps to the times for 2 and
+ * BVCPU_COSTTAPS taps.
+ */
+static void bvcpu_fitscale(int vert, double *fit, unsigned int *src,
+			   unsigned int *dst, int *start, short *w)
+{
+	double lo = bvcpu_timescale(vert, 2, src, dst, start, w);
+	double hi = bvcpu_timescale(vert, BVCPU_COSTTAPS, src, dst, start, w);
+
+	fit[1] = (hi - lo) / (BVCPU_COSTTAPS - 2);
+	if (fit[1] < 0.0)
+		fit[1] = 0.0;
+	fit[0] = lo - 2.0 * fit[1];
+	if (fit[0] < 0.0)
+		fit[0] = 0.0;
+}
+
+/*
+ * bvcpu_timepack() - Time packing BVCPU_COSTPIX pixels of RGB16, with or
+ * without ordered dithering, in nanoseconds per pixel.
+ */
+static double bvcpu_timepack(int dither, const unsigned int *src,
+			     unsigned int *dst)
+{
+	const struct bvcpu_format *fmt = bvcpu_getformat(OCDFMT_RGB16);
+	static const unsigned int bias[4] = {
+		0x00010001, 0x00050205, 0x00030103, 0x00070307
+	};
+	double best = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < BVCPU_COSTRUNS; i++) {
+		double t = bvcpu_now();
+		bvcpu_pack(fmt, src, (unsigned char *)dst, BVCPU_COSTPIX,
+			   dither ? bias : NULL);
+		t = bvcpu_now() - t;
+		if (!i || t < best)
+			best = t;
+	}
+
+	return best / BVCPU_COSTPIX;
+}
+
+/*
+ * bvcpu_timediffuse() - Time packing BVCPU_COSTPIX pixels of RGB16 with
+ * error diffusion on one thread, in nanoseconds per pixel.
+ */
+static double bvcpu_timediffuse(const unsigned int *src, unsigned int *dst)
+{
+	const struct bvcpu_format *fmt = bvcpu_getformat(OCDFMT_RGB16);
+	unsigned int w = BVCPU_COSTPIX / 4;
+	double best = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < BVCPU_COSTRUNS; i++) {
+		double t = bvcpu_now();
+		bvcpu_diffuse(fmt, src, (unsigned char *)dst, w * 2, w, 4, 1);
+		t = bvcpu_now() - t;
+		if (!i || t < best)
+			best = t;
+	}
+
+	return best / BVCPU_COSTPIX;
+}
+
+static void bvcpu_costmeasure(struct bvcpu_costtab *c, unsigned int have)
+{
+	unsigned int n = BVCPU_COSTPIX + BVCPU_COSTTAPS;
+	unsigned int *src = malloc(n * sizeof(*src));
+	unsigned int *dst = malloc(BVCPU_COSTPIX * sizeof(*dst));
+	int *start = malloc(BVCPU_COSTPIX * sizeof(*start));
+	short *w = malloc(BVCPU_COSTPIX * BVCPU_COSTTAPS * sizeof(*w));
+	unsigned int i;
+
+	if (src && dst && start && w) {
+		for (i = 0; i < n; i++)
+			src[i] = i * 0x01010101 | 0xFF000000;
+		for (i = 0; i < BVCPU_COSTPIX; i++)
+			start[i] = (int)i;
+		for (i = 0; i < BVCPU_COSTPIX * BVCPU_COSTTAPS; i++)
+			w[i] = BVCPU_SCALEONE / BVCPU_COSTTAPS;
+
+		if (!(have & (1 << BVCPU_COST_SCALEH)))
+			bvcpu_fitscale(0, c->scaleh, src, dst, start, w);
+		if (!(have & (1 << BVCPU_COST_SCALEV)))
+			bvcpu_fitscale(1, c->scalev, src, dst, start, w);
+		if (!(have & (1 << BVCPU_COST_SCALENN)))
+			c->scalenn = bvcpu_timescale(0, 0, src, dst, start, w);
+		if (!(have & (1 << BVCPU_COST_PACK16)))
+			c->pack16 = bvcpu_timepack(0, src, dst);
+		if (!(have & (1 << BVCPU_COST_DITHER16)))
+			c->dither16 = bvcpu_timepack(1, src, dst);
+		if (!(have & (1 << BVCPU_COST_DIFFUSE16)))
+			c->diffuse16 = bvcpu_timediffuse(src, dst);
+	}
+
+	free(src);
+	free(dst);
+	free(start);
+	free(w);
+}
+
+/*
+ * bvcpu_costload() - Read the entries present in the BVCPU_COSTS file.
+ * Returns a bit for each entry found.
+ */
+static unsigned int bvcpu_costload(struct bvcpu_costtab *c)
+{
+	const char *name = getenv("BVCPU_COSTS");
+	unsigned int have = 0;
+	char line[128], key[16];
+	double v[2];
+	FILE *f;
+	int i;
+
+	if (!name || !*name)
+		return 0;
+	f = fopen(name, "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		int n = sscanf(line, "%15s %lf %lf", key, &v[0], &v[1]);
+		for (i = 0; i < BVCPU_COST_COUNT; i++) {
+			double *e = (double *)((char *)c +
+					       bvcpu_costkeys[i].offset);
+			if (strcmp(key, bvcpu_costkeys[i].name) ||
+			    n < 1 + bvcpu_costkeys[i].values)
+				continue;
+			memcpy(e, v, bvcpu_costkeys[i].values * sizeof(*e));
+			have |= 1 << i;
+		}
+	}
+
+	fclose(f);
+	return have;
+}
+
+static void bvcpu_costinit(void)
+{
+	unsigned int have = bvcpu_costload(&bvcpu_costs);
+
+	if (have != (1 << BVCPU_COST_COUNT) - 1)
+		bvcpu_costmeasure(&bvcpu_costs, have);
+}
+
+/*
+ * Scale candidates, with their quality ranks for photos and for drawings.
+ * Drawings have hard edges, so the long sinc filters, which ring around
+ * them, rank lower; and point sampling ranks highest for exact integer
+ * upscales, which it reproduces without blurring.
+ */
+static const struct {
+	unsigned char filter;
+	unsigned char photo;
+	unsigned char drawing;
+} bvcpu_scalecands[] = {
+	{ BVSCALEDEF_NEAREST_NEIGHBOR,	0, 0 },
+	{ BVSCALEDEF_LINEAR,		1, 3 },
+	{ BVSCALEDEF_3_TAP,		2, 5 },
+	{ BVSCALEDEF_CUBIC,		3, 6 },
+	{ BVSCALEDEF_5_TAP,		4, 4 },
+	{ BVSCALEDEF_7_TAP,		5, 2 },
+	{ BVSCALEDEF_9_TAP,		6, 1 },
+};
+
+#define BVCPU_SCALECANDS \
+	(sizeof(bvcpu_scalecands) / sizeof(bvcpu_scalecands[0]))
+#define BVCPU_RANKEXACT	7
+
+/*
+ * bvcpu_scaleallowed() - Whether an implicit technique permits a filter.
+ */
+static int bvcpu_scaleallowed(unsigned long technique, unsigned char filter)
+{
+	switch (technique) {
+	case BVSCALEDEF_POINT_SAMPLE:
+		return filter == BVSCALEDEF_NEAREST_NEIGHBOR;
+	case BVSCALEDEF_NOT_NEAREST_NEIGHBOR:
+	case BVSCALEDEF_INTERPOLATED:
+		return filter != BVSCALEDEF_NEAREST_NEIGHBOR;
+	default:
+		return 1;
+	}
+}
+
+static unsigned int bvcpu_scalerank(unsigned long type, unsigned int cand,
+				    unsigned int src, unsigned int dst)
+{
+	if (type != BVSCALEDEF_DRAWING)
+		return bvcpu_scalecands[cand].photo;
+	if (bvcpu_scalecands[cand].filter == BVSCALEDEF_NEAREST_NEIGHBOR &&
+	    dst > src && !(dst % src))
+		return BVCPU_RANKEXACT;
+	return bvcpu_scalecands[cand].drawing;
+}
+
+/*
+ * bvcpu_scalecost() - Predicted nanoseconds for one BLT.  The horizontal
+ * pass runs once per source line the vertical taps touch, and is skipped
+ * when the widths match; a single vertical tap only selects a line.
+ */
+static double bvcpu_scalecost(unsigned char hf, unsigned char vf,
+			      unsigned int srcw, unsigned int srch,
+			      unsigned int dstw, unsigned int dsth)
+{
+	const struct bvcpu_costtab *c = &bvcpu_costs;
+	double lines = dsth, cost = 0.0;
+	unsigned int taps;
+
+	if (srch != dsth) {
+		taps = bvcpu_scaletaps(vf, srch, dsth);
+		lines = (double)dsth * taps;
+		if (lines > srch)
+			lines = srch;
+		if (taps > 1)
+			cost += (double)dstw * dsth *
+				(c->scalev[0] + c->scalev[1] * taps);
+	}
+	if (srcw != dstw) {
+		taps = bvcpu_scaletaps(hf, srcw, dstw);
+		cost += lines * dstw * (hf == BVSCALEDEF_NEAREST_NEIGHBOR ?
+					c->scalenn :
+					c->scaleh[0] + c->scaleh[1] * taps);
+	}
+
+	return cost;
+}
+
+/*
+ * bvcpu_choosescale() - Resolve an implicit scale mode.  The same filter is
+ * used in both directions, so that the result does not look different
+ * across and along the lines.
+ */
+void bvcpu_choosescale(unsigned long mode, unsigned int srcw,
+		       unsigned int srch, unsigned int dstw,
+		       unsigned int dsth, unsigned char *hfilter,
+		       unsigned char *vfilter)
+{
+	unsigned long technique = mode & BVSCALEDEF_TECHNIQUE_MASK;
+	unsigned long type = mode & BVSCALEDEF_TYPE_MASK;
+	double quality = (double)((mode & BVSCALEDEF_QUALITY_MASK) >>
+				  BVSCALEDEF_QUALITY_SHIFT) /
+		(BVSCALEDEF_QUALITY_MASK >> BVSCALEDEF_QUALITY_SHIFT);
+	double cost[BVCPU_SCALECANDS];
+	unsigned int rank[BVCPU_SCALECANDS];
+	unsigned int i, top = 0, best = 0;
+	double cheapest = -1.0, topcost = 0.0, budget;
+	int found = 0;
+
+	pthread_once(&bvcpu_costonce, bvcpu_costinit);
+
+	for (i = 0; i < BVCPU_SCALECANDS; i++) {
+		unsigned char f = bvcpu_scalecands[i].filter;
+		cost[i] = -1.0;
+		if (!bvcpu_scaleallowed(technique, f))
+			continue;
+		rank[i] = 0;
+		if (srcw != dstw)
+			rank[i] += bvcpu_scalerank(type, i, srcw, dstw);
+		if (srch != dsth)
+			rank[i] += bvcpu_scalerank(type, i, srch, dsth);
+		cost[i] = bvcpu_scalecost(f, f, srcw, srch, dstw, dsth);
+		if (cheapest < 0.0 || cost[i] < cheapest)
+			cheapest = cost[i];
+		if (!found || rank[i] > top ||
+		    (rank[i] == top && cost[i] < topcost)) {
+			top = rank[i];
+			topcost = cost[i];
+		}
+		found = 1;
+	}
+
+	/* the best candidate that fits the budget */
+	budget = cheapest + quality * (topcost - cheapest);
+	found = 0;
+	for (i = 0; i < BVCPU_SCALECANDS; i++) {
+		if (cost[i] < 0.0 || cost[i] > budget)
+			continue;
+		if (!found || rank[i] > rank[best] ||
+		    (rank[i] == rank[best] && cost[i] < cost[best]))
+			best = i;
+		found = 1;
+	}
+
+	*hfilter = *vfilter = bvcpu_scalecands[best].filter;
+}
+
+/*
+ * Dither candidates, in the same form.  The ordered dithers all cost the
+ * same; 2x2 for the 6-bit green of RGB16 and 4x4 for the rest ranks
+ * highest, since it was made for RGB16.
+ */
+static const struct {
+	unsigned char dither;		/* BVCPU_DITHER_* */
+	unsigned long technique;	/* BVDITHERDEF_* it implements */
+	unsigned char rank;
+} bvcpu_dithercands[] = {
+	{ BVCPU_DITHER_NONE, BVDITHERDEF_DONT_CARE, 0 },
+	{ BVCPU_DITHER_2X2, BVDITHERDEF_ORDERED, 1 },
+	{ BVCPU_DITHER_4X4, BVDITHERDEF_ORDERED, 2 },
+	{ BVCPU_DITHER_2X2_4X4, BVDITHERDEF_ORDERED, 3 },
+	{ BVCPU_DITHER_DIFFUSED, BVDITHERDEF_DIFFUSED, 4 },
+};
+
+#define BVCPU_DITHERCANDS \
+	(sizeof(bvcpu_dithercands) / sizeof(bvcpu_dithercands[0]))
+#define BVCPU_DITHERTECH	(0xFFUL << BVDITHERDEF_TECHNIQUE_SHIFT)
+#define BVCPU_DITHERQUAL	(0xFFUL << BVDITHERDEF_QUALITY_SHIFT)
+
+/*
+ * bvcpu_dithercost() - Predicted nanoseconds per pixel to pack with the
+ * dither.
+ */
+static double bvcpu_dithercost(unsigned char dither)
+{
+	if (dither == BVCPU_DITHER_NONE)
+		return bvcpu_costs.pack16;
+	if (dither == BVCPU_DITHER_DIFFUSED)
+		return bvcpu_costs.diffuse16 / bvcpu_ncpus;
+	return bvcpu_costs.dither16;
+}
+
+/*
+ * bvcpu_ditherallowed() - Whether an implicit technique permits a dither.
+ * BVDITHERDEF_ON asks for any dithering at all.
+ */
+static int bvcpu_ditherallowed(unsigned long technique, unsigned int cand)
+{
+	switch (technique) {
+	case BVDITHERDEF_DONT_CARE:
+		return 1;
+	case BVDITHERDEF_ON:
+		return bvcpu_dithercands[cand].dither != BVCPU_DITHER_NONE;
+	default:
+		return bvcpu_dithercands[cand].technique == technique;
+	}
+}
+
+/*
+ * bvcpu_choosedither() - Resolve an implicit dither mode.  A technique
+ * nothing implements falls back to all of the candidates.
+ */
+unsigned char bvcpu_choosedither(unsigned long mode,
+				 const struct bvcpu_format *fmt)
+{
+	unsigned long technique = mode & BVCPU_DITHERTECH;
+	double quality = (double)((mode & BVCPU_DITHERQUAL) >>
+				  BVDITHERDEF_QUALITY_SHIFT) /
+		(BVCPU_DITHERQUAL >> BVDITHERDEF_QUALITY_SHIFT);
+	double cheapest = -1.0, topcost = 0.0, budget;
+	unsigned int i, top = 0, best = 0;
+	int found = 0;
+
+	if (!(fmt->flags & BVCPU_FMT_REDUCED))
+		return BVCPU_DITHER_NONE;
+
+	pthread_once(&bvcpu_costonce, bvcpu_costinit);
+
+	for (i = 0; i < BVCPU_DITHERCANDS; i++)
+		if (bvcpu_ditherallowed(technique, i))
+			break;
+	if (i == BVCPU_DITHERCANDS)
+		technique = BVDITHERDEF_DONT_CARE;
+
+	for (i = 0; i < BVCPU_DITHERCANDS; i++) {
+		double cost = bvcpu_dithercost(bvcpu_dithercands[i].dither);
+		if (!bvcpu_ditherallowed(technique, i))
+			continue;
+		if (cheapest < 0.0 || cost < cheapest)
+			cheapest = cost;
+		if (!found || bvcpu_dithercands[i].rank > top ||
+		    (bvcpu_dithercands[i].rank == top && cost < topcost)) {
+			top = bvcpu_dithercands[i].rank;
+			topcost = cost;
+		}
+		found = 1;
+	}
+
+	/* the best candidate that fits the budget */
+	budget = cheapest + quality * (topcost - cheapest);
+	found = 0;
+	for (i = 0; i < BVCPU_DITHERCANDS; i++) {
+		double cost = bvcpu_dithercost(bvcpu_dithercands[i].dither);
+		if (!bvcpu_ditherallowed(technique, i) || cost > budget)
+			continue;
+		if (!found || bvcpu_dithercands[i].rank >
+		    bvcpu_dithercands[best].rank)
+			best = i;
+		found = 1;
+	}
+
+	return bvcpu_dithercands[best].dither;
+}
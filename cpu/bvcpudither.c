@@ -0,0 +1,351 @@
+/*
+ * bvcpudither.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the decoding of the dither mode and the setup of the
+ * ordered dithers.  Dithering only applies to destinations with fewer than
+ * 8 bits per color; it is done by the kernel that packs those formats, so
+ * it costs no extra pass over the destination.
+ *
+ * A component is reduced to the level at or below it, and rounded up to
+ * the next level when its distance from the lower one exceeds the threshold
+ * of the pixel.  The thresholds of an n x n matrix are spread evenly over
+ * the distance between levels, so on average the levels mix in proportion
+ * to that distance.  Values already on a level are never changed.
+ *
+ * Error diffusion (Floyd-Steinberg) cannot be done a line at a time, so
+ * the BLT is first rendered at full precision and then packed here.  Each
+ * pixel depends on the three pixels above it and the one to its left, so
+ * lines are packed in parallel along a diagonal wavefront: a line may run
+ * up to the pixel before the last one finished on the line above.  The
+ * result is the same as packing the lines one after another.
+ */
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * bvcpu_dithermodes - The explicit dither mode of each BVCPU_DITHER_*,
+ * less BVDITHERDEF_VENDOR_GENERIC.  Error diffusion has no explicit mode,
+ * so it is returned as the implicit mode that selects it.
+ */
+static const unsigned long bvcpu_dithermodes[BVCPU_DITHER_COUNT] = {
+	[BVCPU_DITHER_NONE] = BVDITHER_NONE & 0xFFFFFF,
+	[BVCPU_DITHER_2X2] = BVDITHER_ORDERED_2x2 & 0xFFFFFF,
+	[BVCPU_DITHER_4X4] = BVDITHER_ORDERED_4x4 & 0xFFFFFF,
+	[BVCPU_DITHER_2X2_4X4] = BVDITHER_ORDERED_2x2_4x4 & 0xFFFFFF,
+};
+
+/* Bayer matrices */
+static const unsigned char bvcpu_bayer2[2][2] = {
+	{ 0, 2 },
+	{ 3, 1 },
+};
+
+static const unsigned char bvcpu_bayer4[4][4] = {
+	{ 0, 8, 2, 10 },
+	{ 12, 4, 14, 6 },
+	{ 3, 11, 1, 9 },
+	{ 15, 7, 13, 5 },
+};
+
+/*
+ * bvcpu_threshold() - The threshold at destination (x, y) for a component
+ * reduced to bits bits.
+ */
+static unsigned int bvcpu_threshold(unsigned char dither, unsigned int bits,
+				    unsigned int x, unsigned int y)
+{
+	unsigned int step = 256 >> bits;
+	unsigned int m, n;
+
+	if (dither == BVCPU_DITHER_2X2 ||
+	    (dither == BVCPU_DITHER_2X2_4X4 && bits == 6)) {
+		m = bvcpu_bayer2[y & 1][x & 1];
+		n = 4;
+	} else {
+		m = bvcpu_bayer4[y & 3][x & 3];
+		n = 16;
+	}
+
+	/* the middle of the part of the step the entry stands for */
+	return (2 * m + 1) * step / (2 * n);
+}
+
+/*
+ * bvcpu_dithersetup() - Fill in the thresholds of an ordered dither.
+ */
+static void bvcpu_dithersetup(struct bvcpu_blt *blt)
+{
+	unsigned int rbits, gbits, bbits;
+	unsigned int x, y;
+
+	if (blt->dst.fmt->pack16 == BVCPU_PACK16_XRGB4444) {
+		rbits = gbits = bbits = 4;
+	} else {
+		rbits = bbits = 5;
+		gbits = 6;
+	}
+
+	for (y = 0; y < 4; y++)
+		for (x = 0; x < 8; x++)
+			blt->dbias[y][x] =
+				BVCPU_ARGB(0, bvcpu_threshold(blt->dither,
+							      rbits, x, y),
+					   bvcpu_threshold(blt->dither,
+							   gbits, x, y),
+					   bvcpu_threshold(blt->dither,
+							   bbits, x, y));
+}
+
+/*
+ * bvcpu_dithermode() - Decode the dither mode.  Implicit modes are resolved
+ * by the cost model for the destination format, and the explicit mode
+ * chosen is written back if the client asked for it.
+ */
+enum bverror bvcpu_dithermode(struct bvcpu_blt *blt)
+{
+	struct bvbltparams *params = blt->params;
+	unsigned long mode = (unsigned int)params->dithermode;
+	unsigned long generic = 0xFFUL << BVDITHERDEF_VENDOR_SHIFT;
+	unsigned int i;
+
+	switch (mode >> BVDITHERDEF_VENDOR_SHIFT) {
+	case BVDITHERDEF_VENDOR_ALL >> BVDITHERDEF_VENDOR_SHIFT:
+		blt->dither = bvcpu_choosedither(mode, blt->dst.fmt);
+		break;
+	case 0xFF:	/* BVDITHERDEF_VENDOR_GENERIC */
+		for (i = 0; i < BVCPU_DITHER_DIFFUSED; i++)
+			if ((mode & ~generic) == bvcpu_dithermodes[i])
+				break;
+		if (i == BVCPU_DITHER_DIFFUSED)
+			return bvcpu_err(params, BVERR_DITHER_MODE,
+					 "bvbltparams.dithermode not supported");
+		blt->dither = (unsigned char)i;
+		break;
+	default:
+		return bvcpu_err(params, BVERR_DITHER_MODE,
+				 "bvbltparams.dithermode not supported");
+	}
+
+	if (params->flags & BVFLAG_DITHER_RETURN) {
+		if (blt->dither == BVCPU_DITHER_DIFFUSED)
+			params->dithermode = BVDITHER_FASTEST_DIFFUSED;
+		else
+			params->dithermode = (enum bvdithermode)
+				(generic | bvcpu_dithermodes[blt->dither]);
+	}
+
+	/* nothing to dither at 8 bits per color */
+	if (!(blt->dst.fmt->flags & BVCPU_FMT_REDUCED))
+		blt->dither = BVCPU_DITHER_NONE;
+	if (blt->dither != BVCPU_DITHER_NONE &&
+	    blt->dither != BVCPU_DITHER_DIFFUSED)
+		bvcpu_dithersetup(blt);
+
+	return BVERR_NONE;
+}
+
+/*
+ * Error diffusion.  Errors are kept in sixteenths of a level of the 8-bit
+ * component, for the three colors of each pixel, in a ring of lines: line
+ * y reads the errors of ring line y and adds to those of line y + 1.  No
+ * more lines are in progress than there are workers, so with two lines to
+ * spare, a ring line has been read and cleared before it is added to
+ * again.  Lines are padded by a pixel on each side for the errors that
+ * fall off the edges.
+ */
+#define BVCPU_DIFFCHUNK	64		/* pixels done between waits */
+#define BVCPU_DIFFMIN	65536		/* fewest pixels for each worker */
+
+struct bvcpu_diffusion {
+	const unsigned int *src;	/* width x height unpacked pixels */
+	unsigned char *dst;
+	long stride;
+	unsigned int width;
+	unsigned int height;
+	unsigned int layout;		/* BVCPU_PACK16_* */
+	unsigned char level[3][256];	/* nearest level of r, g, b */
+	unsigned char value[3][64];	/* 8-bit value of each level */
+	int *err;			/* ring lines of (width + 2) x 3 */
+	unsigned int ring;
+	unsigned int *done;		/* pixels finished on each line */
+	unsigned int next;		/* next line to start */
+};
+
+/*
+ * bvcpu_diffuselevels() - The levels of a component reduced to bits bits,
+ * as expanded by the unpack routines, and the nearest to each value.
+ */
+static void bvcpu_diffuselevels(unsigned char *level, unsigned char *value,
+				unsigned int bits)
+{
+	unsigned int n = 1u << bits;
+	unsigned int q, v;
+
+	for (q = 0; q < n; q++)
+		value[q] = (unsigned char)((q << (8 - bits)) |
+					   (q >> (2 * bits - 8)));
+	for (v = 0, q = 0; v < 256; v++) {
+		if (q + 1 < n && 2 * v > value[q] + value[q + 1])
+			q++;
+		level[v] = (unsigned char)q;
+	}
+}
+
+static void bvcpu_diffusewait(const unsigned int *done, unsigned int need)
+{
+	while (__atomic_load_n(done, __ATOMIC_ACQUIRE) < need)
+		sched_yield();
+}
+
+/*
+ * bvcpu_diffuseline() - Pack line y.
+ */
+static void bvcpu_diffuseline(struct bvcpu_diffusion *d, unsigned int y)
+{
+	unsigned int n = (d->width + 2) * 3;
+	int *cur = d->err + (y % d->ring) * n + 3;
+	int *below = d->err + ((y + 1) % d->ring) * n + 3;
+	const unsigned int *src = d->src + (unsigned long)y * d->width;
+	unsigned short *dst = (unsigned short *)(d->dst + (long)y * d->stride);
+	int right[3] = { 0, 0, 0 };
+	unsigned int q[3];
+	unsigned int x, x0, x1, c;
+
+	for (x0 = 0; x0 < d->width; x0 = x1) {
+		x1 = x0 + BVCPU_DIFFCHUNK < d->width ?
+			x0 + BVCPU_DIFFCHUNK : d->width;
+
+		/* the line above must be done past the last pixel */
+		if (y)
+			bvcpu_diffusewait(&d->done[y - 1],
+					  x1 < d->width ? x1 + 1 : x1);
+
+		for (x = x0; x < x1; x++) {
+			for (c = 0; c < 3; c++) {
+				int *e = &below[x * 3 + c];
+				int v = (int)((src[x] >> (16 - 8 * c)) & 0xFF);
+				v += (cur[x * 3 + c] + right[c] + 8) >> 4;
+				v = v < 0 ? 0 : v > 255 ? 255 : v;
+				q[c] = d->level[c][v];
+				v -= d->value[c][q[c]];
+				right[c] = 7 * v;
+				e[-3] += 3 * v;
+				e[0] += 5 * v;
+				e[3] += v;
+			}
+			switch (d->layout) {
+			case BVCPU_PACK16_RGB565:
+				dst[x] = (unsigned short)((q[0] << 11) |
+							  (q[1] << 5) | q[2]);
+				break;
+			case BVCPU_PACK16_BGR565:
+				dst[x] = (unsigned short)((q[2] << 11) |
+							  (q[1] << 5) | q[0]);
+				break;
+			default:
+				dst[x] = (unsigned short)(0xF000 | (q[0] << 8) |
+							  (q[1] << 4) | q[2]);
+				break;
+			}
+		}
+		if (x1 < d->width)
+			__atomic_store_n(&d->done[y], x1, __ATOMIC_RELEASE);
+	}
+
+	/* clear the ring line for reuse before the line is seen finished */
+	memset(cur - 3, 0, n * sizeof(*cur));
+	__atomic_store_n(&d->done[y], d->width, __ATOMIC_RELEASE);
+}
+
+/*
+ * bvcpu_diffuseworker() - Pack lines in order until none are left.  Taking
+ * lines in order means the line above is always being worked on, so any
+ * number of workers makes progress.
+ */
+static void bvcpu_diffuseworker(void *arg)
+{
+	struct bvcpu_diffusion *d = arg;
+	unsigned int y;
+
+	while ((y = __atomic_fetch_add(&d->next, 1, __ATOMIC_RELAXED)) <
+	       d->height)
+		bvcpu_diffuseline(d, y);
+}
+
+/*
+ * bvcpu_diffuse() - Pack width x height unpacked pixels from src to dst,
+ * in a BVCPU_FMT_REDUCED format, with Floyd-Steinberg error diffusion.
+ * threads limits the workers used; 0 uses one for each CPU, as long as
+ * each has enough pixels to be worth starting.
+ */
+enum bverror bvcpu_diffuse(const struct bvcpu_format *fmt,
+			   const unsigned int *src, unsigned char *dst,
+			   long stride, unsigned int width, unsigned int height,
+			   unsigned int threads)
+{
+	struct bvcpu_diffusion *d;
+	unsigned long pixels = (unsigned long)width * height;
+	unsigned int i;
+
+	if (!threads || threads > bvcpu_ncpus)
+		threads = bvcpu_ncpus;
+	if (threads > pixels / BVCPU_DIFFMIN)
+		threads = (unsigned int)(pixels / BVCPU_DIFFMIN);
+	if (threads > height)
+		threads = height;
+	if (!threads)
+		threads = 1;
+
+	d = malloc(sizeof(*d));
+	if (!d)
+		return BVERR_OOM;
+	d->src = src;
+	d->dst = dst;
+	d->stride = stride;
+	d->width = width;
+	d->height = height;
+	d->layout = fmt->pack16;
+	d->ring = threads + 2;
+	d->next = 0;
+	d->err = calloc((size_t)d->ring * (width + 2) * 3, sizeof(*d->err));
+	d->done = calloc(height, sizeof(*d->done));
+	if (!d->err || !d->done) {
+		free(d->err);
+		free(d->done);
+		free(d);
+		return BVERR_OOM;
+	}
+
+	if (d->layout == BVCPU_PACK16_XRGB4444) {
+		for (i = 0; i < 3; i++)
+			bvcpu_diffuselevels(d->level[i], d->value[i], 4);
+	} else {
+		bvcpu_diffuselevels(d->level[0], d->value[0], 5);
+		bvcpu_diffuselevels(d->level[1], d->value[1], 6);
+		bvcpu_diffuselevels(d->level[2], d->value[2], 5);
+	}
+
+	bvcpu_poolrun(bvcpu_diffuseworker, d, threads);
+
+	free(d->err);
+	free(d->done);
+	free(d);
+	return BVERR_NONE;
+}
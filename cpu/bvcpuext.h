@@ -0,0 +1,66 @@
+/*
+ * bvcpuext.h
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the extensions the BLTsville CPU implementation
+ * (bltsville_cpu) exports beside the bv_*() entry points.  Clients may
+ * link with them or import them like the entry points, with the function
+ * types below.
+ */
+
+#ifndef BVCPUEXT_H
+#define BVCPUEXT_H
+
+/*
+ * Timeline.  Each asynchronous BLT has a point on the timeline, and so
+ * does each NOP BLT (BVFLAG_ROP with op.rop 0xAAAA), which does nothing
+ * else.  The timeline reaches a point once the BLT and every asynchronous
+ * BLT submitted before it have completed; callbacks may still be pending.
+ * Points only increase, and are compared as differences so they can wrap.
+ *
+ * bvcpu_timelinepoint() returns the point of the last asynchronous or NOP
+ * BLT submitted by the calling thread, bvcpu_timeline() the point the
+ * timeline has reached, and bvcpu_timelinewait() returns once it has
+ * reached point.
+ */
+unsigned long bvcpu_timeline(void);
+unsigned long bvcpu_timelinepoint(void);
+void bvcpu_timelinewait(unsigned long point);
+
+typedef unsigned long (*BVCPUFN_TIMELINE)(void);
+typedef unsigned long (*BVCPUFN_TIMELINEPOINT)(void);
+typedef void (*BVCPUFN_TIMELINEWAIT)(unsigned long point);
+
+/*
+ * Plan statistics.  The plans of a BLT are the tables it is run with that
+ * do not depend on where its rectangles are: the weights or index map
+ * that scale each input in each direction, found by source size,
+ * destination size and filter.  They are built on first use and cached
+ * for every thread.  bvcpu_planstats() reports how many times a plan was
+ * found in the cache and how many were built, with the total time spent
+ * building them, since the library was loaded.
+ */
+struct bvcpu_planstats {
+	unsigned long hits;
+	unsigned long builds;
+	unsigned long buildns;		/* nanoseconds */
+	unsigned int plans;		/* held in the cache now */
+};
+
+void bvcpu_planstats(struct bvcpu_planstats *stats);
+
+typedef void (*BVCPUFN_PLANSTATS)(struct bvcpu_planstats *stats);
+
+#endif /* BVCPUEXT_H */
@@ -0,0 +1,387 @@
+/*
+ * bvcpufmt.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the color formats supported by the CPU implementation
+ * and the routines that convert them to and from the internal 0xAARRGGBB
+ * representation.  Buffers need not be aligned to their pixels, so pixels
+ * wider than a byte are read with bvcpu_pixload() and written with
+ * memcpy().
+ */
+
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * 8-bit component formats (24-bit packed and 32-bit containers).
+ */
+static void unpack_bytes(const struct bvcpu_format *fmt,
+			 const unsigned char *src, unsigned int *dst,
+			 unsigned int count)
+{
+	unsigned int bpp = fmt->bpp;
+	int aoff = fmt->aoff;
+	int roff = fmt->roff;
+	int goff = fmt->goff;
+	int boff = fmt->boff;
+	unsigned int i;
+
+	if (aoff < 0) {
+		for (i = 0; i < count; i++, src += bpp)
+			dst[i] = BVCPU_ARGB(0xFF, src[roff], src[goff],
+					    src[boff]);
+	} else {
+		for (i = 0; i < count; i++, src += bpp)
+			dst[i] = BVCPU_ARGB(src[aoff], src[roff], src[goff],
+					    src[boff]);
+	}
+}
+
+static void pack_bytes(const struct bvcpu_format *fmt,
+		       const unsigned int *src, unsigned char *dst,
+		       unsigned int count)
+{
+	unsigned int bpp = fmt->bpp;
+	int aoff = fmt->aoff;
+	int roff = fmt->roff;
+	int goff = fmt->goff;
+	int boff = fmt->boff;
+	int xoff = -1;
+	unsigned int i;
+
+	/* 32-bit containers without alpha fill the unused byte with 1s */
+	if (aoff < 0 && bpp == 4)
+		xoff = 6 - roff - goff - boff;
+
+	for (i = 0; i < count; i++, dst += bpp) {
+		unsigned int p = src[i];
+		dst[roff] = BVCPU_R(p);
+		dst[goff] = BVCPU_G(p);
+		dst[boff] = BVCPU_B(p);
+		if (aoff >= 0)
+			dst[aoff] = BVCPU_A(p);
+		else if (xoff >= 0)
+			dst[xoff] = 0xFF;
+	}
+}
+
+/*
+ * BGRA byte order is the internal representation on little endian CPUs.
+ */
+static void unpack_native(const struct bvcpu_format *fmt,
+			  const unsigned char *src, unsigned int *dst,
+			  unsigned int count)
+{
+	if (fmt->aoff < 0) {
+		unsigned int i;
+		for (i = 0; i < count; i++)
+			dst[i] = bvcpu_pixload(src + i * 4, 4) | 0xFF000000;
+	} else {
+		memcpy(dst, src, count * 4);
+	}
+}
+
+static void pack_native(const struct bvcpu_format *fmt,
+			const unsigned int *src, unsigned char *dst,
+			unsigned int count)
+{
+	if (fmt->aoff < 0) {
+		unsigned int i, p;
+		for (i = 0; i < count; i++) {
+			p = src[i] | 0xFF000000;
+			memcpy(dst + i * 4, &p, 4);
+		}
+	} else {
+		memcpy(dst, src, count * 4);
+	}
+}
+
+/*
+ * Alpha only.
+ */
+static void unpack_alpha8(const struct bvcpu_format *fmt,
+			  const unsigned char *src, unsigned int *dst,
+			  unsigned int count)
+{
+	unsigned int i;
+	for (i = 0; i < count; i++)
+		dst[i] = (unsigned int)src[i] << 24;
+}
+
+static void pack_alpha8(const struct bvcpu_format *fmt,
+			const unsigned int *src, unsigned char *dst,
+			unsigned int count)
+{
+	unsigned int i;
+	for (i = 0; i < count; i++)
+		dst[i] = BVCPU_A(src[i]);
+}
+
+/*
+ * 16-bit containers.  Components are expanded by bit replication and
+ * truncated when packed.
+ */
+static void unpack_rgb16(const struct bvcpu_format *fmt,
+			 const unsigned char *src, unsigned int *dst,
+			 unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int p = bvcpu_pixload(src + i * 2, 2);
+		unsigned int hi = p >> 11;
+		unsigned int g = (p >> 5) & 0x3F;
+		unsigned int lo = p & 0x1F;
+		hi = (hi << 3) | (hi >> 2);
+		g = (g << 2) | (g >> 4);
+		lo = (lo << 3) | (lo >> 2);
+		if (fmt->roff == 0)
+			dst[i] = BVCPU_ARGB(0xFF, hi, g, lo);
+		else
+			dst[i] = BVCPU_ARGB(0xFF, lo, g, hi);
+	}
+}
+
+static void pack_rgb16(const struct bvcpu_format *fmt,
+		       const unsigned int *src, unsigned char *dst,
+		       unsigned int count)
+{
+	unsigned short d;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int p = src[i];
+		unsigned int r = BVCPU_R(p) >> 3;
+		unsigned int g = BVCPU_G(p) >> 2;
+		unsigned int b = BVCPU_B(p) >> 3;
+		if (fmt->roff == 0)
+			d = (unsigned short)((r << 11) | (g << 5) | b);
+		else
+			d = (unsigned short)((b << 11) | (g << 5) | r);
+		memcpy(dst + i * 2, &d, 2);
+	}
+}
+
+static void unpack_xrgb12(const struct bvcpu_format *fmt,
+			  const unsigned char *src, unsigned int *dst,
+			  unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int p = bvcpu_pixload(src + i * 2, 2);
+		dst[i] = BVCPU_ARGB(0xFF, ((p >> 8) & 0xF) * 0x11,
+				    ((p >> 4) & 0xF) * 0x11, (p & 0xF) * 0x11);
+	}
+}
+
+static void pack_xrgb12(const struct bvcpu_format *fmt,
+			const unsigned int *src, unsigned char *dst,
+			unsigned int count)
+{
+	unsigned short d;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int p = src[i];
+		d = (unsigned short)(0xF000 | ((BVCPU_R(p) >> 4) << 8) |
+				     ((BVCPU_G(p) >> 4) << 4) |
+				     (BVCPU_B(p) >> 4));
+		memcpy(dst + i * 2, &d, 2);
+	}
+}
+
+#define FMT8(f, bpp, flags, a, r, g, b) \
+	{ f, bpp, flags, a, r, g, b, unpack_bytes, pack_bytes, 0 }
+#define FMTN(f, flags, a) \
+	{ f, 4, flags, a, 2, 1, 0, unpack_native, pack_native, 0 }
+
+static const struct bvcpu_format bvcpu_formats[] = {
+	{ OCDFMT_ALPHA8, 1, BVCPU_FMT_ALPHA | BVCPU_FMT_ALPHAONLY,
+	  0, -1, -1, -1, unpack_alpha8, pack_alpha8, 0 },
+
+	{ OCDFMT_xRGB12, 2, BVCPU_FMT_REDUCED, -1, 0, 0, 0,
+	  unpack_xrgb12, pack_xrgb12, BVCPU_PACK16_XRGB4444 },
+	{ OCDFMT_RGB16, 2, BVCPU_FMT_REDUCED, -1, 0, 0, 0,
+	  unpack_rgb16, pack_rgb16, BVCPU_PACK16_RGB565 },
+	{ OCDFMT_BGR16, 2, BVCPU_FMT_REDUCED, -1, 1, 0, 0,
+	  unpack_rgb16, pack_rgb16, BVCPU_PACK16_BGR565 },
+
+	FMT8(OCDFMT_RGB24, 3, 0, -1, 0, 1, 2),
+	FMT8(OCDFMT_BGR24, 3, 0, -1, 2, 1, 0),
+
+	FMT8(OCDFMT_xRGB24, 4, 0, -1, 1, 2, 3),
+	FMT8(OCDFMT_RGBx24, 4, 0, -1, 0, 1, 2),
+	FMT8(OCDFMT_xBGR24, 4, 0, -1, 3, 2, 1),
+	FMTN(OCDFMT_BGRx24, 0, -1),
+
+	FMT8(OCDFMT_ARGB24, 4, BVCPU_FMT_ALPHA, 0, 1, 2, 3),
+	FMT8(OCDFMT_RGBA24, 4, BVCPU_FMT_ALPHA, 3, 0, 1, 2),
+	FMT8(OCDFMT_ABGR24, 4, BVCPU_FMT_ALPHA, 0, 3, 2, 1),
+	FMTN(OCDFMT_BGRA24, BVCPU_FMT_ALPHA | BVCPU_FMT_NATIVE, 3),
+
+	FMT8(OCDFMT_nARGB24, 4, BVCPU_FMT_ALPHA | BVCPU_FMT_NONPREMULT,
+	     0, 1, 2, 3),
+	FMT8(OCDFMT_nRGBA24, 4, BVCPU_FMT_ALPHA | BVCPU_FMT_NONPREMULT,
+	     3, 0, 1, 2),
+	FMT8(OCDFMT_nABGR24, 4, BVCPU_FMT_ALPHA | BVCPU_FMT_NONPREMULT,
+	     0, 3, 2, 1),
+	FMTN(OCDFMT_nBGRA24, BVCPU_FMT_ALPHA | BVCPU_FMT_NONPREMULT, 3),
+};
+
+const struct bvcpu_format *bvcpu_getformat(enum ocdformat format)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(bvcpu_formats) / sizeof(bvcpu_formats[0]); i++)
+		if (bvcpu_formats[i].format == format)
+			return &bvcpu_formats[i];
+
+	return NULL;
+}
+
+void bvcpu_premultiply(unsigned int *pix, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int p = pix[i];
+		unsigned int a = BVCPU_A(p);
+		if (a == 0xFF)
+			continue;
+		pix[i] = BVCPU_ARGB(a, bvcpu_div255(BVCPU_R(p) * a),
+				    bvcpu_div255(BVCPU_G(p) * a),
+				    bvcpu_div255(BVCPU_B(p) * a));
+	}
+}
+
+/*
+ * bvcpu_recip - ceil(2^24 / a).  For x = c * 255 + a / 2 with c and a
+ * below 256, (x * bvcpu_recip[a]) >> 24 is exactly x / a.
+ */
+#define RECIP1(a)	((a) ? ((1u << 24) + (a) - 1) / (a) : 0)
+#define RECIP4(a)	RECIP1(a), RECIP1(a + 1), RECIP1(a + 2), RECIP1(a + 3)
+#define RECIP16(a)	RECIP4(a), RECIP4(a + 4), RECIP4(a + 8), RECIP4(a + 12)
+#define RECIP64(a) \
+	RECIP16(a), RECIP16(a + 16), RECIP16(a + 32), RECIP16(a + 48)
+
+static const unsigned int bvcpu_recip[256] = {
+	RECIP64(0), RECIP64(64), RECIP64(128), RECIP64(192)
+};
+
+static inline unsigned int bvcpu_unpremul(unsigned int c, unsigned int a,
+					  unsigned long long m)
+{
+	return (unsigned int)(((c * 255 + a / 2) * m) >> 24);
+}
+
+void bvcpu_unpremultiply(unsigned int *pix, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned int p = pix[i];
+		unsigned int a = BVCPU_A(p);
+		unsigned long long m;
+		unsigned int r, g, b;
+		if (a == 0xFF)
+			continue;
+		if (a == 0) {
+			pix[i] = 0;
+			continue;
+		}
+		m = bvcpu_recip[a];
+		r = bvcpu_unpremul(BVCPU_R(p), a, m);
+		g = bvcpu_unpremul(BVCPU_G(p), a, m);
+		b = bvcpu_unpremul(BVCPU_B(p), a, m);
+		pix[i] = BVCPU_ARGB(a, r > 255 ? 255 : r, g > 255 ? 255 : g,
+				    b > 255 ? 255 : b);
+	}
+}
+
+/*
+ * bvcpu_pack() - Pack count pixels, with ordered dithering if bias holds
+ * the thresholds of the line (see bvcpu_ditherbias()).
+ */
+void bvcpu_pack(const struct bvcpu_format *fmt, const unsigned int *src,
+		unsigned char *dst, unsigned int count,
+		const unsigned int *bias)
+{
+	if (bias && (fmt->flags & BVCPU_FMT_REDUCED))
+		bvcpu_kern->pack16((unsigned short *)dst, src, bias,
+				   fmt->pack16, count);
+	else
+		fmt->pack(fmt, src, dst, count);
+}
+
+/*
+ * bvcpu_alphafix() - How unpacked srcfmt pixels change to be packed into
+ * dstfmt: 1 to premultiply, -1 to unpremultiply, 0 for neither.
+ */
+int bvcpu_alphafix(const struct bvcpu_format *srcfmt,
+		   const struct bvcpu_format *dstfmt)
+{
+	unsigned int from = srcfmt->flags & BVCPU_FMT_NONPREMULT;
+	unsigned int to = dstfmt->flags & BVCPU_FMT_NONPREMULT;
+
+	if (!(srcfmt->flags & BVCPU_FMT_ALPHA))
+		return 0;
+	/* dropping alpha leaves the premultiplied color */
+	if (!(dstfmt->flags & BVCPU_FMT_ALPHA))
+		return from ? 1 : 0;
+	if (from && !to)
+		return 1;
+	if (!from && to)
+		return -1;
+	return 0;
+}
+
+/*
+ * bvcpu_unpackfor() - Unpack count pixels as bvcpu_convert() does before
+ * packing them into dstfmt.
+ */
+void bvcpu_unpackfor(const struct bvcpu_format *srcfmt,
+		     const unsigned char *src,
+		     const struct bvcpu_format *dstfmt,
+		     unsigned int *dst, unsigned int count)
+{
+	int fix = bvcpu_alphafix(srcfmt, dstfmt);
+
+	srcfmt->unpack(srcfmt, src, dst, count);
+	if (fix > 0)
+		bvcpu_premultiply(dst, count);
+	else if (fix < 0)
+		bvcpu_unpremultiply(dst, count);
+}
+
+/*
+ * bvcpu_convert() - Convert count pixels between formats, dithering as
+ * bvcpu_pack().  tmp must hold count 32-bit pixels.
+ */
+void bvcpu_convert(const struct bvcpu_format *srcfmt,
+		   const unsigned char *src,
+		   const struct bvcpu_format *dstfmt,
+		   unsigned char *dst, unsigned int *tmp,
+		   unsigned int count, const unsigned int *bias)
+{
+	if (srcfmt == dstfmt) {
+		memcpy(dst, src, (size_t)count * srcfmt->bpp);
+		return;
+	}
+
+	bvcpu_unpackfor(srcfmt, src, dstfmt, tmp, count);
+	bvcpu_pack(dstfmt, tmp, dst, count, bias);
+}
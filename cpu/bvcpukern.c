@@ -0,0 +1,82 @@
+/*
+ * bvcpukern.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file instantiates the kernels in bvcpukern.h for each instruction set
+ * the CPU implementation can use, and selects among them at run time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+#define BVCPU_KSTR2(x)	#x
+#define BVCPU_KSTR(x)	BVCPU_KSTR2(x)
+
+/*
+ * Baseline kernels, built for the instruction set the file is compiled for.
+ */
+#if defined(__SSE2__)
+#define BVCPU_KISA		sse2
+#define BVCPU_BASEKERNELS	bvcpu_kernels_sse2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BVCPU_KISA		neon
+#define BVCPU_BASEKERNELS	bvcpu_kernels_neon
+#else
+#define BVCPU_KISA		c
+#define BVCPU_BASEKERNELS	bvcpu_kernels_c
+#endif
+#define BVCPU_KVEC	16
+#include "bvcpukern.h"
+#undef BVCPU_KVEC
+#undef BVCPU_KISA
+
+/*
+ * AVX2 kernels, used when the CPU reports support at run time.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define BVCPU_HAVE_AVX2
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define BVCPU_KISA	avx2
+#define BVCPU_KVEC	32
+#include "bvcpukern.h"
+#undef BVCPU_KVEC
+#undef BVCPU_KISA
+#pragma GCC pop_options
+#endif
+
+/*
+ * bvcpu_selectkernels() - Choose the widest kernel set supported by the CPU.
+ * BVCPU_KERNELS may name a narrower set, for debugging.
+ */
+const struct bvcpu_kernels *bvcpu_selectkernels(void)
+{
+	const struct bvcpu_kernels *kern = &BVCPU_BASEKERNELS;
+	const char *force = getenv("BVCPU_KERNELS");
+
+#ifdef BVCPU_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		kern = &bvcpu_kernels_avx2;
+#endif
+
+	if (force && strcmp(force, kern->name) != 0 &&
+	    strcmp(force, BVCPU_BASEKERNELS.name) == 0)
+		kern = &BVCPU_BASEKERNELS;
+
+	return kern;
+}
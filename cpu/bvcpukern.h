@@ -0,0 +1,1338 @@
+/*
+ * bvcpukern.h
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * Pixel processing kernels.  This file is included once per instruction set
+ * by bvcpukern.c, with BVCPU_KISA set to the name of the instruction set and
+ * BVCPU_KVEC set to its vector width in bytes.  The kernels are written with
+ * the GCC vector extensions, so the compiler emits the instructions enabled
+ * for the enclosing target (SSE2, AVX2, NEON, or plain C).
+ */
+
+#define BVCPU_KPASTE2(a, b)	a##_##b
+#define BVCPU_KPASTE(a, b)	BVCPU_KPASTE2(a, b)
+#define K(name)			BVCPU_KPASTE(name, BVCPU_KISA)
+
+typedef unsigned char K(vu8)
+	__attribute__((vector_size(BVCPU_KVEC), aligned(1), may_alias));
+typedef unsigned short K(vu16)
+	__attribute__((vector_size(BVCPU_KVEC), aligned(1), may_alias));
+typedef unsigned int K(vu32)
+	__attribute__((vector_size(BVCPU_KVEC), aligned(1), may_alias));
+
+#define VPIX		(BVCPU_KVEC / 4)
+
+/* one byte per pixel of a VU32 */
+typedef unsigned char K(vpb)
+	__attribute__((vector_size(VPIX), aligned(1), may_alias));
+
+#define VU8		K(vu8)
+#define VU16		K(vu16)
+#define VU32		K(vu32)
+#define VPB		K(vpb)
+#define VLOAD(p)	(*(const VU8 *)(p))
+#define VSTORE(p, v)	(*(VU8 *)(p) = (v))
+#define VLOAD32(p)	(*(const VU32 *)(p))
+#define VSTORE32(p, v)	(*(VU32 *)(p) = (v))
+#define VLOADPB(p)	__builtin_convertvector(*(const VPB *)(p), VU32)
+
+static inline VU8 K(splat)(unsigned char x)
+{
+	VU8 v = { 0 };
+	return v + x;
+}
+
+/*
+ * Raster operations.
+ *
+ * A ROP3 is evaluated as a tree of selects on the bits of src2, src1 and
+ * dst: sel(c, a, b) = b ^ ((a ^ b) & c).  The four leaves (one per src2,
+ * src1 combination) only depend on dst and are precomputed by the caller
+ * as c0 ^ (cx & dst), so any of the 256 ROP3 codes costs the same seventeen
+ * logical operations per vector.  A ROP4 evaluates both halves and selects
+ * between them with the mask.
+ */
+#define ROP3_EVAL(r, c0, cx, d, s1, s2) \
+	do { \
+		__typeof__(d) l0 = (c0)[0] ^ ((cx)[0] & (d)); \
+		__typeof__(d) l1 = (c0)[1] ^ ((cx)[1] & (d)); \
+		__typeof__(d) l2 = (c0)[2] ^ ((cx)[2] & (d)); \
+		__typeof__(d) l3 = (c0)[3] ^ ((cx)[3] & (d)); \
+		__typeof__(d) t0 = l0 ^ ((l1 ^ l0) & (s1)); \
+		__typeof__(d) t1 = l2 ^ ((l3 ^ l2) & (s1)); \
+		(r) = t0 ^ ((t1 ^ t0) & (s2)); \
+	} while (0)
+
+static void K(rop3)(unsigned char *dst, const unsigned char *src1,
+		    const unsigned char *src2, const unsigned char *mask,
+		    unsigned long count, const struct bvcpu_ropconst *rc)
+{
+	VU8 c0[4], cx[4];
+	unsigned long i = 0;
+	int j;
+
+	for (j = 0; j < 4; j++) {
+		c0[j] = K(splat)(rc->c0[j]);
+		cx[j] = K(splat)(rc->cx[j]);
+	}
+
+	for (; i + BVCPU_KVEC <= count; i += BVCPU_KVEC) {
+		VU8 d = VLOAD(dst + i);
+		VU8 r;
+		ROP3_EVAL(r, c0, cx, d, VLOAD(src1 + i), VLOAD(src2 + i));
+		VSTORE(dst + i, r);
+	}
+
+	for (; i < count; i++) {
+		unsigned char d = dst[i];
+		unsigned char r;
+		ROP3_EVAL(r, rc->c0, rc->cx, d, src1[i], src2[i]);
+		dst[i] = r;
+	}
+}
+
+static void K(rop4)(unsigned char *dst, const unsigned char *src1,
+		    const unsigned char *src2, const unsigned char *mask,
+		    unsigned long count, const struct bvcpu_ropconst *rc)
+{
+	VU8 c0[8], cx[8];
+	unsigned long i = 0;
+	int j;
+
+	for (j = 0; j < 8; j++) {
+		c0[j] = K(splat)(rc->c0[j]);
+		cx[j] = K(splat)(rc->cx[j]);
+	}
+
+	for (; i + BVCPU_KVEC <= count; i += BVCPU_KVEC) {
+		VU8 d = VLOAD(dst + i);
+		VU8 s1 = VLOAD(src1 + i);
+		VU8 s2 = VLOAD(src2 + i);
+		VU8 lo, hi;
+		ROP3_EVAL(lo, c0, cx, d, s1, s2);
+		ROP3_EVAL(hi, c0 + 4, cx + 4, d, s1, s2);
+		VSTORE(dst + i, lo ^ ((hi ^ lo) & VLOAD(mask + i)));
+	}
+
+	for (; i < count; i++) {
+		unsigned char d = dst[i];
+		unsigned char lo, hi;
+		ROP3_EVAL(lo, rc->c0, rc->cx, d, src1[i], src2[i]);
+		ROP3_EVAL(hi, rc->c0 + 4, rc->cx + 4, d, src1[i], src2[i]);
+		dst[i] = lo ^ ((hi ^ lo) & mask[i]);
+	}
+}
+
+#undef ROP3_EVAL
+
+/*
+ * Named ROPs.  Copies and fills are left to the C library, which already
+ * selects the widest moves the CPU supports.
+ */
+static void K(copy)(unsigned char *dst, const unsigned char *src1,
+		    const unsigned char *src2, const unsigned char *mask,
+		    unsigned long count, const struct bvcpu_ropconst *rc)
+{
+	memmove(dst, src1, count);
+}
+
+static void K(xor)(unsigned char *dst, const unsigned char *src1,
+		   const unsigned char *src2, const unsigned char *mask,
+		   unsigned long count, const struct bvcpu_ropconst *rc)
+{
+	unsigned long i = 0;
+
+	for (; i + 2 * BVCPU_KVEC <= count; i += 2 * BVCPU_KVEC) {
+		VU8 a = VLOAD(dst + i) ^ VLOAD(src1 + i);
+		VU8 b = VLOAD(dst + i + BVCPU_KVEC) ^
+			VLOAD(src1 + i + BVCPU_KVEC);
+		VSTORE(dst + i, a);
+		VSTORE(dst + i + BVCPU_KVEC, b);
+	}
+	for (; i + BVCPU_KVEC <= count; i += BVCPU_KVEC)
+		VSTORE(dst + i, VLOAD(dst + i) ^ VLOAD(src1 + i));
+	for (; i < count; i++)
+		dst[i] ^= src1[i];
+}
+
+static void K(not)(unsigned char *dst, const unsigned char *src1,
+		   const unsigned char *src2, const unsigned char *mask,
+		   unsigned long count, const struct bvcpu_ropconst *rc)
+{
+	unsigned long i = 0;
+
+	for (; i + BVCPU_KVEC <= count; i += BVCPU_KVEC)
+		VSTORE(dst + i, ~VLOAD(dst + i));
+	for (; i < count; i++)
+		dst[i] = ~dst[i];
+}
+
+static void K(fill)(unsigned char *dst, unsigned char value,
+		    unsigned long count)
+{
+	memset(dst, value, count);
+}
+
+/*
+ * A run of bpp vectors holds a whole number of pixels, so a pixel of any
+ * size is broadcast by storing the vectors of one run in turn.  Pixels of
+ * 1, 2 or 4 bytes fill one vector.
+ */
+static void K(broadcast)(unsigned char *dst, const unsigned char *pixel,
+			 unsigned int bpp, unsigned long count)
+{
+	unsigned char run[3 * BVCPU_KVEC];
+	unsigned long step = (bpp == 3 ? 3 : 1) * BVCPU_KVEC;
+	unsigned long i = 0;
+	unsigned int j;
+
+	for (j = 0; j < step; j++)
+		run[j] = pixel[j % bpp];
+
+	if (step == BVCPU_KVEC) {
+		VU8 v = VLOAD(run);
+		for (; i + 2 * BVCPU_KVEC <= count; i += 2 * BVCPU_KVEC) {
+			VSTORE(dst + i, v);
+			VSTORE(dst + i + BVCPU_KVEC, v);
+		}
+	} else {
+		VU8 v0 = VLOAD(run);
+		VU8 v1 = VLOAD(run + BVCPU_KVEC);
+		VU8 v2 = VLOAD(run + 2 * BVCPU_KVEC);
+		for (; i + step <= count; i += step) {
+			VSTORE(dst + i, v0);
+			VSTORE(dst + i + BVCPU_KVEC, v1);
+			VSTORE(dst + i + 2 * BVCPU_KVEC, v2);
+		}
+	}
+	/* i is a whole number of runs */
+	for (; i < count; i += j) {
+		j = count - i < step ? (unsigned int)(count - i) :
+			(unsigned int)step;
+		memcpy(dst + i, run, j);
+	}
+}
+
+/*
+ * Blending.
+ *
+ * Pixels are blended in the internal 0xAARRGGBB format, split into the
+ * red/blue and alpha/green byte pairs so each component gets a 16-bit lane
+ * for the products.  Division by 255 is the exact round(x / 255) of
+ * bvcpu_div255(), and the sum of the two terms saturates at 255.
+ */
+#define BVCPU_KLO	0x00FF00FF
+
+static inline __attribute__((always_inline)) VU32 K(mul)(VU32 c, VU32 f)
+{
+	VU16 x = (VU16)c * (VU16)f;
+	x += 128;
+	x = (x + (x >> 8)) >> 8;
+	return (VU32)x;
+}
+
+static inline __attribute__((always_inline)) VU32 K(sat)(VU32 c)
+{
+	VU16 x = (VU16)c;
+	x = (x | -(x >> 8)) & 0xFF;
+	return (VU32)x;
+}
+
+/*
+ * K(afactor)() - One of the BVCPU_AFACTORS as a per-pixel value in both
+ * 16-bit lanes.
+ */
+static inline __attribute__((always_inline)) VU32 K(afactor)(int k, VU32 p1,
+							     VU32 p2)
+{
+	VU32 a;
+
+	switch (k) {
+	case BVCPU_AF_A1:
+		a = p1 >> 24;
+		break;
+	case BVCPU_AF_A2:
+		a = p2 >> 24;
+		break;
+	case BVCPU_AF_IA1:
+		a = (p1 >> 24) ^ 0xFF;
+		break;
+	default:
+		a = (p2 >> 24) ^ 0xFF;
+		break;
+	}
+	return a | (a << 16);
+}
+
+static inline __attribute__((always_inline)) VU32 K(blendpix)(VU32 p1,
+							      VU32 p2,
+							      int k1, int k2)
+{
+	VU32 rb = { 0 }, ag = { 0 };
+	VU32 f;
+
+	if (k1 == BVCPU_AF_ONE) {
+		rb = p1 & BVCPU_KLO;
+		ag = (p1 >> 8) & BVCPU_KLO;
+	} else if (k1 != BVCPU_AF_ZERO) {
+		f = K(afactor)(k1, p1, p2);
+		rb = K(mul)(p1 & BVCPU_KLO, f);
+		ag = K(mul)((p1 >> 8) & BVCPU_KLO, f);
+	}
+
+	if (k2 == BVCPU_AF_ONE) {
+		rb += p2 & BVCPU_KLO;
+		ag += (p2 >> 8) & BVCPU_KLO;
+	} else if (k2 != BVCPU_AF_ZERO) {
+		f = K(afactor)(k2, p1, p2);
+		rb += K(mul)(p2 & BVCPU_KLO, f);
+		ag += K(mul)((p2 >> 8) & BVCPU_KLO, f);
+	}
+
+	if (k1 != BVCPU_AF_ZERO && k2 != BVCPU_AF_ZERO) {
+		rb = K(sat)(rb);
+		ag = K(sat)(ag);
+	}
+
+	return rb | (ag << 8);
+}
+
+/*
+ * Source 1 modulation by global and remote alpha (BVCPU_MOD_*).  The factor
+ * is formed per pixel in both 16-bit lanes; with global alpha only it is
+ * loop invariant.
+ */
+static inline __attribute__((always_inline)) VU32 K(modf)(
+	int mod, const unsigned char *ar, unsigned int ag)
+{
+	VU32 f;
+
+	switch (mod) {
+	case BVCPU_MOD_GLOBAL:
+		f = (VU32){ 0 } + ag;
+		break;
+	case BVCPU_MOD_REMOTE:
+		f = VLOADPB(ar);
+		break;
+	default:
+		f = K(mul)(VLOADPB(ar), (VU32){ 0 } + ag);
+		break;
+	}
+	return f | (f << 16);
+}
+
+static inline __attribute__((always_inline)) VU32 K(modulate)(VU32 p,
+							       VU32 f)
+{
+	return K(mul)(p & BVCPU_KLO, f) |
+		(K(mul)((p >> 8) & BVCPU_KLO, f) << 8);
+}
+
+/*
+ * K(blenda)() - Body of the alpha factor kernels.  It is expanded once per
+ * modulation and K1, K2 pair with constant arguments, so the unused terms
+ * and the multiplications by 0 and 1 drop out.  The last partial vector is
+ * blended through a bounce buffer.
+ */
+static inline __attribute__((always_inline)) void K(blenda)(
+	unsigned int *dst, const unsigned int *src1, const unsigned int *src2,
+	const unsigned char *ar, unsigned int ag, unsigned int count,
+	int mod, int k1, int k2)
+{
+	unsigned int i = 0;
+
+	for (; i + VPIX <= count; i += VPIX) {
+		VU32 p1 = VLOAD32(src1 + i);
+		if (mod != BVCPU_MOD_NONE)
+			p1 = K(modulate)(p1, K(modf)(mod, ar + i, ag));
+		VSTORE32(dst + i, K(blendpix)(p1, VLOAD32(src2 + i), k1, k2));
+	}
+
+	if (i < count) {
+		unsigned int b1[VPIX] = { 0 }, b2[VPIX] = { 0 }, bd[VPIX];
+		unsigned char bar[VPIX] = { 0 };
+		unsigned int n = count - i;
+		VU32 p1;
+		memcpy(b1, src1 + i, n * 4);
+		memcpy(b2, src2 + i, n * 4);
+		if (ar)
+			memcpy(bar, ar + i, n);
+		p1 = VLOAD32(b1);
+		if (mod != BVCPU_MOD_NONE)
+			p1 = K(modulate)(p1, K(modf)(mod, bar, ag));
+		VSTORE32(bd, K(blendpix)(p1, VLOAD32(b2), k1, k2));
+		memcpy(dst + i, bd, n * 4);
+	}
+}
+
+#define BLENDA_DEF(mod, k1, k2) \
+	static void K(blend_##mod##_##k1##_##k2)( \
+		unsigned int *dst, const unsigned int *src1, \
+		const unsigned int *src2, const unsigned int *const *k, \
+		const unsigned char *ar, unsigned int ag, unsigned int count) \
+	{ \
+		K(blenda)(dst, src1, src2, ar, ag, count, BVCPU_MOD_##mod, \
+			  BVCPU_AF_##k1, BVCPU_AF_##k2); \
+	}
+#define BLENDA_ROW(mod, k1) \
+	BLENDA_DEF(mod, k1, ZERO) BLENDA_DEF(mod, k1, ONE) \
+	BLENDA_DEF(mod, k1, A1) BLENDA_DEF(mod, k1, A2) \
+	BLENDA_DEF(mod, k1, IA1) BLENDA_DEF(mod, k1, IA2)
+#define BLENDA_NONE(k1)		BLENDA_ROW(NONE, k1)
+#define BLENDA_GLOBAL(k1)	BLENDA_ROW(GLOBAL, k1)
+#define BLENDA_REMOTE(k1)	BLENDA_ROW(REMOTE, k1)
+#define BLENDA_BOTH(k1)		BLENDA_ROW(BOTH, k1)
+BVCPU_AFACTORS(BLENDA_NONE)
+BVCPU_AFACTORS(BLENDA_GLOBAL)
+BVCPU_AFACTORS(BLENDA_REMOTE)
+BVCPU_AFACTORS(BLENDA_BOTH)
+
+#define BLENDA_ENT(mod, k1, k2)	K(blend_##mod##_##k1##_##k2),
+#define BLENDA_TABROW(mod, k1) \
+	BLENDA_ENT(mod, k1, ZERO) BLENDA_ENT(mod, k1, ONE) \
+	BLENDA_ENT(mod, k1, A1) BLENDA_ENT(mod, k1, A2) \
+	BLENDA_ENT(mod, k1, IA1) BLENDA_ENT(mod, k1, IA2)
+#define BLENDA_TNONE(k1)	BLENDA_TABROW(NONE, k1)
+#define BLENDA_TGLOBAL(k1)	BLENDA_TABROW(GLOBAL, k1)
+#define BLENDA_TREMOTE(k1)	BLENDA_TABROW(REMOTE, k1)
+#define BLENDA_TBOTH(k1)	BLENDA_TABROW(BOTH, k1)
+static const bvcpu_blendfn K(blendtab)[BVCPU_MOD_COUNT * BVCPU_AF_COUNT *
+				       BVCPU_AF_COUNT] = {
+	BVCPU_AFACTORS(BLENDA_TNONE)
+	BVCPU_AFACTORS(BLENDA_TGLOBAL)
+	BVCPU_AFACTORS(BLENDA_TREMOTE)
+	BVCPU_AFACTORS(BLENDA_TBOTH)
+};
+
+#undef BLENDA_DEF
+#undef BLENDA_ROW
+#undef BLENDA_NONE
+#undef BLENDA_GLOBAL
+#undef BLENDA_REMOTE
+#undef BLENDA_BOTH
+#undef BLENDA_ENT
+#undef BLENDA_TABROW
+#undef BLENDA_TNONE
+#undef BLENDA_TGLOBAL
+#undef BLENDA_TREMOTE
+#undef BLENDA_TBOTH
+
+/*
+ * K(blendk)() - Blend with a factor per component: the color components
+ * take K1 and K2, alpha takes K3 and K4.
+ */
+static inline __attribute__((always_inline)) VU32 K(blendkpix)(
+	VU32 p1, VU32 p2, VU32 k1, VU32 k2, VU32 k3, VU32 k4)
+{
+	VU32 f1 = (k1 & 0x00FFFFFF) | (k3 & 0xFF000000);
+	VU32 f2 = (k2 & 0x00FFFFFF) | (k4 & 0xFF000000);
+	VU32 rb, ag;
+
+	rb = K(mul)(p1 & BVCPU_KLO, f1 & BVCPU_KLO) +
+		K(mul)(p2 & BVCPU_KLO, f2 & BVCPU_KLO);
+	ag = K(mul)((p1 >> 8) & BVCPU_KLO, (f1 >> 8) & BVCPU_KLO) +
+		K(mul)((p2 >> 8) & BVCPU_KLO, (f2 >> 8) & BVCPU_KLO);
+
+	return K(sat)(rb) | (K(sat)(ag) << 8);
+}
+
+static void K(blendk)(unsigned int *dst, const unsigned int *src1,
+		      const unsigned int *src2, const unsigned int *const *k,
+		      const unsigned char *ar, unsigned int ag,
+		      unsigned int count)
+{
+	unsigned int i = 0;
+	int j;
+
+	for (; i + VPIX <= count; i += VPIX)
+		VSTORE32(dst + i,
+			 K(blendkpix)(VLOAD32(src1 + i), VLOAD32(src2 + i),
+				      VLOAD32(k[0] + i), VLOAD32(k[1] + i),
+				      VLOAD32(k[2] + i), VLOAD32(k[3] + i)));
+
+	if (i < count) {
+		unsigned int b1[VPIX] = { 0 }, b2[VPIX] = { 0 }, bd[VPIX];
+		unsigned int bk[4][VPIX] = { { 0 } };
+		unsigned int n = count - i;
+		memcpy(b1, src1 + i, n * 4);
+		memcpy(b2, src2 + i, n * 4);
+		for (j = 0; j < 4; j++)
+			memcpy(bk[j], k[j] + i, n * 4);
+		VSTORE32(bd, K(blendkpix)(VLOAD32(b1), VLOAD32(b2),
+					  VLOAD32(bk[0]), VLOAD32(bk[1]),
+					  VLOAD32(bk[2]), VLOAD32(bk[3])));
+		memcpy(dst + i, bd, n * 4);
+	}
+}
+
+/*
+ * Factor lines for K(blendk)().  1 - y is the complement of every byte.
+ */
+static void K(kinv)(unsigned int *dst, const unsigned int *x,
+		    const unsigned int *y, unsigned int count)
+{
+	unsigned int i = 0;
+
+	for (; i + VPIX <= count; i += VPIX)
+		VSTORE32(dst + i, ~VLOAD32(y + i));
+	for (; i < count; i++)
+		dst[i] = ~y[i];
+}
+
+static void K(kmin)(unsigned int *dst, const unsigned int *x,
+		    const unsigned int *y, unsigned int count)
+{
+	unsigned long n = (unsigned long)count * 4;
+	const unsigned char *xb = (const unsigned char *)x;
+	const unsigned char *yb = (const unsigned char *)y;
+	unsigned char *db = (unsigned char *)dst;
+	unsigned long i = 0;
+
+	for (; i + BVCPU_KVEC <= n; i += BVCPU_KVEC) {
+		VU8 a = VLOAD(xb + i);
+		VU8 b = ~VLOAD(yb + i);
+		VSTORE(db + i, b ^ ((a ^ b) & (VU8)(a < b)));
+	}
+	for (; i < n; i++) {
+		unsigned char b = ~yb[i];
+		db[i] = xb[i] < b ? xb[i] : b;
+	}
+}
+
+static void K(kmax)(unsigned int *dst, const unsigned int *x,
+		    const unsigned int *y, unsigned int count)
+{
+	unsigned long n = (unsigned long)count * 4;
+	const unsigned char *xb = (const unsigned char *)x;
+	const unsigned char *yb = (const unsigned char *)y;
+	unsigned char *db = (unsigned char *)dst;
+	unsigned long i = 0;
+
+	for (; i + BVCPU_KVEC <= n; i += BVCPU_KVEC) {
+		VU8 a = VLOAD(xb + i);
+		VU8 b = ~VLOAD(yb + i);
+		VSTORE(db + i, b ^ ((a ^ b) & (VU8)(a > b)));
+	}
+	for (; i < n; i++) {
+		unsigned char b = ~yb[i];
+		db[i] = xb[i] > b ? xb[i] : b;
+	}
+}
+
+/*
+ * K(kmod)() - Modulate a line of source 1 by global and remote alpha, for
+ * the blends that compute factor lines from it.
+ */
+static void K(kmod)(unsigned int *dst, const unsigned int *src,
+		    const unsigned char *ar, unsigned int ag,
+		    unsigned int count)
+{
+	unsigned int i = 0;
+
+	if (!ar) {
+		VU32 f = K(modf)(BVCPU_MOD_GLOBAL, NULL, ag);
+		for (; i + VPIX <= count; i += VPIX)
+			VSTORE32(dst + i, K(modulate)(VLOAD32(src + i), f));
+	} else if (ag == 255) {
+		for (; i + VPIX <= count; i += VPIX)
+			VSTORE32(dst + i,
+				 K(modulate)(VLOAD32(src + i),
+					     K(modf)(BVCPU_MOD_REMOTE,
+						     ar + i, ag)));
+	} else {
+		for (; i + VPIX <= count; i += VPIX)
+			VSTORE32(dst + i,
+				 K(modulate)(VLOAD32(src + i),
+					     K(modf)(BVCPU_MOD_BOTH,
+						     ar + i, ag)));
+	}
+
+	for (; i < count; i++) {
+		unsigned int p = src[i];
+		unsigned int f = ar ? bvcpu_div255(ar[i] * ag) : ag;
+		dst[i] = BVCPU_ARGB(bvcpu_div255(BVCPU_A(p) * f),
+				    bvcpu_div255(BVCPU_R(p) * f),
+				    bvcpu_div255(BVCPU_G(p) * f),
+				    bvcpu_div255(BVCPU_B(p) * f));
+	}
+}
+
+static void K(kalpha)(unsigned int *dst, const unsigned int *x,
+		      const unsigned int *y, unsigned int count)
+{
+	unsigned int i = 0;
+
+	for (; i + VPIX <= count; i += VPIX) {
+		VU32 a = VLOAD32(x + i) >> 24;
+		a |= a << 8;
+		VSTORE32(dst + i, a | (a << 16));
+	}
+	for (; i < count; i++)
+		dst[i] = (x[i] >> 24) * 0x01010101;
+}
+
+/*
+ * Essential blends.  B() works on whole byte vectors; the alpha bytes are
+ * computed too and replaced when the result is composited.
+ */
+#define V8MASK(c)	((VU8)(c))
+
+static inline __attribute__((always_inline)) VU8 K(min8)(VU8 a, VU8 b)
+{
+	return b ^ ((a ^ b) & V8MASK(a < b));
+}
+
+static inline __attribute__((always_inline)) VU8 K(max8)(VU8 a, VU8 b)
+{
+	return b ^ ((a ^ b) & V8MASK(a > b));
+}
+
+static inline __attribute__((always_inline)) VU8 K(adds8)(VU8 a, VU8 b)
+{
+	VU8 s = a + b;
+	return s | V8MASK(s < a);
+}
+
+static inline __attribute__((always_inline)) VU8 K(subs8)(VU8 a, VU8 b)
+{
+	return (a - b) & V8MASK(a >= b);
+}
+
+/* a x b / 255 */
+static inline __attribute__((always_inline)) VU8 K(mul8)(VU8 a, VU8 b)
+{
+	VU32 lo = K(mul)((VU32)a & BVCPU_KLO, (VU32)b & BVCPU_KLO);
+	VU32 hi = K(mul)(((VU32)a >> 8) & BVCPU_KLO,
+			 ((VU32)b >> 8) & BVCPU_KLO);
+	return (VU8)(lo | (hi << 8));
+}
+
+/* a x b / 256 */
+static inline __attribute__((always_inline)) VU8 K(mulhi8)(VU8 a, VU8 b)
+{
+	VU16 lo = (VU16)((VU32)a & BVCPU_KLO) * (VU16)((VU32)b & BVCPU_KLO);
+	VU16 hi = (VU16)(((VU32)a >> 8) & BVCPU_KLO) *
+		(VU16)(((VU32)b >> 8) & BVCPU_KLO);
+	return (VU8)((VU16)(lo >> 8) | (hi & 0xFF00));
+}
+
+static inline __attribute__((always_inline)) VU8 K(essb)(int mode, VU8 a,
+							  VU8 b,
+							  const unsigned char
+							  *lut)
+{
+	VU8 lt = V8MASK(b < 128);
+	VU8 r;
+	int j;
+
+	switch (mode) {
+	case BVCPU_ESS_LIGHTEN:
+		return K(max8)(a, b);
+	case BVCPU_ESS_DARKEN:
+		return K(min8)(a, b);
+	case BVCPU_ESS_MULTIPLY:
+		return K(mul8)(a, b);
+	case BVCPU_ESS_AVERAGE:
+		return (a & b) + ((a ^ b) >> 1);
+	case BVCPU_ESS_ADD:
+		return K(adds8)(a, b);
+	case BVCPU_ESS_SUBTRACT:
+		return K(subs8)(a, ~b);
+	case BVCPU_ESS_DIFFERENCE:
+		return K(max8)(a, b) - K(min8)(a, b);
+	case BVCPU_ESS_NEGATE:
+		/* a + b up to 255, 510 - a - b beyond */
+		return K(min8)(K(adds8)(a, b), K(adds8)(~a, ~b));
+	case BVCPU_ESS_SCREEN:
+		return ~K(mulhi8)(~a, ~b);
+	case BVCPU_ESS_EXCLUSION:
+		r = K(mul8)(a, b);
+		return K(adds8)(a - r, b - r);
+	case BVCPU_ESS_OVERLAY:
+		r = K(mul8)(a, b + b) & lt;
+		return r | (~K(mul8)(~a, ~b + ~b) & ~lt);
+	case BVCPU_ESS_HARD_LIGHT:
+		lt = V8MASK(a < 128);
+		r = K(mul8)(b, a + a) & lt;
+		return r | (~K(mul8)(~b, ~a + ~a) & ~lt);
+	case BVCPU_ESS_LINEAR_LIGHT:
+		/* 2 x b - 256 wraps to b + b */
+		return (K(subs8)(a, ~(b + b)) & lt) |
+			(K(adds8)(a, b + b) & ~lt);
+	case BVCPU_ESS_PIN_LIGHT:
+		return (K(min8)(a, b + b) & lt) | (K(max8)(a, b + b) & ~lt);
+	case BVCPU_ESS_PHOENIX:
+		return ~(K(max8)(a, b) - K(min8)(a, b));
+	default:
+		if (!BVCPU_ESSLUT(mode))
+			return a;		/* NORMAL, ALPHA */
+		for (j = 0; j < BVCPU_KVEC; j++)
+			r[j] = lut[a[j] * 256 + b[j]];
+		return r;
+	}
+}
+
+static inline __attribute__((always_inline)) VU32 K(satw)(VU32 c)
+{
+	VU16 x = (VU16)c;
+	VU16 m = (VU16)(x > 255);
+	return (VU32)((x & ~m) | (m & 0xFF));
+}
+
+static inline __attribute__((always_inline)) VU32 K(esspix)(
+	int mode, int opaque, VU32 p1, VU32 p2, VU32 u1, VU32 u2,
+	const unsigned char *lut)
+{
+	VU32 b = (VU32)K(essb)(mode, (VU8)u1, (VU8)u2, lut);
+	VU32 a1, a2, a12, f1, f2, f12, rb, ag;
+
+	if (opaque)
+		return b | 0xFF000000;
+
+	a1 = p1 >> 24;
+	a2 = p2 >> 24;
+	a12 = K(mul)(a1, a2);
+	f1 = a2 ^ 0xFF;
+	f1 |= f1 << 16;
+	f2 = a1 ^ 0xFF;
+	f2 |= f2 << 16;
+	f12 = a12 | (a12 << 16);
+
+	rb = K(mul)(p1 & BVCPU_KLO, f1) + K(mul)(p2 & BVCPU_KLO, f2) +
+		K(mul)(b & BVCPU_KLO, f12);
+	ag = K(mul)((p1 >> 8) & BVCPU_KLO, f1) +
+		K(mul)((p2 >> 8) & BVCPU_KLO, f2) +
+		K(mul)((b >> 8) & BVCPU_KLO, f12);
+	rb = K(satw)(rb);
+	ag = K(satw)(ag);
+
+	return ((rb | (ag << 8)) & 0x00FFFFFF) |
+		((a1 + K(mul)(a2, a1 ^ 0xFF)) << 24);
+}
+
+/*
+ * K(essk)() - Body of the essential blend kernels, expanded once per mode
+ * with and without alpha.  Four vectors (16 or 32 pixels) are blended per
+ * iteration.
+ */
+static inline __attribute__((always_inline)) void K(essk)(
+	unsigned int *dst, const unsigned int *src1, const unsigned int *src2,
+	const unsigned int *const *k, unsigned int count, int mode, int opaque)
+{
+	const unsigned int *u1 = k[0];
+	const unsigned int *u2 = k[1];
+	const unsigned char *lut = (const unsigned char *)k[2];
+	unsigned int i = 0;
+	int j;
+
+	for (; i + 4 * VPIX <= count; i += 4 * VPIX)
+		for (j = 0; j < 4 * VPIX; j += VPIX)
+			VSTORE32(dst + i + j,
+				 K(esspix)(mode, opaque,
+					   VLOAD32(src1 + i + j),
+					   VLOAD32(src2 + i + j),
+					   VLOAD32(u1 + i + j),
+					   VLOAD32(u2 + i + j), lut));
+
+	for (; i + VPIX <= count; i += VPIX)
+		VSTORE32(dst + i, K(esspix)(mode, opaque, VLOAD32(src1 + i),
+					    VLOAD32(src2 + i),
+					    VLOAD32(u1 + i),
+					    VLOAD32(u2 + i), lut));
+
+	if (i < count) {
+		unsigned int b1[VPIX] = { 0 }, b2[VPIX] = { 0 };
+		unsigned int bu1[VPIX] = { 0 }, bu2[VPIX] = { 0 }, bd[VPIX];
+		unsigned int n = count - i;
+		memcpy(b1, src1 + i, n * 4);
+		memcpy(b2, src2 + i, n * 4);
+		memcpy(bu1, u1 + i, n * 4);
+		memcpy(bu2, u2 + i, n * 4);
+		VSTORE32(bd, K(esspix)(mode, opaque, VLOAD32(b1), VLOAD32(b2),
+				       VLOAD32(bu1), VLOAD32(bu2), lut));
+		memcpy(dst + i, bd, n * 4);
+	}
+}
+
+#define ESS_DEF(m) \
+	static void K(ess_##m)(unsigned int *dst, const unsigned int *src1, \
+			       const unsigned int *src2, \
+			       const unsigned int *const *k, \
+			       const unsigned char *ar, unsigned int ag, \
+			       unsigned int count) \
+	{ \
+		K(essk)(dst, src1, src2, k, count, BVCPU_ESS_##m, 0); \
+	} \
+	static void K(esso_##m)(unsigned int *dst, const unsigned int *src1, \
+				const unsigned int *src2, \
+				const unsigned int *const *k, \
+				const unsigned char *ar, unsigned int ag, \
+				unsigned int count) \
+	{ \
+		K(essk)(dst, src1, src2, k, count, BVCPU_ESS_##m, 1); \
+	}
+BVCPU_ESSENTIALS(ESS_DEF)
+
+#define ESS_ENT(m)	K(ess_##m), K(esso_##m),
+static const bvcpu_blendfn K(esstab)[BVCPU_ESS_COUNT * 2] = {
+	BVCPU_ESSENTIALS(ESS_ENT)
+};
+
+#undef ESS_DEF
+#undef ESS_ENT
+#undef V8MASK
+#undef BVCPU_KLO
+
+/*
+ * Scaling.  Each output is a weighted sum of taps inputs, accumulated on
+ * the four components in 32-bit lanes.  The result is rounded, clamped to
+ * 0-255, and the colors clamped to the alpha, since negative lobes of the
+ * filters could otherwise leave a pixel that is not premultiplied.
+ */
+typedef int K(v4s) __attribute__((vector_size(16)));
+typedef unsigned char K(v16b) __attribute__((vector_size(16)));
+typedef unsigned int K(v4u) __attribute__((vector_size(16)));
+typedef int K(vs32)
+	__attribute__((vector_size(BVCPU_KVEC), aligned(1), may_alias));
+
+#define V4S		K(v4s)
+#define V16B		K(v16b)
+#define V4U		K(v4u)
+#define VS32		K(vs32)
+#define SCALE_ROUND	(1 << (BVCPU_SCALEBITS - 1))
+
+/* lane of alpha when a pixel is loaded as bytes */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SCALE_ALANE	3
+#else
+#define SCALE_ALANE	0
+#endif
+
+static inline V4S K(scaleunpack)(const unsigned int *p)
+{
+	V16B b = (V16B)(V4U){ *p, 0, 0, 0 };
+
+	return (V4S)__builtin_shuffle(b, (V16B){ 0 },
+				      (V16B){ 0, 16, 16, 16, 1, 16, 16, 16,
+					      2, 16, 16, 16, 3, 16, 16, 16 });
+}
+
+static inline void K(scalepack)(unsigned int *p, V4S acc)
+{
+	V4S zero = { 0 };
+	V4S a, m;
+
+	acc = (acc + SCALE_ROUND) >> BVCPU_SCALEBITS;
+	acc &= acc > zero;
+	m = acc > 255;
+	acc = (acc & ~m) | (255 & m);
+	a = __builtin_shuffle(acc, (V4S){ 0 } + SCALE_ALANE);
+	m = acc > a;
+	acc = (acc & ~m) | (a & m);
+
+	*p = ((V4U)__builtin_shuffle((V16B)acc,
+				     (V16B){ 0, 4, 8, 12, 0, 4, 8, 12,
+					     0, 4, 8, 12, 0, 4, 8, 12 }))[0];
+}
+
+static inline __attribute__((always_inline)) void K(scalehn)(
+	unsigned int *dst, const unsigned int *src, const int *start,
+	const short *w, unsigned int taps, unsigned int count)
+{
+	unsigned int i, t;
+
+	for (i = 0; i < count; i++, w += taps) {
+		const unsigned int *s = src + start[i];
+		V4S acc = { 0 };
+		for (t = 0; t < taps; t++)
+			acc += K(scaleunpack)(s + t) * w[t];
+		K(scalepack)(dst + i, acc);
+	}
+}
+
+/*
+ * K(scaleh)() - Horizontal pass.  The taps of neighboring outputs start at
+ * unrelated inputs, so the components of one output fill the lanes rather
+ * than the outputs themselves: gathering VPIX outputs into a vector costs
+ * more in lane inserts than it saves in arithmetic.  The common tap counts
+ * are expanded with a constant count so the inner loop unrolls.
+ */
+static void K(scaleh)(unsigned int *dst, const unsigned int *src,
+		      const int *start, const short *w, unsigned int taps,
+		      unsigned int count)
+{
+	switch (taps) {
+	case 1:
+		K(scalehn)(dst, src, start, w, 1, count);
+		break;
+	case 2:
+		K(scalehn)(dst, src, start, w, 2, count);
+		break;
+	case 3:
+		K(scalehn)(dst, src, start, w, 3, count);
+		break;
+	case 4:
+		K(scalehn)(dst, src, start, w, 4, count);
+		break;
+	default:
+		K(scalehn)(dst, src, start, w, taps, count);
+		break;
+	}
+}
+
+static inline VS32 K(scaleclamp)(VS32 x, VS32 hi)
+{
+	VS32 m;
+
+	x = (x + SCALE_ROUND) >> BVCPU_SCALEBITS;
+	x &= x > (VS32){ 0 };
+	m = x > hi;
+	return (x & ~m) | (hi & m);
+}
+
+/*
+ * K(scalev)() - Vertical pass, VPIX pixels at a time.
+ */
+static void K(scalev)(unsigned int *dst, const unsigned int *const *rows,
+		      const short *w, unsigned int taps, unsigned int count)
+{
+	unsigned int i = 0, t;
+
+	for (; i + VPIX <= count; i += VPIX) {
+		VS32 b = { 0 }, g = { 0 }, r = { 0 }, a = { 0 };
+		for (t = 0; t < taps; t++) {
+			VU32 p = VLOAD32(rows[t] + i);
+			int wt = w[t];
+			b += (VS32)(p & 0xFF) * wt;
+			g += (VS32)((p >> 8) & 0xFF) * wt;
+			r += (VS32)((p >> 16) & 0xFF) * wt;
+			a += (VS32)(p >> 24) * wt;
+		}
+		a = K(scaleclamp)(a, (VS32){ 0 } + 255);
+		b = K(scaleclamp)(b, a);
+		g = K(scaleclamp)(g, a);
+		r = K(scaleclamp)(r, a);
+		VSTORE32(dst + i, (VU32)(b | (g << 8) | (r << 16) | (a << 24)));
+	}
+
+	for (; i < count; i++) {
+		V4S acc = { 0 };
+		for (t = 0; t < taps; t++)
+			acc += K(scaleunpack)(rows[t] + i) * w[t];
+		K(scalepack)(dst + i, acc);
+	}
+}
+
+/*
+ * Nearest neighbor.  Pixels are copied whole, so no unpacking is needed.
+ * Exact 2x, 3x and 4x upscales expand each vector of input into factor
+ * vectors of output with fixed shuffles; an exact 1/2 takes every other
+ * pixel of two vectors.
+ */
+#define SCALE_REPL(f, j, n)	(((j) * VPIX + (n)) / (f))
+#if BVCPU_KVEC == 32
+#define SCALE_REPMASK(f, j) \
+	(VU32){ SCALE_REPL(f, j, 0), SCALE_REPL(f, j, 1), \
+		SCALE_REPL(f, j, 2), SCALE_REPL(f, j, 3), \
+		SCALE_REPL(f, j, 4), SCALE_REPL(f, j, 5), \
+		SCALE_REPL(f, j, 6), SCALE_REPL(f, j, 7) }
+#define SCALE_HALFMASK	(VU32){ 0, 2, 4, 6, 8, 10, 12, 14 }
+#else
+#define SCALE_REPMASK(f, j) \
+	(VU32){ SCALE_REPL(f, j, 0), SCALE_REPL(f, j, 1), \
+		SCALE_REPL(f, j, 2), SCALE_REPL(f, j, 3) }
+#define SCALE_HALFMASK	(VU32){ 0, 2, 4, 6 }
+#endif
+
+static void K(scalenn)(unsigned int *dst, const unsigned int *src,
+		       const int *idx, unsigned int count)
+{
+	unsigned int i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		dst[i] = src[idx[i]];
+		dst[i + 1] = src[idx[i + 1]];
+		dst[i + 2] = src[idx[i + 2]];
+		dst[i + 3] = src[idx[i + 3]];
+	}
+	for (; i < count; i++)
+		dst[i] = src[idx[i]];
+}
+
+static void K(scalerep)(unsigned int *dst, const unsigned int *src,
+			unsigned int factor, unsigned int phase,
+			unsigned int count)
+{
+	unsigned int i = 0;
+
+	/* finish the first input pixel */
+	if (phase) {
+		for (; i < count && phase + i < factor; i++)
+			dst[i] = src[0];
+		src++;
+	}
+
+	switch (factor) {
+	case 2:
+		for (; i + 2 * VPIX <= count; i += 2 * VPIX, src += VPIX) {
+			VU32 p = VLOAD32(src);
+			VSTORE32(dst + i, __builtin_shuffle(p,
+							    SCALE_REPMASK(2, 0)));
+			VSTORE32(dst + i + VPIX,
+				 __builtin_shuffle(p, SCALE_REPMASK(2, 1)));
+		}
+		break;
+	case 3:
+		for (; i + 3 * VPIX <= count; i += 3 * VPIX, src += VPIX) {
+			VU32 p = VLOAD32(src);
+			VSTORE32(dst + i, __builtin_shuffle(p,
+							    SCALE_REPMASK(3, 0)));
+			VSTORE32(dst + i + VPIX,
+				 __builtin_shuffle(p, SCALE_REPMASK(3, 1)));
+			VSTORE32(dst + i + 2 * VPIX,
+				 __builtin_shuffle(p, SCALE_REPMASK(3, 2)));
+		}
+		break;
+	case 4:
+		for (; i + 4 * VPIX <= count; i += 4 * VPIX, src += VPIX) {
+			VU32 p = VLOAD32(src);
+			VSTORE32(dst + i, __builtin_shuffle(p,
+							    SCALE_REPMASK(4, 0)));
+			VSTORE32(dst + i + VPIX,
+				 __builtin_shuffle(p, SCALE_REPMASK(4, 1)));
+			VSTORE32(dst + i + 2 * VPIX,
+				 __builtin_shuffle(p, SCALE_REPMASK(4, 2)));
+			VSTORE32(dst + i + 3 * VPIX,
+				 __builtin_shuffle(p, SCALE_REPMASK(4, 3)));
+		}
+		break;
+	}
+
+	/* i is now a multiple of factor from the first whole input pixel */
+	for (; i < count; src++) {
+		unsigned int j;
+		for (j = 0; j < factor && i < count; j++, i++)
+			dst[i] = *src;
+	}
+}
+
+static void K(scalehalf)(unsigned int *dst, const unsigned int *src,
+			 unsigned int count)
+{
+	unsigned int i = 0;
+
+	/* the last vector pair would read one pixel past the last input */
+	for (; i + VPIX < count; i += VPIX)
+		VSTORE32(dst + i, __builtin_shuffle(VLOAD32(src + 2 * i),
+						    VLOAD32(src + 2 * i +
+							    VPIX),
+						    SCALE_HALFMASK));
+	for (; i < count; i++)
+		dst[i] = src[2 * i];
+}
+
+/*
+ * Rotation.  Turned inputs are transposed in blocks of VPIX x VPIX pixels
+ * held in registers, in rounds that each swap the off-diagonal quarters
+ * of blocks half the size of the last round's.  Pixels reversed along a
+ * line take a single shuffle per vector.
+ */
+#define TURN_A(s, j)	(((j) & (s)) ? VPIX + (j) - (s) : (j))
+#define TURN_B(s, j)	(((j) & (s)) ? VPIX + (j) : (j) + (s))
+#define TURN_R(s, j)	(VPIX - 1 - (j))
+#if BVCPU_KVEC == 32
+#define TURN_MASK(f, s) \
+	(VU32){ f(s, 0), f(s, 1), f(s, 2), f(s, 3), \
+		f(s, 4), f(s, 5), f(s, 6), f(s, 7) }
+#else
+#define TURN_MASK(f, s) \
+	(VU32){ f(s, 0), f(s, 1), f(s, 2), f(s, 3) }
+#endif
+
+#define TURN_ROUND(r, s) \
+	do { \
+		unsigned int i_; \
+		for (i_ = 0; i_ < VPIX; i_++) { \
+			VU32 a_, b_; \
+			if (i_ & (s)) \
+				continue; \
+			a_ = (r)[i_]; \
+			b_ = (r)[i_ + (s)]; \
+			(r)[i_] = __builtin_shuffle(a_, b_, \
+						    TURN_MASK(TURN_A, s)); \
+			(r)[i_ + (s)] = __builtin_shuffle(a_, b_, \
+							  TURN_MASK(TURN_B, s)); \
+		} \
+	} while (0)
+
+static void K(transpose)(unsigned int *dst, long dstride,
+			 const unsigned int *src, long sstride,
+			 unsigned int w, unsigned int h)
+{
+	unsigned int x, y, i;
+
+	for (y = 0; y + VPIX <= h; y += VPIX) {
+		for (x = 0; x + VPIX <= w; x += VPIX) {
+			VU32 r[VPIX];
+			for (i = 0; i < VPIX; i++)
+				r[i] = VLOAD32(src + (long)(y + i) * sstride +
+					       x);
+#if BVCPU_KVEC == 32
+			TURN_ROUND(r, 4);
+#endif
+			TURN_ROUND(r, 2);
+			TURN_ROUND(r, 1);
+			for (i = 0; i < VPIX; i++)
+				VSTORE32(dst + (long)(x + i) * dstride + y,
+					 r[i]);
+		}
+		for (; x < w; x++)
+			for (i = 0; i < VPIX; i++)
+				dst[(long)x * dstride + y + i] =
+					src[(long)(y + i) * sstride + x];
+	}
+	for (; y < h; y++)
+		for (x = 0; x < w; x++)
+			dst[(long)x * dstride + y] = src[(long)y * sstride + x];
+}
+
+static void K(reverse)(unsigned int *dst, const unsigned int *src,
+		       unsigned int count)
+{
+	unsigned int i = 0;
+
+	for (; i + VPIX <= count; i += VPIX) {
+		VU32 p = VLOAD32(src + count - VPIX - i);
+		VSTORE32(dst + i, __builtin_shuffle(p, TURN_MASK(TURN_R, 0)));
+	}
+	for (; i < count; i++)
+		dst[i] = src[count - 1 - i];
+}
+
+#undef TURN_A
+#undef TURN_B
+#undef TURN_R
+#undef TURN_MASK
+#undef TURN_ROUND
+
+#undef V4S
+#undef V16B
+#undef V4U
+#undef VS32
+#undef SCALE_ROUND
+#undef SCALE_ALANE
+#undef SCALE_REPL
+#undef SCALE_REPMASK
+#undef SCALE_HALFMASK
+
+/*
+ * Packing of the reduced formats with ordered dithering (see
+ * bvcpudither.c).  Each component is reduced to the level at or below it,
+ * found by truncating and stepping down if the bit replicated expansion of
+ * the result is above the component, and then rounded up if its distance
+ * from that level exceeds the threshold.
+ */
+typedef unsigned short K(vh)
+	__attribute__((vector_size(BVCPU_KVEC / 2), aligned(1), may_alias));
+
+#define VH		K(vh)
+
+static inline __attribute__((always_inline)) VU32 K(dithc)(VU32 v, VU32 t,
+							   unsigned int bits)
+{
+	unsigned int sh = 8 - bits;
+	unsigned int rep = 2 * bits - 8;
+	VU32 q = v >> sh;
+
+	q += (VU32)(((q << sh) | (q >> rep)) > v);
+	return q - (VU32)(v - ((q << sh) | (q >> rep)) > t);
+}
+
+static inline __attribute__((always_inline)) VH K(dithpix)(VU32 p, VU32 t,
+							    unsigned int layout)
+{
+	VU32 r = (p >> 16) & 0xFF, g = (p >> 8) & 0xFF, b = p & 0xFF;
+	VU32 tr = (t >> 16) & 0xFF, tg = (t >> 8) & 0xFF, tb = t & 0xFF;
+	VU32 out;
+
+	switch (layout) {
+	case BVCPU_PACK16_RGB565:
+		out = (K(dithc)(r, tr, 5) << 11) | (K(dithc)(g, tg, 6) << 5) |
+			K(dithc)(b, tb, 5);
+		break;
+	case BVCPU_PACK16_BGR565:
+		out = (K(dithc)(b, tb, 5) << 11) | (K(dithc)(g, tg, 6) << 5) |
+			K(dithc)(r, tr, 5);
+		break;
+	default:
+		out = 0xF000 | (K(dithc)(r, tr, 4) << 8) |
+			(K(dithc)(g, tg, 4) << 4) | K(dithc)(b, tb, 4);
+		break;
+	}
+
+	return __builtin_convertvector(out, VH);
+}
+
+static inline __attribute__((always_inline)) void K(pack16n)(
+	unsigned short *dst, const unsigned int *src, const unsigned int *bias,
+	unsigned int layout, unsigned int count)
+{
+	unsigned int pat[VPIX];
+	unsigned int i = 0;
+	VU32 t;
+
+	/* the pattern repeats every 4 pixels, which divides VPIX */
+	for (i = 0; i < VPIX; i++)
+		pat[i] = bias[i & 3];
+	t = VLOAD32(pat);
+
+	for (i = 0; i + VPIX <= count; i += VPIX)
+		*(VH *)(dst + i) = K(dithpix)(VLOAD32(src + i), t, layout);
+
+	if (i < count) {
+		unsigned int b[VPIX] = { 0 };
+		unsigned short d[VPIX];
+		unsigned int n = count - i;
+		memcpy(b, src + i, n * 4);
+		*(VH *)d = K(dithpix)(VLOAD32(b), t, layout);
+		memcpy(dst + i, d, n * 2);
+	}
+}
+
+static void K(pack16)(unsigned short *dst, const unsigned int *src,
+		      const unsigned int *bias, unsigned int layout,
+		      unsigned int count)
+{
+	switch (layout) {
+	case BVCPU_PACK16_RGB565:
+		K(pack16n)(dst, src, bias, BVCPU_PACK16_RGB565, count);
+		break;
+	case BVCPU_PACK16_BGR565:
+		K(pack16n)(dst, src, bias, BVCPU_PACK16_BGR565, count);
+		break;
+	default:
+		K(pack16n)(dst, src, bias, BVCPU_PACK16_XRGB4444, count);
+		break;
+	}
+}
+
+/*
+ * Color keys.  A vector of pixels is loaded in the format of the keyed
+ * surface, widened to one lane per pixel, and compared with the key in a
+ * single step; the lanes that pass select the pixels of the line written.
+ * Pixels of 3 bytes are compared one at a time, without branching.
+ */
+static void K(keycmp)(unsigned int *m, const unsigned char *src,
+		      unsigned int bpp, unsigned int key, unsigned int care,
+		      int match, unsigned int count)
+{
+	VU32 k = (VU32){ 0 } + key;
+	VU32 c = (VU32){ 0 } + care;
+	VU32 flip = (VU32){ 0 } + (match ? 0 : ~0U);
+	unsigned int i = 0;
+	VU32 v;
+
+	for (; bpp != 3 && i + VPIX <= count; i += VPIX) {
+		if (bpp == 4)
+			v = VLOAD32(src + i * 4);
+		else if (bpp == 2)
+			v = __builtin_convertvector(*(const VH *)(src + i * 2),
+						    VU32);
+		else
+			v = VLOADPB(src + i);
+		VSTORE32(m + i, (VU32)(((v ^ k) & c) == 0) ^ flip);
+	}
+	for (; i < count; i++)
+		m[i] = -(unsigned int)(((bvcpu_pixload(src + i * bpp, bpp) ^
+					 key) & care) == 0) ^ flip[0];
+}
+
+static void K(keysel)(unsigned char *dst, const unsigned char *save,
+		      const unsigned int *m, unsigned int bpp,
+		      unsigned int count)
+{
+	unsigned int i = 0, j;
+
+	if (bpp == 4) {
+		for (; i + VPIX <= count; i += VPIX) {
+			VU32 d = VLOAD32(dst + i * 4);
+			VU32 s = VLOAD32(save + i * 4);
+			VSTORE32(dst + i * 4, s ^ ((s ^ d) & VLOAD32(m + i)));
+		}
+	} else if (bpp == 2) {
+		for (; i + VPIX <= count; i += VPIX) {
+			VH d = *(const VH *)(dst + i * 2);
+			VH s = *(const VH *)(save + i * 2);
+			VH c = __builtin_convertvector(VLOAD32(m + i), VH);
+			*(VH *)(dst + i * 2) = s ^ ((s ^ d) & c);
+		}
+	} else if (bpp == 1) {
+		for (; i + VPIX <= count; i += VPIX) {
+			VPB d = *(const VPB *)(dst + i);
+			VPB s = *(const VPB *)(save + i);
+			VPB c = __builtin_convertvector(VLOAD32(m + i), VPB);
+			*(VPB *)(dst + i) = s ^ ((s ^ d) & c);
+		}
+	}
+	for (; i < count; i++)
+		for (j = 0; j < bpp; j++)
+			dst[i * bpp + j] = (unsigned char)
+				(save[i * bpp + j] ^
+				 ((save[i * bpp + j] ^ dst[i * bpp + j]) &
+				  m[i]));
+}
+
+#undef VH
+
+const struct bvcpu_kernels K(bvcpu_kernels) = {
+	.name = BVCPU_KSTR(BVCPU_KISA),
+	.rop3 = K(rop3),
+	.rop4 = K(rop4),
+	.copy = K(copy),
+	.xor = K(xor),
+	.not = K(not),
+	.fill = K(fill),
+	.broadcast = K(broadcast),
+	.blend = K(blendtab),
+	.blendk = K(blendk),
+	.kinv = K(kinv),
+	.kmin = K(kmin),
+	.kmax = K(kmax),
+	.kalpha = K(kalpha),
+	.kmod = K(kmod),
+	.essential = K(esstab),
+	.scaleh = K(scaleh),
+	.scalev = K(scalev),
+	.scalenn = K(scalenn),
+	.scalerep = K(scalerep),
+	.scalehalf = K(scalehalf),
+	.transpose = K(transpose),
+	.reverse = K(reverse),
+	.keycmp = K(keycmp),
+	.keysel = K(keysel),
+	.pack16 = K(pack16),
+};
+
+#undef VU8
+#undef VU16
+#undef VU32
+#undef VPB
+#undef VPIX
+#undef VLOAD
+#undef VSTORE
+#undef VLOAD32
+#undef VSTORE32
+#undef VLOADPB
+#undef K
@@ -0,0 +1,184 @@
+/*
+ * bvcpukey.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains color keying.  The operations run as if there were no
+ * key, and the key only decides which of the pixels they write stay: the
+ * destination line is saved before it is written and the pixels the key
+ * holds back are selected from the saved line after.  So keys compose with
+ * every operation, scaling and dithering, at the cost of a copy of each
+ * line and a select.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+enum bverror bvcpu_keyvalidate(struct bvcpu_blt *blt)
+{
+	struct bvbltparams *params = blt->params;
+	struct bvcpu_key *key = &blt->key;
+	const struct bvcpu_format *fmt;
+	unsigned int ones = 0xFFFFFFFF, zeros = 0;
+	unsigned char p1[4], p0[4];
+
+	if (!(blt->flags & (BVFLAG_KEY_SRC | BVFLAG_KEY_DST)))
+		return BVERR_NONE;
+	if ((blt->flags & BVFLAG_KEY_SRC) && (blt->flags & BVFLAG_KEY_DST))
+		return bvcpu_err(params, BVERR_KEY,
+				 "source and destination keys exclusive");
+	if (!params->colorkey)
+		return bvcpu_err(params, BVERR_KEY,
+				 "bvbltparams.colorkey required");
+
+	if (blt->flags & BVFLAG_KEY_SRC) {
+		if (!(blt->uses & BVCPU_USES_SRC1))
+			return bvcpu_err(params, BVERR_KEY,
+					 "source key needs source 1");
+		key->in = &blt->src1;
+		fmt = blt->src1.surf.fmt;
+	} else {
+		key->match = 1;
+		fmt = blt->dst.fmt;
+	}
+
+	/* unpacked lines have no bits without a component */
+	if (key->in && key->in->scaled) {
+		fmt->unpack(fmt, params->colorkey, &key->value, 1);
+		if ((blt->flags & BVFLAG_OP_MASK) == BVFLAG_BLEND &&
+		    (fmt->flags & BVCPU_FMT_NONPREMULT))
+			bvcpu_premultiply(&key->value, 1);
+		key->care = 0xFFFFFFFF;
+		key->bpp = 4;
+		return BVERR_NONE;
+	}
+
+	/* bits packed the same from black and white hold no component */
+	fmt->pack(fmt, &ones, p1, 1);
+	fmt->pack(fmt, &zeros, p0, 1);
+	key->bpp = fmt->bpp;
+	key->value = bvcpu_pixload(params->colorkey, fmt->bpp);
+	key->care = bvcpu_pixload(p1, fmt->bpp) ^
+		bvcpu_pixload(p0, fmt->bpp);
+	return BVERR_NONE;
+}
+
+enum bverror bvcpu_keystart(struct bvcpu_blt *blt, unsigned int nslot)
+{
+	struct bvcpu_key *key = &blt->key;
+	unsigned long mpitch = BVCPU_ROWSIZE((unsigned long)blt->width * 4);
+
+	if (!key->bpp)
+		return BVERR_NONE;
+	key->pitch = BVCPU_ROWSIZE((unsigned long)blt->width *
+				   blt->dst.fmt->bpp);
+	key->mask = aligned_alloc(BVCPU_ROWALIGN,
+				  nslot * (mpitch + key->pitch));
+	if (!key->mask)
+		return bvcpu_err(blt->params, BVERR_OOM,
+				 "out of memory for color keying");
+	key->save = (unsigned char *)key->mask + nslot * mpitch;
+	return BVERR_NONE;
+}
+
+/*
+ * bvcpu_keymask() - The line of pixels written held in slot.
+ */
+static unsigned int *bvcpu_keymask(const struct bvcpu_blt *blt,
+				   unsigned int slot)
+{
+	return blt->key.mask + slot *
+		(BVCPU_ROWSIZE((unsigned long)blt->width * 4) / 4);
+}
+
+void bvcpu_keyget(struct bvcpu_blt *blt, int y, unsigned int slot)
+{
+	const struct bvcpu_key *key = &blt->key;
+	const struct bvcpu_input *in = key->in;
+	const unsigned char *d;
+	const unsigned char *p;
+
+	if (!key->bpp)
+		return;
+	d = bvcpu_pixaddr(&blt->dst, blt->dstx, blt->dsty + y);
+	memcpy(key->save + slot * key->pitch, d,
+	       (unsigned long)blt->width * blt->dst.fmt->bpp);
+
+	if (!in)
+		p = d;
+	else if (in->scaler)
+		p = (const unsigned char *)bvcpu_scaleline(in, y);
+	else
+		p = bvcpu_pixaddr(&in->surf, in->x, in->y + y);
+	bvcpu_kern->keycmp(bvcpu_keymask(blt, slot), p, key->bpp, key->value,
+			   key->care, key->match, blt->width);
+}
+
+void bvcpu_keyput(struct bvcpu_blt *blt, int y, unsigned int slot)
+{
+	const struct bvcpu_key *key = &blt->key;
+
+	if (!key->bpp)
+		return;
+	bvcpu_kern->keysel(bvcpu_pixaddr(&blt->dst, blt->dstx, blt->dsty + y),
+			   key->save + slot * key->pitch,
+			   bvcpu_keymask(blt, slot), blt->dst.fmt->bpp,
+			   blt->width);
+}
+
+/*
+ * bvcpu_keycopy() - Copy source 1 through a source key in one pass, when
+ * it is in the destination format and read in place clear of the
+ * destination: the key test selects between the source and destination
+ * pixels directly, and nothing is saved.  Returns 0 if the BLT is not
+ * such a copy, or memory ran out.
+ */
+int bvcpu_keycopy(struct bvcpu_blt *blt)
+{
+	const struct bvcpu_key *key = &blt->key;
+	const struct bvcpu_input *in = key->in;
+	unsigned int *m;
+	unsigned int y;
+
+	if (!in || in->scaler || in->surf.fmt != blt->dst.fmt ||
+	    bvcpu_hazard(blt, in))
+		return 0;
+	m = aligned_alloc(BVCPU_ROWALIGN,
+			  BVCPU_ROWSIZE((unsigned long)blt->width * 4));
+	if (!m)
+		return 0;
+
+	/* the mask keeps the destination where the source has the key */
+	for (y = 0; y < blt->height; y++) {
+		const unsigned char *s = bvcpu_pixaddr(&in->surf, in->x,
+						       in->y + (int)y);
+		bvcpu_kern->keycmp(m, s, key->bpp, key->value, key->care,
+				   !key->match, blt->width);
+		bvcpu_kern->keysel(bvcpu_pixaddr(&blt->dst, blt->dstx,
+						 blt->dsty + (int)y),
+				   s, m, key->bpp, blt->width);
+	}
+
+	free(m);
+	return 1;
+}
+
+void bvcpu_keyend(struct bvcpu_blt *blt)
+{
+	free(blt->key.mask);
+	blt->key.mask = NULL;
+	blt->key.save = NULL;
+}
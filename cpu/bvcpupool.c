@@ -0,0 +1,331 @@
+/*
+ * bvcpupool.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the worker pool used to spread a BLT over the CPUs,
+ * and the splitting of large BLTs into bands of destination lines.
+ *
+ * The workers are started the first time they are needed and live as long
+ * as the process.  A job is a function that takes pieces of work from a
+ * shared counter until none are left; the caller runs it too, and workers
+ * join it as they come free, so a job finishes even when every worker is
+ * busy with others.
+ *
+ * Bands are run as separate BLTs of the same mapping, clipped to their
+ * lines.  Scaling weights are indexed by the position in the destination
+ * rectangle and ordered dithers by destination coordinates, so the bands
+ * produce exactly the pixels of the whole BLT.  BLTs that read what other
+ * bands write, and error diffusion, which carries from line to line, are
+ * not split.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "bvcpu.h"
+
+/*
+ * BVCPU_BANDMIN - Pixels a BLT must write to be split into bands.
+ * BVCPU_BANDPIXELS - Pixels in a band: the intermediate lines of a band
+ * stay in a core's cache, and each band amortizes the setup of its
+ * scalers.
+ * BVCPU_BANDREDO - Bands are at least this many times the lines the
+ * vertical filters of neighboring bands both read, which are scaled
+ * horizontally by each.
+ */
+#define BVCPU_BANDMIN		(256 * 1024)
+#define BVCPU_BANDPIXELS	(64 * 1024)
+#define BVCPU_BANDLINESMIN	16
+#define BVCPU_BANDREDO		8
+
+/*
+ * bvcpu_job - A function run by the caller and up to helpers workers.
+ */
+struct bvcpu_job {
+	void (*fn)(void *arg);
+	void *arg;
+	unsigned int helpers;		/* workers still wanted */
+	unsigned int active;		/* workers running fn */
+	struct bvcpu_job *next;
+};
+
+static pthread_mutex_t bvcpu_poollock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bvcpu_poolwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t bvcpu_pooldone = PTHREAD_COND_INITIALIZER;
+static pthread_once_t bvcpu_poolonce = PTHREAD_ONCE_INIT;
+static struct bvcpu_job *bvcpu_jobs;
+static unsigned int bvcpu_nworkers;
+
+/*
+ * bvcpu_queue() - Put a job at the end of the queue, and bvcpu_unqueue()
+ * take it off.  Called with the lock held.
+ */
+static void bvcpu_queue(struct bvcpu_job *job)
+{
+	struct bvcpu_job **link = &bvcpu_jobs;
+
+	while (*link)
+		link = &(*link)->next;
+	*link = job;
+}
+
+static void bvcpu_unqueue(struct bvcpu_job *job)
+{
+	struct bvcpu_job **link;
+
+	for (link = &bvcpu_jobs; *link; link = &(*link)->next) {
+		if (*link == job) {
+			*link = job->next;
+			break;
+		}
+	}
+}
+
+static void *bvcpu_worker(void *arg)
+{
+	struct bvcpu_job *job;
+
+	pthread_mutex_lock(&bvcpu_poollock);
+	for (;;) {
+		while (!bvcpu_jobs)
+			pthread_cond_wait(&bvcpu_poolwork, &bvcpu_poollock);
+		job = bvcpu_jobs;
+		if (!--job->helpers)
+			bvcpu_jobs = job->next;
+		job->active++;
+		pthread_mutex_unlock(&bvcpu_poollock);
+
+		job->fn(job->arg);
+
+		pthread_mutex_lock(&bvcpu_poollock);
+		if (!--job->active)
+			pthread_cond_broadcast(&bvcpu_pooldone);
+	}
+
+	return NULL;
+}
+
+/*
+ * bvcpu_poolinit() - Start a worker for each CPU but the caller's.
+ * Workers that fail to start leave the work to the others.
+ */
+static void bvcpu_poolinit(void)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+	unsigned int i;
+
+	if (pthread_attr_init(&attr))
+		return;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 1; i < bvcpu_ncpus; i++)
+		if (!pthread_create(&tid, &attr, bvcpu_worker, NULL))
+			bvcpu_nworkers++;
+	pthread_attr_destroy(&attr);
+}
+
+void bvcpu_poolrun(void (*fn)(void *arg), void *arg, unsigned int threads)
+{
+	struct bvcpu_job job;
+
+	if (threads > 1)
+		pthread_once(&bvcpu_poolonce, bvcpu_poolinit);
+	job.fn = fn;
+	job.arg = arg;
+	job.helpers = threads > 1 ? threads - 1 : 0;
+	if (job.helpers > bvcpu_nworkers)
+		job.helpers = bvcpu_nworkers;
+	job.active = 0;
+	job.next = NULL;
+	if (!job.helpers) {
+		fn(arg);
+		return;
+	}
+
+	pthread_mutex_lock(&bvcpu_poollock);
+	bvcpu_queue(&job);
+	pthread_cond_broadcast(&bvcpu_poolwork);
+	pthread_mutex_unlock(&bvcpu_poollock);
+
+	fn(arg);
+
+	/* workers that have not joined yet would find nothing left */
+	pthread_mutex_lock(&bvcpu_poollock);
+	if (job.helpers)
+		bvcpu_unqueue(&job);
+	while (job.active)
+		pthread_cond_wait(&bvcpu_pooldone, &bvcpu_poollock);
+	pthread_mutex_unlock(&bvcpu_poollock);
+}
+
+/*
+ * bvcpu_bandsafe() - Whether an input may be read by bands running at the
+ * same time: it does not share bytes with the region written, or it is
+ * read in place at the very pixels written, so each band only reads the
+ * lines it writes.
+ */
+static int bvcpu_bandsafe(const struct bvcpu_blt *blt,
+			  const struct bvcpu_input *in)
+{
+	struct bvrect dr = {
+		blt->dstx, blt->dsty, blt->width, blt->height
+	};
+	struct bvrect box;
+
+	if (!in->scaled)
+		return !bvcpu_hazard(blt, in) || bvcpu_inplace(blt, in);
+	bvcpu_readbox(blt, in, &box);
+	return !bvcpu_overlap(&in->surf, &box, &blt->dst, &dr);
+}
+
+/*
+ * bvcpu_bandredo() - Destination lines' worth of source lines read by
+ * both of two neighboring bands through the vertical filter of an input.
+ */
+static unsigned int bvcpu_bandredo(const struct bvcpu_blt *blt,
+				   const struct bvcpu_input *in)
+{
+	unsigned int taps;
+
+	if (!in->scaled || in->height == in->dstrect.height)
+		return 0;
+	taps = bvcpu_scaletaps(blt->vfilter, in->height, in->dstrect.height);
+	return (unsigned int)(((unsigned long)(taps - 1) *
+			       in->dstrect.height + in->height - 1) /
+			      in->height);
+}
+
+/*
+ * bvcpu_bandlines() - Lines per band of count BLTs writing the same
+ * region, or 0 if they are run whole.
+ */
+static unsigned int bvcpu_bandlines(const struct bvcpu_blt *blts,
+				    unsigned int count)
+{
+	const struct bvcpu_blt *blt = blts;
+	unsigned int lines, redo = 0, r, i;
+
+	if (bvcpu_ncpus < 2 ||
+	    (unsigned long)blt->width * blt->height * count < BVCPU_BANDMIN)
+		return 0;
+	for (i = 0; i < count; i++) {
+		blt = &blts[i];
+		if (blt->dither == BVCPU_DITHER_DIFFUSED)
+			return 0;
+		if (((blt->uses & BVCPU_USES_SRC1) &&
+		     !bvcpu_bandsafe(blt, &blt->src1)) ||
+		    ((blt->uses & BVCPU_USES_SRC2) &&
+		     !bvcpu_bandsafe(blt, &blt->src2)) ||
+		    ((blt->uses & BVCPU_USES_MASK) &&
+		     !bvcpu_bandsafe(blt, &blt->mask)))
+			return 0;
+
+		if ((blt->uses & BVCPU_USES_SRC1) &&
+		    (r = bvcpu_bandredo(blt, &blt->src1)) > redo)
+			redo = r;
+		if ((blt->uses & BVCPU_USES_SRC2) &&
+		    (r = bvcpu_bandredo(blt, &blt->src2)) > redo)
+			redo = r;
+		if ((blt->uses & BVCPU_USES_MASK) &&
+		    (r = bvcpu_bandredo(blt, &blt->mask)) > redo)
+			redo = r;
+	}
+
+	lines = BVCPU_BANDPIXELS / blt->width;
+	if (lines < BVCPU_BANDLINESMIN)
+		lines = BVCPU_BANDLINESMIN;
+	if (lines < BVCPU_BANDREDO * redo)
+		lines = BVCPU_BANDREDO * redo;
+	return lines < blt->height ? lines : 0;
+}
+
+/*
+ * bvcpu_bands - The bands of the BLTs, taken in order by the threads
+ * running them.
+ */
+struct bvcpu_bands {
+	const struct bvcpu_blt *blts;
+	unsigned int nblts;
+	enum bverror (*run)(struct bvcpu_blt *blt, unsigned int count);
+	unsigned int lines;
+	unsigned int count;
+	unsigned int next;
+	enum bverror err;		/* first error */
+};
+
+/*
+ * bvcpu_bandinput() - Move an input read in place down to line y of the
+ * BLT.  Scalers find their lines from the destination position.
+ */
+static void bvcpu_bandinput(struct bvcpu_input *in, int y)
+{
+	if (in->scaled)
+		return;
+	in->x += y * in->vx;
+	in->y += y * in->vy;
+}
+
+static void bvcpu_bandworker(void *arg)
+{
+	struct bvcpu_bands *b = arg;
+	struct bvcpu_blt band[BVCPU_MAXLAYERS];
+	enum bverror err;
+	unsigned int i, j;
+
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) <
+	       b->count) {
+		unsigned int y = i * b->lines;
+		unsigned int height = b->blts->height - y < b->lines ?
+			b->blts->height - y : b->lines;
+
+		for (j = 0; j < b->nblts; j++) {
+			band[j] = b->blts[j];
+			band[j].dsty += (int)y;
+			band[j].height = height;
+			bvcpu_bandinput(&band[j].src1, (int)y);
+			bvcpu_bandinput(&band[j].src2, (int)y);
+			bvcpu_bandinput(&band[j].mask, (int)y);
+			if (band[j].key.in)
+				band[j].key.in = &band[j].src1;
+		}
+
+		err = b->run(band, b->nblts);
+		if (err != BVERR_NONE) {
+			enum bverror none = BVERR_NONE;
+			__atomic_compare_exchange_n(&b->err, &none, err, 0,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED);
+		}
+	}
+}
+
+enum bverror bvcpu_bandrun(struct bvcpu_blt *blt, unsigned int count,
+			   enum bverror (*run)(struct bvcpu_blt *blt,
+					       unsigned int count))
+{
+	struct bvcpu_bands b;
+
+	b.lines = bvcpu_bandlines(blt, count);
+	if (!b.lines)
+		return run(blt, count);
+	b.blts = blt;
+	b.nblts = count;
+	b.run = run;
+	b.count = (blt->height + b.lines - 1) / b.lines;
+	b.next = 0;
+	b.err = BVERR_NONE;
+	bvcpu_poolrun(bvcpu_bandworker, &b, b.count);
+	return b.err;
+}
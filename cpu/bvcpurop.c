@@ -0,0 +1,441 @@
+/*
+ * bvcpurop.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the raster operations (BVFLAG_ROP).  ROPs work on the
+ * bits of the destination format, so sources in other formats, and scaled
+ * sources, are converted to the destination format one line at a time
+ * before the ROP kernel runs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * bvcpu_ropuses() - Find the inputs a ROP4 depends on.  An input matters if
+ * flipping its bit changes the result for any combination of the others.
+ */
+unsigned int bvcpu_ropuses(unsigned short rop)
+{
+	unsigned int uses = 0;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++) {
+		unsigned int bit = (rop >> i) & 1;
+		if (bit != ((rop >> (i ^ 1)) & 1u))
+			uses |= BVCPU_USES_DST;
+		if (bit != ((rop >> (i ^ 2)) & 1u))
+			uses |= BVCPU_USES_SRC1;
+		if (bit != ((rop >> (i ^ 4)) & 1u))
+			uses |= BVCPU_USES_SRC2;
+		if (bit != ((rop >> (i ^ 8)) & 1u))
+			uses |= BVCPU_USES_MASK;
+	}
+
+	return uses;
+}
+
+static void bvcpu_ropconst(unsigned short rop, struct bvcpu_ropconst *rc)
+{
+	unsigned int j;
+
+	for (j = 0; j < 8; j++) {
+		unsigned int b0 = (rop >> (2 * j)) & 1;
+		unsigned int b1 = (rop >> (2 * j + 1)) & 1;
+		rc->c0[j] = b0 ? 0xFF : 0x00;
+		rc->cx[j] = (b0 ^ b1) ? 0xFF : 0x00;
+	}
+}
+
+/*
+ * bvcpu_ropsrc - Row source for one ROP input.  row is 0 when the input is
+ * read in place.  Inputs converted with error diffusion are converted
+ * whole into image before the ROP runs.
+ */
+struct bvcpu_ropsrc {
+	const struct bvcpu_input *in;
+	unsigned char *row;
+	unsigned char *image;
+};
+
+static const unsigned char *bvcpu_ropfetch(struct bvcpu_blt *blt,
+					   struct bvcpu_ropsrc *src,
+					   int y, unsigned int *tmp)
+{
+	const struct bvcpu_input *in = src->in;
+	const struct bvcpu_format *dfmt = blt->dst.fmt;
+	const unsigned char *p;
+
+	if (src->image)
+		return src->image + (unsigned long)y *
+			BVCPU_ROWSIZE((unsigned long)blt->width * dfmt->bpp);
+
+	if (in->scaler) {
+		const unsigned int *bias = bvcpu_ditherbias(blt, y);
+		const unsigned int *line;
+		int fix;
+		/* spans of a tile are packed once, unless dithered */
+		if (!bias) {
+			p = bvcpu_scalepacked(in, y, dfmt);
+			if (p)
+				return p;
+		}
+		line = bvcpu_scaleline(in, y);
+		fix = bvcpu_alphafix(in->surf.fmt, dfmt);
+		if (fix) {
+			memcpy(tmp, line, blt->width * 4);
+			if (fix > 0)
+				bvcpu_premultiply(tmp, blt->width);
+			else
+				bvcpu_unpremultiply(tmp, blt->width);
+			line = tmp;
+		}
+		bvcpu_pack(dfmt, line, src->row, blt->width, bias);
+		return src->row;
+	}
+
+	p = bvcpu_pixaddr(&in->surf, in->x, in->y + y);
+	if (!src->row)
+		return p;
+	bvcpu_convert(in->surf.fmt, p, blt->dst.fmt, src->row, tmp,
+		      blt->width, bvcpu_ditherbias(blt, y));
+	return src->row;
+}
+
+/*
+ * bvcpu_ropdiffuse() - Convert a whole input to the destination format
+ * with error diffusion.  Failures are reported in errdesc here, as the
+ * blend path does.
+ */
+static enum bverror bvcpu_ropdiffuse(struct bvcpu_blt *blt,
+				     struct bvcpu_ropsrc *src)
+{
+	const struct bvcpu_input *in = src->in;
+	const struct bvcpu_format *dfmt = blt->dst.fmt;
+	unsigned long rowsize =
+		BVCPU_ROWSIZE((unsigned long)blt->width * dfmt->bpp);
+	unsigned int *stage;
+	unsigned int y;
+	enum bverror err;
+
+	stage = malloc((size_t)blt->width * blt->height * 4);
+	src->image = aligned_alloc(BVCPU_ROWALIGN, rowsize * blt->height);
+	if (!stage || !src->image) {
+		free(stage);
+		return bvcpu_err(blt->params, BVERR_OOM,
+				 "out of memory for error diffusion");
+	}
+
+	for (y = 0; y < blt->height; y++) {
+		unsigned int *line = stage + (unsigned long)y * blt->width;
+		if (in->scaler) {
+			int fix = bvcpu_alphafix(in->surf.fmt, dfmt);
+			memcpy(line, bvcpu_scaleline(in, (int)y),
+			       blt->width * 4);
+			if (fix > 0)
+				bvcpu_premultiply(line, blt->width);
+			else if (fix < 0)
+				bvcpu_unpremultiply(line, blt->width);
+		} else {
+			bvcpu_unpackfor(in->surf.fmt,
+					bvcpu_pixaddr(&in->surf, in->x,
+						      in->y + (int)y),
+					dfmt, line, blt->width);
+		}
+	}
+
+	err = bvcpu_diffuse(dfmt, stage, src->image, (long)rowsize,
+			    blt->width, blt->height, 0);
+	free(stage);
+	if (err != BVERR_NONE)
+		return bvcpu_err(blt->params, err,
+				 "out of memory for error diffusion");
+	return BVERR_NONE;
+}
+
+/*
+ * bvcpu_ropmask() - Expand a line of the mask into one byte of all 0s or
+ * all 1s per destination byte.  Mask pixels with alpha of at least one half
+ * select the upper half of the ROP4.
+ */
+static void bvcpu_ropmask(struct bvcpu_blt *blt, int y, unsigned char *row,
+			  unsigned int *tmp)
+{
+	const struct bvcpu_input *in = &blt->mask;
+	const struct bvcpu_format *fmt = in->surf.fmt;
+	const unsigned int *line = tmp;
+	unsigned int bpp = blt->dst.fmt->bpp;
+	unsigned int i, j;
+
+	if (in->scaler)
+		line = bvcpu_scaleline(in, y);
+	else
+		fmt->unpack(fmt, bvcpu_pixaddr(&in->surf, in->x, in->y + y),
+			    tmp, blt->width);
+	for (i = 0; i < blt->width; i++) {
+		unsigned char m = (line[i] & 0x80000000) ? 0xFF : 0x00;
+		for (j = 0; j < bpp; j++)
+			*row++ = m;
+	}
+}
+
+/*
+ * bvcpu_ropfill() - BLACKNESS and WHITENESS.
+ */
+static void bvcpu_ropfill(struct bvcpu_blt *blt, unsigned char value)
+{
+	unsigned long count = (unsigned long)blt->width * blt->dst.fmt->bpp;
+	unsigned int y;
+
+	for (y = 0; y < blt->height; y++)
+		bvcpu_kern->fill(bvcpu_pixaddr(&blt->dst, blt->dstx,
+					       blt->dsty + (int)y),
+				 value, count);
+}
+
+/*
+ * bvcpu_ropsolid() - Copy a tile of one pixel, which is a solid fill of
+ * it.  Returns 0 if the pixel could not be packed.
+ */
+static int bvcpu_ropsolid(struct bvcpu_blt *blt, const struct bvcpu_input *in)
+{
+	const struct bvcpu_format *dfmt = blt->dst.fmt;
+	const unsigned char *pixel = bvcpu_scalepacked(in, 0, dfmt);
+	unsigned int y;
+
+	if (!pixel)
+		return 0;
+	for (y = 0; y < blt->height; y++)
+		bvcpu_kern->broadcast(bvcpu_pixaddr(&blt->dst, blt->dstx,
+						    blt->dsty + (int)y),
+				      pixel, dfmt->bpp,
+				      (unsigned long)blt->width * dfmt->bpp);
+	return 1;
+}
+
+enum bverror bvcpu_rop(struct bvcpu_blt *blt)
+{
+	unsigned short rop = blt->params->op.rop;
+	const struct bvcpu_format *dfmt = blt->dst.fmt;
+	unsigned long count = (unsigned long)blt->width * dfmt->bpp;
+	unsigned long rowsize = BVCPU_ROWSIZE(count);
+	struct bvcpu_ropsrc src[2] = { { 0 } };
+	unsigned int nsrc = 0;
+	struct bvcpu_ropconst rc;
+	bvcpu_ropfn fn;
+	int generic = 0;
+	int inplace = 0;
+	int bottomup = 0;
+	int diffuse = 0;
+	unsigned char *zero = NULL;
+	unsigned char *maskrow = NULL;
+	unsigned int *tmp = NULL;
+	unsigned char *scratch;
+	unsigned char *next;
+	unsigned long size;
+	enum bverror err;
+	unsigned int i;
+	int y, yend, ystep;
+
+	switch (rop) {
+	case BVCPU_ROP_NOP:
+		return BVERR_NONE;
+	case BVCPU_ROP_SRCCOPY:
+		fn = bvcpu_kern->copy;
+		src[nsrc++].in = &blt->src1;
+		inplace = 1;
+		break;
+	case BVCPU_ROP_PATCOPY:
+		fn = bvcpu_kern->copy;
+		src[nsrc++].in = &blt->src2;
+		inplace = 1;
+		break;
+	case BVCPU_ROP_SRCINVERT:
+		fn = bvcpu_kern->xor;
+		src[nsrc++].in = &blt->src1;
+		break;
+	case BVCPU_ROP_PATINVERT:
+		fn = bvcpu_kern->xor;
+		src[nsrc++].in = &blt->src2;
+		break;
+	case BVCPU_ROP_DSTINVERT:
+		fn = bvcpu_kern->not;
+		break;
+	case BVCPU_ROP_BLACKNESS:
+	case BVCPU_ROP_WHITENESS:
+		/* keyed fills go through the generic kernel */
+		if (!blt->key.bpp) {
+			bvcpu_ropfill(blt, rop == BVCPU_ROP_WHITENESS ?
+				      0xFF : 0x00);
+			return BVERR_NONE;
+		}
+		/* fall through */
+	default:
+		generic = 1;
+		bvcpu_ropconst(rop, &rc);
+		if (blt->uses & BVCPU_USES_MASK)
+			fn = bvcpu_kern->rop4;
+		else
+			fn = bvcpu_kern->rop3;
+		src[0].in = (blt->uses & BVCPU_USES_SRC1) ? &blt->src1 : NULL;
+		src[1].in = (blt->uses & BVCPU_USES_SRC2) ? &blt->src2 : NULL;
+		nsrc = 2;
+		break;
+	}
+
+	if (fn == bvcpu_kern->copy && src[0].in->tile &&
+	    src[0].in->tw == 1 && src[0].in->th == 1 &&
+	    blt->dither == BVCPU_DITHER_NONE && !blt->key.bpp &&
+	    bvcpu_ropsolid(blt, src[0].in))
+		return BVERR_NONE;
+	if (rop == BVCPU_ROP_SRCCOPY && blt->key.in &&
+	    blt->dither == BVCPU_DITHER_NONE && bvcpu_keycopy(blt))
+		return BVERR_NONE;
+
+	/*
+	 * Work out which lines need scratch space: sources in a different
+	 * format, sources overlapping the destination (unless the kernel is
+	 * a memmove()), the expanded mask, and a line of 0s standing in for
+	 * inputs the generic kernels read but the ROP ignores.
+	 */
+	size = 0;
+	for (i = 0; i < nsrc; i++) {
+		const struct bvcpu_input *in = src[i].in;
+		int overlap;
+		if (!in) {
+			if (!zero) {
+				zero = (unsigned char *)1;
+				size += rowsize;
+			}
+			continue;
+		}
+		if (blt->dither == BVCPU_DITHER_DIFFUSED &&
+		    (in->scaler || in->surf.fmt != dfmt)) {
+			/* converted before anything is written */
+			diffuse = 1;
+			continue;
+		}
+		if (in->scaler) {
+			/* scaled lines are packed into the destination format */
+			src[i].row = (unsigned char *)1;
+			size += rowsize;
+			if (bvcpu_alphafix(in->surf.fmt, dfmt))
+				tmp = (unsigned int *)1;
+			continue;
+		}
+		overlap = bvcpu_hazard(blt, in);
+		if (overlap < 0)
+			bottomup = 1;
+		if (in->surf.fmt != dfmt || (overlap && !inplace)) {
+			src[i].row = (unsigned char *)1;
+			size += rowsize;
+		}
+		if (in->surf.fmt != dfmt)
+			tmp = (unsigned int *)1;
+	}
+	if (generic && (blt->uses & BVCPU_USES_MASK)) {
+		maskrow = (unsigned char *)1;
+		tmp = (unsigned int *)1;
+		size += rowsize;
+	}
+	if (tmp)
+		size += BVCPU_ROWSIZE((unsigned long)blt->width * 4);
+
+	scratch = NULL;
+	if (size) {
+		scratch = aligned_alloc(BVCPU_ROWALIGN, size);
+		if (!scratch)
+			return bvcpu_err(blt->params, BVERR_OOM,
+					 "out of memory for line buffers");
+		next = scratch;
+		for (i = 0; i < nsrc; i++) {
+			if (src[i].row) {
+				src[i].row = next;
+				next += rowsize;
+			}
+		}
+		if (zero) {
+			zero = next;
+			memset(zero, 0, count);
+			next += rowsize;
+		}
+		if (maskrow) {
+			maskrow = next;
+			next += rowsize;
+		}
+		if (tmp)
+			tmp = (unsigned int *)next;
+	}
+
+	if (diffuse) {
+		for (i = 0; i < nsrc; i++) {
+			if (!src[i].in ||
+			    (!src[i].in->scaler && src[i].in->surf.fmt == dfmt))
+				continue;
+			err = bvcpu_ropdiffuse(blt, &src[i]);
+			if (err != BVERR_NONE) {
+				for (i = 0; i < nsrc; i++)
+					free(src[i].image);
+				free(scratch);
+				return err;
+			}
+		}
+	}
+
+	err = bvcpu_keystart(blt, 1);
+	if (err != BVERR_NONE) {
+		for (i = 0; i < nsrc; i++)
+			free(src[i].image);
+		free(scratch);
+		return err;
+	}
+
+	if (!generic)
+		memset(&rc, 0, sizeof(rc));
+
+	if (bottomup) {
+		y = (int)blt->height - 1;
+		yend = -1;
+		ystep = -1;
+	} else {
+		y = 0;
+		yend = (int)blt->height;
+		ystep = 1;
+	}
+
+	for (; y != yend; y += ystep) {
+		unsigned char *d = bvcpu_pixaddr(&blt->dst, blt->dstx,
+						 blt->dsty + y);
+		const unsigned char *s[2] = { zero, zero };
+
+		bvcpu_keyget(blt, y, 0);
+		for (i = 0; i < nsrc; i++)
+			if (src[i].in)
+				s[i] = bvcpu_ropfetch(blt, &src[i], y, tmp);
+		if (maskrow)
+			bvcpu_ropmask(blt, y, maskrow, tmp);
+
+		fn(d, s[0], s[1], maskrow, count, &rc);
+		bvcpu_keyput(blt, y, 0);
+	}
+
+	bvcpu_keyend(blt);
+	for (i = 0; i < nsrc; i++)
+		free(src[i].image);
+	free(scratch);
+	return BVERR_NONE;
+}
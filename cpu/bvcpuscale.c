@@ -0,0 +1,1019 @@
+/*
+ * bvcpuscale.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the scaler used for inputs whose rectangle differs in
+ * size from the destination rectangle.  Scaling is separable: source lines
+ * are unpacked and scaled horizontally into a ring of intermediate lines,
+ * one per vertical tap, and each destination line is a weighted sum of the
+ * lines in the ring.  The weights of a (source size, destination size,
+ * filter) combination are computed once and kept in a cache shared by all
+ * threads, since the same ratios tend to be used for many BLTs in a row.
+ * Nearest neighbor has no weights; its cached index map is used to copy
+ * whole pixels.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bvcpu.h"
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+/*
+ * bvcpu_coefs - Filter weights for one direction.  Output i is the sum of
+ * w[i * taps + t] x input[start[i] + t].  Taps that fall outside the source
+ * have already been folded onto the edge pixels, so start[i] + taps never
+ * exceeds src.  Nearest neighbor has no weights; start is the index map.
+ */
+struct bvcpu_coefs {
+	unsigned int src;
+	unsigned int dst;
+	unsigned char filter;		/* BVSCALEDEF_NEAREST_NEIGHBOR... */
+	unsigned int taps;
+	unsigned int rep;		/* nearest: exact 2x, 3x or 4x */
+	int half;			/* nearest: exact 1/2 */
+	struct bvcpu_coefslot *slot;	/* cache entry holding them, or 0 */
+	int *start;
+	short *w;
+};
+
+/*
+ * bvcpu_scalefilter() - Decode one direction of an explicit scale mode.
+ */
+static int bvcpu_scalefilter(unsigned int f)
+{
+	switch (f) {
+	case BVSCALEDEF_NEAREST_NEIGHBOR:
+	case BVSCALEDEF_LINEAR:
+	case BVSCALEDEF_CUBIC:
+	case BVSCALEDEF_3_TAP:
+	case BVSCALEDEF_5_TAP:
+	case BVSCALEDEF_7_TAP:
+	case BVSCALEDEF_9_TAP:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * bvcpu_scalemode() - Decode the scale mode, the first time an input is
+ * found to be scaled from rect onto dstrect.  Implicit modes are resolved
+ * by the cost model for the ratio of that input, and the explicit mode
+ * chosen is written back if the client asked for it.
+ */
+enum bverror bvcpu_scalemode(struct bvcpu_blt *blt, const struct bvrect *rect,
+			     const struct bvrect *dstrect)
+{
+	struct bvbltparams *params = blt->params;
+	unsigned long mode = (unsigned int)params->scalemode;
+
+	if (blt->scaled)
+		return BVERR_NONE;
+
+	switch (mode >> BVSCALEDEF_VENDOR_SHIFT) {
+	case BVSCALEDEF_VENDOR_ALL >> BVSCALEDEF_VENDOR_SHIFT:
+		if ((mode & BVSCALEDEF_CLASS_MASK) != BVSCALEDEF_IMPLICIT)
+			break;
+		bvcpu_choosescale(mode, rect->width, rect->height,
+				  dstrect->width, dstrect->height, &blt->hfilter,
+				  &blt->vfilter);
+		blt->scaled = 1;
+		if (params->flags & BVFLAG_SCALE_RETURN)
+			params->scalemode = (enum bvscalemode)
+				((0xFFUL << BVSCALEDEF_VENDOR_SHIFT) |
+				 BVSCALEDEF_EXPLICIT |
+				 ((unsigned long)blt->hfilter <<
+				  BVSCALEDEF_HORZ_SHIFT) |
+				 ((unsigned long)blt->vfilter <<
+				  BVSCALEDEF_VERT_SHIFT));
+		return BVERR_NONE;
+	case 0xFF:	/* BVSCALEDEF_VENDOR_GENERIC */
+		if ((mode & ((1UL << BVSCALEDEF_VENDOR_SHIFT) - 1) &
+		     ~(unsigned long)(BVSCALEDEF_HORZ_MASK |
+				      BVSCALEDEF_VERT_MASK)) !=
+		    BVSCALEDEF_EXPLICIT)
+			break;
+		blt->hfilter = (unsigned char)((mode & BVSCALEDEF_HORZ_MASK) >>
+					       BVSCALEDEF_HORZ_SHIFT);
+		blt->vfilter = (unsigned char)((mode & BVSCALEDEF_VERT_MASK) >>
+					       BVSCALEDEF_VERT_SHIFT);
+		if (!bvcpu_scalefilter(blt->hfilter) ||
+		    !bvcpu_scalefilter(blt->vfilter))
+			break;
+		blt->scaled = 1;
+		return BVERR_NONE;
+	}
+
+	return bvcpu_err(params, BVERR_SCALE_MODE,
+			 "bvbltparams.scalemode not supported");
+}
+
+static double bvcpu_sinc(double x)
+{
+	if (x == 0.0)
+		return 1.0;
+	x *= M_PI;
+	return sin(x) / x;
+}
+
+/*
+ * bvcpu_filterfn() - The filter kernel at distance d >= 0 input pixels,
+ * widened by stretch.  LINEAR is a triangle and CUBIC is Catmull-Rom.  The
+ * N-tap filters are sincs with their cutoff lowered by stretch, under a
+ * Lanczos window N pixels wide.
+ */
+static double bvcpu_filterfn(unsigned char filter, double d, double stretch)
+{
+	double r;
+
+	switch (filter) {
+	case BVSCALEDEF_LINEAR:
+		d /= stretch;
+		return d < 1.0 ? 1.0 - d : 0.0;
+	case BVSCALEDEF_CUBIC:
+		d /= stretch;
+		if (d < 1.0)
+			return (1.5 * d - 2.5) * d * d + 1.0;
+		if (d < 2.0)
+			return ((-0.5 * d + 2.5) * d - 4.0) * d + 2.0;
+		return 0.0;
+	default:
+		r = filter / 2.0;
+		if (d >= r)
+			return 0.0;
+		return bvcpu_sinc(d / stretch) * bvcpu_sinc(d / r);
+	}
+}
+
+/*
+ * bvcpu_support() - Half the width of the filter, in input pixels, times
+ * 2 x dst.  Positions in the input are kept in these units, which make
+ * every output center a whole number, so that where the taps of an output
+ * fall is found exactly.
+ */
+static unsigned long long bvcpu_support(unsigned char filter,
+					unsigned int src, unsigned int dst)
+{
+	unsigned long long stretch = 2ULL * (src > dst ? src : dst);
+
+	switch (filter) {
+	case BVSCALEDEF_LINEAR:
+		return stretch;
+	case BVSCALEDEF_CUBIC:
+		return 2 * stretch;
+	default:
+		return (unsigned long long)filter * dst;
+	}
+}
+
+/*
+ * bvcpu_span() - Input pixels under the filter of an output.
+ */
+static unsigned int bvcpu_span(unsigned char filter, unsigned int src,
+			       unsigned int dst)
+{
+	return (unsigned int)((bvcpu_support(filter, src, dst) + dst - 1) /
+			      dst);
+}
+
+unsigned int bvcpu_scaletaps(unsigned char filter, unsigned int src,
+			     unsigned int dst)
+{
+	unsigned int span;
+
+	if (filter == BVSCALEDEF_NEAREST_NEIGHBOR)
+		return 1;
+	span = bvcpu_span(filter, src, dst);
+	return span < src ? span : src;
+}
+
+/*
+ * bvcpu_coefnearest() - Compute the index map for nearest neighbor.  Output
+ * i takes input ((2i + 1) x src) / (2 x dst), the pixel under its center,
+ * stepped without a divide per pixel.
+ */
+static struct bvcpu_coefs *bvcpu_coefnearest(unsigned int src,
+					     unsigned int dst)
+{
+	struct bvcpu_coefs *c;
+	unsigned long long den = 2ULL * dst;
+	unsigned long long whole = 2ULL * src / den;
+	unsigned long long frac = 2ULL * src % den;
+	unsigned long long rem = src % den;
+	unsigned int idx = (unsigned int)(src / den);
+	unsigned int i;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+	c->start = malloc(dst * sizeof(*c->start));
+	if (!c->start) {
+		free(c);
+		return NULL;
+	}
+	c->src = src;
+	c->dst = dst;
+	c->filter = BVSCALEDEF_NEAREST_NEIGHBOR;
+	c->taps = 1;
+	if (dst == 2 * src || dst == 3 * src || dst == 4 * src)
+		c->rep = dst / src;
+	c->half = src == 2 * dst;
+
+	for (i = 0; i < dst; i++) {
+		c->start[i] = (int)idx;
+		idx += (unsigned int)whole;
+		rem += frac;
+		if (rem >= den) {
+			rem -= den;
+			idx++;
+		}
+	}
+
+	return c;
+}
+
+/*
+ * bvcpu_coefbuild() - Compute the weights for scaling src pixels to dst.
+ * Pixel centers are aligned, so output i samples input ((2i + 1) x src -
+ * dst) / (2 x dst).  The first tap and the distance of each tap from that
+ * center are found in whole units of 1 / (2 x dst), so the weights of an
+ * output depend on nothing but src, dst and i, and split or clipped BLTs
+ * produce exactly the pixels of the whole one.  When downscaling, LINEAR
+ * and CUBIC are stretched to cover the input pixels each output stands
+ * for; the N-tap filters keep their taps and lower their cutoff instead.
+ */
+static struct bvcpu_coefs *bvcpu_coefbuild(unsigned int src,
+					   unsigned int dst,
+					   unsigned char filter)
+{
+	struct bvcpu_coefs *c;
+	double ratio = (double)src / dst;
+	double stretch = ratio > 1.0 ? ratio : 1.0;
+	long long den = 2LL * dst;
+	long long support;
+	double *f;
+	unsigned int span, taps, i, t;
+
+	if (filter == BVSCALEDEF_NEAREST_NEIGHBOR)
+		return bvcpu_coefnearest(src, dst);
+
+	support = (long long)bvcpu_support(filter, src, dst);
+	span = bvcpu_span(filter, src, dst);
+	taps = span < src ? span : src;
+
+	c = calloc(1, sizeof(*c));
+	f = malloc(span * sizeof(*f));
+	if (!c || !f)
+		goto fail;
+	c->start = malloc(dst * sizeof(*c->start));
+	c->w = calloc((size_t)dst * taps, sizeof(*c->w));
+	if (!c->start || !c->w)
+		goto fail;
+	c->src = src;
+	c->dst = dst;
+	c->filter = filter;
+	c->taps = taps;
+
+	for (i = 0; i < dst; i++) {
+		short *w = c->w + (size_t)i * taps;
+		long long center = (2LL * i + 1) * src - dst;
+		double sum = 0.0;
+		long first, start;
+		int total = 0, big = 0;
+
+		first = (long)bvcpu_floordiv(center - support, den) + 1;
+		for (t = 0; t < span; t++) {
+			long long d = (first + (long)t) * den - center;
+			f[t] = bvcpu_filterfn(filter,
+					      (double)(d < 0 ? -d : d) / den,
+					      stretch);
+			sum += f[t];
+		}
+
+		/* fold taps outside the source onto the edge pixels */
+		start = first;
+		if (start > (long)(src - taps))
+			start = (long)(src - taps);
+		if (start < 0)
+			start = 0;
+		c->start[i] = (int)start;
+		for (t = 0; t < span; t++) {
+			long p = first + (long)t;
+			int q;
+			if (p < 0)
+				p = 0;
+			if (p > (long)src - 1)
+				p = (long)src - 1;
+			q = (int)lrint(f[t] / sum * BVCPU_SCALEONE);
+			w[p - start] = (short)(w[p - start] + q);
+		}
+
+		/* make the weights add up to exactly 1 */
+		for (t = 0; t < taps; t++) {
+			total += w[t];
+			if (w[t] > w[big])
+				big = (int)t;
+		}
+		w[big] = (short)(w[big] + BVCPU_SCALEONE - total);
+	}
+
+	free(f);
+	return c;
+
+fail:
+	if (c) {
+		free(c->start);
+		free(c->w);
+	}
+	free(c);
+	free(f);
+	return NULL;
+}
+
+static void bvcpu_coeffree(struct bvcpu_coefs *c)
+{
+	free(c->start);
+	free(c->w);
+	free(c);
+}
+
+/*
+ * The weights cache, shared by all threads.  Weights are found by their
+ * key in one set of BVCPU_COEFWAYS entries, replacing the least recently
+ * used when they are built.  Finding them takes no lock: each entry counts
+ * the scalers using its weights, and is only replaced while there are
+ * none, with BVCPU_COEFBUSY set in the count so that no scaler takes it
+ * meanwhile.  Weights built while every entry of their set is in use are
+ * used once and freed.  Building takes bvcpu_coeflock, so that weights
+ * wanted by several threads at once are built once.
+ *
+ * Sizes of 2^28 or more are not cached; their key would not fit.
+ */
+#define BVCPU_COEFSETS	16
+#define BVCPU_COEFWAYS	4
+#define BVCPU_COEFBUSY	(~0UL ^ (~0UL >> 1))
+#define BVCPU_COEFSIZE	(1U << 28)
+
+struct bvcpu_coefslot {
+	unsigned long long key;		/* 0 when empty */
+	unsigned long refs;		/* scalers using c, | BVCPU_COEFBUSY */
+	unsigned long stamp;		/* last use, for replacement */
+	struct bvcpu_coefs *c;
+};
+
+struct bvcpu_coefset {
+	unsigned long clock;
+	unsigned long hits;
+	struct bvcpu_coefslot way[BVCPU_COEFWAYS];
+};
+
+static struct bvcpu_coefset bvcpu_coefsets[BVCPU_COEFSETS];
+static pthread_mutex_t bvcpu_coeflock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long bvcpu_coefbuilds;		/* under bvcpu_coeflock */
+static unsigned long bvcpu_coefbuildns;
+
+static unsigned long long bvcpu_coefkey(unsigned int src, unsigned int dst,
+					unsigned char filter)
+{
+	if (src >= BVCPU_COEFSIZE || dst >= BVCPU_COEFSIZE)
+		return 0;
+	return ((unsigned long long)filter << 56) |
+		((unsigned long long)src << 28) | dst;
+}
+
+/*
+ * bvcpu_coeffind() - Take the weights of key from the cache, or 0.
+ */
+static struct bvcpu_coefs *bvcpu_coeffind(struct bvcpu_coefset *set,
+					  unsigned long long key)
+{
+	struct bvcpu_coefslot *slot;
+	unsigned int w;
+
+	for (w = 0; w < BVCPU_COEFWAYS; w++) {
+		slot = &set->way[w];
+		if (__atomic_load_n(&slot->key, __ATOMIC_RELAXED) != key)
+			continue;
+		/* replaced since, or being replaced */
+		if ((__atomic_fetch_add(&slot->refs, 1, __ATOMIC_ACQUIRE) &
+		     BVCPU_COEFBUSY) ||
+		    __atomic_load_n(&slot->key, __ATOMIC_RELAXED) != key) {
+			__atomic_fetch_sub(&slot->refs, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		__atomic_store_n(&slot->stamp,
+				 __atomic_add_fetch(&set->clock, 1,
+						    __ATOMIC_RELAXED),
+				 __ATOMIC_RELAXED);
+		__atomic_fetch_add(&set->hits, 1, __ATOMIC_RELAXED);
+		return slot->c;
+	}
+
+	return NULL;
+}
+
+/*
+ * bvcpu_coefkeep() - Put new weights in the least recently used entry of a
+ * set that is not in use, with a reference taken.  Called with the lock
+ * held.
+ */
+static void bvcpu_coefkeep(struct bvcpu_coefset *set, unsigned long long key,
+			   struct bvcpu_coefs *c)
+{
+	struct bvcpu_coefslot *slot, *victim = NULL;
+	unsigned long idle = 0;
+	unsigned int w;
+
+	for (w = 0; w < BVCPU_COEFWAYS; w++) {
+		slot = &set->way[w];
+		if (__atomic_load_n(&slot->refs, __ATOMIC_RELAXED))
+			continue;
+		if (!victim ||
+		    __atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) <
+		    __atomic_load_n(&victim->stamp, __ATOMIC_RELAXED))
+			victim = slot;
+	}
+	if (!victim ||
+	    !__atomic_compare_exchange_n(&victim->refs, &idle, BVCPU_COEFBUSY,
+					 0, __ATOMIC_ACQUIRE,
+					 __ATOMIC_RELAXED))
+		return;
+
+	__atomic_store_n(&victim->key, 0, __ATOMIC_RELAXED);
+	if (victim->c)
+		bvcpu_coeffree(victim->c);
+	victim->c = c;
+	c->slot = victim;
+	__atomic_store_n(&victim->stamp,
+			 __atomic_add_fetch(&set->clock, 1, __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->key, key, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&victim->refs, BVCPU_COEFBUSY - 1,
+			   __ATOMIC_RELEASE);
+}
+
+static struct bvcpu_coefs *bvcpu_coefget(unsigned int src, unsigned int dst,
+					 unsigned char filter)
+{
+	unsigned long long key = bvcpu_coefkey(src, dst, filter);
+	struct bvcpu_coefset *set;
+	struct bvcpu_coefs *c;
+	struct timespec t0, t1;
+	unsigned long h;
+
+	h = src * 0x9E3779B1ul;
+	h = (h ^ dst) * 0x9E3779B1ul;
+	h = (h ^ filter) * 0x9E3779B1ul;
+	set = &bvcpu_coefsets[(h >> 16) % BVCPU_COEFSETS];
+	if (key) {
+		c = bvcpu_coeffind(set, key);
+		if (c)
+			return c;
+	}
+
+	pthread_mutex_lock(&bvcpu_coeflock);
+	c = key ? bvcpu_coeffind(set, key) : NULL;
+	if (!c) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		c = bvcpu_coefbuild(src, dst, filter);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		bvcpu_coefbuilds++;
+		bvcpu_coefbuildns += (unsigned long)
+			((t1.tv_sec - t0.tv_sec) * 1000000000L +
+			 (t1.tv_nsec - t0.tv_nsec));
+		if (c && key)
+			bvcpu_coefkeep(set, key, c);
+	}
+	pthread_mutex_unlock(&bvcpu_coeflock);
+	return c;
+}
+
+static void bvcpu_coefput(struct bvcpu_coefs *c)
+{
+	if (!c)
+		return;
+	if (c->slot)
+		__atomic_fetch_sub(&c->slot->refs, 1, __ATOMIC_RELEASE);
+	else
+		bvcpu_coeffree(c);
+}
+
+void bvcpu_planstats(struct bvcpu_planstats *stats)
+{
+	const struct bvcpu_coefset *set;
+	unsigned int i, w;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < BVCPU_COEFSETS; i++) {
+		set = &bvcpu_coefsets[i];
+		stats->hits += __atomic_load_n(&set->hits, __ATOMIC_RELAXED);
+		for (w = 0; w < BVCPU_COEFWAYS; w++)
+			if (__atomic_load_n(&set->way[w].key,
+					    __ATOMIC_RELAXED))
+				stats->plans++;
+	}
+	pthread_mutex_lock(&bvcpu_coeflock);
+	stats->builds = bvcpu_coefbuilds;
+	stats->buildns = bvcpu_coefbuildns;
+	pthread_mutex_unlock(&bvcpu_coeflock);
+}
+
+/*
+ * BVCPU_BANDLINES - Lines of a turned input transposed at a time.  Each
+ * pass over the source reads a cache line of 32-bit pixels from every
+ * row, and transposes it in blocks that fit in registers.
+ */
+#define BVCPU_BANDLINES	16
+
+/*
+ * bvcpu_scaler - The state of one scaled input while a BLT runs.  Source
+ * lines are the lines of the view of the input described in bvcpu_input.
+ */
+struct bvcpu_scaler {
+	struct bvcpu_surf surf;		/* the input, or a copy of it */
+	int x;				/* view origin in surf */
+	int y;
+	int ux, uy;			/* memory step along a line */
+	int vx, vy;			/* memory step to the next line */
+	unsigned int width;		/* pixels per output line */
+	int ox;				/* first output pixel in dstrect */
+	int oy;
+	struct bvcpu_coefs *h;		/* 0 when not scaled that way */
+	struct bvcpu_coefs *v;
+	int x0;				/* first source column read */
+	unsigned int nx;		/* source columns read */
+	int y0;				/* first source line read */
+	unsigned int ny;		/* source lines read */
+	int direct;			/* source pixels used in place */
+	int premul;			/* premultiply source pixels */
+	int unpremul;			/* undo it on the output */
+	int *hstart;			/* h->start, relative to x0 */
+	unsigned int *line;		/* unpacked source line */
+	unsigned int *rev;		/* same, before reversing */
+	unsigned int *band;		/* BVCPU_BANDLINES turned lines */
+	unsigned long bandpitch;	/* pixels from one to the next */
+	int bandy;			/* first source line in band */
+	unsigned int nband;
+	unsigned int *tile;		/* unpacked block to transpose */
+	unsigned int nring;
+	unsigned int **ring;		/* horizontally scaled lines */
+	int *tag;			/* source line in each ring entry */
+	const unsigned int **rows;	/* ring entries for one output */
+	unsigned int *out;
+	unsigned char *copy;		/* copy of an overlapping source */
+	struct bvcpu_tile *plane;	/* of a tiled input */
+	unsigned char *mem;
+};
+
+/*
+ * bvcpu_scalecopy() - Take a copy of the source pixels read if the BLT
+ * writes over them, so that lines still to be filtered are not overwritten
+ * first.
+ */
+static int bvcpu_scalecopy(struct bvcpu_blt *blt, struct bvcpu_input *in,
+			   struct bvcpu_scaler *sc)
+{
+	struct bvrect box;
+	struct bvrect dr = {
+		blt->dstx, blt->dsty, blt->width, blt->height
+	};
+	unsigned long row;
+	unsigned int y;
+
+	bvcpu_inputbox(in, sc->x0, sc->y0, sc->nx, sc->ny, &box);
+	if (!bvcpu_overlap(&in->surf, &box, &blt->dst, &dr))
+		return 1;
+
+	row = (unsigned long)box.width * in->surf.fmt->bpp;
+	sc->copy = aligned_alloc(BVCPU_ROWALIGN,
+				 BVCPU_ROWSIZE(row * box.height));
+	if (!sc->copy)
+		return 0;
+	for (y = 0; y < box.height; y++)
+		memcpy(sc->copy + y * row, bvcpu_pixaddr(&in->surf, box.left,
+							 box.top + (int)y),
+		       row);
+	sc->surf.virtaddr = sc->copy;
+	sc->surf.stride = (long)row;
+	sc->surf.width = box.width;
+	sc->surf.height = box.height;
+	sc->x -= box.left;
+	sc->y -= box.top;
+	return 1;
+}
+
+static void bvcpu_scalefree(struct bvcpu_scaler *sc)
+{
+	bvcpu_coefput(sc->h);
+	bvcpu_coefput(sc->v);
+	bvcpu_tilefree(sc->plane);
+	free(sc->copy);
+	free(sc->mem);
+	free(sc);
+}
+
+/*
+ * bvcpu_scalefilters() - Whether the scaler mixes pixels, rather than only
+ * copying them.
+ */
+static int bvcpu_scalefilters(const struct bvcpu_scaler *sc)
+{
+	return (sc->h && sc->h->filter != BVSCALEDEF_NEAREST_NEIGHBOR) ||
+		(sc->v && sc->v->filter != BVSCALEDEF_NEAREST_NEIGHBOR);
+}
+
+static struct bvcpu_scaler *bvcpu_scalenew(struct bvcpu_blt *blt,
+					   struct bvcpu_input *in)
+{
+	const struct bvrect *dr = &in->dstrect;
+	const struct bvcpu_format *fmt = in->surf.fmt;
+	unsigned long rowsize = BVCPU_ROWSIZE((unsigned long)blt->width * 4);
+	unsigned long nxsize;
+	struct bvcpu_scaler *sc;
+	unsigned long size;
+	unsigned char *next;
+	unsigned int i;
+	int x1, y1;
+
+	sc = calloc(1, sizeof(*sc));
+	if (!sc)
+		return NULL;
+	sc->surf = in->surf;
+	sc->x = in->x;
+	sc->y = in->y;
+	sc->ux = in->ux;
+	sc->uy = in->uy;
+	sc->vx = in->vx;
+	sc->vy = in->vy;
+	if (in->tile) {
+		/* lines of the plane come unpacked from the tile engine */
+		sc->x = 0;
+		sc->y = 0;
+		sc->ux = 1;
+		sc->uy = 0;
+		sc->vx = 0;
+		sc->vy = 1;
+	}
+	sc->width = blt->width;
+	sc->ox = blt->dstx - dr->left;
+	sc->oy = blt->dsty - dr->top;
+
+	if (in->width != dr->width) {
+		sc->h = bvcpu_coefget(in->width, dr->width, blt->hfilter);
+		if (!sc->h)
+			goto fail;
+	}
+	if (in->height != dr->height) {
+		sc->v = bvcpu_coefget(in->height, dr->height, blt->vfilter);
+		if (!sc->v)
+			goto fail;
+	}
+
+	if (sc->h) {
+		sc->x0 = sc->h->start[sc->ox];
+		x1 = sc->h->start[sc->ox + (int)sc->width - 1] +
+			(int)sc->h->taps;
+	} else {
+		sc->x0 = sc->ox;
+		x1 = sc->ox + (int)sc->width;
+	}
+	sc->nx = (unsigned int)(x1 - sc->x0);
+	if (sc->v) {
+		sc->y0 = sc->v->start[sc->oy];
+		y1 = sc->v->start[sc->oy + (int)blt->height - 1] +
+			(int)sc->v->taps;
+	} else {
+		sc->y0 = sc->oy;
+		y1 = sc->oy + (int)blt->height;
+	}
+	sc->ny = (unsigned int)(y1 - sc->y0);
+	if (!in->tile && !bvcpu_scalecopy(blt, in, sc))
+		goto fail;
+
+	sc->direct = in->tile || ((fmt->flags & BVCPU_FMT_NATIVE) &&
+				  !(sc->surf.stride & 3) &&
+				  !((unsigned long)sc->surf.virtaddr & 3));
+	sc->premul = (blt->flags & BVFLAG_OP_MASK) == BVFLAG_BLEND ||
+		bvcpu_scalefilters(sc);
+	sc->unpremul = sc->premul &&
+		(blt->flags & BVFLAG_OP_MASK) != BVFLAG_BLEND &&
+		(fmt->flags & BVCPU_FMT_NONPREMULT);
+	if (in->tile) {
+		sc->plane = bvcpu_tilenew(blt, in, sc->x0, sc->nx, sc->ny,
+					  sc->premul);
+		if (!sc->plane)
+			goto fail;
+	}
+	sc->nring = sc->v ? sc->v->taps : 1;
+
+	/* one block holds the lines and tables */
+	nxsize = BVCPU_ROWSIZE((unsigned long)sc->nx * 4);
+	size = rowsize * sc->nring +
+		BVCPU_ROWSIZE(sc->nring * (sizeof(*sc->ring) +
+					   sizeof(*sc->rows) +
+					   sizeof(*sc->tag)));
+	if (sc->h)
+		size += BVCPU_ROWSIZE((unsigned long)sc->width *
+				      sizeof(*sc->hstart));
+	if (sc->h && (!sc->direct || sc->ux < 0))
+		size += nxsize;
+	if (sc->ux < 0 && !sc->direct)
+		size += nxsize;
+	if (sc->uy) {
+		size += nxsize * BVCPU_BANDLINES;
+		if (!sc->direct)
+			size += BVCPU_BANDLINES * BVCPU_BANDLINES * 4;
+	}
+	if (sc->v || sc->unpremul)
+		size += rowsize;
+	sc->mem = aligned_alloc(BVCPU_ROWALIGN, size);
+	if (!sc->mem)
+		goto fail;
+
+	next = sc->mem;
+	sc->ring = (unsigned int **)next;
+	sc->rows = (const unsigned int **)(sc->ring + sc->nring);
+	sc->tag = (int *)(sc->rows + sc->nring);
+	next += BVCPU_ROWSIZE(sc->nring * (sizeof(*sc->ring) +
+					   sizeof(*sc->rows) +
+					   sizeof(*sc->tag)));
+	for (i = 0; i < sc->nring; i++) {
+		sc->ring[i] = (unsigned int *)next;
+		sc->tag[i] = -1;
+		next += rowsize;
+	}
+	if (sc->h) {
+		sc->hstart = (int *)next;
+		for (i = 0; i < sc->width; i++)
+			sc->hstart[i] = sc->h->start[sc->ox + (int)i] - sc->x0;
+		next += BVCPU_ROWSIZE((unsigned long)sc->width *
+				      sizeof(*sc->hstart));
+	}
+	if (sc->h && (!sc->direct || sc->ux < 0)) {
+		sc->line = (unsigned int *)next;
+		next += nxsize;
+	}
+	if (sc->ux < 0 && !sc->direct) {
+		sc->rev = (unsigned int *)next;
+		next += nxsize;
+	}
+	if (sc->uy) {
+		sc->band = (unsigned int *)next;
+		sc->bandpitch = nxsize / 4;
+		sc->nband = 0;
+		next += nxsize * BVCPU_BANDLINES;
+		if (!sc->direct) {
+			sc->tile = (unsigned int *)next;
+			next += BVCPU_BANDLINES * BVCPU_BANDLINES * 4;
+		}
+	}
+	if (sc->v || sc->unpremul)
+		sc->out = (unsigned int *)next;
+
+	return sc;
+
+fail:
+	bvcpu_scalefree(sc);
+	return NULL;
+}
+
+enum bverror bvcpu_scalestart(struct bvcpu_blt *blt)
+{
+	struct bvcpu_input *in[3] = { &blt->src1, &blt->src2, &blt->mask };
+	unsigned int uses[3] = {
+		BVCPU_USES_SRC1, BVCPU_USES_SRC2, BVCPU_USES_MASK
+	};
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		if (!(blt->uses & uses[i]) || !in[i]->scaled)
+			continue;
+		in[i]->scaler = bvcpu_scalenew(blt, in[i]);
+		if (!in[i]->scaler) {
+			bvcpu_scaleend(blt);
+			return bvcpu_err(blt->params, BVERR_OOM,
+					 "out of memory for scaling");
+		}
+	}
+
+	return BVERR_NONE;
+}
+
+void bvcpu_scaleend(struct bvcpu_blt *blt)
+{
+	struct bvcpu_input *in[3] = { &blt->src1, &blt->src2, &blt->mask };
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		if (in[i]->scaler)
+			bvcpu_scalefree(in[i]->scaler);
+		in[i]->scaler = NULL;
+	}
+}
+
+/*
+ * bvcpu_scalehorz() - Scale one source line horizontally.  Nearest neighbor
+ * copies pixels through the index map, or replicates or decimates them
+ * when the ratio is exact.
+ */
+static void bvcpu_scalehorz(struct bvcpu_scaler *sc, unsigned int *dst,
+			    const unsigned int *line)
+{
+	const struct bvcpu_coefs *h = sc->h;
+
+	if (h->rep)
+		bvcpu_kern->scalerep(dst, line, h->rep,
+				     (unsigned int)sc->ox % h->rep, sc->width);
+	else if (h->half)
+		bvcpu_kern->scalehalf(dst, line, sc->width);
+	else if (h->filter == BVSCALEDEF_NEAREST_NEIGHBOR)
+		bvcpu_kern->scalenn(dst, line, sc->hstart, sc->width);
+	else
+		bvcpu_kern->scaleh(dst, line, sc->hstart,
+				   h->w + (size_t)sc->ox * h->taps, h->taps,
+				   sc->width);
+}
+
+/*
+ * bvcpu_scaleturn() - Fill the band with n source lines from line b of a
+ * turned input.  The lines are columns of the source, each BVCPU_BANDLINES
+ * rows of which are unpacked side by side (if need be) and transposed
+ * into place.
+ */
+static void bvcpu_scaleturn(struct bvcpu_scaler *sc, int b, unsigned int n)
+{
+	const struct bvcpu_format *fmt = sc->surf.fmt;
+	long dstride = sc->vx > 0 ? (long)sc->bandpitch :
+		-(long)sc->bandpitch;
+	unsigned int *dst = sc->vx > 0 ? sc->band :
+		sc->band + (n - 1) * sc->bandpitch;
+	int left = sc->x + sc->vx * (sc->vx > 0 ? b : b + (int)n - 1);
+	int top = sc->y + sc->uy * sc->x0;
+	unsigned int i, t, rows;
+
+	for (i = 0; i < sc->nx; i += BVCPU_BANDLINES) {
+		int y = top + sc->uy * (int)i;
+		rows = sc->nx - i < BVCPU_BANDLINES ? sc->nx - i :
+			BVCPU_BANDLINES;
+		if (sc->direct) {
+			bvcpu_kern->transpose(dst + i, dstride,
+					      (const unsigned int *)
+					      bvcpu_pixaddr(&sc->surf, left,
+							    y),
+					      sc->uy * sc->surf.stride / 4,
+					      n, rows);
+			continue;
+		}
+		for (t = 0; t < rows; t++) {
+			unsigned int *p = sc->tile + t * BVCPU_BANDLINES;
+			fmt->unpack(fmt, bvcpu_pixaddr(&sc->surf, left,
+						       y + sc->uy * (int)t),
+				    p, n);
+			if (sc->premul && (fmt->flags & BVCPU_FMT_NONPREMULT))
+				bvcpu_premultiply(p, n);
+		}
+		bvcpu_kern->transpose(dst + i, dstride, sc->tile,
+				      BVCPU_BANDLINES, n, rows);
+	}
+}
+
+/*
+ * bvcpu_scalesrc() - Get source line sy, from column x0, unpacked.  The
+ * line is read in place, or from the band of a turned input, or else
+ * unpacked into line.
+ */
+static const unsigned int *bvcpu_scalesrc(struct bvcpu_scaler *sc, int sy,
+					  unsigned int *line)
+{
+	const struct bvcpu_format *fmt = sc->surf.fmt;
+	const unsigned char *p;
+	unsigned int *u;
+
+	if (sc->plane)
+		return bvcpu_tileline(sc->plane, sy);
+	if (sc->uy) {
+		if (sy < sc->bandy || sy >= sc->bandy + (int)sc->nband) {
+			int b = sy - (sy - sc->y0) % BVCPU_BANDLINES;
+			int left = sc->y0 + (int)sc->ny - b;
+			sc->bandy = b;
+			sc->nband = left < BVCPU_BANDLINES ?
+				(unsigned int)left : BVCPU_BANDLINES;
+			bvcpu_scaleturn(sc, b, sc->nband);
+		}
+		return sc->band + (unsigned long)(sy - sc->bandy) *
+			sc->bandpitch;
+	}
+
+	/* the first pixel in memory is the last of a reversed line */
+	p = bvcpu_pixaddr(&sc->surf,
+			  sc->x + sc->ux * (sc->ux > 0 ? sc->x0 :
+					    sc->x0 + (int)sc->nx - 1),
+			  sc->y + sc->vy * sy);
+	if (sc->ux > 0 && sc->direct)
+		return (const unsigned int *)p;
+
+	u = sc->ux > 0 ? line : sc->direct ? (unsigned int *)p : sc->rev;
+	if (!sc->direct) {
+		fmt->unpack(fmt, p, u, sc->nx);
+		if (sc->premul && (fmt->flags & BVCPU_FMT_NONPREMULT))
+			bvcpu_premultiply(u, sc->nx);
+	}
+	if (sc->ux < 0)
+		bvcpu_kern->reverse(line, u, sc->nx);
+	return line;
+}
+
+/*
+ * bvcpu_scalerow() - Get source line sy scaled horizontally, through the
+ * ring.
+ */
+static const unsigned int *bvcpu_scalerow(struct bvcpu_scaler *sc, int sy)
+{
+	unsigned int slot = (unsigned int)sy % sc->nring;
+	const unsigned int *line;
+
+	if (sc->tag[slot] == sy)
+		return sc->ring[slot];
+
+	if (sc->h) {
+		line = bvcpu_scalesrc(sc, sy, sc->line);
+		bvcpu_scalehorz(sc, sc->ring[slot], line);
+	} else {
+		line = bvcpu_scalesrc(sc, sy, sc->ring[slot]);
+		/*
+		 * lines in place stay valid; those in the band or a span of
+		 * the plane may not
+		 */
+		if (line != sc->ring[slot] &&
+		    ((!sc->band && !sc->plane) || !sc->v))
+			return line;
+		if (line != sc->ring[slot])
+			memcpy(sc->ring[slot], line, sc->width * 4);
+	}
+
+	sc->tag[slot] = sy;
+	return sc->ring[slot];
+}
+
+const unsigned int *bvcpu_scaleline(const struct bvcpu_input *in, int y)
+{
+	struct bvcpu_scaler *sc = in->scaler;
+	const struct bvcpu_coefs *v = sc->v;
+	unsigned int oy = (unsigned int)(sc->oy + y);
+	const unsigned int *line;
+	unsigned int t;
+	int sy;
+
+	if (!v) {
+		line = bvcpu_scalerow(sc, (int)oy);
+	} else {
+		sy = v->start[oy];
+		for (t = 0; t < v->taps; t++)
+			sc->rows[t] = bvcpu_scalerow(sc, sy + (int)t);
+		line = sc->rows[0];
+		if (v->taps > 1) {
+			bvcpu_kern->scalev(sc->out, sc->rows,
+					   v->w + (size_t)oy * v->taps,
+					   v->taps, sc->width);
+			line = sc->out;
+		}
+	}
+
+	if (sc->unpremul) {
+		if (line != sc->out)
+			memcpy(sc->out, line, sc->width * 4);
+		bvcpu_unpremultiply(sc->out, sc->width);
+		line = sc->out;
+	}
+	return line;
+}
+
+const unsigned char *bvcpu_scalepacked(const struct bvcpu_input *in, int y,
+				       const struct bvcpu_format *fmt)
+{
+	struct bvcpu_scaler *sc = in->scaler;
+
+	if (!sc->plane || sc->h || sc->v || sc->premul)
+		return NULL;
+	return bvcpu_tilepacked(sc->plane, sc->oy + y, fmt,
+				bvcpu_alphafix(in->surf.fmt, fmt));
+}
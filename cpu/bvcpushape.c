@@ -0,0 +1,225 @@
+/*
+ * bvcpushape.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the cache of BLT shapes: what validation decoded from
+ * the flags, the operation, the modes and the formats of the BLTs a thread
+ * validated recently.  A BLT of a shape seen before only has its buffers,
+ * strides and rectangles checked.
+ *
+ * Only shapes that validated are kept, so a BLT found in the cache can
+ * only fail the checks that are still made, in the order they are made
+ * for any BLT.  Each thread has its own cache, so lookups take no lock.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * BVCPU_SHAPESETS - Sets of shapes, found by the hash of the key.
+ * BVCPU_SHAPEWAYS - Shapes in a set.  The least recently used is
+ * replaced.
+ */
+#define BVCPU_SHAPESETS		16
+#define BVCPU_SHAPEWAYS		4
+
+/*
+ * bvcpu_shapes - The cache of a thread.
+ */
+struct bvcpu_shapes {
+	unsigned long clock;
+	struct bvcpu_shape shape[BVCPU_SHAPESETS][BVCPU_SHAPEWAYS];
+};
+
+static pthread_once_t bvcpu_shapeonce = PTHREAD_ONCE_INIT;
+static pthread_key_t bvcpu_shapetls;
+static int bvcpu_shapetlsok;
+static __thread struct bvcpu_shapes *bvcpu_shapes;
+static __thread int bvcpu_shapesgone;	/* the thread is exiting */
+
+/*
+ * bvcpu_shapefree() - Free the cache of a thread as it exits.  BLTs may
+ * still come from the destructors of other keys, so they find no cache
+ * rather than the one freed, and do not make another.
+ */
+static void bvcpu_shapefree(void *shapes)
+{
+	bvcpu_shapes = NULL;
+	bvcpu_shapesgone = 1;
+	free(shapes);
+}
+
+static void bvcpu_shapeinit(void)
+{
+	bvcpu_shapetlsok = !pthread_key_create(&bvcpu_shapetls,
+					       bvcpu_shapefree);
+}
+
+/*
+ * bvcpu_shapetable() - The cache of the calling thread, or 0 if it cannot
+ * have one.  It is freed when the thread exits.
+ */
+static struct bvcpu_shapes *bvcpu_shapetable(void)
+{
+	struct bvcpu_shapes *shapes = bvcpu_shapes;
+
+	if (shapes)
+		return shapes;
+	if (bvcpu_shapesgone)
+		return NULL;
+	pthread_once(&bvcpu_shapeonce, bvcpu_shapeinit);
+	if (!bvcpu_shapetlsok)
+		return NULL;
+	shapes = calloc(1, sizeof(*shapes));
+	if (!shapes)
+		return NULL;
+	if (pthread_setspecific(bvcpu_shapetls, shapes)) {
+		free(shapes);
+		return NULL;
+	}
+	bvcpu_shapes = shapes;
+	return shapes;
+}
+
+static void bvcpu_shapegeom(const struct bvsurfgeom *geom,
+			    struct bvcpu_shapegeom *sg)
+{
+	sg->structsize = geom->structsize;
+	sg->format = geom->format;
+	sg->orientation = geom->orientation;
+}
+
+static int bvcpu_shapegeomis(const struct bvsurfgeom *geom,
+			     const struct bvcpu_shapegeom *sg)
+{
+	return geom && geom->structsize == sg->structsize &&
+		geom->format == sg->format &&
+		geom->orientation == sg->orientation;
+}
+
+/*
+ * bvcpu_shapeset() - The set a key falls in.
+ */
+static struct bvcpu_shape *bvcpu_shapeset(struct bvcpu_shapes *shapes,
+					  const struct bvcpu_shapekey *key)
+{
+	unsigned long h;
+
+	h = key->flags * 0x9E3779B1ul;
+	h = (h ^ key->op) * 0x9E3779B1ul;
+	h = (h ^ key->dst.format) * 0x9E3779B1ul;
+	return shapes->shape[(h >> 16) % BVCPU_SHAPESETS];
+}
+
+const struct bvcpu_shape *bvcpu_shapefind(const struct bvbltparams *params,
+					  struct bvcpu_shapekey *key)
+{
+	static const unsigned int uses[3] = {
+		BVCPU_USES_SRC1, BVCPU_USES_SRC2, BVCPU_USES_MASK
+	};
+	const struct bvsurfgeom *geoms[3] = {
+		params->src1geom, params->src2geom, params->maskgeom
+	};
+	struct bvcpu_shapes *shapes;
+	struct bvcpu_shape *set;
+	unsigned long global;
+	unsigned int w, i;
+
+	memset(key, 0, sizeof(*key));
+	if (!params->dstgeom)
+		return NULL;
+	key->flags = params->flags & ~(unsigned long)(BVFLAG_BATCH_MASK |
+						     BVFLAG_ASYNC |
+						     BVFLAG_TESTPARAMS_NOP);
+	switch (params->flags & BVFLAG_OP_MASK) {
+	case BVFLAG_ROP:
+		key->op = params->op.rop;
+		break;
+	case BVFLAG_BLEND:
+		key->op = (unsigned long)params->op.blend;
+		global = key->op & BVBLENDDEF_GLOBAL_MASK;
+		if (global == BVBLENDDEF_GLOBAL_UCHAR)
+			key->globalalpha = params->globalalpha.size8;
+		else if (global == BVBLENDDEF_GLOBAL_FLOAT)
+			memcpy(&key->globalalpha, &params->globalalpha.fp,
+			       sizeof(params->globalalpha.fp));
+		break;
+	}
+	key->dithermode = (unsigned int)params->dithermode;
+	key->structsize = params->structsize;
+	bvcpu_shapegeom(params->dstgeom, &key->dst);
+
+	shapes = bvcpu_shapetable();
+	if (!shapes)
+		return NULL;
+	set = bvcpu_shapeset(shapes, key);
+	for (w = 0; w < BVCPU_SHAPEWAYS; w++) {
+		if (!set[w].stamp || memcmp(&set[w].key, key, sizeof(*key)))
+			continue;
+		/* the inputs the shape reads have the same surfaces */
+		for (i = 0; i < 3; i++)
+			if ((set[w].uses & uses[i]) &&
+			    !bvcpu_shapegeomis(geoms[i], &set[w].in[i]))
+				break;
+		if (i < 3)
+			continue;
+		set[w].stamp = ++shapes->clock;
+		return &set[w];
+	}
+
+	return NULL;
+}
+
+void bvcpu_shapeadd(const struct bvcpu_shapekey *key,
+		    const struct bvcpu_blt *blt)
+{
+	const struct bvbltparams *params = blt->params;
+	struct bvcpu_shapes *shapes = bvcpu_shapes;
+	struct bvcpu_shape *set, *shape;
+	unsigned int w;
+
+	if (!shapes)
+		return;
+	set = bvcpu_shapeset(shapes, key);
+	shape = &set[0];
+	for (w = 1; w < BVCPU_SHAPEWAYS; w++)
+		if (set[w].stamp < shape->stamp)
+			shape = &set[w];
+
+	memset(shape, 0, sizeof(*shape));
+	memcpy(&shape->key, key, sizeof(*key));
+	shape->uses = blt->uses;
+	shape->fmt[0] = blt->dst.fmt;
+	if (blt->uses & BVCPU_USES_SRC1) {
+		bvcpu_shapegeom(params->src1geom, &shape->in[0]);
+		shape->fmt[1] = blt->src1.surf.fmt;
+	}
+	if (blt->uses & BVCPU_USES_SRC2) {
+		bvcpu_shapegeom(params->src2geom, &shape->in[1]);
+		shape->fmt[2] = blt->src2.surf.fmt;
+	}
+	if (blt->uses & BVCPU_USES_MASK) {
+		bvcpu_shapegeom(params->maskgeom, &shape->in[2]);
+		shape->fmt[3] = blt->mask.surf.fmt;
+	}
+	shape->dithermode = params->dithermode;
+	shape->dither = blt->dither;
+	memcpy(shape->dbias, blt->dbias, sizeof(shape->dbias));
+	shape->blend = blt->blend;
+	shape->stamp = ++shapes->clock;
+}
@@ -0,0 +1,279 @@
+/*
+ * bvcputile.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the tile engine.  The tile is unpacked once when the
+ * BLT starts, so it may lie in the destination.  The part of the plane
+ * read is a band of columns, and its lines are spans of that band: one per
+ * line of the tile, built the first time it is needed.
+ *
+ * On each side of the alignment location the plane repeats with a period
+ * of the tile width, or twice that when mirrored.  A span is built by
+ * copying whole lines of the tile (or the line reversed) for the first
+ * period of each side, and doubling what is there for the rest, so no
+ * pixel is placed by a modulo.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * BVCPU_TILECACHE - Most bytes of spans kept.  Tiles with more lines than
+ * fit rebuild a span each time the tile line read changes.
+ */
+#define BVCPU_TILECACHE	(1UL << 20)
+
+struct bvcpu_tile {
+	unsigned int w;			/* tile size */
+	unsigned int h;
+	int ax;				/* plane location of the tile at */
+	int ay;				/* the alignment location */
+	unsigned long flags;		/* BVTILE_* */
+	int x0;				/* first plane column read */
+	unsigned int nx;
+	unsigned int *pix;		/* the tile, unpacked */
+	unsigned int *rev;		/* one line of it reversed */
+	unsigned int nspan;
+	unsigned long pitch;		/* pixels from one span to the next */
+	unsigned int *span;
+	int *tag;			/* tile line in each span */
+	const struct bvcpu_format *fmt;	/* of the packed spans */
+	int fix;			/* bvcpu_alphafix() to fmt */
+	unsigned long ppitch;		/* bytes from one to the next */
+	unsigned char *packed;
+	int *ptag;
+	unsigned int *tmp;		/* a span with the alpha fixed */
+	unsigned char *mem;
+};
+
+/*
+ * bvcpu_tileunpack() - Read the tile through the mapping of the input.
+ * Lines along memory are unpacked whole; those of a turned tile a pixel at
+ * a time, since they are read once.
+ */
+static void bvcpu_tileunpack(struct bvcpu_tile *t,
+			     const struct bvcpu_input *in, int premul)
+{
+	const struct bvcpu_format *fmt = in->surf.fmt;
+	unsigned int i, j;
+
+	for (j = 0; j < t->h; j++) {
+		unsigned int *line = t->pix + (unsigned long)j * t->w;
+		int x = in->x + (int)j * in->vx;
+		int y = in->y + (int)j * in->vy;
+		if (in->uy) {
+			for (i = 0; i < t->w; i++)
+				fmt->unpack(fmt,
+					    bvcpu_pixaddr(&in->surf,
+							  x + (int)i * in->ux,
+							  y + (int)i * in->uy),
+					    line + i, 1);
+		} else if (in->ux > 0) {
+			fmt->unpack(fmt, bvcpu_pixaddr(&in->surf, x, y), line,
+				    t->w);
+		} else {
+			fmt->unpack(fmt,
+				    bvcpu_pixaddr(&in->surf,
+						  x - (int)t->w + 1, y),
+				    t->rev, t->w);
+			bvcpu_kern->reverse(line, t->rev, t->w);
+		}
+		if (premul && (fmt->flags & BVCPU_FMT_NONPREMULT))
+			bvcpu_premultiply(line, t->w);
+	}
+}
+
+struct bvcpu_tile *bvcpu_tilenew(const struct bvcpu_blt *blt,
+				 const struct bvcpu_input *in, int x0,
+				 unsigned int nx, unsigned int ny, int premul)
+{
+	const struct bvrect *dr = &in->dstrect;
+	const struct bvtileparams *tp = in->tile;
+	struct bvcpu_tile *t;
+	unsigned long size;
+	unsigned char *next;
+	unsigned int i;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->w = in->tw;
+	t->h = in->th;
+	t->flags = tp->flags;
+	t->x0 = x0;
+	t->nx = nx;
+	t->ax = (int)bvcpu_floordiv((long)(tp->dstleft - dr->left) *
+				    (long)in->width, (long)dr->width);
+	t->ay = (int)bvcpu_floordiv((long)(tp->dsttop - dr->top) *
+				    (long)in->height, (long)dr->height);
+
+	t->pitch = BVCPU_ROWSIZE((unsigned long)nx * 4) / 4;
+	t->nspan = t->h < ny ? t->h : ny;
+	if (t->nspan * t->pitch * 4 > BVCPU_TILECACHE)
+		t->nspan = 1;
+
+	size = BVCPU_ROWSIZE((unsigned long)t->w * t->h * 4) +
+		BVCPU_ROWSIZE((unsigned long)t->w * 4) +
+		t->nspan * t->pitch * 4 +
+		BVCPU_ROWSIZE(t->nspan * sizeof(*t->tag));
+	t->mem = aligned_alloc(BVCPU_ROWALIGN, size);
+	if (!t->mem) {
+		free(t);
+		return NULL;
+	}
+	next = t->mem;
+	t->pix = (unsigned int *)next;
+	next += BVCPU_ROWSIZE((unsigned long)t->w * t->h * 4);
+	t->rev = (unsigned int *)next;
+	next += BVCPU_ROWSIZE((unsigned long)t->w * 4);
+	t->span = (unsigned int *)next;
+	next += t->nspan * t->pitch * 4;
+	t->tag = (int *)next;
+	for (i = 0; i < t->nspan; i++)
+		t->tag[i] = -1;
+
+	bvcpu_tileunpack(t, in, premul);
+	return t;
+}
+
+void bvcpu_tilefree(struct bvcpu_tile *t)
+{
+	if (!t)
+		return;
+	free(t->packed);
+	free(t->mem);
+	free(t);
+}
+
+/*
+ * bvcpu_tileside() - Fill n pixels of a span from plane column c, all on
+ * one side of the alignment location.
+ */
+static void bvcpu_tileside(const struct bvcpu_tile *t,
+			   const unsigned int *line, unsigned int *s, int c,
+			   unsigned int n, int mirror)
+{
+	unsigned int period = mirror ? 2 * t->w : t->w;
+	unsigned int first = n < period ? n : period;
+	long k = bvcpu_floordiv((long)c - t->ax, (long)t->w);
+	unsigned int o = (unsigned int)((long)c - t->ax - k * (long)t->w);
+	unsigned int i, m, len;
+
+	for (i = 0; i < first; i += m, o = 0, k++) {
+		m = t->w - o < first - i ? t->w - o : first - i;
+		memcpy(s + i, ((mirror && (k & 1)) ? t->rev : line) + o,
+		       m * 4);
+	}
+
+	/* the rest repeats the first period */
+	for (len = first; len < n; len *= 2)
+		memcpy(s + len, s, (len < n - len ? len : n - len) * 4);
+}
+
+/*
+ * bvcpu_tilerow() - The line of the tile crossed by line y of the plane.
+ */
+static unsigned int bvcpu_tilerow(const struct bvcpu_tile *t, int y)
+{
+	long k = bvcpu_floordiv((long)y - t->ay, (long)t->h);
+	unsigned int o = (unsigned int)((long)y - t->ay - k * (long)t->h);
+	unsigned long mirror = k < 0 ? BVTILE_TOP_MIRROR :
+		BVTILE_BOTTOM_MIRROR;
+
+	if ((k & 1) && (t->flags & mirror))
+		return t->h - 1 - o;
+	return o;
+}
+
+const unsigned int *bvcpu_tileline(struct bvcpu_tile *t, int y)
+{
+	unsigned int r = bvcpu_tilerow(t, y);
+	unsigned int slot = r % t->nspan;
+	unsigned int *s = t->span + slot * t->pitch;
+	const unsigned int *line = t->pix + (unsigned long)r * t->w;
+	long split;
+
+	if (t->tag[slot] == (int)r)
+		return s;
+
+	if (t->flags & (BVTILE_LEFT_MIRROR | BVTILE_RIGHT_MIRROR))
+		bvcpu_kern->reverse(t->rev, line, t->w);
+	split = (long)t->ax - t->x0;
+	if (split < 0)
+		split = 0;
+	if (split > (long)t->nx)
+		split = t->nx;
+	if (split)
+		bvcpu_tileside(t, line, s, t->x0, (unsigned int)split,
+			       !!(t->flags & BVTILE_LEFT_MIRROR));
+	if (split < (long)t->nx)
+		bvcpu_tileside(t, line, s + split, t->x0 + (int)split,
+			       t->nx - (unsigned int)split,
+			       !!(t->flags & BVTILE_RIGHT_MIRROR));
+
+	t->tag[slot] = (int)r;
+	return s;
+}
+
+const unsigned char *bvcpu_tilepacked(struct bvcpu_tile *t, int y,
+				      const struct bvcpu_format *fmt,
+				      int fix)
+{
+	const unsigned int *line = bvcpu_tileline(t, y);
+	unsigned int r = bvcpu_tilerow(t, y);
+	unsigned int slot = r % t->nspan;
+	unsigned char *p;
+	unsigned int i;
+
+	if (t->fmt != fmt || t->fix != fix) {
+		free(t->packed);
+		t->fmt = fmt;
+		t->fix = fix;
+		t->ppitch = BVCPU_ROWSIZE((unsigned long)t->nx * fmt->bpp);
+		t->packed = aligned_alloc(BVCPU_ROWALIGN,
+					  t->nspan * t->ppitch +
+					  BVCPU_ROWSIZE(t->nspan *
+							sizeof(*t->ptag)) +
+					  (fix ? t->pitch * 4 : 0));
+		if (!t->packed) {
+			t->fmt = NULL;
+			return NULL;
+		}
+		t->ptag = (int *)(t->packed + t->nspan * t->ppitch);
+		for (i = 0; i < t->nspan; i++)
+			t->ptag[i] = -1;
+		t->tmp = (unsigned int *)((unsigned char *)t->ptag +
+					  BVCPU_ROWSIZE(t->nspan *
+							sizeof(*t->ptag)));
+	}
+
+	p = t->packed + slot * t->ppitch;
+	if (t->ptag[slot] == (int)r)
+		return p;
+
+	if (fix) {
+		memcpy(t->tmp, line, t->nx * 4);
+		if (fix > 0)
+			bvcpu_premultiply(t->tmp, t->nx);
+		else
+			bvcpu_unpremultiply(t->tmp, t->nx);
+		line = t->tmp;
+	}
+	bvcpu_pack(fmt, line, p, t->nx, NULL);
+	t->ptag[slot] = (int)r;
+	return p;
+}
@@ -0,0 +1,236 @@
+/*
+ * asynctest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests asynchronous BLTs (BVFLAG_ASYNC) submitted from several
+ * threads at once to one destination, with rectangles that overlap:
+ * - each callback is called once, without an error, from one thread that
+ *   is none of the submitters', in the order of the BLTs' points on the
+ *   timeline, and once the timeline has reached that point;
+ * - after bvcpu_asyncwait(), the destination is what the same BLTs give
+ *   run synchronously, one thread, in the order of their points;
+ * - with copies, scaled copies, blends over the destination, ROPs reading
+ *   it, and copies within it.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bvcputest.h"
+
+#define SW		47
+#define SH		31
+#define DW		83
+#define DH		59
+
+#define ROUNDS		40
+#define PERTHREAD	50		/* BLTs each thread submits a round */
+#define NBLTS		(BVTEST_THREADS * PERTHREAD)
+
+static unsigned char src[SW * SH * 4];
+static unsigned char dst[DW * DH * 4], ref[DW * DH * 4];
+static struct bvbuffdesc srcdesc, dstdesc, refdesc;
+static struct bvsurfgeom srcgeom, dstgeom;
+
+/* each BLT of a round, by id, and its point on the timeline */
+static struct bvbltparams blt[NBLTS];
+static unsigned long point[NBLTS];
+static pthread_t submitter[BVTEST_THREADS];
+
+/* what each callback saw, in the order they were called */
+static unsigned int called;
+static int order[NBLTS];
+static unsigned long reached[NBLTS];
+static pthread_t caller[NBLTS];
+static int errors;
+
+static unsigned long blts;
+
+static void callback(struct bvcallbackerror *err, unsigned long data)
+{
+	unsigned int n = __atomic_fetch_add(&called, 1, __ATOMIC_SEQ_CST);
+
+	if (err)
+		__atomic_fetch_add(&errors, 1, __ATOMIC_SEQ_CST);
+	if (n >= NBLTS)
+		return;
+	order[n] = (int)data;
+	reached[n] = bvcpu_timeline();
+	caller[n] = pthread_self();
+}
+
+/*
+ * make() - A random BLT to the destination, which is also src2 of blends
+ * and src1 of copies within it.
+ */
+static void make(struct bvbltparams *params, int id)
+{
+	int w = 1 + rand() % SW, h = 1 + rand() % SH;
+
+	memset(params, 0, sizeof(*params));
+	params->structsize = sizeof(*params);
+	params->flags = BVFLAG_ROP | BVFLAG_ASYNC;
+	params->op.rop = 0xCCCC;
+	params->scalemode = BVSCALE_NEAREST_NEIGHBOR;
+	params->callbackfn = callback;
+	params->callbackdata = id;
+	params->dstdesc = &dstdesc;
+	params->dstgeom = &dstgeom;
+	params->src1.desc = &srcdesc;
+	params->src1geom = &srcgeom;
+	params->src1rect = bvtest_rect(w, h, SW, SH);
+	params->dstrect = bvtest_rect(w, h, DW, DH);
+
+	switch (rand() % 5) {
+	case 1:
+		w = 1 + rand() % DW;
+		h = 1 + rand() % DH;
+		params->dstrect = bvtest_rect(w, h, DW, DH);
+		break;
+	case 2:
+		params->flags = BVFLAG_BLEND | BVFLAG_ASYNC;
+		params->op.blend = BVBLEND_SRC1OVER;
+		params->src2.desc = &dstdesc;
+		params->src2geom = &dstgeom;
+		params->src2rect = params->dstrect;
+		break;
+	case 3:
+		params->op.rop = 0x6666;
+		break;
+	case 4:
+		params->src1.desc = &dstdesc;
+		params->src1geom = &dstgeom;
+		params->src1rect = bvtest_rect(w, h, DW, DH);
+		break;
+	}
+}
+
+static void *submit(void *arg)
+{
+	int t = (int)(long)arg, i, id;
+
+	for (i = 0; i < PERTHREAD; i++) {
+		id = t * PERTHREAD + i;
+		if (bv_blt(&blt[id]) != BVERR_NONE) {
+			bvtest_fail("async: BLT %d rejected: %s", id,
+				    blt[id].errdesc);
+			point[id] = 0;
+			continue;
+		}
+		point[id] = bvcpu_timelinepoint();
+	}
+	return NULL;
+}
+
+/*
+ * replay() - Run the BLTs of a round again, synchronously and in the
+ * order of their points, on the image the round started from.
+ */
+static void replay(void)
+{
+	struct bvbltparams params;
+	int i, n;
+
+	for (n = 0; n < NBLTS; n++) {
+		params = blt[order[n]];
+		params.flags &= ~BVFLAG_ASYNC;
+		params.callbackfn = NULL;
+		params.dstdesc = &refdesc;
+		if (params.src1.desc == &dstdesc)
+			params.src1.desc = &refdesc;
+		if (params.src2.desc == &dstdesc)
+			params.src2.desc = &refdesc;
+		if (bv_blt(&params) != BVERR_NONE)
+			bvtest_fail("async: replay of BLT %d rejected: %s",
+				    order[n], params.errdesc);
+	}
+	if (!memcmp(dst, ref, sizeof(dst)))
+		return;
+	for (i = 0; dst[i] == ref[i]; i++)
+		;
+	bvtest_fail("async: pixel %d,%d differs from the BLTs run in order",
+		    i / 4 % DW, i / 4 / DW);
+}
+
+/*
+ * check() - Submit BVTEST_THREADS threads' worth of BLTs at once, wait for
+ * them and their callbacks, and check the callbacks and the destination.
+ */
+static void check(void)
+{
+	int i, t, n, wait;
+
+	bvtest_premul(src, SW * SH);
+	bvtest_premul(dst, DW * DH);
+	memcpy(ref, dst, sizeof(dst));
+	for (i = 0; i < NBLTS; i++)
+		make(&blt[i], i);
+	__atomic_store_n(&called, 0, __ATOMIC_SEQ_CST);
+
+	for (t = 0; t < BVTEST_THREADS; t++)
+		pthread_create(&submitter[t], NULL, submit, (void *)(long)t);
+	for (t = 0; t < BVTEST_THREADS; t++)
+		pthread_join(submitter[t], NULL);
+	bvcpu_asyncwait();
+	blts += NBLTS;
+
+	/* callbacks may still be pending once the BLTs are done */
+	for (wait = 0; __atomic_load_n(&called, __ATOMIC_SEQ_CST) < NBLTS &&
+	     wait < 10000; wait++)
+		usleep(1000);
+	n = __atomic_load_n(&called, __ATOMIC_SEQ_CST);
+	if (n != NBLTS) {
+		bvtest_fail("async: %d callbacks for %d BLTs", n, NBLTS);
+		return;
+	}
+
+	for (n = 0; n < NBLTS; n++) {
+		for (t = 0; t < BVTEST_THREADS; t++)
+			if (pthread_equal(caller[n], submitter[t]))
+				break;
+		if (t < BVTEST_THREADS ||
+		    pthread_equal(caller[n], pthread_self()) ||
+		    !pthread_equal(caller[n], caller[0]))
+			bvtest_fail("async: callback %d called from another "
+				    "thread", n);
+		if ((long)(reached[n] - point[order[n]]) < 0)
+			bvtest_fail("async: callback of point %lu called at "
+				    "%lu", point[order[n]], reached[n]);
+		if (n && (long)(point[order[n]] - point[order[n - 1]]) <= 0)
+			bvtest_fail("async: callback of point %lu called "
+				    "after %lu", point[order[n]],
+				    point[order[n - 1]]);
+	}
+	replay();
+}
+
+int main(void)
+{
+	int i;
+
+	srand(19);
+	bvcpu_ncpus = BVTEST_THREADS;
+	bvtest_surface(&srcdesc, &srcgeom, src, sizeof(src), OCDFMT_BGRA24,
+		       SW, SH, 4);
+	bvtest_surface(&dstdesc, &dstgeom, dst, sizeof(dst), OCDFMT_BGRA24,
+		       DW, DH, 4);
+	refdesc = dstdesc;
+	refdesc.virtaddr = ref;
+	for (i = 0; i < ROUNDS; i++)
+		check();
+	if (errors)
+		bvtest_fail("async: %d callbacks with an error", errors);
+	return bvtest_done("asynctest", blts);
+}
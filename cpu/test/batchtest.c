@@ -0,0 +1,493 @@
+/*
+ * batchtest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests that batching BLTs does not change what they do.  The
+ * same BLTs are sent one at a time and in a batch, and must leave the same
+ * pixels and be accepted or rejected alike:
+ * - many small BLTs of mixed kinds, which the batch merges and runs in
+ *   parallel on BVTEST_THREADS threads, sent through one bvbltparams and
+ *   one bvtileparams changed between BLTs;
+ * - chains of SRC1OVER blends onto one rectangle, which the batch
+ *   composites in one pass.
+ */
+
+#include <unistd.h>
+
+#include "bvcputest.h"
+
+#define SW		64
+#define SH		48
+#define DW		80
+#define DH		60
+#define MAXBLTS		700
+#define MERGEBATCHES	300
+
+#define LW		160		/* layer chains */
+#define LH		120
+#define LAYERS		4
+#define MAXCHAIN	40
+#define CHAINBATCHES	300
+
+static unsigned char src[SW * SH * 4];
+static unsigned char init[DW * DH * 4], single[DW * DH * 4];
+static unsigned char batched[DW * DH * 4];
+static struct bvbuffdesc srcdesc, dstdesc;
+static struct bvsurfgeom srcgeom, dstgeom;
+static struct bvbltparams blts[MAXBLTS];
+static struct bvtileparams tiles[MAXBLTS];
+static unsigned char keys[MAXBLTS][4];
+
+static unsigned char layer[LAYERS][LW * LH * 4 + 8];
+static unsigned char linit[LW * LH * 4 + 8], lsingle[LW * LH * 4 + 8];
+static unsigned char lbatched[LW * LH * 4 + 8];
+static struct bvbuffdesc layerdesc[LAYERS];
+static struct bvsurfgeom layergeom[LAYERS];
+
+static const enum ocdformat layerformats[] = {
+	OCDFMT_BGRA24, OCDFMT_RGBA24, OCDFMT_RGB16, OCDFMT_nBGRA24,
+	OCDFMT_BGRx24,
+};
+
+static const enum ocdformat chainformats[] = {
+	OCDFMT_BGRA24, OCDFMT_ARGB24, OCDFMT_RGB16, OCDFMT_nBGRA24,
+	OCDFMT_BGRx24,
+};
+
+static unsigned long nblts;
+static int callbacks;
+
+static void callback(struct bvcallbackerror *err, unsigned long data)
+{
+	__atomic_fetch_add(&callbacks, (int)data, __ATOMIC_RELEASE);
+}
+
+/*
+ * randblt() - A random small BLT of a kind: 0 copy, 1 blend, 2 tiled
+ * copy, 3 keyed copy, 4 XOR.
+ */
+static void randblt(unsigned int i, int kind)
+{
+	struct bvbltparams *params = &blts[i];
+	struct bvtileparams *tile = &tiles[i];
+	int w = 1 + rand() % 24, h = 1 + rand() % 24;
+
+	memset(params, 0, sizeof(*params));
+	memset(tile, 0, sizeof(*tile));
+	params->structsize = sizeof(*params);
+	params->dstdesc = &dstdesc;
+	params->dstgeom = &dstgeom;
+	params->src1.desc = &srcdesc;
+	params->src1geom = &srcgeom;
+	params->scalemode = rand() % 2 ? BVSCALE_NEAREST_NEIGHBOR :
+		BVSCALE_BILINEAR;
+	params->dstrect = bvtest_rect(w, h, DW, DH);
+	params->src1rect = bvtest_rect(w, h, SW, SH);
+	params->flags = BVFLAG_ROP;
+	params->op.rop = 0xCCCC;
+	switch (kind) {
+	case 1:
+		params->flags = BVFLAG_BLEND;
+		params->op.blend = BVBLEND_SRC1OVER;
+		params->src1rect = bvtest_rect(1 + rand() % 30,
+					       1 + rand() % 30, SW, SH);
+		params->src2.desc = &dstdesc;
+		params->src2geom = &dstgeom;
+		params->src2rect = params->dstrect;
+		break;
+	case 2:
+		params->flags |= BVFLAG_TILE_SRC1;
+		tile->structsize = sizeof(*tile);
+		tile->virtaddr = src + (rand() % (SH - 8)) * SW * 4;
+		tile->dstleft = rand() % 7 - 3;
+		tile->dsttop = rand() % 7 - 3;
+		tile->srcwidth = rand() % 3 ? 0 : 1 + rand() % 20;
+		tile->srcheight = tile->srcwidth ? 1 + rand() % 20 : 0;
+		params->src1rect = bvtest_rect(1 + rand() % 8,
+					       1 + rand() % 8, SW, 8);
+		break;
+	case 3:
+		params->flags |= BVFLAG_KEY_SRC;
+		memcpy(keys[i], src + 4 * (rand() % (SW * SH)), 4);
+		params->colorkey = keys[i];
+		break;
+	case 4:
+		params->op.rop = 0x6666;
+		break;
+	}
+	if (rand() % 4 == 0) {
+		params->flags |= BVFLAG_CLIP;
+		params->cliprect = bvtest_rect(1 + rand() % 40,
+					       1 + rand() % 40, DW, DH);
+	}
+	if (rand() % 25 == 0)
+		params->dstrect.left = DW - 2;	/* past the surface */
+}
+
+/*
+ * changed() - The batchflags of BLT i, given BLT i - 1.
+ */
+static unsigned long changed(unsigned int i)
+{
+	const struct bvbltparams *p = &blts[i], *q = &blts[i - 1];
+	unsigned long flags = 0;
+
+	if (p->flags != q->flags)
+		flags |= BVBATCH_MISCFLAGS | BVBATCH_OP;
+	if (memcmp(&p->op, &q->op, sizeof(p->op)))
+		flags |= BVBATCH_OP;
+	if (p->colorkey != q->colorkey)
+		flags |= BVBATCH_KEY;
+	if (p->scalemode != q->scalemode)
+		flags |= BVBATCH_SCALE;
+	if (memcmp(&p->dstrect, &q->dstrect, sizeof(p->dstrect)))
+		flags |= BVBATCH_DSTRECT_ORIGIN | BVBATCH_DSTRECT_SIZE;
+	if (memcmp(&p->src1rect, &q->src1rect, sizeof(p->src1rect)))
+		flags |= BVBATCH_SRC1RECT_ORIGIN | BVBATCH_SRC1RECT_SIZE;
+	if (memcmp(&p->src2rect, &q->src2rect, sizeof(p->src2rect)))
+		flags |= BVBATCH_SRC2RECT_ORIGIN | BVBATCH_SRC2RECT_SIZE;
+	if (memcmp(&p->cliprect, &q->cliprect, sizeof(p->cliprect)))
+		flags |= BVBATCH_CLIPRECT;
+	if (memcmp(&tiles[i], &tiles[i - 1], sizeof(tiles[i])))
+		flags |= BVBATCH_TILE_SRC1;
+	if (p->src2.desc != q->src2.desc)
+		flags |= BVBATCH_SRC2;
+	return flags;
+}
+
+/*
+ * mergecheck() - Compare random small BLTs sent one at a time with them
+ * sent in one batch, ended asynchronously, maybe without a BLT.
+ */
+static void mergecheck(int it)
+{
+	enum bverror single_err[MAXBLTS], batch_err;
+	struct bvtileparams tile;
+	struct bvbltparams params;
+	unsigned int n, i, last;
+	int kind, endnop, ended, wait;
+
+	n = 1 + rand() % MAXBLTS;
+	kind = rand() % 5;
+	endnop = rand() % 3 == 0;
+	if (rand() % 2) {
+		bvtest_surface(&dstdesc, &dstgeom, single, sizeof(single),
+			       OCDFMT_RGB16, DW, DH, 2);
+		for (i = 0; i < DW * DH * 2; i++)
+			init[i] = rand();
+	} else {
+		bvtest_surface(&dstdesc, &dstgeom, single, sizeof(single),
+			       OCDFMT_BGRA24, DW, DH, 4);
+		bvtest_premul(init, DW * DH);
+	}
+	for (i = 0; i < n; i++) {
+		if (rand() % 10 < 3)
+			kind = rand() % 5;
+		randblt(i, kind);
+	}
+
+	memcpy(single, init, sizeof(single));
+	for (i = 0; i < n; i++) {
+		params = blts[i];
+		tile = tiles[i];
+		if (params.flags & BVFLAG_TILE_SRC1)
+			params.src1.tileparams = &tile;
+		single_err[i] = bv_blt(&params);
+	}
+
+	memcpy(batched, init, sizeof(batched));
+	dstdesc.virtaddr = batched;
+	callbacks = 0;
+	ended = 0;
+	last = n - 1 + endnop;
+	params.batch = NULL;
+	for (i = 0; i <= last; i++) {
+		struct bvbatch *batch = params.batch;
+
+		/* a rejected first BLT begins no batch, so the next does */
+		if (i == n && !batch)
+			break;
+		if (i < n) {
+			params = blts[i];
+			params.batchflags = batch ? changed(i) : 0;
+			tile = tiles[i];
+			if (params.flags & BVFLAG_TILE_SRC1)
+				params.src1.tileparams = &tile;
+		} else {
+			params.batchflags = BVBATCH_ENDNOP;
+		}
+		params.batch = batch;
+		params.flags = (params.flags & ~BVFLAG_BATCH_MASK) |
+			(!batch ? BVFLAG_BATCH_BEGIN : i == last ?
+			 BVFLAG_BATCH_END : BVFLAG_BATCH_CONTINUE);
+		if (i == last && batch) {
+			params.flags |= BVFLAG_ASYNC;
+			params.callbackfn = callback;
+			params.callbackdata = 1;
+			ended = 1;
+		}
+		batch_err = bv_blt(&params);
+		if (i < n && (batch_err != BVERR_NONE) !=
+		    (single_err[i] != BVERR_NONE))
+			bvtest_fail("merge %d: BLT %u: error %d batched, %d "
+				    "alone", it, i, batch_err, single_err[i]);
+
+		/* the batch keeps its own copy of the tile */
+		memset(&tile, 0x5A, sizeof(tile));
+		tile.structsize = sizeof(tile);
+		tile.virtaddr = src;
+	}
+	if (!ended && params.batch) {
+		/* a batch of one BLT, begun but not ended */
+		params.flags = (params.flags & ~BVFLAG_BATCH_MASK) |
+			BVFLAG_BATCH_END;
+		params.batchflags = BVBATCH_ENDNOP;
+		bv_blt(&params);
+	}
+	nblts += 2 * n;
+
+	for (wait = 0; ended && wait < 2000; wait++) {
+		if (__atomic_load_n(&callbacks, __ATOMIC_ACQUIRE) == 1)
+			break;
+		usleep(500);
+	}
+	if (callbacks != ended)
+		bvtest_fail("merge %d: %d callbacks", it, callbacks);
+	if (memcmp(single, batched, sizeof(single)))
+		bvtest_fail("merge %d: %u BLTs differ batched", it, n);
+}
+
+/*
+ * mergeerrors() - Check the batches that must be rejected.
+ */
+static void mergeerrors(void)
+{
+	struct bvbltparams params;
+
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP | BVFLAG_BATCH_CONTINUE;
+	if (bv_blt(&params) != BVERR_BATCH)
+		bvtest_fail("merge: BLT without a batch accepted");
+
+	/* a batch whose first BLT is rejected is not begun */
+	params.flags = BVFLAG_ROP | BVFLAG_BATCH_BEGIN;
+	params.batch = NULL;
+	if (bv_blt(&params) == BVERR_NONE || params.batch)
+		bvtest_fail("merge: rejected BLT began a batch");
+
+	params.op.rop = 0x0000;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.dstrect.width = params.dstrect.height = 1;
+	params.flags = BVFLAG_ROP | BVFLAG_BATCH_BEGIN;
+	if (bv_blt(&params) != BVERR_NONE)
+		bvtest_fail("merge: batch not begun: %s", params.errdesc);
+	params.flags = (params.flags & ~BVFLAG_BATCH_MASK) |
+		BVFLAG_BATCH_CONTINUE;
+	params.batchflags = BVBATCH_ENDNOP;
+	if (bv_blt(&params) != BVERR_BATCH_FLAGS)
+		bvtest_fail("merge: BVBATCH_ENDNOP accepted to continue");
+	params.flags = (params.flags & ~BVFLAG_BATCH_MASK) |
+		BVFLAG_BATCH_END;
+	params.batchflags = 0x01000000;
+	if (bv_blt(&params) != BVERR_BATCH_FLAGS)
+		bvtest_fail("merge: unknown batchflags accepted");
+}
+
+/*
+ * randlayer() - Fill a layer with premultiplied colors, a quarter of them
+ * opaque or transparent.
+ */
+static void randlayer(unsigned char *pix, unsigned int count)
+{
+	unsigned char *p;
+	unsigned int i;
+
+	bvtest_premul(pix, count);
+	for (i = 0; i < count; i++) {
+		p = pix + i * 4;
+		if (rand() % 4)
+			continue;
+		p[3] = rand() % 2 ? 0xFF : 0;
+		if (!p[3])
+			p[0] = p[1] = p[2] = 0;
+	}
+}
+
+/*
+ * randlayerblt() - A blend of a random layer over rect of the destination;
+ * the first of a chain may blend two layers.
+ */
+static void randlayerblt(struct bvbltparams *params, struct bvrect rect,
+			 int first)
+{
+	int s = rand() % LAYERS, t, alpha = rand() % 4;
+
+	memset(params, 0, sizeof(*params));
+	params->structsize = sizeof(*params);
+	params->dstdesc = &dstdesc;
+	params->dstgeom = &dstgeom;
+	params->dstrect = rect;
+	params->flags = BVFLAG_BLEND;
+	params->op.blend = BVBLEND_SRC1OVER;
+	params->scalemode = rand() % 2 ? BVSCALE_BILINEAR :
+		BVSCALE_NEAREST_NEIGHBOR;
+	params->src1.desc = &layerdesc[s];
+	params->src1geom = &layergeom[s];
+	params->src1rect.left = rand() % 20;
+	params->src1rect.top = rand() % 20;
+	params->src1rect.width = rect.width;
+	params->src1rect.height = rect.height;
+	if (rand() % 4 == 0) {
+		params->src1rect.width = 1 + rand() % (LW - 20);
+		params->src1rect.height = 1 + rand() % (LH - 20);
+	}
+	if (params->src1rect.left + params->src1rect.width > LW)
+		params->src1rect.left = LW - params->src1rect.width;
+	if (params->src1rect.top + params->src1rect.height > LH)
+		params->src1rect.top = LH - params->src1rect.height;
+	params->src2.desc = &dstdesc;
+	params->src2geom = &dstgeom;
+	params->src2rect = rect;
+	if (first && rand() % 2) {
+		t = (s + 1) % LAYERS;
+		params->src2.desc = &layerdesc[t];
+		params->src2geom = &layergeom[t];
+		params->src2rect.left = rand() % 20;
+		params->src2rect.top = rand() % 20;
+	}
+
+	if (alpha == 1) {
+		params->op.blend |= BVBLENDDEF_GLOBAL_UCHAR;
+		params->globalalpha.size8 = rand() % 5 ? rand() : 0;
+	} else if (alpha == 2) {
+		params->op.blend |= BVBLENDDEF_GLOBAL_FLOAT;
+		params->globalalpha.fp = (rand() % 1000) / 999.0f;
+	}
+
+	/* what breaks a chain */
+	if (rand() % 30 == 0) {
+		params->flags = BVFLAG_ROP;
+		params->op.rop = 0x6666;
+	}
+	if (rand() % 30 == 0)
+		params->dstrect.left ^= 1;
+	if (rand() % 40 == 0) {
+		params->src1.desc = &dstdesc;
+		params->src1geom = &dstgeom;
+	}
+}
+
+/*
+ * chaincheck() - Compare chains of blends onto a rectangle sent one at a
+ * time with them sent in one batch.
+ */
+static void chaincheck(int it)
+{
+	struct bvbltparams chain[MAXCHAIN], params;
+	enum ocdformat format;
+	struct bvbatch *batch = NULL;
+	unsigned int n, i, offset;
+	struct bvrect rect;
+
+	format = rand() % 2 ? OCDFMT_BGRA24 :
+		chainformats[rand() % (sizeof(chainformats) /
+				       sizeof(chainformats[0]))];
+	n = 1 + rand() % MAXCHAIN;
+	offset = rand() % 3 == 0;	/* misaligned */
+	bvtest_surface(&dstdesc, &dstgeom, lsingle + offset, LW * LH * 4,
+		       format, LW, LH, format == OCDFMT_RGB16 ? 2 : 4);
+	randlayer(linit, LW * LH);
+	for (i = 0; i < n; i++) {
+		if (!i || rand() % 6 == 0)
+			rect = bvtest_rect(1 + rand() % LW, 1 + rand() % LH,
+					   LW, LH);
+		randlayerblt(&chain[i], rect, !i || rand() % 6 == 0);
+	}
+
+	memcpy(lsingle, linit, sizeof(lsingle));
+	for (i = 0; i < n; i++) {
+		params = chain[i];
+		bv_blt(&params);
+	}
+
+	memcpy(lbatched, linit, sizeof(lbatched));
+	dstdesc.virtaddr = lbatched + offset;
+	for (i = 0; i <= n; i++) {
+		if (i < n) {
+			params = chain[i];
+			params.batchflags = BVBATCH_OP | BVBATCH_DST |
+				BVBATCH_SRC1 | BVBATCH_SRC2 | BVBATCH_ALPHA |
+				BVBATCH_MISCFLAGS | BVBATCH_SCALE |
+				BVBATCH_SRC1RECT_ORIGIN |
+				BVBATCH_SRC1RECT_SIZE |
+				BVBATCH_DSTRECT_ORIGIN |
+				BVBATCH_DSTRECT_SIZE |
+				BVBATCH_SRC2RECT_ORIGIN |
+				BVBATCH_SRC2RECT_SIZE;
+		} else {
+			params.batchflags = BVBATCH_ENDNOP;
+		}
+		if (i == n && !batch)
+			break;
+		params.batch = batch;
+		params.flags = (params.flags & ~BVFLAG_BATCH_MASK) |
+			(!batch ? BVFLAG_BATCH_BEGIN : i == n ?
+			 BVFLAG_BATCH_END : BVFLAG_BATCH_CONTINUE);
+		bv_blt(&params);
+		batch = params.batch;
+	}
+	nblts += 2 * n;
+
+	if (memcmp(lsingle, lbatched, sizeof(lsingle)))
+		bvtest_fail("chain %d: %u blends to format %x differ batched",
+			    it, n, format);
+}
+
+int main(void)
+{
+	enum ocdformat format;
+	int it, i;
+
+	bvcpu_ncpus = BVTEST_THREADS;
+
+	srand(7);
+	bvtest_premul(src, SW * SH);
+	for (i = 0; i < SW * SH; i++)
+		if (rand() % 3 == 0)	/* repeated colors, for keys */
+			memcpy(src + i * 4, src + (rand() % (i + 1)) * 4, 4);
+	bvtest_surface(&srcdesc, &srcgeom, src, sizeof(src), OCDFMT_BGRA24,
+		       SW, SH, 4);
+	for (it = 0; it < MERGEBATCHES; it++)
+		mergecheck(it);
+	mergeerrors();
+
+	srand(5);
+	for (i = 0; i < LAYERS; i++) {
+		format = i ? layerformats[rand() % (sizeof(layerformats) /
+						    sizeof(layerformats[0]))] :
+			OCDFMT_BGRA24;
+		randlayer(layer[i], LW * LH);
+		/* one misaligned */
+		bvtest_surface(&layerdesc[i], &layergeom[i],
+			       layer[i] + (i == 3), LW * LH * 4, format,
+			       LW, LH, format == OCDFMT_RGB16 ? 2 : 4);
+	}
+	for (it = 0; it < CHAINBATCHES; it++)
+		chaincheck(it);
+
+	return bvtest_done("batchtest", nblts);
+}
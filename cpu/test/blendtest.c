@@ -0,0 +1,460 @@
+/*
+ * blendtest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests blends (BVFLAG_BLEND).  Blends are compared with their
+ * equations evaluated here in floating point, within a few steps of 8-bit
+ * rounding:
+ * - the Porter-Duff blends, and classic blends with random K1-K4, whose
+ *   undefined constants must be rejected;
+ * - classic blends with global alpha, as an unsigned char and as a float,
+ *   and with remote alpha from ALPHA8 and BGRA24 masks holding transparent
+ *   and opaque runs;
+ * - every essential blend, BVBLEND_ALPHA included, of sources with and
+ *   without alpha;
+ * - source 2 being the destination itself, read as it was before the BLT.
+ */
+
+#include <math.h>
+
+#include "bvcputest.h"
+
+#define W		45
+#define H		23
+#define CLASSICBLTS	3000
+#define ESSBLTS		40
+
+#define TOL		2		/* classic blends */
+#define MODTOL		3		/* with source 1 modulated first */
+#define ESSTOL		3		/* essential blends, B() included */
+
+static const enum bvblend porterduff[] = {
+	BVBLEND_CLEAR, BVBLEND_SRC1, BVBLEND_SRC2, BVBLEND_SRC1OVER,
+	BVBLEND_SRC2OVER, BVBLEND_SRC1IN, BVBLEND_SRC2IN, BVBLEND_SRC1OUT,
+	BVBLEND_SRC2OUT, BVBLEND_SRC1ATOP, BVBLEND_SRC2ATOP, BVBLEND_XOR,
+	BVBLEND_PLUS,
+};
+
+#define NPORTERDUFF	(sizeof(porterduff) / sizeof(porterduff[0]))
+#define NESSENTIALS	(BVBLEND_ALPHA - BVBLEND_NORMAL + 1)
+
+static unsigned char src1[W * H * 4], src2[W * H * 4], mask[W * H * 4];
+static unsigned char dst[W * H * 4], before[W * H * 4];
+static double ref[W * H * 4];
+static unsigned char ambiguous[W * H];	/* either 0 or 255 is right */
+
+/*
+ * pix() - Pixel (x, y) of a BGRA24 or BGRx24 surface, premultiplied, in
+ * b, g, r, a order from 0 to 1.
+ */
+static void pix(const unsigned char *buf, int alpha, int x, int y,
+		double *c)
+{
+	const unsigned char *p = buf + (y * W + x) * 4;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		c[i] = p[i] / 255.0;
+	if (!alpha)
+		c[3] = 1.0;
+}
+
+/*
+ * kfield() - The value of a 6-bit constant field for component i, with c1
+ * and c2 the premultiplied sources, or -1 if bvblend.h leaves it undefined.
+ * For alpha, C1 and C2 are the alphas.
+ */
+static double kfield(unsigned int field, const double *c1, const double *c2,
+		     int i)
+{
+	unsigned int norm = field & 3, inv = (field >> 2) & 3;
+	double v[4];
+
+	v[0] = c1[i];
+	v[1] = c1[3];
+	v[2] = c2[i];
+	v[3] = c2[3];
+
+	switch (field >> 4) {
+	case 0:				/* only As */
+		if (!field)
+			return 0.0;
+		if ((norm & 1) == (inv & 1))
+			return -1.0;
+		return norm & 1 ? v[norm] : 1.0 - v[inv];
+	case 1:
+		return fmin(v[norm], 1.0 - v[inv]);
+	case 2:
+		return fmax(v[norm], 1.0 - v[inv]);
+	default:			/* only Cs */
+		if (field == 0x3F)
+			return 1.0;
+		if ((norm & 1) == (inv & 1))
+			return -1.0;
+		return norm & 1 ? 1.0 - v[inv] : v[norm];
+	}
+}
+
+/*
+ * classicref() - One pixel of a classic blend: source 1 scaled by the
+ * global and remote alpha, then Cd = K1 x C1 + K2 x C2 and
+ * Ad = K3 x A1 + K4 x A2.  Returns 0 if a constant is undefined.
+ */
+static int classicref(unsigned long op, double *c1, const double *c2,
+		      double modulate, double *out)
+{
+	double k[4];
+	int i, j;
+
+	for (i = 0; i < 4; i++)
+		c1[i] *= modulate;
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			k[j] = kfield((op >> (18 - 6 * j)) & 0x3F, c1, c2, i);
+			if (k[j] < 0.0)
+				return 0;
+		}
+		out[i] = i < 3 ? k[0] * c1[i] + k[1] * c2[i] :
+			k[2] * c1[i] + k[3] * c2[i];
+		out[i] = fmin(out[i], 1.0);
+	}
+	return 1;
+}
+
+/*
+ * The B() of the essential blends, on 0 to 255, as defined by the
+ * BLTsville documentation.
+ */
+static double dodge(double a, double b)
+{
+	return b >= 255.0 ? 255.0 : fmin(255.0, 255.0 * a / (255.0 - b));
+}
+
+static double burn(double a, double b)
+{
+	return b <= 0.0 ? 0.0 : fmax(0.0, 255.0 - 255.0 * (255.0 - a) / b);
+}
+
+static double vivid(double a, double b)
+{
+	return b < 128 ? burn(a, 2 * b) : dodge(a, 2 * (b - 128));
+}
+
+static double reflect(double a, double b)
+{
+	return b >= 255.0 ? 255.0 : fmin(255.0, a * a / (255.0 - b));
+}
+
+static double essb(int mode, double a, double b, int *either)
+{
+	double m;
+
+	switch (mode) {
+	case BVBLEND_LIGHTEN:
+		return fmax(a, b);
+	case BVBLEND_DARKEN:
+		return fmin(a, b);
+	case BVBLEND_MULTIPLY:
+		return a * b / 255.0;
+	case BVBLEND_AVERAGE:
+		return (a + b) / 2.0;
+	case BVBLEND_ADD:
+		return fmin(255.0, a + b);
+	case BVBLEND_SUBTRACT:
+		return fmax(0.0, a + b - 255.0);
+	case BVBLEND_DIFFERENCE:
+		return fabs(a - b);
+	case BVBLEND_NEGATE:
+		return 255.0 - fabs(255.0 - a - b);
+	case BVBLEND_SCREEN:
+		return 255.0 - (255.0 - a) * (255.0 - b) / 255.0;
+	case BVBLEND_EXCLUSION:
+		return a + b - 2.0 * a * b / 255.0;
+	case BVBLEND_OVERLAY:
+		return b < 128 ? 2.0 * a * b / 255.0 :
+			255.0 - 2.0 * (255.0 - a) * (255.0 - b) / 255.0;
+	case BVBLEND_SOFT_LIGHT:
+		m = a / 2.0 + 64.0;
+		return b < 128 ? 2.0 * m * b / 255.0 :
+			255.0 - 2.0 * (255.0 - m) * (255.0 - b) / 255.0;
+	case BVBLEND_HARD_LIGHT:
+		return a < 128 ? 2.0 * a * b / 255.0 :
+			255.0 - 2.0 * (255.0 - a) * (255.0 - b) / 255.0;
+	case BVBLEND_COLOR_DODGE:
+		return dodge(a, b);
+	case BVBLEND_COLOR_BURN:
+		return burn(a, b);
+	case BVBLEND_LINEAR_LIGHT:
+		return fmin(255.0, fmax(0.0, a + 2.0 * b - 255.0));
+	case BVBLEND_VIVID_LIGHT:
+		return vivid(a, b);
+	case BVBLEND_PIN_LIGHT:
+		return b < 128 ? fmin(a, 2.0 * b) : fmax(a, 2.0 * b - 255.0);
+	case BVBLEND_HARD_MIX:
+		m = vivid(a, b);
+		*either |= fabs(m - 127.5) < 2.0 * ESSTOL;
+		return m < 128 ? 0.0 : 255.0;
+	case BVBLEND_REFLECT:
+		return reflect(a, b);
+	case BVBLEND_GLOW:
+		return reflect(b, a);
+	case BVBLEND_PHOENIX:
+		return 255.0 - fabs(a - b);
+	default:			/* NORMAL, ALPHA */
+		return a;
+	}
+}
+
+/*
+ * unpremul() - A component unpremultiplied to 0 to 255, as the sources of
+ * an essential blend are before B() is applied.
+ */
+static double unpremul(const double *c, int i)
+{
+	long cv = lround(c[i] * 255.0), av = lround(c[3] * 255.0);
+
+	if (!av)
+		return 0.0;
+	cv = (cv * 255 + av / 2) / av;
+	return cv > 255 ? 255.0 : (double)cv;
+}
+
+/*
+ * essref() - One pixel of an essential blend:
+ *   Cd = (1 - A2) x C1 + (1 - A1) x C2 + A1 x A2 x B(C1 / A1, C2 / A2)
+ *   Ad = A1 + (1 - A1) x A2
+ */
+static void essref(int mode, const double *c1, const double *c2,
+		   double *out, int *either)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		out[i] = fmin(1.0, (1.0 - c2[3]) * c1[i] +
+			      (1.0 - c1[3]) * c2[i] + c1[3] * c2[3] *
+			      essb(mode, unpremul(c1, i), unpremul(c2, i),
+				   either) / 255.0);
+	out[3] = c1[3] + (1.0 - c1[3]) * c2[3];
+}
+
+/*
+ * randsurf() - Fill a surface with random premultiplied pixels, a quarter
+ * of them opaque or transparent.
+ */
+static void randsurf(unsigned char *buf)
+{
+	unsigned char *p;
+	int i;
+
+	bvtest_premul(buf, W * H);
+	for (i = 0; i < W * H; i++) {
+		p = buf + i * 4;
+		if (rand() % 4)
+			continue;
+		p[3] = rand() % 2 ? 0xFF : 0;
+		if (!p[3])
+			p[0] = p[1] = p[2] = 0;
+	}
+}
+
+/*
+ * randmask() - Fill the alpha of a mask with runs of transparent, opaque
+ * and random values, long enough to be seen as spans.
+ */
+static void randmask(int bpp)
+{
+	int i = 0, n, kind, v;
+
+	while (i < W * H) {
+		n = 1 + rand() % 80;
+		kind = rand() % 3;
+		for (; n && i < W * H; n--, i++) {
+			v = kind == 0 ? 0 : kind == 1 ? 0xFF : rand() & 0xFF;
+			if (bpp == 1) {
+				mask[i] = v;
+			} else {
+				mask[i * 4 + 3] = v;
+				mask[i * 4] = rand() % (v + 1);
+				mask[i * 4 + 1] = rand() % (v + 1);
+				mask[i * 4 + 2] = rand() % (v + 1);
+			}
+		}
+	}
+}
+
+/*
+ * check() - Do one blend and compare it with the reference.  ga is the
+ * global alpha, used as the BVBLENDDEF_GLOBAL_* of op says; maskbpp is the
+ * size of a mask pixel, for BVBLENDDEF_REMOTE.
+ */
+static void check(unsigned long op, int alpha1, int alpha2, int indst,
+		  float ga, int maskbpp)
+{
+	struct bvbuffdesc s1desc, s2desc, mdesc, ddesc;
+	struct bvsurfgeom s1geom, s2geom, mgeom, dgeom;
+	struct bvbltparams params;
+	int essential = op >> BVBLENDDEF_FORMAT_SHIFT ==
+		BVBLENDDEF_FORMAT_ESSENTIAL >> BVBLENDDEF_FORMAT_SHIFT;
+	unsigned long global = op & BVBLENDDEF_GLOBAL_MASK;
+	int w = 1 + rand() % W, h = 1 + rand() % H;
+	int x, y, i, dx, dy, defined = 1;
+	int tol = essential ? ESSTOL :
+		global || (op & BVBLENDDEF_REMOTE) ? MODTOL : TOL;
+	double c1[4], c2[4], m, diff;
+	const unsigned char *s2 = indst ? before : src2;
+	enum bverror err;
+
+	for (x = 0; x < W * H * 4; x++)
+		dst[x] = rand();
+	if (indst)
+		randsurf(dst);
+	memcpy(before, dst, sizeof(dst));
+	for (x = 0; x < W * H * 4; x++)
+		ref[x] = dst[x] / 255.0;
+	memset(ambiguous, 0, sizeof(ambiguous));
+
+	bvtest_surface(&s1desc, &s1geom, src1, sizeof(src1),
+		       alpha1 ? OCDFMT_BGRA24 : OCDFMT_BGRx24, W, H, 4);
+	bvtest_surface(&s2desc, &s2geom, indst ? dst : src2, sizeof(src2),
+		       alpha2 ? OCDFMT_BGRA24 : OCDFMT_BGRx24, W, H, 4);
+	bvtest_surface(&mdesc, &mgeom, mask, W * H * maskbpp,
+		       maskbpp == 1 ? OCDFMT_ALPHA8 : OCDFMT_BGRA24, W, H,
+		       maskbpp);
+	bvtest_surface(&ddesc, &dgeom, dst, sizeof(dst), OCDFMT_BGRA24,
+		       W, H, 4);
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_BLEND;
+	params.op.blend = (enum bvblend)op;
+	if (global == BVBLENDDEF_GLOBAL_FLOAT)
+		params.globalalpha.fp = ga;
+	else
+		params.globalalpha.size8 = (unsigned char)ga;
+	params.dstdesc = &ddesc;
+	params.dstgeom = &dgeom;
+	params.dstrect = bvtest_rect(w, h, W, H);
+	params.src1.desc = &s1desc;
+	params.src1geom = &s1geom;
+	params.src1rect = bvtest_rect(w, h, W, H);
+	params.src2.desc = &s2desc;
+	params.src2geom = &s2geom;
+	params.src2rect = indst ? params.dstrect : bvtest_rect(w, h, W, H);
+	if (op & BVBLENDDEF_REMOTE) {
+		params.mask.desc = &mdesc;
+		params.maskgeom = &mgeom;
+		params.maskrect = bvtest_rect(w, h, W, H);
+	}
+
+	for (y = 0; y < h && defined; y++)
+		for (x = 0; x < w && defined; x++) {
+			dx = params.dstrect.left + x;
+			dy = params.dstrect.top + y;
+			pix(src1, alpha1, params.src1rect.left + x,
+			    params.src1rect.top + y, c1);
+			pix(s2, alpha2, params.src2rect.left + x,
+			    params.src2rect.top + y, c2);
+			if (essential) {
+				int either = 0;
+				essref((int)op, c1, c2,
+				       &ref[(dy * W + dx) * 4], &either);
+				ambiguous[dy * W + dx] = either;
+				continue;
+			}
+			m = global == BVBLENDDEF_GLOBAL_UCHAR ? ga / 255.0 :
+				global == BVBLENDDEF_GLOBAL_FLOAT ?
+				round(fmin(1.0, fmax(0.0, ga)) * 255.0) /
+				255.0 : 1.0;
+			if (op & BVBLENDDEF_REMOTE)
+				m *= mask[((params.maskrect.top + y) * W +
+					   params.maskrect.left + x) *
+					  maskbpp + maskbpp - 1] / 255.0;
+			defined = classicref(op, c1, c2, m,
+					     &ref[(dy * W + dx) * 4]);
+		}
+
+	err = bv_blt(&params);
+	if (!defined) {
+		if (err == BVERR_NONE)
+			bvtest_fail("blend %08lx: undefined constant accepted",
+				    op);
+		return;
+	}
+	if (err != BVERR_NONE) {
+		bvtest_fail("blend %08lx: BLT rejected: %s", op,
+			    params.errdesc);
+		return;
+	}
+	for (i = 0; i < W * H * 4; i++) {
+		diff = fabs(dst[i] - ref[i] * 255.0);
+		if (diff > tol && !(ambiguous[i / 4] && i % 4 < 3 &&
+				    (dst[i] == 0 || dst[i] == 255)))
+			break;
+	}
+	if (i < W * H * 4)
+		bvtest_fail("blend %08lx%s%s ga %g%s %dx%d: %d at byte %d of "
+			    "%d,%d, not %.2f", op, alpha1 ? "" : " opaque1",
+			    alpha2 ? "" : " opaque2", ga,
+			    indst ? " in place" : "", w, h, dst[i], i % 4,
+			    i / 4 % W, i / 4 / W, ref[i] * 255.0);
+}
+
+int main(void)
+{
+	unsigned long blts = 0, op;
+	unsigned int i, mode;
+	int maskbpp;
+	float ga;
+
+	srand(2);
+	randsurf(src1);
+	randsurf(src2);
+
+	for (i = 0; i < CLASSICBLTS; i++, blts++) {
+		op = i % 3 ? porterduff[rand() % NPORTERDUFF] :
+			(unsigned long)(rand() & 0xFFFFFF);
+		maskbpp = rand() % 3 ? 1 : 4;
+		switch (rand() % 4) {
+		case 0:
+			ga = 255.0f;
+			break;
+		case 1:
+			op |= BVBLENDDEF_GLOBAL_UCHAR;
+			ga = rand() % 4 ? rand() & 0xFF : rand() % 2 * 255;
+			break;
+		case 2:
+			op |= BVBLENDDEF_GLOBAL_FLOAT;
+			ga = (rand() % 1201 - 100) / 1000.0f;
+			break;
+		default:
+			op |= BVBLENDDEF_REMOTE;
+			ga = 255.0f;
+			randmask(maskbpp);
+			break;
+		}
+		if (rand() % 4 == 0 && !(op & BVBLENDDEF_REMOTE)) {
+			op |= BVBLENDDEF_REMOTE;
+			randmask(maskbpp);
+		}
+		check(op, rand() % 4 != 0, rand() % 4 != 0, rand() % 4 == 0,
+		      ga, maskbpp);
+	}
+
+	for (mode = 0; mode < NESSENTIALS; mode++)
+		for (i = 0; i < ESSBLTS; i++, blts++)
+			check(BVBLENDDEF_FORMAT_ESSENTIAL + mode, i % 4 != 1,
+			      i % 4 != 2, i % 5 == 0, 255.0f, 1);
+
+	return bvtest_done("blendtest", blts);
+}
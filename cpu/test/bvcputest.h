@@ -0,0 +1,123 @@
+/*
+ * bvcputest.h
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the helpers shared by the tests of the BLTsville CPU
+ * implementation (bltsville_cpu).  The tests are linked with its objects,
+ * so they can also set bvcpu_ncpus and call its internal functions.
+ *
+ * Each test compares two ways of doing the same BLTs that must give the
+ * same pixels, reports the first few mismatches, and exits with 1 if there
+ * were any.
+ */
+
+#ifndef BVCPUTEST_H
+#define BVCPUTEST_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvcpu.h"
+
+/*
+ * BVTEST_THREADS - Threads the tests split work across, whatever the CPUs
+ * online, so that the threaded paths are taken.
+ */
+#define BVTEST_THREADS		8
+
+static int bvtest_fails;
+
+/*
+ * bvtest_fail() - Report a mismatch; only the first few are printed.
+ */
+static inline void bvtest_fail(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (bvtest_fails++ >= 10)
+		return;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+}
+
+/*
+ * bvtest_done() - Report the result of a test, for its exit status.
+ */
+static inline int bvtest_done(const char *test, unsigned long blts)
+{
+	printf("%s: %lu BLTs, %d failures\n", test, blts, bvtest_fails);
+	return bvtest_fails != 0;
+}
+
+/*
+ * bvtest_surface() - Describe a buffer holding one surface.
+ */
+static inline void bvtest_surface(struct bvbuffdesc *desc,
+				  struct bvsurfgeom *geom, void *virtaddr,
+				  unsigned long length, enum ocdformat format,
+				  unsigned int width, unsigned int height,
+				  unsigned int bpp)
+{
+	memset(desc, 0, sizeof(*desc));
+	desc->structsize = sizeof(*desc);
+	desc->virtaddr = virtaddr;
+	desc->length = length;
+	memset(geom, 0, sizeof(*geom));
+	geom->structsize = sizeof(*geom);
+	geom->format = format;
+	geom->width = width;
+	geom->height = height;
+	geom->virtstride = width * bpp;
+}
+
+/*
+ * bvtest_premul() - Fill count BGRA24 pixels with random premultiplied
+ * colors.
+ */
+static inline void bvtest_premul(unsigned char *pix, unsigned long count)
+{
+	unsigned char *p;
+	unsigned long i;
+
+	for (i = 0; i < count; i++) {
+		p = pix + i * 4;
+		p[3] = rand();
+		p[0] = rand() % (p[3] + 1);
+		p[1] = rand() % (p[3] + 1);
+		p[2] = rand() % (p[3] + 1);
+	}
+}
+
+/*
+ * bvtest_rect() - A rectangle of width x height at a random place inside
+ * a surface of maxwidth x maxheight.
+ */
+static inline struct bvrect bvtest_rect(int width, int height,
+					int maxwidth, int maxheight)
+{
+	struct bvrect rect;
+
+	rect.width = width;
+	rect.height = height;
+	rect.left = rand() % (maxwidth - width + 1);
+	rect.top = rand() % (maxheight - height + 1);
+	return rect;
+}
+
+#endif /* BVCPUTEST_H */
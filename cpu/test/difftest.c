@@ -0,0 +1,243 @@
+/*
+ * difftest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests error diffusion (BVDITHER_*_DIFFUSED).  Floyd-Steinberg
+ * diffusion is serial by definition, and the implementation runs it on
+ * several threads in a wavefront, so:
+ * - BLTs to 16-bit formats are compared with a plain serial Floyd-Steinberg
+ *   written here, on one thread and on BVTEST_THREADS;
+ * - bvcpu_diffuse() on 1 thread is compared with it on 2 to 16;
+ * - a color the destination holds exactly must come out unchanged.
+ */
+
+#include "bvcputest.h"
+
+static const struct {
+	enum ocdformat format;
+	int bits[3];			/* red, green, blue */
+	int shift[3];
+	unsigned short fill;		/* unused bits */
+} diffformats[] = {
+	{ OCDFMT_RGB16, { 5, 6, 5 }, { 11, 5, 0 }, 0 },
+	{ OCDFMT_BGR16, { 5, 6, 5 }, { 0, 5, 11 }, 0 },
+	{ OCDFMT_xRGB12, { 4, 4, 4 }, { 8, 4, 0 }, 0xF000 },
+};
+
+static const unsigned int sizes[][2] = {
+	{ 67, 23 }, { 1, 1 }, { 200, 3 }, { 3, 200 }, { 1000, 300 },
+	{ 2000, 700 },
+};
+
+#define NFORMATS	(sizeof(diffformats) / sizeof(diffformats[0]))
+#define NSIZES		(sizeof(sizes) / sizeof(sizes[0]))
+
+static unsigned char nearest[9][256];	/* [bits][value] */
+
+static int expand(int q, int bits)
+{
+	return (q << (8 - bits)) | (q >> (2 * bits - 8));
+}
+
+static void initnearest(void)
+{
+	int bits, v, q, best, d;
+
+	for (bits = 4; bits <= 6; bits++)
+		for (v = 0; v < 256; v++) {
+			best = 0;
+			for (q = 1; q < (1 << bits); q++) {
+				d = abs(expand(q, bits) - v);
+				if (d < abs(expand(best, bits) - v))
+					best = q;
+			}
+			nearest[bits][v] = best;
+		}
+}
+
+/*
+ * diffuse() - Floyd-Steinberg error diffusion of BGRA24 src into a 16-bit
+ * format, serially, one pixel after the other.
+ */
+static void diffuse(const unsigned char *src, unsigned short *dst,
+		    unsigned int fi, int width, int height)
+{
+	const int *bits = diffformats[fi].bits;
+	int right[3], *err, *above, *below;
+	unsigned short pix;
+	int x, y, c, v, q;
+
+	err = calloc((size_t)(width + 2) * (height + 1) * 3, sizeof(*err));
+	if (!err)
+		exit(2);
+
+	for (y = 0; y < height; y++) {
+		memset(right, 0, sizeof(right));
+		for (x = 0; x < width; x++) {
+			above = &err[(y * (width + 2) + x + 1) * 3];
+			below = &err[((y + 1) * (width + 2) + x) * 3];
+			pix = diffformats[fi].fill;
+			for (c = 0; c < 3; c++) {
+				/* c is red, green, blue; src is B, G, R */
+				v = src[(y * width + x) * 4 + 2 - c];
+				v += (above[c] + right[c] + 8) >> 4;
+				v = v < 0 ? 0 : v > 255 ? 255 : v;
+				q = nearest[bits[c]][v];
+				pix |= q << diffformats[fi].shift[c];
+				v -= expand(q, bits[c]);
+				right[c] = 7 * v;
+				below[c] += 3 * v;
+				below[3 + c] += 5 * v;
+				below[6 + c] += v;
+			}
+			dst[y * width + x] = pix;
+		}
+	}
+	free(err);
+}
+
+/*
+ * blt() - Copy or blend (over dst) src into dst, diffused.
+ */
+static void blt(unsigned char *src, unsigned short *dst,
+		enum ocdformat format, int rop, int width, int height)
+{
+	struct bvbuffdesc srcdesc, dstdesc;
+	struct bvsurfgeom srcgeom, dstgeom;
+	struct bvbltparams params;
+
+	bvtest_surface(&srcdesc, &srcgeom, src, width * height * 4,
+		       OCDFMT_BGRA24, width, height, 4);
+	bvtest_surface(&dstdesc, &dstgeom, dst, width * height * 2,
+		       format, width, height, 2);
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	if (rop) {
+		params.flags = BVFLAG_ROP;
+		params.op.rop = 0xCCCC;
+	} else {
+		params.flags = BVFLAG_BLEND;
+		params.op.blend = BVBLEND_SRC1OVER;
+		params.src2.desc = &dstdesc;
+		params.src2geom = &dstgeom;
+		params.src2rect.width = width;
+		params.src2rect.height = height;
+	}
+	params.flags |= BVFLAG_DITHER_RETURN;
+	params.dithermode = BVDITHER_BEST_DIFFUSED;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.dstrect.width = params.src1rect.width = width;
+	params.dstrect.height = params.src1rect.height = height;
+	params.src1.desc = &srcdesc;
+	params.src1geom = &srcgeom;
+	if (bv_blt(&params) != BVERR_NONE)
+		bvtest_fail("%dx%d: BLT rejected: %s", width, height,
+			    params.errdesc);
+	else if (params.dithermode != BVDITHER_FASTEST_DIFFUSED)
+		bvtest_fail("%dx%d: dithermode %x returned", width, height,
+			    params.dithermode);
+}
+
+/*
+ * check() - Compare a diffused BLT with diffuse().
+ */
+static void check(unsigned char *src, unsigned short *dst,
+		  unsigned short *ref, unsigned int fi, int rop,
+		  int width, int height)
+{
+	int i;
+
+	for (i = 0; i < width * height * 4; i++)
+		src[i] = i % 4 == 3 ? 255 : rand();
+	blt(src, dst, diffformats[fi].format, rop, width, height);
+	diffuse(src, ref, fi, width, height);
+	for (i = 0; i < width * height; i++)
+		if (dst[i] != ref[i])
+			break;
+	if (i < width * height)
+		bvtest_fail("%dx%d format %x rop %d threads %u: "
+			    "%04x at %d,%d, not %04x", width, height,
+			    diffformats[fi].format, rop, bvcpu_ncpus,
+			    dst[i], i % width, i / width, ref[i]);
+}
+
+int main(void)
+{
+	const struct bvcpu_format *fmt;
+	unsigned long blts = 0;
+	unsigned short *dst, *ref;
+	unsigned int si, fi, threads;
+	unsigned char *src;
+	int width, height, pass, rop, i;
+
+	srand(9);
+	initnearest();
+	for (si = 0; si < NSIZES; si++) {
+		width = sizes[si][0];
+		height = sizes[si][1];
+		src = malloc(width * height * 4);
+		dst = malloc(width * height * 2);
+		ref = malloc(width * height * 2);
+		if (!src || !dst || !ref)
+			return 2;
+
+		for (pass = 0; pass < 2; pass++) {
+			bvcpu_ncpus = pass ? BVTEST_THREADS : 1;
+			for (fi = 0; fi < NFORMATS; fi++)
+				for (rop = 0; rop < 2; rop++) {
+					check(src, dst, ref, fi, rop, width,
+					      height);
+					blts++;
+				}
+		}
+
+		/* the wavefront on 2 to 16 threads, against 1 */
+		bvcpu_ncpus = 16;
+		fmt = bvcpu_getformat(OCDFMT_RGB16);
+		bvcpu_diffuse(fmt, (unsigned int *)src, (unsigned char *)ref,
+			      width * 2, width, height, 1);
+		for (threads = 2; threads <= 16; threads *= 2) {
+			bvcpu_diffuse(fmt, (unsigned int *)src,
+				      (unsigned char *)dst, width * 2, width,
+				      height, threads);
+			if (memcmp(dst, ref, width * height * 2))
+				bvtest_fail("%dx%d: bvcpu_diffuse() on %u "
+					    "threads differs", width, height,
+					    threads);
+		}
+
+		/* no error to diffuse */
+		for (i = 0; i < width * height * 4; i += 4) {
+			src[i] = 0x84;
+			src[i + 1] = 0x82;
+			src[i + 2] = 0x42;
+		}
+		blt(src, dst, OCDFMT_RGB16, 1, width, height);
+		blts++;
+		for (i = 0; i < width * height; i++)
+			if (dst[i] != (0x42 >> 3 << 11 | 0x82 >> 2 << 5 |
+				       0x84 >> 3))
+				break;
+		if (i < width * height)
+			bvtest_fail("%dx%d: exact color changed to %04x",
+				    width, height, dst[i]);
+
+		free(src);
+		free(dst);
+		free(ref);
+	}
+	return bvtest_done("difftest", blts);
+}
@@ -0,0 +1,192 @@
+/*
+ * dithertest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests ordered dithering (BVDITHER_ORDERED_*), which is done by
+ * the kernels packing the 16-bit formats.  Copies of flat gradients, whose
+ * colors fall between the levels of the destination, are compared with the
+ * Bayer thresholds applied here one component at a time:
+ * - to RGB16, BGR16 and xRGB12, with the 2x2, 4x4 and 2x2/4x4 matrices;
+ * - to rectangles at any place, as the pattern follows the destination;
+ * - over widths that leave a partial vector at the end of each line.
+ */
+
+#include "bvcputest.h"
+
+#define W		83
+#define H		29
+#define BLTS		200
+
+static const struct {
+	enum ocdformat format;
+	int bits[3];			/* red, green, blue */
+	int shift[3];
+	unsigned short fill;		/* unused bits */
+} ditherformats[] = {
+	{ OCDFMT_RGB16, { 5, 6, 5 }, { 11, 5, 0 }, 0 },
+	{ OCDFMT_BGR16, { 5, 6, 5 }, { 0, 5, 11 }, 0 },
+	{ OCDFMT_xRGB12, { 4, 4, 4 }, { 8, 4, 0 }, 0xF000 },
+};
+
+static const struct {
+	enum bvdithermode mode;
+	int n[3];			/* matrix size for 4, 5 and 6 bits */
+} dithermodes[] = {
+	{ BVDITHER_ORDERED_2x2, { 2, 2, 2 } },
+	{ BVDITHER_ORDERED_4x4, { 4, 4, 4 } },
+	{ BVDITHER_ORDERED_2x2_4x4, { 4, 4, 2 } },
+};
+
+#define NFORMATS	(sizeof(ditherformats) / sizeof(ditherformats[0]))
+#define NMODES		(sizeof(dithermodes) / sizeof(dithermodes[0]))
+
+static const unsigned char bayer2[2][2] = {
+	{ 0, 2 },
+	{ 3, 1 },
+};
+
+static const unsigned char bayer4[4][4] = {
+	{ 0, 8, 2, 10 },
+	{ 12, 4, 14, 6 },
+	{ 3, 11, 1, 9 },
+	{ 15, 7, 13, 5 },
+};
+
+static unsigned char src[W * H * 4];
+static unsigned short dst[W * H], ref[W * H];
+
+static int expand(int q, int bits)
+{
+	return (q << (8 - bits)) | (q >> (2 * bits - 8));
+}
+
+/*
+ * dither() - Component v reduced to bits bits at destination (x, y), with
+ * an n x n Bayer matrix: the level at or below v, or the one above when v
+ * is further from it than the threshold of the pixel.
+ */
+static int dither(int v, int bits, int n, int x, int y)
+{
+	int m = n == 2 ? bayer2[y & 1][x & 1] : bayer4[y & 3][x & 3];
+	int t = (2 * m + 1) * (256 >> bits) / (2 * n * n);
+	int q = (1 << bits) - 1;
+
+	while (expand(q, bits) > v)
+		q--;
+	return v - expand(q, bits) > t ? q + 1 : q;
+}
+
+/*
+ * gradient() - Fill src with flat gradients: red along x, green along y,
+ * blue along both, starting from a random color and going either way.
+ */
+static void gradient(void)
+{
+	int x, y, c, start[3], step[3];
+	unsigned char *p;
+
+	for (c = 0; c < 3; c++) {
+		start[c] = rand() % 256;
+		step[c] = rand() % 5 - 2;
+	}
+	for (y = 0; y < H; y++)
+		for (x = 0; x < W; x++) {
+			p = src + (y * W + x) * 4;
+			p[2] = (start[0] + step[0] * x) & 0xFF;
+			p[1] = (start[1] + step[1] * y) & 0xFF;
+			p[0] = (start[2] + step[2] * (x + y) / 2) & 0xFF;
+			p[3] = 0xFF;
+		}
+}
+
+/*
+ * check() - Copy a rectangle of src to dst in format fi, dithered with
+ * mode mi, and compare it with dither().
+ */
+static void check(unsigned int fi, unsigned int mi)
+{
+	struct bvbuffdesc srcdesc, dstdesc;
+	struct bvsurfgeom srcgeom, dstgeom;
+	struct bvbltparams params;
+	const int *bits = ditherformats[fi].bits;
+	const int *shift = ditherformats[fi].shift;
+	int w = 1 + rand() % W, h = 1 + rand() % H;
+	int x, y, c, dx, dy;
+	const unsigned char *p;
+	unsigned short pix;
+
+	for (x = 0; x < W * H; x++)
+		dst[x] = rand();
+	memcpy(ref, dst, sizeof(dst));
+
+	bvtest_surface(&srcdesc, &srcgeom, src, sizeof(src), OCDFMT_BGRA24,
+		       W, H, 4);
+	bvtest_surface(&dstdesc, &dstgeom, dst, sizeof(dst),
+		       ditherformats[fi].format, W, H, 2);
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP;
+	params.op.rop = 0xCCCC;
+	params.dithermode = dithermodes[mi].mode;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.dstrect = bvtest_rect(w, h, W, H);
+	params.src1.desc = &srcdesc;
+	params.src1geom = &srcgeom;
+	params.src1rect = bvtest_rect(w, h, W, H);
+
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++) {
+			dx = params.dstrect.left + x;
+			dy = params.dstrect.top + y;
+			p = src + ((params.src1rect.top + y) * W +
+				   params.src1rect.left + x) * 4;
+			pix = ditherformats[fi].fill;
+			for (c = 0; c < 3; c++)
+				pix |= dither(p[2 - c], bits[c],
+					      dithermodes[mi].n[bits[c] - 4],
+					      dx, dy) << shift[c];
+			ref[dy * W + dx] = pix;
+		}
+
+	if (bv_blt(&params) != BVERR_NONE) {
+		bvtest_fail("format %x mode %x: BLT rejected: %s",
+			    ditherformats[fi].format, dithermodes[mi].mode,
+			    params.errdesc);
+		return;
+	}
+	for (x = 0; x < W * H; x++)
+		if (dst[x] != ref[x])
+			break;
+	if (x < W * H)
+		bvtest_fail("format %x mode %x %dx%d: %04x at %d,%d, not %04x",
+			    ditherformats[fi].format, dithermodes[mi].mode,
+			    w, h, dst[x], x % W, x / W, ref[x]);
+}
+
+int main(void)
+{
+	unsigned long blts = 0;
+	unsigned int fi, mi, i;
+
+	srand(8);
+	for (i = 0; i < BLTS; i++) {
+		gradient();
+		for (fi = 0; fi < NFORMATS; fi++)
+			for (mi = 0; mi < NMODES; mi++, blts++)
+				check(fi, mi);
+	}
+	return bvtest_done("dithertest", blts);
+}
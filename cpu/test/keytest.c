@@ -0,0 +1,205 @@
+/*
+ * keytest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests color keys.  Keyed copies of surfaces drawn from a few
+ * colors, the key among them, are compared with each pixel written or
+ * not as the key says:
+ * - with a source key (BVFLAG_KEY_SRC), source pixels matching the key
+ *   are not written; with a destination key (BVFLAG_KEY_DST), only the
+ *   destination pixels matching it are;
+ * - in BGRA24, RGB16, RGB24 and BGRx24, whose unused byte must not take
+ *   part in the match;
+ * - from another surface, and from the destination itself overlapping
+ *   the rectangle written;
+ * - unscaled, and scaled with nearest neighbor, which tests the key
+ *   against the lines out of the scaler.
+ */
+
+#include "bvcputest.h"
+
+#define W		53
+#define H		37
+#define COLORS		4		/* in each surface, the key first */
+
+#define BLTS		250		/* for each kind of BLT and format */
+
+static const struct {
+	enum ocdformat format;
+	unsigned int bpp;
+	unsigned int care;		/* bits holding a component */
+} formats[] = {
+	{ OCDFMT_BGRA24, 4, 0xFFFFFFFF },
+	{ OCDFMT_RGB16, 2, 0xFFFF },
+	{ OCDFMT_RGB24, 3, 0xFFFFFF },
+	{ OCDFMT_BGRx24, 4, 0x00FFFFFF },
+};
+
+#define NFORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+static unsigned char src[W * H * 4], dst[W * H * 4];
+static unsigned char before[W * H * 4], ref[W * H * 4];
+static unsigned char written[W * H];
+static unsigned char key[4];
+static unsigned long blts;
+
+static unsigned int load(const unsigned char *p, unsigned int bpp)
+{
+	unsigned int v = 0;
+
+	while (bpp--)
+		v = v << 8 | p[bpp];
+	return v;
+}
+
+static void store(unsigned char *p, unsigned int v, unsigned int bpp)
+{
+	while (bpp--) {
+		*p++ = (unsigned char)v;
+		v >>= 8;
+	}
+}
+
+/*
+ * paint() - Fill a surface with pixels of the colors given, with random
+ * bits where there is no component.
+ */
+static void paint(unsigned char *buf, const unsigned int *colors,
+		  unsigned int fi)
+{
+	unsigned int care = formats[fi].care, bpp = formats[fi].bpp;
+	int i;
+
+	for (i = 0; i < W * H; i++)
+		store(buf + i * bpp, colors[rand() % COLORS] |
+		      ((unsigned int)rand() & ~care), bpp);
+}
+
+/*
+ * nn() - The source pixel under the center of output i, scaling s pixels
+ * to d.
+ */
+static int nn(int i, int s, int d)
+{
+	return (int)((2LL * i + 1) * s / (2LL * d));
+}
+
+/*
+ * check() - Copy a random rectangle through a key, with kind bit 0 set
+ * for a destination key, bit 1 for a scaled copy and bit 2 for a copy
+ * within the destination, and compare the pixels written with the source
+ * and the rest with what was there.
+ */
+static void check(unsigned int fi, unsigned int kind)
+{
+	struct bvbuffdesc srcdesc, dstdesc;
+	struct bvsurfgeom srcgeom, dstgeom;
+	struct bvbltparams params;
+	unsigned int bpp = formats[fi].bpp, care = formats[fi].care;
+	unsigned int colors[COLORS], k, p, d;
+	const unsigned char *in;
+	const struct bvrect *sr, *dr;
+	int dstkey = kind & 1, inplace = kind & 4;
+	int x, y, sx, sy, i, w, h;
+
+	for (i = 0; i < COLORS; i++)
+		colors[i] = (unsigned int)rand() & care;
+	paint(dst, colors, fi);
+	memcpy(before, dst, sizeof(dst));
+	memcpy(ref, dst, sizeof(dst));
+	memset(written, 0, sizeof(written));
+	in = before;
+	if (!inplace) {
+		for (i = 0; i < COLORS; i++)
+			if (rand() % 2)
+				colors[i] = (unsigned int)rand() & care;
+		paint(src, colors, fi);
+		in = src;
+	}
+	k = colors[0] | ((unsigned int)rand() & ~care);
+	store(key, k, bpp);
+
+	bvtest_surface(&srcdesc, &srcgeom, inplace ? dst : src, sizeof(src),
+		       formats[fi].format, W, H, bpp);
+	bvtest_surface(&dstdesc, &dstgeom, dst, sizeof(dst),
+		       formats[fi].format, W, H, bpp);
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP | (dstkey ? BVFLAG_KEY_DST :
+				     BVFLAG_KEY_SRC);
+	params.op.rop = 0xCCCC;
+	params.colorkey = key;
+	params.scalemode = BVSCALE_NEAREST_NEIGHBOR;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.src1.desc = &srcdesc;
+	params.src1geom = &srcgeom;
+	w = 1 + rand() % W;
+	h = 1 + rand() % H;
+	params.src1rect = bvtest_rect(w, h, W, H);
+	if (kind & 2) {
+		w = 1 + rand() % W;
+		h = 1 + rand() % H;
+	}
+	params.dstrect = bvtest_rect(w, h, W, H);
+	sr = &params.src1rect;
+	dr = &params.dstrect;
+
+	for (y = 0; y < (int)dr->height; y++)
+		for (x = 0; x < (int)dr->width; x++) {
+			sx = sr->left + nn(x, sr->width, dr->width);
+			sy = sr->top + nn(y, sr->height, dr->height);
+			i = (dr->top + y) * W + dr->left + x;
+			p = load(in + (sy * W + sx) * bpp, bpp);
+			d = load(before + i * bpp, bpp);
+			if (dstkey ? (d & care) != (k & care) :
+			    (p & care) == (k & care))
+				continue;
+			store(ref + i * bpp, p, bpp);
+			written[i] = 1;
+		}
+
+	blts++;
+	if (bv_blt(&params) != BVERR_NONE) {
+		bvtest_fail("key %x: BLT rejected: %s", kind, params.errdesc);
+		return;
+	}
+	/* only the components of the pixels written are compared */
+	for (i = 0; i < W * H; i++) {
+		p = load(dst + i * bpp, bpp);
+		d = load(ref + i * bpp, bpp);
+		if (written[i] ? (p & care) != (d & care) : p != d)
+			break;
+	}
+	if (i < W * H)
+		bvtest_fail("key %x, format %x, %ux%u to %ux%u: %x at %d,%d, "
+			    "not %x", kind, formats[fi].format, sr->width,
+			    sr->height, dr->width, dr->height, p, i % W,
+			    i / W, d);
+}
+
+int main(void)
+{
+	unsigned int fi, kind;
+	int i;
+
+	srand(13);
+	bvcpu_ncpus = BVTEST_THREADS;
+	for (kind = 0; kind < 8; kind++)
+		for (fi = 0; fi < NFORMATS; fi++)
+			for (i = 0; i < BLTS; i++)
+				check(fi, kind);
+	return bvtest_done("keytest", blts);
+}
@@ -0,0 +1,220 @@
+/*
+ * plantest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests the cache of scaling plans shared by threads.  Scaled
+ * copies between a few sizes, with a few filters, want more plans than the
+ * cache holds, so that plans are found, evicted and built again.  They are
+ * run by this thread alone, and then by BVTEST_THREADS threads at once, each
+ * to a destination of its own:
+ * - the threads give the same pixels as this thread alone;
+ * - bvcpu_planstats() counts each plan a BLT wants once, as found or
+ *   built, whichever thread wanted it and however the others raced it;
+ * - the first time, each plan is built at least once, and the cache never
+ *   holds more plans than it has room for;
+ * - once the plans of a BLT are in the cache, the threads running it find
+ *   them every time, and build none.
+ */
+
+#include <pthread.h>
+
+#include "bvcputest.h"
+
+#define S		128		/* source and destinations */
+#define NBLTS		256
+#define PASSES		4		/* over the BLTs, by the threads */
+#define ROOM		(16 * 4)	/* plans the cache holds */
+
+static const unsigned int sizes[] = { 5, 17, 31, 48, 67, 96, 128 };
+
+#define NSIZES		(sizeof(sizes) / sizeof(sizes[0]))
+
+static const unsigned char filters[] = {
+	BVSCALEDEF_NEAREST_NEIGHBOR, BVSCALEDEF_LINEAR, BVSCALEDEF_CUBIC,
+};
+
+#define NFILTERS	(sizeof(filters) / sizeof(filters[0]))
+
+static unsigned char src[S * S * 4];
+static unsigned char one[NBLTS][S * S * 4], many[NBLTS][S * S * 4];
+static struct bvbuffdesc srcdesc, onedesc[NBLTS], manydesc[NBLTS];
+static struct bvsurfgeom srcgeom, dstgeom;
+static struct bvbltparams blt[NBLTS];
+static unsigned char seen[NSIZES][NSIZES][NFILTERS];
+static unsigned long blts;
+
+static unsigned long explicitmode(unsigned char h, unsigned char v)
+{
+	return (0xFFUL << BVSCALEDEF_VENDOR_SHIFT) | BVSCALEDEF_EXPLICIT |
+		((unsigned long)h << BVSCALEDEF_HORZ_SHIFT) |
+		((unsigned long)v << BVSCALEDEF_VERT_SHIFT);
+}
+
+/*
+ * make() - A scaled copy between random sizes, with random filters,
+ * counting the plans it wants.  Sizes that match want none.
+ */
+static unsigned long make(struct bvbltparams *params)
+{
+	int sw = rand() % NSIZES, sh = rand() % NSIZES;
+	int dw = rand() % NSIZES, dh = rand() % NSIZES;
+	int h = rand() % NFILTERS, v = rand() % NFILTERS;
+	unsigned long plans = 0;
+
+	memset(params, 0, sizeof(*params));
+	params->structsize = sizeof(*params);
+	params->flags = BVFLAG_ROP;
+	params->op.rop = 0xCCCC;
+	params->scalemode = (enum bvscalemode)explicitmode(filters[h],
+							   filters[v]);
+	params->dstgeom = &dstgeom;
+	params->src1.desc = &srcdesc;
+	params->src1geom = &srcgeom;
+	params->src1rect = bvtest_rect(sizes[sw], sizes[sh], S, S);
+	params->dstrect = bvtest_rect(sizes[dw], sizes[dh], S, S);
+	if (sw != dw) {
+		seen[sw][dw][h] = 1;
+		plans++;
+	}
+	if (sh != dh) {
+		seen[sh][dh][v] = 1;
+		plans++;
+	}
+	return plans;
+}
+
+static void run(struct bvbltparams *params, struct bvbuffdesc *desc)
+{
+	struct bvbltparams copy = *params;
+
+	copy.dstdesc = desc;
+	if (bv_blt(&copy) != BVERR_NONE)
+		bvtest_fail("plan: BLT rejected: %s", copy.errdesc);
+}
+
+/*
+ * runmany() - Run every BVTEST_THREADS-th BLT, from the one given, PASSES
+ * times, each pass starting at another of them.
+ */
+static void *runmany(void *arg)
+{
+	int t = (int)(long)arg, pass, i, n = NBLTS / BVTEST_THREADS;
+
+	for (pass = 0; pass < PASSES; pass++)
+		for (i = 0; i < n; i++)
+			run(&blt[t + (i + pass * 7) % n * BVTEST_THREADS],
+			    &manydesc[t + (i + pass * 7) % n *
+				      BVTEST_THREADS]);
+	return NULL;
+}
+
+static void threads(void)
+{
+	pthread_t tid[BVTEST_THREADS];
+	int t;
+
+	for (t = 0; t < BVTEST_THREADS; t++)
+		pthread_create(&tid[t], NULL, runmany, (void *)(long)t);
+	for (t = 0; t < BVTEST_THREADS; t++)
+		pthread_join(tid[t], NULL);
+	blts += NBLTS * PASSES;
+}
+
+/*
+ * count() - Check the plans found and built since before against those
+ * wanted, and the plans held against the room for them.
+ */
+static void count(const struct bvcpu_planstats *before,
+		  struct bvcpu_planstats *after, unsigned long wanted,
+		  const char *what)
+{
+	unsigned long hits, builds;
+
+	bvcpu_planstats(after);
+	hits = after->hits - before->hits;
+	builds = after->builds - before->builds;
+	if (hits + builds != wanted)
+		bvtest_fail("plan: %s found %lu and built %lu of %lu plans",
+			    what, hits, builds, wanted);
+	if (after->plans > ROOM)
+		bvtest_fail("plan: %u plans held, room for %d", after->plans,
+			    ROOM);
+}
+
+int main(void)
+{
+	struct bvcpu_planstats s0, s1, s2, s3;
+	unsigned long wanted = 0, distinct = 0;
+	unsigned int i, j, k;
+
+	srand(23);
+	bvcpu_ncpus = BVTEST_THREADS;
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = rand();
+	bvtest_surface(&srcdesc, &srcgeom, src, sizeof(src), OCDFMT_BGRA24,
+		       S, S, 4);
+	for (i = 0; i < NBLTS; i++) {
+		bvtest_surface(&onedesc[i], &dstgeom, one[i], sizeof(one[i]),
+			       OCDFMT_BGRA24, S, S, 4);
+		bvtest_surface(&manydesc[i], &dstgeom, many[i],
+			       sizeof(many[i]), OCDFMT_BGRA24, S, S, 4);
+		wanted += make(&blt[i]);
+	}
+	for (i = 0; i < NSIZES; i++)
+		for (j = 0; j < NSIZES; j++)
+			for (k = 0; k < NFILTERS; k++)
+				distinct += seen[i][j][k];
+	if (distinct <= ROOM)
+		bvtest_fail("plan: %lu plans fit in the cache", distinct);
+
+	/* this thread alone, from an empty cache */
+	bvcpu_planstats(&s0);
+	for (i = 0; i < NBLTS; i++)
+		run(&blt[i], &onedesc[i]);
+	blts += NBLTS;
+	count(&s0, &s1, wanted, "one thread");
+	if (s1.builds - s0.builds < distinct)
+		bvtest_fail("plan: %lu plans built of %lu", s1.builds -
+			    s0.builds, distinct);
+
+	/* the threads racing each other for them */
+	threads();
+	count(&s1, &s2, wanted * PASSES, "threads");
+	for (i = 0; i < NBLTS; i++)
+		if (memcmp(many[i], one[i], sizeof(one[i])))
+			bvtest_fail("plan: BLT %u differs on threads", i);
+
+	/* only the plans of one BLT, in the cache already */
+	do
+		wanted = make(&blt[0]);
+	while (!wanted);
+	memset(one[0], 0, sizeof(one[0]));
+	run(&blt[0], &onedesc[0]);
+	blts++;
+	for (i = 0; i < NBLTS; i++) {
+		blt[i] = blt[0];
+		memset(many[i], 0, sizeof(many[i]));
+	}
+	bvcpu_planstats(&s2);
+	threads();
+	count(&s2, &s3, wanted * NBLTS * PASSES, "threads on a few plans");
+	if (s3.builds != s2.builds)
+		bvtest_fail("plan: %lu plans built again",
+			    s3.builds - s2.builds);
+	for (i = 0; i < NBLTS; i++)
+		if (memcmp(many[i], one[0], sizeof(one[0])))
+			bvtest_fail("plan: BLT %u differs on threads", i);
+	return bvtest_done("plantest", blts);
+}
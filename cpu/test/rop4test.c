@@ -0,0 +1,176 @@
+/*
+ * rop4test.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests raster operations (BVFLAG_ROP).  BLTs with random ROP4
+ * codes, and with the codes that have kernels of their own, are compared
+ * with a ROP evaluated here one bit at a time:
+ * - source 1, source 2 and the destination are BGRA24 or RGB16, and the
+ *   mask is ALPHA8, whose pixels with alpha of at least 0x80 select the
+ *   upper byte of the ROP4;
+ * - source 1 is flipped horizontally, vertically or both;
+ * - source 1 is sometimes the destination itself, read as it was before
+ *   the BLT.
+ */
+
+#include "bvcputest.h"
+
+#define W		61
+#define H		37
+#define RANDBLTS	400
+
+static const unsigned short rops[] = {
+	0x0000, 0xFFFF, 0xAAAA, 0xCCCC, 0xF0F0, 0x6666, 0x5A5A, 0x5555,
+	0xCCF0, 0xF0CC, 0xAACC, 0xE2E2, 0xB8B8,
+};
+
+#define NROPS		(sizeof(rops) / sizeof(rops[0]))
+
+static const struct {
+	enum ocdformat format;
+	unsigned int bpp;
+} ropformats[] = {
+	{ OCDFMT_BGRA24, 4 },
+	{ OCDFMT_RGB16, 2 },
+};
+
+#define NFORMATS	(sizeof(ropformats) / sizeof(ropformats[0]))
+
+static unsigned char src1[W * H * 4], src2[W * H * 4], mask[W * H];
+static unsigned char dst[W * H * 4], before[W * H * 4], ref[W * H * 4];
+
+/*
+ * ropbyte() - One byte of a ROP4, a bit at a time.
+ */
+static unsigned char ropbyte(unsigned short rop, unsigned char d,
+			     unsigned char s, unsigned char p, unsigned char m)
+{
+	unsigned char out = 0;
+	unsigned int k, i;
+
+	for (k = 0; k < 8; k++) {
+		i = ((d >> k) & 1) | ((s >> k) & 1) << 1 |
+			((p >> k) & 1) << 2 | ((m >> k) & 1) << 3;
+		out |= ((rop >> i) & 1) << k;
+	}
+	return out;
+}
+
+/*
+ * check() - Do one ROP BLT and compare it with ropbyte().  src1 is dst
+ * when indst is set.
+ */
+static void check(unsigned int fi, unsigned short rop, unsigned long flip,
+		  int indst)
+{
+	struct bvbuffdesc s1desc, s2desc, mdesc, ddesc;
+	struct bvsurfgeom s1geom, s2geom, mgeom, dgeom;
+	struct bvbltparams params;
+	unsigned int bpp = ropformats[fi].bpp;
+	const unsigned char *s1 = indst ? before : src1;
+	int w = 1 + rand() % W, h = 1 + rand() % H;
+	int x, y, sx, sy, b;
+	unsigned char m;
+
+	for (x = 0; x < W * H * 4; x++)
+		dst[x] = rand();
+	memcpy(before, dst, sizeof(dst));
+	memcpy(ref, dst, sizeof(dst));
+
+	bvtest_surface(&s1desc, &s1geom, indst ? dst : src1, W * H * bpp,
+		       ropformats[fi].format, W, H, bpp);
+	bvtest_surface(&s2desc, &s2geom, src2, W * H * bpp,
+		       ropformats[fi].format, W, H, bpp);
+	bvtest_surface(&mdesc, &mgeom, mask, W * H, OCDFMT_ALPHA8, W, H, 1);
+	bvtest_surface(&ddesc, &dgeom, dst, W * H * bpp,
+		       ropformats[fi].format, W, H, bpp);
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP | flip;
+	params.op.rop = rop;
+	params.dstdesc = &ddesc;
+	params.dstgeom = &dgeom;
+	params.dstrect = bvtest_rect(w, h, W, H);
+	params.src1.desc = &s1desc;
+	params.src1geom = &s1geom;
+	params.src1rect = bvtest_rect(w, h, W, H);
+	params.src2.desc = &s2desc;
+	params.src2geom = &s2geom;
+	params.src2rect = bvtest_rect(w, h, W, H);
+	params.mask.desc = &mdesc;
+	params.maskgeom = &mgeom;
+	params.maskrect = bvtest_rect(w, h, W, H);
+
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++) {
+			int dx = params.dstrect.left + x;
+			int dy = params.dstrect.top + y;
+			int px = params.src2rect.left + x;
+			int py = params.src2rect.top + y;
+			sx = params.src1rect.left +
+				(flip & BVFLAG_HORZ_FLIP_SRC1 ? w - 1 - x : x);
+			sy = params.src1rect.top +
+				(flip & BVFLAG_VERT_FLIP_SRC1 ? h - 1 - y : y);
+			m = mask[(params.maskrect.top + y) * W +
+				 params.maskrect.left + x] >= 0x80 ? 0xFF : 0;
+			for (b = 0; b < (int)bpp; b++)
+				ref[(dy * W + dx) * bpp + b] =
+					ropbyte(rop,
+						before[(dy * W + dx) * bpp + b],
+						s1[(sy * W + sx) * bpp + b],
+						src2[(py * W + px) * bpp + b], m);
+		}
+
+	if (bv_blt(&params) != BVERR_NONE) {
+		bvtest_fail("rop %04x format %x: BLT rejected: %s", rop,
+			    ropformats[fi].format, params.errdesc);
+		return;
+	}
+	for (x = 0; x < W * H * (int)bpp; x++)
+		if (dst[x] != ref[x])
+			break;
+	if (x < W * H * (int)bpp)
+		bvtest_fail("rop %04x format %x flip %lx%s %dx%d: "
+			    "%02x at byte %d of %d,%d, not %02x", rop,
+			    ropformats[fi].format, flip,
+			    indst ? " in place" : "", w, h, dst[x],
+			    x % bpp, x / bpp % W, x / bpp / W, ref[x]);
+}
+
+int main(void)
+{
+	static const unsigned long flips[] = {
+		0, BVFLAG_HORZ_FLIP_SRC1, BVFLAG_VERT_FLIP_SRC1,
+		BVFLAG_HORZ_FLIP_SRC1 | BVFLAG_VERT_FLIP_SRC1,
+	};
+	unsigned long blts = 0;
+	unsigned int fi, i;
+
+	srand(4);
+	for (i = 0; i < sizeof(src1); i++) {
+		src1[i] = rand();
+		src2[i] = rand();
+	}
+	for (i = 0; i < sizeof(mask); i++)
+		mask[i] = rand();
+
+	for (fi = 0; fi < NFORMATS; fi++) {
+		for (i = 0; i < NROPS; i++, blts++)
+			check(fi, rops[i], flips[i % 4], 0);
+		for (i = 0; i < RANDBLTS; i++, blts++)
+			check(fi, rand(), flips[i % 4], i % 5 == 0);
+	}
+	return bvtest_done("rop4test", blts);
+}
@@ -0,0 +1,239 @@
+/*
+ * rotatetest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests surfaces turned by bvsurfgeom.orientation, flipped and
+ * stored bottom-up.  Copies between them are compared with each pixel
+ * moved here from its coordinates in one image to the other:
+ * - from and to surfaces turned 0, 90, 180 and 270 degrees, in BGRA24,
+ *   RGB24 and RGB16;
+ * - with the source flipped horizontally, vertically or both;
+ * - with either surface given a negative virtstride, and lines padded;
+ * - unscaled, and scaled with nearest neighbor, which reads turned
+ *   sources through the transposing scaler.
+ */
+
+#include "bvcputest.h"
+
+#define SW		57
+#define SH		43
+#define DW		64
+#define DH		50
+#define MAXPAD		13		/* bytes after each line */
+#define BUFSIZE		((64 * 4 + MAXPAD) * 64)
+
+#define BLTS		3000
+
+static const struct {
+	enum ocdformat format;
+	unsigned int bpp;
+} formats[] = {
+	{ OCDFMT_BGRA24, 4 },
+	{ OCDFMT_RGB24, 3 },
+	{ OCDFMT_RGB16, 2 },
+};
+
+#define NFORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+/*
+ * surface - A surface of width x height pixels as seen, turned rot
+ * quarter turns in memory.  Negative strides store the last line first.
+ */
+struct surface {
+	unsigned char *buf;
+	unsigned int width;
+	unsigned int height;
+	unsigned int bpp;
+	unsigned int rot;
+	long stride;
+};
+
+static unsigned char src[BUFSIZE];
+static unsigned char dst[BUFSIZE], ref[BUFSIZE];
+static unsigned long blts;
+
+/*
+ * pixel() - The address of pixel (x, y) of the image of a surface.  A
+ * surface turned a quarter turn clockwise has the first column of its
+ * image, from the bottom up, as its first line in memory.
+ */
+static unsigned char *pixel(const struct surface *s, int x, int y)
+{
+	unsigned int memh = s->rot & 1 ? s->width : s->height;
+	int mx, my;
+
+	switch (s->rot) {
+	case 1:
+		mx = (int)s->height - 1 - y;
+		my = x;
+		break;
+	case 2:
+		mx = (int)s->width - 1 - x;
+		my = (int)s->height - 1 - y;
+		break;
+	case 3:
+		mx = y;
+		my = (int)s->width - 1 - x;
+		break;
+	default:
+		mx = x;
+		my = y;
+		break;
+	}
+	if (s->stride < 0)
+		my = (int)memh - 1 - my;
+	return s->buf + my * labs(s->stride) + mx * (int)s->bpp;
+}
+
+/*
+ * describe() - Give a surface a random orientation, padding and stride
+ * direction, and describe it.
+ */
+static void describe(struct surface *s, struct bvbuffdesc *desc,
+		     struct bvsurfgeom *geom, unsigned char *buf,
+		     unsigned int width, unsigned int height,
+		     enum ocdformat format, unsigned int bpp)
+{
+	unsigned int memw, memh;
+
+	s->buf = buf;
+	s->width = width;
+	s->height = height;
+	s->bpp = bpp;
+	s->rot = rand() % 4;
+	memw = s->rot & 1 ? height : width;
+	memh = s->rot & 1 ? width : height;
+	s->stride = memw * bpp + rand() % (MAXPAD + 1);
+	if (rand() % 3 == 0)
+		s->stride = -s->stride;
+
+	bvtest_surface(desc, geom, buf, labs(s->stride) * memh, format,
+		       width, height, bpp);
+	geom->orientation = (int)s->rot * 90 - 360 * (rand() % 2);
+	geom->virtstride = s->stride;
+}
+
+/*
+ * nn() - The source pixel under the center of output i, scaling s pixels
+ * to d.
+ */
+static int nn(int i, int s, int d)
+{
+	return (int)((2LL * i + 1) * s / (2LL * d));
+}
+
+/*
+ * tie() - Whether the center of an output falls between two source pixels
+ * when scaling s pixels to d, for some output: when 2d divides an odd
+ * multiple of s.  Which of the two is taken depends on the order in which
+ * the destination is written in memory, so these sizes are not tested.
+ */
+static int tie(int s, int d)
+{
+	return (s & -s) > (d & -d);
+}
+
+/*
+ * check() - Copy a random rectangle between two random surfaces, and
+ * compare the destination with the pixels moved one at a time.
+ */
+static void check(void)
+{
+	struct bvbuffdesc srcdesc, dstdesc;
+	struct bvsurfgeom srcgeom, dstgeom;
+	struct bvbltparams params;
+	struct surface s, d, r;
+	const struct bvrect *sr, *dr;
+	unsigned int fi = rand() % NFORMATS, bpp = formats[fi].bpp;
+	int scaled = rand() % 4 == 0;
+	int x, y, sx, sy, i, w, h;
+
+	for (i = 0; i < BUFSIZE; i++) {
+		src[i] = rand();
+		dst[i] = rand();
+	}
+	memcpy(ref, dst, sizeof(dst));
+	describe(&s, &srcdesc, &srcgeom, src, SW, SH, formats[fi].format,
+		 bpp);
+	describe(&d, &dstdesc, &dstgeom, dst, DW, DH, formats[fi].format,
+		 bpp);
+
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP;
+	params.op.rop = 0xCCCC;
+	params.scalemode = BVSCALE_NEAREST_NEIGHBOR;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.src1.desc = &srcdesc;
+	params.src1geom = &srcgeom;
+	w = 1 + rand() % SW;
+	h = 1 + rand() % SH;
+	params.src1rect = bvtest_rect(w, h, SW, SH);
+	while (scaled) {
+		w = 1 + rand() % DW;
+		h = 1 + rand() % DH;
+		if (!tie(params.src1rect.width, w) &&
+		    !tie(params.src1rect.height, h))
+			break;
+	}
+	params.dstrect = bvtest_rect(w, h, DW, DH);
+	if (rand() % 2)
+		params.flags |= BVFLAG_HORZ_FLIP_SRC1;
+	if (rand() % 2)
+		params.flags |= BVFLAG_VERT_FLIP_SRC1;
+	sr = &params.src1rect;
+	dr = &params.dstrect;
+	r = d;
+	r.buf = ref;
+
+	for (y = 0; y < (int)dr->height; y++)
+		for (x = 0; x < (int)dr->width; x++) {
+			sx = nn(x, sr->width, dr->width);
+			sy = nn(y, sr->height, dr->height);
+			if (params.flags & BVFLAG_HORZ_FLIP_SRC1)
+				sx = (int)sr->width - 1 - sx;
+			if (params.flags & BVFLAG_VERT_FLIP_SRC1)
+				sy = (int)sr->height - 1 - sy;
+			memcpy(pixel(&r, dr->left + x, dr->top + y),
+			       pixel(&s, sr->left + sx, sr->top + sy), bpp);
+		}
+
+	blts++;
+	if (bv_blt(&params) != BVERR_NONE) {
+		bvtest_fail("rotate: BLT rejected: %s", params.errdesc);
+		return;
+	}
+	if (!memcmp(dst, ref, sizeof(dst)))
+		return;
+	for (i = 0; dst[i] == ref[i]; i++)
+		;
+	bvtest_fail("rotate %d to %d, format %x, flags %lx, strides %ld "
+		    "%ld, %ux%u to %ux%u: byte %d differs",
+		    srcgeom.orientation, dstgeom.orientation,
+		    formats[fi].format, params.flags, s.stride, d.stride,
+		    sr->width, sr->height, dr->width, dr->height, i);
+}
+
+int main(void)
+{
+	int i;
+
+	srand(10);
+	bvcpu_ncpus = BVTEST_THREADS;
+	for (i = 0; i < BLTS; i++)
+		check();
+	return bvtest_done("rotatetest", blts);
+}
@@ -0,0 +1,512 @@
+/*
+ * scaletest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests the scaler against what its modes promise:
+ * - explicit nearest neighbor must copy the source pixel under the center
+ *   of each output, at exact 2x, 3x, 4x and 1/2 ratios and others, with
+ *   the source flipped and the destination clipped;
+ * - the filters must leave a flat image as it was, whatever the ratio, as
+ *   their weights add up to exactly 1;
+ * - each quality of each implicit mode must resolve to the best ranked
+ *   filter whose cost, under a cost table given in BVCPU_COSTS, fits the
+ *   budget that quality sets, and BVFLAG_SCALE_RETURN must report it.
+ */
+
+#include <unistd.h>
+
+#include "bvcputest.h"
+
+#define SW		61
+#define SH		47
+#define DW		211
+#define DH		167
+
+#define NNBLTS		1500
+#define FLATBLTS	600
+#define CHOOSERATIOS	300
+
+static const unsigned char filters[] = {
+	BVSCALEDEF_LINEAR, BVSCALEDEF_CUBIC, BVSCALEDEF_3_TAP,
+	BVSCALEDEF_5_TAP, BVSCALEDEF_7_TAP, BVSCALEDEF_9_TAP,
+};
+
+#define NFILTERS	(sizeof(filters) / sizeof(filters[0]))
+
+static const struct {
+	enum ocdformat format;
+	unsigned int bpp;
+} flatformats[] = {
+	{ OCDFMT_BGRA24, 4 },
+	{ OCDFMT_RGB24, 3 },
+	{ OCDFMT_RGB16, 2 },
+};
+
+#define NFLATFORMATS	(sizeof(flatformats) / sizeof(flatformats[0]))
+
+/*
+ * The cost table given to the cost model, and the candidates it chooses
+ * from, with their ranks for photos and drawings as bvcpucost.c has them.
+ */
+static const char costs[] =
+	"scaleh 1.5 0.75\n"
+	"scalev 0.5 0.5\n"
+	"scalenn 0.25\n";
+
+static const struct {
+	unsigned char filter;
+	unsigned char photo;
+	unsigned char drawing;
+} cands[] = {
+	{ BVSCALEDEF_NEAREST_NEIGHBOR, 0, 0 },
+	{ BVSCALEDEF_LINEAR, 1, 3 },
+	{ BVSCALEDEF_3_TAP, 2, 5 },
+	{ BVSCALEDEF_CUBIC, 3, 6 },
+	{ BVSCALEDEF_5_TAP, 4, 4 },
+	{ BVSCALEDEF_7_TAP, 5, 2 },
+	{ BVSCALEDEF_9_TAP, 6, 1 },
+};
+
+#define NCANDS		(sizeof(cands) / sizeof(cands[0]))
+#define RANKEXACT	7
+
+static const unsigned long techniques[] = {
+	BVSCALEDEF_DONT_CARE, BVSCALEDEF_NOT_NEAREST_NEIGHBOR,
+	BVSCALEDEF_POINT_SAMPLE, BVSCALEDEF_INTERPOLATED,
+};
+
+static const unsigned long types[] = {
+	0, BVSCALEDEF_PHOTO, BVSCALEDEF_DRAWING,
+};
+
+static unsigned char src[SW * SH * 4];
+static unsigned char init[DW * DH * 4];
+static unsigned char dst[DW * DH * 4], ref[DW * DH * 4];
+static unsigned long blts;
+
+static unsigned long explicitmode(unsigned char h, unsigned char v)
+{
+	return (0xFFUL << BVSCALEDEF_VENDOR_SHIFT) | BVSCALEDEF_EXPLICIT |
+		((unsigned long)h << BVSCALEDEF_HORZ_SHIFT) |
+		((unsigned long)v << BVSCALEDEF_VERT_SHIFT);
+}
+
+/*
+ * ratio() - Pick a source and destination size of at most maxs and maxd:
+ * 2x, 3x or 4x up, 1/2 down, unscaled, or anything.
+ */
+static void ratio(int maxs, int maxd, int *s, int *d)
+{
+	int r;
+
+	switch (rand() % 6) {
+	case 0:
+	case 1:
+	case 2:
+		r = 2 + rand() % 3;
+		*s = 1 + rand() % (maxs < maxd / r ? maxs : maxd / r);
+		*d = *s * r;
+		break;
+	case 3:
+		*d = 1 + rand() % (maxs / 2 < maxd ? maxs / 2 : maxd);
+		*s = 2 * *d;
+		break;
+	case 4:
+		*s = 1 + rand() % (maxs < maxd ? maxs : maxd);
+		*d = *s;
+		break;
+	default:
+		*s = 1 + rand() % maxs;
+		*d = 1 + rand() % maxd;
+		break;
+	}
+}
+
+/*
+ * clip() - Maybe clip the BLT to a random rectangle of the destination,
+ * which need not meet dstrect.
+ */
+static void clip(struct bvbltparams *params)
+{
+	if (rand() % 2)
+		return;
+	params->flags |= BVFLAG_CLIP;
+	params->cliprect = bvtest_rect(1 + rand() % DW, 1 + rand() % DH,
+				       DW, DH);
+}
+
+/*
+ * written() - Whether the BLT writes pixel (x, y) of the destination.
+ */
+static int written(const struct bvbltparams *params, int x, int y)
+{
+	const struct bvrect *d = &params->dstrect, *c = &params->cliprect;
+
+	if (x < d->left || x >= d->left + (int)d->width ||
+	    y < d->top || y >= d->top + (int)d->height)
+		return 0;
+	if (!(params->flags & BVFLAG_CLIP))
+		return 1;
+	return x >= c->left && x < c->left + (int)c->width &&
+		y >= c->top && y < c->top + (int)c->height;
+}
+
+/*
+ * setup() - A ROP copy of a random rectangle of src in format to a random
+ * rectangle of dst, which starts out as init.
+ */
+static void setup(struct bvbltparams *params, struct bvbuffdesc *srcdesc,
+		  struct bvsurfgeom *srcgeom, struct bvbuffdesc *dstdesc,
+		  struct bvsurfgeom *dstgeom, enum ocdformat format,
+		  unsigned int bpp)
+{
+	int sw, sh, dw, dh;
+
+	ratio(SW, DW, &sw, &dw);
+	ratio(SH, DH, &sh, &dh);
+	memcpy(dst, init, sizeof(dst));
+	memcpy(ref, init, sizeof(ref));
+
+	bvtest_surface(srcdesc, srcgeom, src, sizeof(src), format, SW, SH,
+		       bpp);
+	bvtest_surface(dstdesc, dstgeom, dst, sizeof(dst), format, DW, DH,
+		       bpp);
+	memset(params, 0, sizeof(*params));
+	params->structsize = sizeof(*params);
+	params->flags = BVFLAG_ROP;
+	params->op.rop = 0xCCCC;
+	params->dstdesc = dstdesc;
+	params->dstgeom = dstgeom;
+	params->dstrect = bvtest_rect(dw, dh, DW, DH);
+	params->src1.desc = srcdesc;
+	params->src1geom = srcgeom;
+	params->src1rect = bvtest_rect(sw, sh, SW, SH);
+	if (rand() % 3 == 0)
+		params->flags |= BVFLAG_HORZ_FLIP_SRC1;
+	if (rand() % 3 == 0)
+		params->flags |= BVFLAG_VERT_FLIP_SRC1;
+	clip(params);
+}
+
+/*
+ * compare() - Compare dst with ref, and report the first difference.
+ */
+static void compare(const struct bvbltparams *params, const char *test,
+		    unsigned int bpp)
+{
+	int i;
+
+	blts++;
+	if (!memcmp(dst, ref, sizeof(dst)))
+		return;
+	for (i = 0; dst[i] == ref[i]; i++)
+		;
+	bvtest_fail("%s: scale %x, flags %lx, %ux%u to %ux%u: pixel %d,%d "
+		    "differs", test, params->scalemode, params->flags,
+		    params->src1rect.width, params->src1rect.height,
+		    params->dstrect.width, params->dstrect.height,
+		    i / (int)bpp % DW, i / (int)bpp / DW);
+}
+
+/*
+ * nn() - The source pixel under the center of output i, scaling s pixels
+ * to d.
+ */
+static int nn(int i, int s, int d)
+{
+	return (int)((2LL * i + 1) * s / (2LL * d));
+}
+
+/*
+ * nncheck() - Scale random pixels with explicit nearest neighbor.  A
+ * flipped source is scaled as if flipped first.
+ */
+static void nncheck(void)
+{
+	struct bvbuffdesc srcdesc, dstdesc;
+	struct bvsurfgeom srcgeom, dstgeom;
+	struct bvbltparams params;
+	const struct bvrect *s, *d;
+	int x, y, sx, sy, i;
+
+	for (i = 0; i < SW * SH * 4; i++)
+		src[i] = rand();
+	setup(&params, &srcdesc, &srcgeom, &dstdesc, &dstgeom, OCDFMT_BGRA24,
+	      4);
+	params.scalemode = BVSCALE_NEAREST_NEIGHBOR;
+	s = &params.src1rect;
+	d = &params.dstrect;
+
+	for (y = 0; y < DH; y++)
+		for (x = 0; x < DW; x++) {
+			if (!written(&params, x, y))
+				continue;
+			sx = nn(x - d->left, s->width, d->width);
+			sy = nn(y - d->top, s->height, d->height);
+			if (params.flags & BVFLAG_HORZ_FLIP_SRC1)
+				sx = s->width - 1 - sx;
+			if (params.flags & BVFLAG_VERT_FLIP_SRC1)
+				sy = s->height - 1 - sy;
+			memcpy(ref + (y * DW + x) * 4,
+			       src + ((s->top + sy) * SW + s->left + sx) * 4,
+			       4);
+		}
+
+	if (bv_blt(&params) != BVERR_NONE) {
+		bvtest_fail("nearest: BLT rejected: %s", params.errdesc);
+		return;
+	}
+	compare(&params, "nearest", 4);
+}
+
+/*
+ * flatcheck() - Scale a flat image with random filters, which must give
+ * back its color.  For BGRA24 the color is premultiplied; the others have
+ * no alpha.
+ */
+static void flatcheck(void)
+{
+	struct bvbuffdesc srcdesc, dstdesc;
+	struct bvsurfgeom srcgeom, dstgeom;
+	struct bvbltparams params;
+	unsigned int fi = rand() % NFLATFORMATS;
+	unsigned int bpp = flatformats[fi].bpp;
+	unsigned char color[4];
+	int x, y, i;
+
+	bvtest_premul(color, 1);
+	for (i = 0; i < SW * SH; i++)
+		memcpy(src + i * bpp, color, bpp);
+	setup(&params, &srcdesc, &srcgeom, &dstdesc, &dstgeom,
+	      flatformats[fi].format, bpp);
+	params.scalemode = explicitmode(filters[rand() % NFILTERS],
+					filters[rand() % NFILTERS]);
+
+	for (y = 0; y < DH; y++)
+		for (x = 0; x < DW; x++)
+			if (written(&params, x, y))
+				memcpy(ref + (y * DW + x) * bpp, color, bpp);
+
+	if (bv_blt(&params) != BVERR_NONE) {
+		bvtest_fail("flat: BLT rejected: %s", params.errdesc);
+		return;
+	}
+	compare(&params, "flat", bpp);
+}
+
+/*
+ * rank() - The rank of candidate c for scaling s pixels to d.
+ */
+static unsigned int rank(unsigned long type, unsigned int c, int s, int d)
+{
+	if (s == d)
+		return 0;
+	if (type != BVSCALEDEF_DRAWING)
+		return cands[c].photo;
+	if (cands[c].filter == BVSCALEDEF_NEAREST_NEIGHBOR && d > s &&
+	    !(d % s))
+		return RANKEXACT;
+	return cands[c].drawing;
+}
+
+/*
+ * cost() - The cost of candidate c under the table in costs: the
+ * horizontal pass over each source line the vertical taps touch, then the
+ * vertical pass if it has more than one tap.
+ */
+static double cost(unsigned int c, int sw, int sh, int dw, int dh)
+{
+	unsigned char f = cands[c].filter;
+	double lines = dh, total = 0.0;
+	unsigned int taps;
+
+	if (sh != dh) {
+		taps = bvcpu_scaletaps(f, sh, dh);
+		lines = (double)dh * taps;
+		if (lines > sh)
+			lines = sh;
+		if (taps > 1)
+			total += (double)dw * dh * (0.5 + 0.5 * taps);
+	}
+	if (sw != dw) {
+		taps = bvcpu_scaletaps(f, sw, dw);
+		total += lines * dw * (f == BVSCALEDEF_NEAREST_NEIGHBOR ?
+				       0.25 : 1.5 + 0.75 * taps);
+	}
+	return total;
+}
+
+static int allowed(unsigned long technique, unsigned char filter)
+{
+	switch (technique) {
+	case BVSCALEDEF_POINT_SAMPLE:
+		return filter == BVSCALEDEF_NEAREST_NEIGHBOR;
+	case BVSCALEDEF_NOT_NEAREST_NEIGHBOR:
+	case BVSCALEDEF_INTERPOLATED:
+		return filter != BVSCALEDEF_NEAREST_NEIGHBOR;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * choosecheck() - Resolve every quality of every implicit mode for one
+ * ratio, and check that the filter chosen is allowed, fits the budget,
+ * and that no allowed candidate within it ranks higher, or as high for
+ * less.  The budget is the cost of the cheapest candidate plus the given
+ * fraction of the way to that of the best ranked.
+ */
+static void choosecheck(void)
+{
+	unsigned int r[NCANDS], c, top, cheap, chosen, q, ti, yi;
+	double k[NCANDS], budget, slack;
+	unsigned char h, v;
+	unsigned long mode;
+	int sw, sh, dw, dh;
+
+	ratio(SW, DW, &sw, &dw);
+	ratio(SH, DH, &sh, &dh);
+	if (sw == dw && sh == dh)
+		return;
+
+	for (ti = 0; ti < sizeof(techniques) / sizeof(techniques[0]); ti++)
+		for (yi = 0; yi < sizeof(types) / sizeof(types[0]); yi++) {
+			top = cheap = NCANDS;
+			for (c = 0; c < NCANDS; c++) {
+				if (!allowed(techniques[ti], cands[c].filter))
+					continue;
+				r[c] = rank(types[yi], c, sw, dw) +
+					rank(types[yi], c, sh, dh);
+				k[c] = cost(c, sw, sh, dw, dh);
+				if (cheap == NCANDS || k[c] < k[cheap])
+					cheap = c;
+				if (top == NCANDS || r[c] > r[top] ||
+				    (r[c] == r[top] && k[c] < k[top]))
+					top = c;
+			}
+
+			for (q = 0; q <= BVSCALEDEF_QUALITY_MASK >>
+				     BVSCALEDEF_QUALITY_SHIFT; q++) {
+				mode = BVSCALEDEF_VENDOR_ALL |
+					BVSCALEDEF_IMPLICIT |
+					(q << BVSCALEDEF_QUALITY_SHIFT) |
+					techniques[ti] | types[yi];
+				bvcpu_choosescale(mode, sw, sh, dw, dh, &h, &v);
+				for (chosen = 0; chosen < NCANDS; chosen++)
+					if (cands[chosen].filter == h)
+						break;
+				budget = k[cheap] + q * (k[top] - k[cheap]) /
+					(BVSCALEDEF_QUALITY_MASK >>
+					 BVSCALEDEF_QUALITY_SHIFT);
+				slack = budget * 1e-9;
+				if (h != v || chosen == NCANDS ||
+				    !allowed(techniques[ti], h) ||
+				    k[chosen] > budget + slack) {
+					bvtest_fail("choose %lx, %dx%d to "
+						    "%dx%d: filters %x %x "
+						    "outside budget %g", mode,
+						    sw, sh, dw, dh, h, v,
+						    budget);
+					continue;
+				}
+				for (c = 0; c < NCANDS; c++) {
+					if (!allowed(techniques[ti],
+						     cands[c].filter) ||
+					    k[c] > budget - slack)
+						continue;
+					if (r[c] > r[chosen] ||
+					    (r[c] == r[chosen] &&
+					     k[c] < k[chosen] - slack))
+						break;
+				}
+				if (c < NCANDS)
+					bvtest_fail("choose %lx, %dx%d to "
+						    "%dx%d: filter %x chosen "
+						    "over %x", mode, sw, sh,
+						    dw, dh, h,
+						    cands[c].filter);
+			}
+		}
+}
+
+/*
+ * returncheck() - An implicit mode resolved by a BLT must be reported as
+ * the explicit mode bvcpu_choosescale() gives.
+ */
+static void returncheck(void)
+{
+	static const enum bvscalemode modes[] = {
+		BVSCALE_FASTEST, BVSCALE_GOOD_PHOTO, BVSCALE_BETTER_DRAWING,
+		BVSCALE_BEST, BVSCALE_BEST_INTERPOLATED,
+	};
+	struct bvbuffdesc srcdesc, dstdesc;
+	struct bvsurfgeom srcgeom, dstgeom;
+	struct bvbltparams params;
+	unsigned long mode;
+	unsigned char h, v;
+
+	bvtest_premul(src, SW * SH);
+	setup(&params, &srcdesc, &srcgeom, &dstdesc, &dstgeom, OCDFMT_BGRA24,
+	      4);
+	mode = modes[rand() % (sizeof(modes) / sizeof(modes[0]))];
+	params.scalemode = (enum bvscalemode)mode;
+	params.flags |= BVFLAG_SCALE_RETURN;
+	params.flags &= ~BVFLAG_CLIP;
+	if (params.src1rect.width == params.dstrect.width &&
+	    params.src1rect.height == params.dstrect.height)
+		return;
+	bvcpu_choosescale(mode, params.src1rect.width, params.src1rect.height,
+			  params.dstrect.width, params.dstrect.height, &h, &v);
+
+	blts++;
+	if (bv_blt(&params) != BVERR_NONE)
+		bvtest_fail("return: BLT rejected: %s", params.errdesc);
+	else if ((unsigned int)params.scalemode !=
+		 (unsigned int)explicitmode(h, v))
+		bvtest_fail("return: %lx resolved to %x, not %lx", mode,
+			    params.scalemode, explicitmode(h, v));
+}
+
+int main(void)
+{
+	char name[] = "/tmp/scaletestXXXXXX";
+	unsigned char h, v;
+	int fd, i;
+
+	fd = mkstemp(name);
+	if (fd < 0 || write(fd, costs, sizeof(costs) - 1) !=
+	    (ssize_t)(sizeof(costs) - 1)) {
+		bvtest_fail("cannot write %s", name);
+		return bvtest_done("scaletest", blts);
+	}
+	close(fd);
+	setenv("BVCPU_COSTS", name, 1);
+	bvcpu_choosescale(BVSCALE_FASTEST, 2, 2, 1, 1, &h, &v);
+	unlink(name);
+
+	srand(16);
+	for (i = 0; i < DW * DH * 4; i++)
+		init[i] = rand();
+	bvcpu_ncpus = BVTEST_THREADS;
+	for (i = 0; i < NNBLTS; i++)
+		nncheck();
+	for (i = 0; i < FLATBLTS; i++)
+		flatcheck();
+	for (i = 0; i < CHOOSERATIOS; i++) {
+		choosecheck();
+		returncheck();
+	}
+	return bvtest_done("scaletest", blts);
+}
@@ -0,0 +1,380 @@
+/*
+ * seamtest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests that a BLT done in pieces leaves no seams:
+ * - a scaled BLT split by cliprect into strips must match the BLT done
+ *   whole, with every filter and with ordered dither; a src2 given an
+ *   auxiliary dstrect must match src2 scaled to it first;
+ * - a large BLT run in bands on BVTEST_THREADS threads must match it run
+ *   on one.
+ */
+
+#include "bvcputest.h"
+
+#define SW		53
+#define SH		41
+#define DW		131
+#define DH		97
+
+#define BW		900		/* banded BLTs */
+#define BH		700
+
+#define CLIPBLTS	500
+#define BANDBLTS	60
+
+static const unsigned long scalemodes[] = {
+	BVSCALE_NEAREST_NEIGHBOR, BVSCALE_BILINEAR, BVSCALE_BICUBIC,
+	BVSCALE_5x5_TAP, BVSCALE_9x9_TAP, BVSCALE_FASTEST, BVSCALE_BEST,
+};
+
+#define NSCALEMODES	(sizeof(scalemodes) / sizeof(scalemodes[0]))
+
+static const enum ocdformat bandformats[] = {
+	OCDFMT_BGRA24, OCDFMT_nBGRA24, OCDFMT_RGB24, OCDFMT_RGB16,
+};
+
+static unsigned char src1[SW * SH * 4], src2[SW * SH * 4];
+static unsigned char init[DW * DH * 4], whole[DW * DH * 4];
+static unsigned char strips[DW * DH * 4], scaled[DW * DH * 4];
+
+static unsigned char bsrc1[BW * BH * 4], bsrc2[BW * BH * 4];
+static unsigned char bmask[BW * BH], binit[BW * BH * 4];
+static unsigned char bone[BW * BH * 4], bbands[BW * BH * 4];
+
+static unsigned long blts;
+
+static unsigned int bytesper(enum ocdformat format)
+{
+	return format == OCDFMT_RGB24 ? 3 : format == OCDFMT_RGB16 ? 2 : 4;
+}
+
+static int blt(struct bvbltparams *params, const char *what, int it)
+{
+	blts++;
+	if (bv_blt(params) == BVERR_NONE)
+		return 0;
+	bvtest_fail("clip %d: %s rejected: %s", it, what, params->errdesc);
+	return -1;
+}
+
+/*
+ * clipcheck() - Compare a random scaled BLT done whole with it done in
+ * clipped strips.
+ */
+static void clipcheck(int it)
+{
+	struct bvbuffdesc desc1, desc2, dstdesc, scaleddesc;
+	struct bvsurfgeom geom1, geom2, dstgeom, scaledgeom;
+	struct bvbltparams params, strip;
+	struct bvrect dstrect, src1rect, src2rect, aux;
+	enum ocdformat format;
+	unsigned long scalemode;
+	int blend, dither, useaux, vert, bpp, n, k, i;
+
+	blend = rand() % 2;
+	dither = rand() % 3 == 0;
+	useaux = blend && rand() % 2;
+	scalemode = scalemodes[rand() % NSCALEMODES];
+	format = rand() % 2 ? OCDFMT_BGRA24 : OCDFMT_RGB16;
+	bpp = bytesper(format);
+	dstrect = bvtest_rect(1 + rand() % DW, 1 + rand() % DH, DW, DH);
+	src1rect = bvtest_rect(1 + rand() % SW, 1 + rand() % SH, SW, SH);
+	src2rect = bvtest_rect(1 + rand() % SW, 1 + rand() % SH, SW, SH);
+
+	/* the auxiliary dstrect of src2 holds dstrect */
+	aux.left = rand() % (dstrect.left + 1);
+	aux.top = rand() % (dstrect.top + 1);
+	aux.width = dstrect.left + dstrect.width - aux.left +
+		rand() % (DW - dstrect.left - dstrect.width + 1);
+	aux.height = dstrect.top + dstrect.height - aux.top +
+		rand() % (DH - dstrect.top - dstrect.height + 1);
+
+	bvtest_premul(src1, SW * SH);
+	bvtest_premul(src2, SW * SH);
+	if (format == OCDFMT_BGRA24)
+		bvtest_premul(init, DW * DH);
+	else
+		for (i = 0; i < DW * DH * 2; i++)
+			init[i] = rand();
+	bvtest_surface(&desc1, &geom1, src1, sizeof(src1), OCDFMT_BGRA24,
+		       SW, SH, 4);
+	bvtest_surface(&desc2, &geom2, src2, sizeof(src2), OCDFMT_BGRA24,
+		       SW, SH, 4);
+	bvtest_surface(&scaleddesc, &scaledgeom, scaled, sizeof(scaled),
+		       OCDFMT_BGRA24, DW, DH, 4);
+
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.scalemode = scalemode;
+	params.dithermode = dither ? BVDITHER_ORDERED_2x2 : BVDITHER_NONE;
+	params.dstgeom = &dstgeom;
+	params.dstrect = dstrect;
+	params.src1.desc = &desc1;
+	params.src1geom = &geom1;
+	params.src1rect = src1rect;
+	if (blend) {
+		params.flags = BVFLAG_BLEND;
+		params.op.blend = BVBLEND_SRC1OVER;
+		params.src2.desc = &desc2;
+		params.src2geom = &geom2;
+		params.src2rect = src2rect;
+	} else {
+		params.flags = BVFLAG_ROP;
+		params.op.rop = 0xCCCC;
+	}
+
+	/* whole, with src2 first scaled to its auxiliary dstrect */
+	memcpy(whole, init, sizeof(whole));
+	bvtest_surface(&dstdesc, &dstgeom, whole, sizeof(whole), format,
+		       DW, DH, bpp);
+	strip = params;
+	strip.dstdesc = &dstdesc;
+	if (useaux) {
+		memset(&params, 0, sizeof(params));
+		params.structsize = sizeof(params);
+		params.flags = BVFLAG_ROP;
+		params.op.rop = 0xCCCC;
+		params.scalemode = scalemode;
+		params.dstdesc = &scaleddesc;
+		params.dstgeom = &scaledgeom;
+		params.dstrect = aux;
+		params.src1.desc = &desc2;
+		params.src1geom = &geom2;
+		params.src1rect = src2rect;
+		if (blt(&params, "src2 scale", it))
+			return;
+		params = strip;
+		params.src2.desc = &scaleddesc;
+		params.src2geom = &scaledgeom;
+		params.src2rect = dstrect;
+		if (blt(&params, "whole BLT", it))
+			return;
+		strip.flags |= BVFLAG_SRC2_AUXDSTRECT;
+		strip.src2auxdstrect = aux;
+	} else {
+		params = strip;
+		if (blt(&params, "whole BLT", it))
+			return;
+	}
+
+	/* in horizontal or vertical strips */
+	memcpy(strips, init, sizeof(strips));
+	dstdesc.virtaddr = strips;
+	strip.flags |= BVFLAG_CLIP;
+	vert = it & 1;
+	n = 1 + rand() % 6;
+	for (k = 0; k < n; k++) {
+		params = strip;
+		params.cliprect = dstrect;
+		if (vert) {
+			params.cliprect.left += dstrect.width * k / n;
+			params.cliprect.width = dstrect.width * (k + 1) / n -
+				dstrect.width * k / n;
+		} else {
+			params.cliprect.top += dstrect.height * k / n;
+			params.cliprect.height = dstrect.height * (k + 1) / n -
+				dstrect.height * k / n;
+		}
+		if (!params.cliprect.width || !params.cliprect.height)
+			continue;
+		if (blt(&params, "strip", it))
+			return;
+	}
+
+	if (memcmp(whole, strips, sizeof(whole))) {
+		for (i = 0; whole[i] == strips[i]; i++)
+			;
+		bvtest_fail("clip %d: blend %d aux %d scale %lx, %dx%d to "
+			    "%dx%d in %d strips: pixel %d,%d differs", it,
+			    blend, useaux, scalemode, src1rect.width,
+			    src1rect.height, dstrect.width, dstrect.height,
+			    n, i / bpp % DW, i / bpp / DW);
+	}
+}
+
+/*
+ * bandcheck() - Compare a random large BLT run on BVTEST_THREADS threads
+ * with it run on one.
+ */
+static void bandcheck(int it)
+{
+	static struct bvtileparams tile;
+	struct bvbuffdesc desc1, desc2, maskdesc, dstdesc;
+	struct bvsurfgeom geom1, geom2, maskgeom, dstgeom;
+	struct bvbltparams params, run;
+	enum ocdformat srcformat, dstformat;
+	int kind, rotate, scale, sw, sh, i;
+	struct bvrect dstrect;
+
+	srcformat = bandformats[rand() % 4];
+	dstformat = bandformats[rand() % 4];
+	kind = rand() % 8;
+	rotate = rand() % 4 * 90;
+	scale = rand() % 2;
+	dstrect = bvtest_rect(520 + rand() % (BW - 520),
+			      520 + rand() % (BH - 520), BW, BH);
+	if (scale) {
+		sw = 1 + rand() % (rotate % 180 ? BH : BW);
+		sh = 1 + rand() % (rotate % 180 ? BW : BH);
+	} else {
+		sw = rotate % 180 ? dstrect.height : dstrect.width;
+		sh = rotate % 180 ? dstrect.width : dstrect.height;
+		if (sw > (rotate % 180 ? BH : BW) ||
+		    sh > (rotate % 180 ? BW : BH))
+			return;
+	}
+
+	for (i = 0; i < BW * BH * 4; i++) {
+		bsrc1[i] = rand();
+		bsrc2[i] = rand();
+		binit[i] = rand();
+	}
+	for (i = 0; i < BW * BH; i++)
+		bmask[i] = rand();
+
+	bvtest_surface(&desc1, &geom1, bsrc1, sizeof(bsrc1), srcformat,
+		       BW, BH, bytesper(srcformat));
+	if (rotate % 180) {
+		geom1.width = BH;
+		geom1.height = BW;
+	}
+	geom1.orientation = rotate;
+	bvtest_surface(&desc2, &geom2, bsrc2, sizeof(bsrc2), OCDFMT_BGRA24,
+		       BW, BH, 4);
+	bvtest_surface(&maskdesc, &maskgeom, bmask, sizeof(bmask),
+		       OCDFMT_ALPHA8, BW, BH, 1);
+	bvtest_surface(&dstdesc, &dstgeom, bone, sizeof(bone), dstformat,
+		       BW, BH, bytesper(dstformat));
+
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.scalemode = scalemodes[rand() % 4];
+	params.dithermode = rand() % 2 ? BVDITHER_ORDERED_4x4 : BVDITHER_NONE;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.dstrect = dstrect;
+	params.src1.desc = &desc1;
+	params.src1geom = &geom1;
+	params.src1rect = bvtest_rect(sw, sh, geom1.width, geom1.height);
+	params.flags = BVFLAG_ROP;
+	params.op.rop = 0xCCCC;
+	switch (kind) {
+	case 0:
+		break;
+	case 1:
+		params.op.rop = 0xB8B8;
+		params.src2.desc = &desc2;
+		params.src2geom = &geom2;
+		params.src2rect.width = BW;
+		params.src2rect.height = BH;
+		break;
+	case 2:
+		/* over the destination */
+		params.flags = BVFLAG_BLEND;
+		params.op.blend = BVBLEND_SRC1OVER;
+		params.src2.desc = &dstdesc;
+		params.src2geom = &dstgeom;
+		params.src2rect = dstrect;
+		break;
+	case 3:
+		/* over the destination, through a scaled mask */
+		params.flags = BVFLAG_BLEND | BVFLAG_SRCMASK;
+		params.op.blend = BVBLEND_SRC1OVER;
+		params.src2.desc = &dstdesc;
+		params.src2geom = &dstgeom;
+		params.src2rect = dstrect;
+		params.mask.desc = &maskdesc;
+		params.maskgeom = &maskgeom;
+		params.maskrect.width = 1 + rand() % BW;
+		params.maskrect.height = 1 + rand() % BH;
+		break;
+	case 4:
+		params.flags |= BVFLAG_KEY_SRC;
+		params.colorkey = bsrc1;
+		break;
+	case 5:
+		/* overlapping the destination, which must not be banded */
+		params.src1.desc = &dstdesc;
+		params.src1geom = &dstgeom;
+		params.src1rect = bvtest_rect(dstrect.width, dstrect.height,
+					      BW, BH);
+		break;
+	case 6:
+		memset(&tile, 0, sizeof(tile));
+		tile.structsize = sizeof(tile);
+		tile.virtaddr = bsrc1;
+		tile.dstleft = dstrect.left + 3;
+		tile.dsttop = dstrect.top - 7;
+		tile.flags = BVTILE_LEFT_MIRROR;
+		geom1.orientation = 0;
+		geom1.width = BW;
+		geom1.height = BH;
+		params.flags |= BVFLAG_TILE_SRC1;
+		params.src1.tileparams = &tile;
+		params.src1rect.left = params.src1rect.top = 5;
+		params.src1rect.width = 1 + rand() % 40;
+		params.src1rect.height = 1 + rand() % 40;
+		break;
+	default:
+		params.flags = BVFLAG_BLEND | BVFLAG_CLIP;
+		params.op.blend = BVBLEND_SRC1OVER;
+		params.src2.desc = &desc2;
+		params.src2geom = &geom2;
+		params.src2rect.width = BW / 2;
+		params.src2rect.height = BH / 2;
+		params.cliprect.left = dstrect.left + 10;
+		params.cliprect.top = dstrect.top + 5;
+		params.cliprect.width = dstrect.width - 20;
+		params.cliprect.height = dstrect.height - 7;
+		break;
+	}
+
+	bvcpu_ncpus = 1;
+	memcpy(bone, binit, sizeof(bone));
+	dstdesc.virtaddr = bone;
+	run = params;
+	if (bv_blt(&run) != BVERR_NONE) {
+		/* some formats cannot be keyed or rotated, say */
+		return;
+	}
+
+	bvcpu_ncpus = BVTEST_THREADS;
+	memcpy(bbands, binit, sizeof(bbands));
+	dstdesc.virtaddr = bbands;
+	run = params;
+	blts += 2;
+	if (bv_blt(&run) != BVERR_NONE)
+		bvtest_fail("band %d: kind %d rejected on %d threads: %s",
+			    it, kind, BVTEST_THREADS, run.errdesc);
+	else if (memcmp(bone, bbands, sizeof(bone)))
+		bvtest_fail("band %d: kind %d, formats %x to %x, rotated %d, "
+			    "differs on %d threads", it, kind, srcformat,
+			    dstformat, rotate, BVTEST_THREADS);
+}
+
+int main(void)
+{
+	int it;
+
+	srand(14);
+	bvcpu_ncpus = 1;
+	for (it = 0; it < CLIPBLTS; it++)
+		clipcheck(it);
+	srand(15);
+	for (it = 0; it < BANDBLTS; it++)
+		bandcheck(it);
+	return bvtest_done("seamtest", blts);
+}
@@ -0,0 +1,349 @@
+/*
+ * shapetest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests the cache of BLT shapes.  This thread repeats a shape,
+ * changing one thing about it at a time, and each BLT is compared with the
+ * same BLT run by a new thread, whose cache is empty, on a copy of the
+ * destination: the pixels and the error returned must be the same.
+ * Between BLTs of the shape:
+ * - the rectangles move and change size, scaled or not, and now and then
+ *   fall off the destination;
+ * - the formats and orientations of the source and destination change;
+ * - a buffer is unmapped and its bvbuffdesc mapped again, or not, over
+ *   the same or another buffer;
+ * - the color key, global alpha and dither mode change.
+ * A thread that has a cache also BLTs from the destructor of a key made
+ * after its first BLT, once the cache has been freed as the thread exits.
+ */
+
+#include <pthread.h>
+
+#include "bvcputest.h"
+
+#define S		48		/* surfaces are square, to turn */
+#define COLORS		4		/* in the source, so keys match */
+
+#define SHAPES		40
+#define REPEATS		50		/* BLTs of each shape */
+
+static const struct {
+	enum ocdformat format;
+	unsigned int bpp;
+} formats[] = {
+	{ OCDFMT_BGRA24, 4 },
+	{ OCDFMT_RGB24, 3 },
+	{ OCDFMT_RGB16, 2 },
+	{ OCDFMT_BGRx24, 4 },
+};
+
+#define NFORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+static const unsigned long dithers[] = {
+	BVDITHER_NONE, BVDITHER_ORDERED_2x2, BVDITHER_ORDERED_4x4,
+};
+
+static unsigned char src[2][S * S * 4], dst[2][S * S * 4], ref[S * S * 4];
+static struct bvbuffdesc srcdesc, dstdesc;
+static struct bvsurfgeom srcgeom, dstgeom;
+static unsigned char key[4];
+static unsigned long blts;
+
+/*
+ * shape - What this thread keeps between BLTs: the kind of BLT, the
+ * formats, and the buffers the descriptors point to.
+ */
+static struct {
+	int kind;
+	unsigned int sfi, dfi;		/* formats */
+	int srot, drot;
+	unsigned char alpha;
+	unsigned long dither;
+	int s, d;			/* buffers */
+} shape;
+
+static enum bverror uncachederr;
+
+static void *uncached(void *arg)
+{
+	uncachederr = bv_blt(arg);
+	return NULL;
+}
+
+/*
+ * exiting - A BLT run by a thread, and then twice by the destructor of a
+ * key of its own, with the errors it returned.  Keys made later have their
+ * destructors called later, so the thread's shape cache is gone by then.
+ */
+static struct bvbltparams exitblt;
+static pthread_key_t exitkey;
+static enum bverror exiterr[3];
+
+static void exitdestroy(void *arg)
+{
+	exiterr[1] = bv_blt(&exitblt);
+	exiterr[2] = bv_blt(&exitblt);
+}
+
+static void *exiting(void *arg)
+{
+	exiterr[0] = bv_blt(&exitblt);
+	if (pthread_key_create(&exitkey, exitdestroy) ||
+	    pthread_setspecific(exitkey, &exitblt))
+		bvtest_fail("shape: no key");
+	return NULL;
+}
+
+/*
+ * paint() - Fill a surface with pixels of a few random colors.
+ */
+static void paint(unsigned char *buf, unsigned int bpp)
+{
+	unsigned char colors[COLORS][4];
+	int i;
+
+	for (i = 0; i < COLORS * 4; i++)
+		colors[i / 4][i % 4] = rand();
+	for (i = 0; i < S * S; i++)
+		memcpy(buf + i * bpp, colors[rand() % COLORS], bpp);
+}
+
+static void describe(struct bvsurfgeom *geom, unsigned int fi, int rot)
+{
+	geom->format = formats[fi].format;
+	geom->orientation = rot;
+	geom->virtstride = S * formats[fi].bpp;
+}
+
+/*
+ * change() - Change one thing about the shape, or only the rectangles.
+ */
+static void change(void)
+{
+	struct bvbuffdesc *desc;
+
+	switch (rand() % 10) {
+	case 0:
+		shape.sfi = rand() % NFORMATS;
+		break;
+	case 1:
+		shape.dfi = rand() % NFORMATS;
+		break;
+	case 2:
+		if (rand() % 2)
+			shape.srot = rand() % 4 * 90;
+		else
+			shape.drot = rand() % 4 * 90;
+		break;
+	case 3:
+		desc = rand() % 2 ? &srcdesc : &dstdesc;
+		if (bv_unmap(desc) != BVERR_NONE)
+			bvtest_fail("shape: bv_unmap() failed");
+		if (rand() % 2) {
+			if (desc == &srcdesc)
+				shape.s ^= 1;
+			else
+				shape.d ^= 1;
+		}
+		srcdesc.virtaddr = src[shape.s];
+		dstdesc.virtaddr = dst[shape.d];
+		if (rand() % 2 && bv_map(desc) != BVERR_NONE)
+			bvtest_fail("shape: bv_map() failed");
+		break;
+	case 4:
+		shape.alpha = rand();
+		shape.dither = dithers[rand() % 3];
+		break;
+	}
+}
+
+/*
+ * check() - Run a BLT of the shape to random rectangles here and on a new
+ * thread, and compare them.
+ */
+static void check(void)
+{
+	struct bvbuffdesc usrcdesc, udstdesc;
+	struct bvbltparams params, copy;
+	unsigned int sbpp = formats[shape.sfi].bpp;
+	unsigned int dbpp = formats[shape.dfi].bpp;
+	unsigned char *out = dst[shape.d];
+	pthread_t tid;
+	enum bverror err;
+	int w, h, i;
+
+	paint(src[shape.s], sbpp);
+	for (i = 0; i < S * S * 4; i++)
+		out[i] = rand();
+	memcpy(ref, out, sizeof(ref));
+	describe(&srcgeom, shape.sfi, shape.srot);
+	describe(&dstgeom, shape.dfi, shape.drot);
+
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP;
+	params.op.rop = 0xCCCC;
+	params.scalemode = BVSCALE_NEAREST_NEIGHBOR;
+	params.dithermode = (enum bvdithermode)shape.dither;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.src1.desc = &srcdesc;
+	params.src1geom = &srcgeom;
+	w = 1 + rand() % S;
+	h = 1 + rand() % S;
+	params.src1rect = bvtest_rect(w, h, S, S);
+	if (rand() % 2) {
+		w = 1 + rand() % S;
+		h = 1 + rand() % S;
+	}
+	params.dstrect = bvtest_rect(w, h, S, S);
+	if (rand() % 20 == 0)
+		params.dstrect.left += S - params.dstrect.width + 1;
+
+	switch (shape.kind) {
+	case 1:
+		params.flags = BVFLAG_BLEND;
+		params.op.blend = BVBLEND_SRC1OVER + BVBLENDDEF_GLOBAL_UCHAR;
+		params.globalalpha.size8 = shape.alpha;
+		params.src2.desc = &dstdesc;
+		params.src2geom = &dstgeom;
+		params.src2rect = params.dstrect;
+		break;
+	case 2:
+	case 3:
+		params.flags |= shape.kind == 2 ? BVFLAG_KEY_SRC :
+			BVFLAG_KEY_DST;
+		params.colorkey = key;
+		if (shape.kind == 2)
+			memcpy(key, src[shape.s] + rand() % (S * S) * sbpp,
+			       sbpp);
+		else
+			memcpy(key, out + rand() % (S * S) * dbpp, dbpp);
+		break;
+	case 4:
+		params.op.rop = 0x6666;
+		break;
+	}
+
+	/* the same BLT, by a thread that has seen no shape */
+	copy = params;
+	usrcdesc = srcdesc;
+	usrcdesc.map = NULL;
+	udstdesc = dstdesc;
+	udstdesc.virtaddr = ref;
+	udstdesc.map = NULL;
+	copy.dstdesc = &udstdesc;
+	copy.src1.desc = &usrcdesc;
+	if (copy.src2.desc)
+		copy.src2.desc = &udstdesc;
+	if (pthread_create(&tid, NULL, uncached, &copy)) {
+		bvtest_fail("shape: no thread");
+		return;
+	}
+	pthread_join(tid, NULL);
+
+	blts++;
+	err = bv_blt(&params);
+	if (err != uncachederr)
+		bvtest_fail("shape %d: error %d, not %d: %s", shape.kind, err,
+			    uncachederr, params.errdesc);
+	if (!memcmp(out, ref, sizeof(ref)))
+		return;
+	for (i = 0; out[i] == ref[i]; i++)
+		;
+	bvtest_fail("shape %d, formats %x to %x, turned %d to %d: byte %d "
+		    "differs", shape.kind, formats[shape.sfi].format,
+		    formats[shape.dfi].format, shape.srot, shape.drot, i);
+}
+
+/*
+ * exitcheck() - Copy a rectangle on a thread that exits, and from the
+ * destructor of its key, and compare it with the same copy here.
+ */
+static void exitcheck(void)
+{
+	struct bvbuffdesc refdesc;
+	struct bvbltparams params;
+	pthread_t tid;
+	int i;
+
+	for (i = 0; i < S * S * 4; i++) {
+		src[0][i] = rand();
+		dst[0][i] = rand();
+	}
+	memcpy(ref, dst[0], sizeof(ref));
+	srcdesc.virtaddr = src[0];
+	dstdesc.virtaddr = dst[0];
+	describe(&srcgeom, 0, 0);
+	describe(&dstgeom, 0, 0);
+	refdesc = dstdesc;
+	refdesc.virtaddr = ref;
+
+	memset(&exitblt, 0, sizeof(exitblt));
+	exitblt.structsize = sizeof(exitblt);
+	exitblt.flags = BVFLAG_ROP;
+	exitblt.op.rop = 0xCCCC;
+	exitblt.dstdesc = &dstdesc;
+	exitblt.dstgeom = &dstgeom;
+	exitblt.src1.desc = &srcdesc;
+	exitblt.src1geom = &srcgeom;
+	exitblt.src1rect = bvtest_rect(1 + rand() % S, 1 + rand() % S, S, S);
+	exitblt.dstrect = bvtest_rect(exitblt.src1rect.width,
+				      exitblt.src1rect.height, S, S);
+	params = exitblt;
+	params.dstdesc = &refdesc;
+	if (bv_blt(&params) != BVERR_NONE)
+		bvtest_fail("shape: BLT rejected: %s", params.errdesc);
+
+	if (pthread_create(&tid, NULL, exiting, NULL)) {
+		bvtest_fail("shape: no thread");
+		return;
+	}
+	pthread_join(tid, NULL);
+	blts += 3;
+	for (i = 0; i < 3; i++)
+		if (exiterr[i] != BVERR_NONE)
+			bvtest_fail("shape: BLT %d of an exiting thread: error "
+				    "%d", i, exiterr[i]);
+	if (memcmp(dst[0], ref, sizeof(ref)))
+		bvtest_fail("shape: BLT of an exiting thread differs");
+	pthread_key_delete(exitkey);
+}
+
+int main(void)
+{
+	int i, j;
+
+	srand(22);
+	bvcpu_ncpus = BVTEST_THREADS;
+	bvtest_surface(&srcdesc, &srcgeom, src[0], sizeof(src[0]),
+		       OCDFMT_BGRA24, S, S, 4);
+	bvtest_surface(&dstdesc, &dstgeom, dst[0], sizeof(dst[0]),
+		       OCDFMT_BGRA24, S, S, 4);
+	for (i = 0; i < SHAPES; i++) {
+		shape.kind = i % 5;
+		shape.sfi = rand() % NFORMATS;
+		shape.dfi = rand() % NFORMATS;
+		for (j = 0; j < REPEATS; j++) {
+			check();
+			change();
+		}
+	}
+	bv_unmap(&srcdesc);
+	bv_unmap(&dstdesc);
+
+	exitcheck();
+	return bvtest_done("shapetest", blts);
+}
@@ -0,0 +1,159 @@
+/*
+ * tiletest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests tiled sources (BVFLAG_TILE_SRC1).  Tiled copies are
+ * compared with each destination pixel looked up in the tile here, by its
+ * distance from the alignment location modulo the tile size, or twice
+ * that where the tile is mirrored:
+ * - with each of the 16 combinations of BVTILE_LEFT_MIRROR,
+ *   BVTILE_RIGHT_MIRROR, BVTILE_TOP_MIRROR and BVTILE_BOTTOM_MIRROR;
+ * - with the alignment location anywhere, left of and above the
+ *   destination surface included, so that dstleft and dsttop are negative;
+ * - with tiles of one pixel up to larger than the destination rectangle,
+ *   in BGRA24, RGB24 and RGB16.
+ */
+
+#include "bvcputest.h"
+
+#define TW		23		/* surface holding the tile */
+#define TH		19
+#define DW		97
+#define DH		61
+
+#define BLTS		200		/* for each combination of flags */
+
+static const struct {
+	enum ocdformat format;
+	unsigned int bpp;
+} formats[] = {
+	{ OCDFMT_BGRA24, 4 },
+	{ OCDFMT_RGB24, 3 },
+	{ OCDFMT_RGB16, 2 },
+};
+
+#define NFORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+static unsigned char tile[TW * TH * 4];
+static unsigned char dst[DW * DH * 4], ref[DW * DH * 4];
+static unsigned long blts;
+
+/*
+ * tilepos() - The pixel of a tile n pixels wide which lands d pixels from
+ * the alignment location, with before and after telling whether it is
+ * mirrored on each side.
+ */
+static int tilepos(int d, int n, int before, int after)
+{
+	int k = d >= 0 ? d / n : -((-d + n - 1) / n);
+	int o = d - k * n;
+
+	if ((k & 1) && (k < 0 ? before : after))
+		return n - 1 - o;
+	return o;
+}
+
+/*
+ * check() - Fill a random rectangle with a random tile, with the mirror
+ * flags given, and compare it with tilepos() in both directions.
+ */
+static void check(unsigned long flags)
+{
+	struct bvbuffdesc tiledesc, dstdesc;
+	struct bvsurfgeom tilegeom, dstgeom;
+	struct bvtileparams tp;
+	struct bvbltparams params;
+	unsigned int fi = rand() % NFORMATS, bpp = formats[fi].bpp;
+	const struct bvrect *tr, *dr;
+	int x, y, tx, ty, i;
+
+	for (i = 0; i < TW * TH * 4; i++)
+		tile[i] = rand();
+	for (i = 0; i < DW * DH * 4; i++)
+		dst[i] = rand();
+	memcpy(ref, dst, sizeof(dst));
+
+	/* the geometry is of the surface tp.virtaddr points into */
+	bvtest_surface(&tiledesc, &tilegeom, tile, sizeof(tile),
+		       formats[fi].format, TW, TH, bpp);
+	bvtest_surface(&dstdesc, &dstgeom, dst, sizeof(dst),
+		       formats[fi].format, DW, DH, bpp);
+	memset(&tp, 0, sizeof(tp));
+	tp.structsize = sizeof(tp);
+	tp.flags = flags;
+	tp.virtaddr = tile;
+	tp.dstleft = rand() % (3 * DW) - DW;
+	tp.dsttop = rand() % (3 * DH) - DH;
+
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP | BVFLAG_TILE_SRC1;
+	params.op.rop = 0xCCCC;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.dstrect = bvtest_rect(1 + rand() % DW, 1 + rand() % DH,
+				     DW, DH);
+	params.src1.tileparams = &tp;
+	params.src1geom = &tilegeom;
+	params.src1rect = rand() % 4 ? bvtest_rect(1 + rand() % 8,
+						   1 + rand() % 8, TW, TH) :
+		bvtest_rect(1 + rand() % TW, 1 + rand() % TH, TW, TH);
+	tr = &params.src1rect;
+	dr = &params.dstrect;
+
+	for (y = dr->top; y < dr->top + (int)dr->height; y++)
+		for (x = dr->left; x < dr->left + (int)dr->width; x++) {
+			tx = tilepos(x - tp.dstleft, tr->width,
+				     !!(flags & BVTILE_LEFT_MIRROR),
+				     !!(flags & BVTILE_RIGHT_MIRROR));
+			ty = tilepos(y - tp.dsttop, tr->height,
+				     !!(flags & BVTILE_TOP_MIRROR),
+				     !!(flags & BVTILE_BOTTOM_MIRROR));
+			memcpy(ref + (y * DW + x) * bpp,
+			       tile + ((tr->top + ty) * TW + tr->left + tx) *
+			       bpp, bpp);
+		}
+
+	blts++;
+	if (bv_blt(&params) != BVERR_NONE) {
+		bvtest_fail("tile %lx: BLT rejected: %s", flags,
+			    params.errdesc);
+		return;
+	}
+	if (!memcmp(dst, ref, sizeof(dst)))
+		return;
+	for (i = 0; dst[i] == ref[i]; i++)
+		;
+	bvtest_fail("tile %lx, format %x, %ux%u at %d,%d: pixel %d,%d "
+		    "differs", flags, formats[fi].format, tr->width,
+		    tr->height, tp.dstleft, tp.dsttop, i / (int)bpp % DW,
+		    i / (int)bpp / DW);
+}
+
+int main(void)
+{
+	unsigned long flags;
+	int i;
+
+	srand(12);
+	bvcpu_ncpus = BVTEST_THREADS;
+	for (flags = 0; flags < 16; flags++)
+		for (i = 0; i < BLTS; i++)
+			check(((flags & 1) ? BVTILE_LEFT_MIRROR : 0) |
+			      ((flags & 2) ? BVTILE_RIGHT_MIRROR : 0) |
+			      ((flags & 4) ? BVTILE_TOP_MIRROR : 0) |
+			      ((flags & 8) ? BVTILE_BOTTOM_MIRROR : 0));
+	return bvtest_done("tiletest", blts);
+}
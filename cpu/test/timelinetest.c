@@ -0,0 +1,225 @@
+/*
+ * timelinetest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests the timeline of bvcpuext.h and NOP BLTs.  Asynchronous
+ * BLTs, each to a destination of its own, are submitted from this thread
+ * or from several, and a destination counts as done once it holds what
+ * the same BLT gives run synchronously:
+ * - once bvcpu_timelinewait() returns for the point of a BLT, it and the
+ *   BLTs with earlier points are done, and bvcpu_timeline() has reached
+ *   the point;
+ * - an asynchronous NOP without a callback takes the point of the last
+ *   BLT submitted, by any thread, and waiting for it finds them all done;
+ * - an asynchronous NOP with a callback takes the next point, and its
+ *   callback is called once, without an error;
+ * - a synchronous NOP returns with them all done.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bvcputest.h"
+
+#define SW		61
+#define SH		47
+#define DW		128
+#define DH		96
+#define MINSIZE		8		/* so a BLT not run cannot look done */
+
+#define NDST		32
+#define ROUNDS		40
+
+static unsigned char src[SW * SH * 4];
+static unsigned char dst[NDST][DW * DH * 4], ref[NDST][DW * DH * 4];
+static struct bvbuffdesc srcdesc, dstdesc[NDST], refdesc[NDST];
+static struct bvsurfgeom srcgeom, dstgeom;
+
+static struct bvbltparams blt[NDST];
+static unsigned long point[NDST];
+static unsigned int nopcalls;
+static unsigned long blts;
+
+static void nopdone(struct bvcallbackerror *err, unsigned long data)
+{
+	if (err)
+		bvtest_fail("timeline: NOP called back with %d", err->error);
+	__atomic_fetch_add(&nopcalls, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * make() - A random scaled copy or blend of the source to destination i,
+ * run synchronously on its reference.
+ */
+static void make(int i)
+{
+	struct bvbltparams *params = &blt[i];
+	struct bvbltparams sync;
+	int w = MINSIZE + rand() % (SW - MINSIZE + 1);
+	int h = MINSIZE + rand() % (SH - MINSIZE + 1);
+
+	memset(params, 0, sizeof(*params));
+	params->structsize = sizeof(*params);
+	params->flags = BVFLAG_ROP;
+	params->op.rop = 0xCCCC;
+	params->scalemode = BVSCALE_NEAREST_NEIGHBOR;
+	params->src1.desc = &srcdesc;
+	params->src1geom = &srcgeom;
+	params->src1rect = bvtest_rect(w, h, SW, SH);
+	w = MINSIZE + rand() % (DW - MINSIZE + 1);
+	h = MINSIZE + rand() % (DH - MINSIZE + 1);
+	params->dstrect = bvtest_rect(w, h, DW, DH);
+	params->dstgeom = &dstgeom;
+	if (rand() % 2) {
+		params->flags = BVFLAG_BLEND;
+		params->op.blend = BVBLEND_SRC1OVER;
+		params->src2geom = &dstgeom;
+		params->src2rect = params->dstrect;
+	}
+
+	sync = *params;
+	sync.dstdesc = &refdesc[i];
+	if (sync.flags & BVFLAG_BLEND)
+		sync.src2.desc = &refdesc[i];
+	if (bv_blt(&sync) != BVERR_NONE)
+		bvtest_fail("timeline: BLT rejected: %s", sync.errdesc);
+
+	params->flags |= BVFLAG_ASYNC;
+	params->dstdesc = &dstdesc[i];
+	if (params->flags & BVFLAG_BLEND)
+		params->src2.desc = &dstdesc[i];
+}
+
+static void submit(int i)
+{
+	if (bv_blt(&blt[i]) != BVERR_NONE)
+		bvtest_fail("timeline: BLT rejected: %s", blt[i].errdesc);
+	point[i] = bvcpu_timelinepoint();
+}
+
+static void *submitter(void *arg)
+{
+	int t = (int)(long)arg, i;
+
+	for (i = t; i < NDST; i += BVTEST_THREADS)
+		submit(i);
+	return NULL;
+}
+
+/*
+ * done() - Check that the BLTs with points up to p are done.
+ */
+static void done(unsigned long p, const char *after)
+{
+	int i;
+
+	if ((long)(bvcpu_timeline() - p) < 0)
+		bvtest_fail("timeline: at %lu after %s for %lu",
+			    bvcpu_timeline(), after, p);
+	for (i = 0; i < NDST; i++)
+		if ((long)(point[i] - p) <= 0 && memcmp(dst[i], ref[i],
+							sizeof(dst[i])))
+			bvtest_fail("timeline: BLT at %lu not done after %s "
+				    "for %lu", point[i], after, p);
+}
+
+/*
+ * check() - Submit a BLT to each destination, from this thread or from
+ * several, wait for the point of one of them, and then fence them all
+ * with a NOP.
+ */
+static void check(void)
+{
+	pthread_t tid[BVTEST_THREADS];
+	struct bvbltparams nop;
+	unsigned long last, p;
+	int i, t, kind = rand() % 3, wait;
+
+	bvtest_premul(src, SW * SH);
+	for (i = 0; i < NDST; i++) {
+		bvtest_premul(dst[i], DW * DH);
+		memcpy(ref[i], dst[i], sizeof(dst[i]));
+		make(i);
+	}
+
+	if (rand() % 2) {
+		for (i = 0; i < NDST; i++)
+			submit(i);
+	} else {
+		for (t = 0; t < BVTEST_THREADS; t++)
+			pthread_create(&tid[t], NULL, submitter,
+				       (void *)(long)t);
+		for (t = 0; t < BVTEST_THREADS; t++)
+			pthread_join(tid[t], NULL);
+	}
+	blts += NDST;
+	last = point[0];
+	for (i = 1; i < NDST; i++)
+		if ((long)(point[i] - last) > 0)
+			last = point[i];
+
+	p = point[rand() % NDST];
+	bvcpu_timelinewait(p);
+	done(p, "waiting");
+
+	memset(&nop, 0, sizeof(nop));
+	nop.structsize = sizeof(nop);
+	nop.flags = BVFLAG_ROP | (kind ? BVFLAG_ASYNC : 0);
+	nop.op.rop = 0xAAAA;
+	if (kind == 2)
+		nop.callbackfn = nopdone;
+	__atomic_store_n(&nopcalls, 0, __ATOMIC_SEQ_CST);
+	if (bv_blt(&nop) != BVERR_NONE) {
+		bvtest_fail("timeline: NOP rejected: %s", nop.errdesc);
+		return;
+	}
+	if (!kind) {
+		done(last, "a synchronous NOP");
+		return;
+	}
+
+	p = bvcpu_timelinepoint();
+	if (p != last + (kind == 2))
+		bvtest_fail("timeline: NOP %s a callback at %lu, after %lu",
+			    kind == 2 ? "with" : "without", p, last);
+	bvcpu_timelinewait(p);
+	done(last, "waiting for a NOP");
+	if (kind != 2)
+		return;
+	for (wait = 0; !__atomic_load_n(&nopcalls, __ATOMIC_SEQ_CST) &&
+	     wait < 10000; wait++)
+		usleep(1000);
+	if (__atomic_load_n(&nopcalls, __ATOMIC_SEQ_CST) != 1)
+		bvtest_fail("timeline: NOP called back %u times", nopcalls);
+}
+
+int main(void)
+{
+	int i;
+
+	srand(20);
+	bvcpu_ncpus = BVTEST_THREADS;
+	bvtest_surface(&srcdesc, &srcgeom, src, sizeof(src), OCDFMT_BGRA24,
+		       SW, SH, 4);
+	for (i = 0; i < NDST; i++) {
+		bvtest_surface(&dstdesc[i], &dstgeom, dst[i], sizeof(dst[i]),
+			       OCDFMT_BGRA24, DW, DH, 4);
+		bvtest_surface(&refdesc[i], &dstgeom, ref[i], sizeof(ref[i]),
+			       OCDFMT_BGRA24, DW, DH, 4);
+	}
+	for (i = 0; i < ROUNDS; i++)
+		check();
+	return bvtest_done("timelinetest", blts);
+}
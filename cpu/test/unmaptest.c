@@ -0,0 +1,263 @@
+/*
+ * unmaptest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests bv_map() and bv_unmap():
+ * - a slot given by bv_mapslot() after a buffer was mapped is ignored, so
+ *   the buffer is still found, copied from and unmapped;
+ * - bv_unmap() passes the buffer on to the implementation that mapped it
+ *   next in the chain, even when this one cannot run;
+ * - buffers unmapped, and their bvbuffdesc freed, as soon as asynchronous
+ *   BLTs using them are submitted, are still written as synchronous BLTs
+ *   write them, and can be freed from the callback of the last BLT.
+ */
+
+#include <unistd.h>
+
+#include "bvcputest.h"
+
+#define W		32
+#define H		16
+
+#define AW		256		/* surfaces of the asynchronous BLTs */
+#define AH		192
+#define ASYNCBLTS	16
+#define ROUNDS		20
+
+static unsigned char src[W * H * 4], dst[W * H * 4];
+static struct bvbuffdesc srcdesc, dstdesc;
+static struct bvsurfgeom srcgeom, dstgeom;
+static unsigned long blts;
+
+/*
+ * other - The bvbuffmap of another implementation, without slot fields,
+ * and the number of times its bv_unmap() was called.
+ */
+static struct bvbuffmap other;
+static int otherunmaps;
+
+static enum bverror otherunmap(struct bvbuffdesc *desc)
+{
+	struct bvbuffmap **link;
+
+	otherunmaps++;
+	for (link = &desc->map; *link; link = &(*link)->nextmap)
+		if (*link == &other) {
+			*link = other.nextmap;
+			break;
+		}
+	if (desc->map)
+		return desc->map->bv_unmap(desc);
+	return BVERR_NONE;
+}
+
+static void addother(struct bvbuffdesc *desc)
+{
+	memset(&other, 0, sizeof(other));
+	other.structsize = offsetof(struct bvbuffmap, slot);
+	other.bv_unmap = otherunmap;
+	other.nextmap = desc->map;
+	desc->map = &other;
+}
+
+/*
+ * copy() - Copy src to dst, and check it.
+ */
+static void copy(const char *what)
+{
+	struct bvbltparams params;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = rand();
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.flags = BVFLAG_ROP;
+	params.op.rop = 0xCCCC;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &dstgeom;
+	params.dstrect.width = params.src1rect.width = W;
+	params.dstrect.height = params.src1rect.height = H;
+	params.src1.desc = &srcdesc;
+	params.src1geom = &srcgeom;
+	blts++;
+	if (bv_blt(&params) != BVERR_NONE)
+		bvtest_fail("%s: BLT rejected: %s", what, params.errdesc);
+	else if (memcmp(dst, src, sizeof(src)))
+		bvtest_fail("%s: copy differs", what);
+}
+
+/*
+ * held - The buffers of a round of asynchronous BLTs, freed by the
+ * callback of the last, after it has checked them.
+ */
+struct held {
+	unsigned char *src;
+	unsigned char *dst;
+	unsigned char ref[AW * AH * 4];
+};
+
+static unsigned int callbacks;
+
+static void asyncdone(struct bvcallbackerror *err, unsigned long data)
+{
+	struct held *h = (struct held *)data;
+
+	if (err)
+		bvtest_fail("deferred: BLT failed: %s", err->errdesc);
+	if (h) {
+		if (memcmp(h->dst, h->ref, sizeof(h->ref)))
+			bvtest_fail("deferred: blends differ");
+		free(h->src);
+		free(h->dst);
+		free(h);
+	}
+	__atomic_fetch_add(&callbacks, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * deferred() - Blend a mapped buffer over another, scaled, asynchronously
+ * and synchronously to a reference, and unmap both buffers and free their
+ * descriptors before the asynchronous BLTs have run.
+ */
+static void deferred(void)
+{
+	struct bvbuffdesc *sdesc, *ddesc, refdesc;
+	struct bvsurfgeom geom;
+	struct bvbltparams params[ASYNCBLTS];
+	struct held *h;
+	unsigned int i, wait;
+
+	h = malloc(sizeof(*h));
+	sdesc = malloc(sizeof(*sdesc));
+	ddesc = malloc(sizeof(*ddesc));
+	if (!h || !sdesc || !ddesc ||
+	    !(h->src = malloc(AW * AH * 4)) ||
+	    !(h->dst = malloc(AW * AH * 4))) {
+		bvtest_fail("deferred: out of memory");
+		exit(1);
+	}
+	bvtest_premul(h->src, AW * AH);
+	bvtest_premul(h->dst, AW * AH);
+	memcpy(h->ref, h->dst, sizeof(h->ref));
+	bvtest_surface(sdesc, &geom, h->src, AW * AH * 4, OCDFMT_BGRA24,
+		       AW, AH, 4);
+	bvtest_surface(ddesc, &geom, h->dst, AW * AH * 4, OCDFMT_BGRA24,
+		       AW, AH, 4);
+	refdesc = *ddesc;
+	refdesc.virtaddr = h->ref;
+	if (bv_map(sdesc) != BVERR_NONE || bv_map(ddesc) != BVERR_NONE)
+		bvtest_fail("deferred: bv_map() failed");
+
+	/* the reference first, as synchronous BLTs wait for the others */
+	for (i = 0; i < ASYNCBLTS; i++) {
+		memset(&params[i], 0, sizeof(params[i]));
+		params[i].structsize = sizeof(params[i]);
+		params[i].flags = BVFLAG_BLEND;
+		params[i].op.blend = BVBLEND_SRC1OVER;
+		params[i].scalemode = BVSCALE_NEAREST_NEIGHBOR;
+		params[i].dstdesc = &refdesc;
+		params[i].dstgeom = &geom;
+		params[i].dstrect = bvtest_rect(AW / 2 + rand() % (AW / 2),
+						AH / 2 + rand() % (AH / 2),
+						AW, AH);
+		params[i].src1.desc = sdesc;
+		params[i].src1geom = &geom;
+		params[i].src1rect = bvtest_rect(1 + rand() % AW,
+						 1 + rand() % AH, AW, AH);
+		params[i].src2.desc = &refdesc;
+		params[i].src2geom = &geom;
+		params[i].src2rect = params[i].dstrect;
+		blts++;
+		if (bv_blt(&params[i]) != BVERR_NONE)
+			bvtest_fail("deferred: BLT rejected: %s",
+				    params[i].errdesc);
+	}
+
+	__atomic_store_n(&callbacks, 0, __ATOMIC_SEQ_CST);
+	for (i = 0; i < ASYNCBLTS; i++) {
+		params[i].flags |= BVFLAG_ASYNC;
+		params[i].callbackfn = asyncdone;
+		params[i].callbackdata = i == ASYNCBLTS - 1 ?
+			(unsigned long)h : 0;
+		params[i].dstdesc = ddesc;
+		params[i].src2.desc = ddesc;
+		blts++;
+		if (bv_blt(&params[i]) != BVERR_NONE)
+			bvtest_fail("deferred: BLT rejected: %s",
+				    params[i].errdesc);
+	}
+
+	/* the BLTs are left holding the buffers */
+	if (bv_unmap(sdesc) != BVERR_NONE || bv_unmap(ddesc) != BVERR_NONE ||
+	    sdesc->map || ddesc->map)
+		bvtest_fail("deferred: buffers not unmapped");
+	free(sdesc);
+	free(ddesc);
+
+	for (wait = 0; __atomic_load_n(&callbacks, __ATOMIC_SEQ_CST) <
+	     ASYNCBLTS && wait < 10000; wait++)
+		usleep(1000);
+	if (__atomic_load_n(&callbacks, __ATOMIC_SEQ_CST) != ASYNCBLTS)
+		bvtest_fail("deferred: %u callbacks for %d BLTs", callbacks,
+			    ASYNCBLTS);
+}
+
+int main(void)
+{
+	const struct bvcpu_kernels *kern = bvcpu_kern;
+	unsigned int i;
+
+	srand(25);
+	bvtest_surface(&srcdesc, &srcgeom, src, sizeof(src), OCDFMT_BGRA24,
+		       W, H, 4);
+	bvtest_surface(&dstdesc, &dstgeom, dst, sizeof(dst), OCDFMT_BGRA24,
+		       W, H, 4);
+
+	/* the slot is given before any buffer is mapped, and kept after */
+	bv_mapslot(2);
+	if (bv_map(&srcdesc) != BVERR_NONE || bv_map(&dstdesc) != BVERR_NONE)
+		bvtest_fail("bv_map() failed");
+	bv_mapslot(3);
+	if (bvcpu_mapslot != 2 || !srcdesc.map || srcdesc.map->slot != 2)
+		bvtest_fail("slot %u, buffer mapped in %u", bvcpu_mapslot,
+			    srcdesc.map ? srcdesc.map->slot : BVBUFFMAP_NOSLOT);
+	copy("mapped");
+	if (bv_map(&srcdesc) != BVERR_NONE || srcdesc.map->nextmap)
+		bvtest_fail("buffer mapped twice");
+	if (bv_unmap(&srcdesc) != BVERR_NONE || srcdesc.map)
+		bvtest_fail("buffer not unmapped");
+	copy("unmapped");
+
+	/* the next implementation in the chain is unmapped too */
+	addother(&dstdesc);
+	if (bv_unmap(&dstdesc) != BVERR_NONE || dstdesc.map ||
+	    otherunmaps != 1)
+		bvtest_fail("chained bv_unmap() not called");
+
+	/* even when this implementation did not load */
+	bvcpu_kern = NULL;
+	addother(&dstdesc);
+	if (bv_unmap(&dstdesc) != BVERR_NONE || dstdesc.map ||
+	    otherunmaps != 2)
+		bvtest_fail("chained bv_unmap() not called without kernels");
+	bvcpu_kern = kern;
+
+	bvcpu_ncpus = BVTEST_THREADS;
+	for (i = 0; i < ROUNDS; i++)
+		deferred();
+
+	return bvtest_done("unmaptest", blts);
+}
@@ -499,6 +499,7 @@ enum bvblend {
 	BVBLEND_REFLECT = BVBLENDDEF_FORMAT_ESSENTIAL + 20,
 	BVBLEND_GLOW = BVBLENDDEF_FORMAT_ESSENTIAL + 21,
 	BVBLEND_PHOENIX = BVBLENDDEF_FORMAT_ESSENTIAL + 22,
+	BVBLEND_ALPHA = BVBLENDDEF_FORMAT_ESSENTIAL + 23,
 
 #ifdef BVBLEND_EXTERNAL_INCLUDE
 #define BVBLEND_EXTERNAL_INCLUDE
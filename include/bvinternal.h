@@ -31,7 +31,28 @@
  * bv_blt() and bv_unmap() calls.  The latter frees the associated resource
  * and the structure (if applicable).  Note that a given resource might be
  * used by more than one implementation.
+ *
+ * Implementations built with the slot fields (structsize of at least
+ * sizeof(struct bvbuffmap)) find their own bvbuffmap without walking the
+ * chain.  Each has a slot of its own, given out the way BVIMPL_* bits are:
+ * CPU implementations from BVBUFFMAP_FIRST_CPU up, hardware ones from
+ * BVBUFFMAP_FIRST_HW down.  A manager gives the slots through bv_mapslot()
+ * below; an implementation loaded on its own keeps the first slot of its
+ * kind.  The first bvbuffmap in the chain with the slot fields holds the
+ * slot table, the registry of the bvbuffmap of each slot; the others keep
+ * a stale copy.  bvbuffmap_add() puts the table in the head of the chain,
+ * so finding it takes one read, unless a bvbuffmap without slot fields was
+ * added after it.  Earlier implementations may still add and remove such
+ * bvbuffmap objects anywhere in the chain, through nextmap, without
+ * disturbing the table; a manager maps a buffer with them first.  The slot
+ * table is only kept right if every implementation that has slot fields
+ * goes through bvbuffmap_add() and bvbuffmap_remove().
  */
+#define BVBUFFMAP_SLOTS		8
+#define BVBUFFMAP_FIRST_CPU	0			/* Continues up */
+#define BVBUFFMAP_FIRST_HW	(BVBUFFMAP_SLOTS - 1)	/* Continues down */
+#define BVBUFFMAP_NOSLOT	(~0U)
+
 struct bvbuffmap {
 	unsigned int structsize; /* used to ID structure ver */
 
@@ -42,6 +63,120 @@ struct bvbuffmap {
 
 	/* pointer to next resource mapping structure */
 	struct bvbuffmap *nextmap;
+
+	/* slot of the implementation, or BVBUFFMAP_NOSLOT */
+	unsigned int slot;
+
+	/* slot table: the bvbuffmap in each slot, or 0 */
+	struct bvbuffmap *slotmap[BVBUFFMAP_SLOTS];
 };
 
+/*
+ * bv_mapslot() - Optional entry point of an implementation with the slot
+ * fields, by which a manager gives it its slot before it maps a buffer.
+ * Once it has mapped one, the implementation keeps the slot it has.
+ */
+typedef void (*BVFN_MAPSLOT)(unsigned int slot);
+
+/*
+ * bvbuffmap_table() - The bvbuffmap of a buffer holding the slot table, or
+ * 0 if no bvbuffmap of the buffer has slot fields.
+ */
+static inline struct bvbuffmap *bvbuffmap_table(struct bvbuffdesc *buffdesc)
+{
+	struct bvbuffmap *map;
+
+	for (map = buffdesc->map; map; map = map->nextmap)
+		if (map->structsize >= sizeof(struct bvbuffmap))
+			return map;
+	return 0;
+}
+
+/*
+ * bvbuffmap_find() - The bvbuffmap of the implementation in slot, whose
+ * bv_unmap is given, or 0 if it has not mapped the buffer.  The chain is
+ * only walked when the slot is used by another implementation, which has
+ * not been given a slot of its own, or when the table is not in the first
+ * bvbuffmap.
+ */
+static inline struct bvbuffmap *bvbuffmap_find(struct bvbuffdesc *buffdesc,
+					       unsigned int slot,
+					       BVFN_UNMAP bv_unmap)
+{
+	struct bvbuffmap *table, *map;
+
+	table = bvbuffmap_table(buffdesc);
+	if (!table)
+		return 0;
+	if (slot < BVBUFFMAP_SLOTS) {
+		map = table->slotmap[slot];
+		if (!map || map->bv_unmap == bv_unmap)
+			return map;
+	}
+	for (map = buffdesc->map; map; map = map->nextmap)
+		if (map->bv_unmap == bv_unmap)
+			return map;
+	return 0;
+}
+
+/*
+ * bvbuffmap_add() - Put a bvbuffmap with slot fields at the head of the
+ * chain of a buffer.  It takes its slot if no other implementation has.
+ */
+static inline void bvbuffmap_add(struct bvbuffdesc *buffdesc,
+				 struct bvbuffmap *map)
+{
+	struct bvbuffmap *table = bvbuffmap_table(buffdesc);
+	unsigned int i;
+
+	for (i = 0; i < BVBUFFMAP_SLOTS; i++)
+		map->slotmap[i] = table ? table->slotmap[i] : 0;
+	if (map->slot < BVBUFFMAP_SLOTS && !map->slotmap[map->slot])
+		map->slotmap[map->slot] = map;
+	map->nextmap = buffdesc->map;
+	buffdesc->map = map;
+}
+
+/*
+ * bvbuffmap_remove() - Take a bvbuffmap added by bvbuffmap_add() out of
+ * the chain of a buffer.  Its slot goes to another bvbuffmap that wants
+ * it, and the table to the next bvbuffmap with slot fields.
+ */
+static inline void bvbuffmap_remove(struct bvbuffdesc *buffdesc,
+				    struct bvbuffmap *map)
+{
+	struct bvbuffmap *table = bvbuffmap_table(buffdesc);
+	struct bvbuffmap **link;
+	struct bvbuffmap *m;
+	unsigned int i;
+
+	for (link = &buffdesc->map; *link; link = &(*link)->nextmap) {
+		if (*link == map) {
+			*link = map->nextmap;
+			break;
+		}
+	}
+	if (!table)
+		return;
+
+	if (map->slot < BVBUFFMAP_SLOTS &&
+	    table->slotmap[map->slot] == map) {
+		table->slotmap[map->slot] = 0;
+		for (m = buffdesc->map; m; m = m->nextmap) {
+			if (m->structsize >= sizeof(struct bvbuffmap) &&
+			    m->slot == map->slot) {
+				table->slotmap[map->slot] = m;
+				break;
+			}
+		}
+	}
+
+	if (table == map) {
+		m = bvbuffmap_table(buffdesc);
+		if (m)
+			for (i = 0; i < BVBUFFMAP_SLOTS; i++)
+				m->slotmap[i] = map->slotmap[i];
+	}
+}
+
 #endif /* BVINTERNAL_H */
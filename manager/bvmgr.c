@@ -0,0 +1,493 @@
+/*
+ * bvmgr.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the entry points of the BLTsville manager
+ * (bltsville_mgr), which loads other implementations and sends each BLT to
+ * the one that has been doing BLTs like it fastest (see bvmgrcost.c).
+ * bvbltparams.implementation limits the choice to the implementations
+ * whose BVIMPL_* bits it has set.
+ *
+ * The implementations are named by BVMGR_HW and BVMGR_CPU, colon-separated
+ * lists of libraries, which default to the standard libbltsville_hw2d.so
+ * and libbltsville_cpu.so.  Libraries that do not load are left out.
+ *
+ * A BLT an implementation rejects goes to the next best one, and the class
+ * of the BLT is not sent to it again first.  The time of an asynchronous
+ * BLT is taken when its callback is called, so it includes the time spent
+ * queued behind others.  Batches stay with the implementation their first
+ * BLT went to, and are not measured.
+ *
+ * Before a thread's BLT goes to an implementation other than the one its
+ * last asynchronous BLT went to, a synchronous NOP BLT is sent to that one,
+ * which returns once the BLTs queued before it have completed.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvmgr.h"
+
+/*
+ * BVMGR_RTLD_DEEPBIND - Implementations look for the entry points they
+ * export (bv_unmap() in a bvbuffmap, say) in their own library first, not
+ * in the manager, which exports the same names.
+ */
+#ifdef RTLD_DEEPBIND
+#define BVMGR_RTLD_DEEPBIND	RTLD_DEEPBIND
+#else
+#define BVMGR_RTLD_DEEPBIND	0
+#endif
+
+#define BVMGR_ROP_NOP		0xAAAA
+
+struct bvmgr_impl bvmgr_impls[BVMGR_MAXIMPLS];
+unsigned int bvmgr_nimpls;
+
+/* 1 + the implementation of the thread's last asynchronous BLT, or 0 */
+static __thread unsigned int bvmgr_pending;
+
+/*
+ * bvmgr_open() - Load an implementation, and give it its bvbuffmap slot.
+ */
+static int bvmgr_open(const char *name, unsigned long id, unsigned int slot)
+{
+	struct bvmgr_impl *impl = &bvmgr_impls[bvmgr_nimpls];
+
+	impl->lib = dlopen(name, RTLD_NOW | RTLD_LOCAL | BVMGR_RTLD_DEEPBIND);
+	if (!impl->lib)
+		return 0;
+	impl->id = id;
+	impl->map = (BVFN_MAP)dlsym(impl->lib, "bv_map");
+	impl->blt = (BVFN_BLT)dlsym(impl->lib, "bv_blt");
+	impl->unmap = (BVFN_UNMAP)dlsym(impl->lib, "bv_unmap");
+	impl->cache = (BVFN_CACHE)dlsym(impl->lib, "bv_cache");
+	impl->mapslot = (BVFN_MAPSLOT)dlsym(impl->lib, "bv_mapslot");
+
+	/* the manager itself, under one of the standard names */
+	if (!impl->map || !impl->blt || !impl->unmap || impl->blt == bv_blt) {
+		dlclose(impl->lib);
+		return 0;
+	}
+	if (impl->mapslot)
+		impl->mapslot(slot);
+	bvmgr_nimpls++;
+	return 1;
+}
+
+/*
+ * bvmgr_load() - Load the implementations of a list.  CPU implementations
+ * take BVIMPL_* bits leftwards from first, and bvbuffmap slots upwards from
+ * BVBUFFMAP_FIRST_CPU; hardware ones the other way.  With no more
+ * implementations than slots, the two never meet.
+ */
+static void bvmgr_load(const char *list, unsigned long first, int cpu)
+{
+	char name[256];
+	unsigned int n = 0;
+	size_t len;
+
+	while (*list && bvmgr_nimpls < BVMGR_MAXIMPLS && n < 16) {
+		len = strcspn(list, ":");
+		if (len && len < sizeof(name)) {
+			memcpy(name, list, len);
+			name[len] = '\0';
+			if (bvmgr_open(name, cpu ? first << n : first >> n,
+				       cpu ? BVBUFFMAP_FIRST_CPU + n :
+				       BVBUFFMAP_FIRST_HW - n))
+				n++;
+		}
+		list += list[len] ? len + 1 : len;
+	}
+}
+
+/*
+ * bvmgr_init() - Library initialization.  If no implementation loads,
+ * every entry point returns BVERR_RSRC.  Hardware comes first, so that it
+ * wins ties and leaves the CPU to the client.
+ */
+static void __attribute__((constructor)) bvmgr_init(void)
+{
+	const char *hw = getenv("BVMGR_HW");
+	const char *cpu = getenv("BVMGR_CPU");
+
+	bvmgr_load(hw ? hw : "libbltsville_hw2d.so",
+		   (unsigned long)BVIMPL_FIRST_HW & 0xFFFFFFFFul, 0);
+	bvmgr_load(cpu ? cpu : "libbltsville_cpu.so", BVIMPL_FIRST_CPU, 1);
+}
+
+static void __attribute__((destructor)) bvmgr_exit(void)
+{
+	while (bvmgr_nimpls)
+		dlclose(bvmgr_impls[--bvmgr_nimpls].lib);
+}
+
+/*
+ * bvmgr_allowed() - The implementations, as a mask of indices, that
+ * bvbltparams.implementation lets a BLT go to.
+ */
+static unsigned int bvmgr_allowed(unsigned long implementation)
+{
+	unsigned int allowed = 0, i;
+
+	for (i = 0; i < bvmgr_nimpls; i++)
+		if (!implementation || (implementation & bvmgr_impls[i].id))
+			allowed |= 1u << i;
+	return allowed;
+}
+
+/*
+ * bvmgr_copyparams() - Copy the bvbltparams of a client, which may be
+ * shorter than the manager's, to send a BLT of the manager's own.
+ */
+static void bvmgr_copyparams(struct bvbltparams *copy,
+			     const struct bvbltparams *params)
+{
+	unsigned long size;
+
+	size = params->structsize < sizeof(*copy) ?
+		params->structsize : sizeof(*copy);
+	memset(copy, 0, sizeof(*copy));
+	memcpy(copy, params, size);
+	copy->implementation = 0;
+	copy->callbackfn = NULL;
+}
+
+/*
+ * bvmgr_fence() - Complete the asynchronous BLTs of the thread before one
+ * goes to another implementation.  Until that succeeds, the BLTs of the
+ * thread can only go to the implementation they are pending on.
+ */
+static enum bverror bvmgr_fence(struct bvbltparams *params, unsigned int impl)
+{
+	struct bvbltparams nop;
+	enum bverror err;
+
+	if (!bvmgr_pending || bvmgr_pending == impl + 1)
+		return BVERR_NONE;
+
+	bvmgr_copyparams(&nop, params);
+	nop.flags = BVFLAG_ROP;
+	nop.op.rop = BVMGR_ROP_NOP;
+	nop.batch = NULL;
+	err = bvmgr_impls[bvmgr_pending - 1].blt(&nop);
+	if (err != BVERR_NONE)
+		return bvmgr_err(params, err, nop.errdesc);
+	bvmgr_pending = 0;
+	return BVERR_NONE;
+}
+
+/*
+ * bvmgr_call - An asynchronous BLT being measured, passed to the
+ * implementation as the callback data.
+ */
+struct bvmgr_call {
+	struct bvmgr_class c;
+	unsigned int impl;
+	unsigned long start;
+	void (*callbackfn)(struct bvcallbackerror *err,
+			   unsigned long callbackdata);
+	unsigned long callbackdata;
+};
+
+static void bvmgr_callback(struct bvcallbackerror *err,
+			   unsigned long callbackdata)
+{
+	struct bvmgr_call *call = (struct bvmgr_call *)callbackdata;
+
+	if (!err)
+		bvmgr_measured(&call->c, call->impl,
+			       bvmgr_now() - call->start);
+	if (call->callbackfn)
+		call->callbackfn(err, call->callbackdata);
+	free(call);
+}
+
+/*
+ * bvmgr_bltimpl() - Send a BLT to an implementation, and measure it.
+ */
+static enum bverror bvmgr_bltimpl(struct bvbltparams *params,
+				  const struct bvmgr_class *c,
+				  unsigned int impl)
+{
+	unsigned long implementation = params->implementation;
+	void (*callbackfn)(struct bvcallbackerror *err,
+			   unsigned long callbackdata) = params->callbackfn;
+	unsigned long callbackdata = params->callbackdata;
+	unsigned long start;
+	struct bvmgr_call *call;
+	enum bverror err;
+
+	params->implementation = 0;
+
+	if (params->flags & BVFLAG_TESTPARAMS_NOP) {
+		err = bvmgr_impls[impl].blt(params);
+	} else if (params->flags & BVFLAG_ASYNC) {
+		call = malloc(sizeof(*call));
+		if (!call) {
+			params->implementation = implementation;
+			return bvmgr_err(params, BVERR_OOM,
+					 "out of memory for asynchronous BLT");
+		}
+		call->c = *c;
+		call->impl = impl;
+		call->callbackfn = params->callbackfn;
+		call->callbackdata = params->callbackdata;
+		params->callbackfn = bvmgr_callback;
+		params->callbackdata = (unsigned long)call;
+		call->start = bvmgr_now();
+
+		/* the callback may have been called, and call freed */
+		err = bvmgr_impls[impl].blt(params);
+
+		params->callbackfn = callbackfn;
+		params->callbackdata = callbackdata;
+		if (err != BVERR_NONE)
+			free(call);
+		else
+			bvmgr_pending = impl + 1;
+	} else {
+		start = bvmgr_now();
+		err = bvmgr_impls[impl].blt(params);
+		if (err == BVERR_NONE)
+			bvmgr_measured(c, impl, bvmgr_now() - start);
+	}
+
+	params->implementation = implementation;
+	return err;
+}
+
+/*
+ * bvbatch - A batch of the manager: the implementation it went to, and
+ * that implementation's batch.
+ */
+struct bvbatch {
+	unsigned int impl;
+	struct bvbatch *batch;
+};
+
+/*
+ * bvmgr_dropbatch() - End, without a BLT, the batch an implementation
+ * began with a BLT it rejected.
+ */
+static void bvmgr_dropbatch(struct bvbltparams *params, unsigned int impl)
+{
+	struct bvbltparams end;
+
+	if (!params->batch)
+		return;
+	bvmgr_copyparams(&end, params);
+	end.flags = (params->flags & ~(BVFLAG_BATCH_MASK | BVFLAG_ASYNC)) |
+		BVFLAG_BATCH_END;
+	end.batchflags = BVBATCH_ENDNOP;
+	bvmgr_impls[impl].blt(&end);
+	params->batch = NULL;
+}
+
+/*
+ * bvmgr_batchbegin() - Begin a batch with the implementation that takes
+ * its first BLT, tried in the order bv_blt() tries them.
+ */
+static enum bverror bvmgr_batchbegin(struct bvbltparams *params,
+				     unsigned int allowed)
+{
+	unsigned long implementation = params->implementation;
+	unsigned int order[BVMGR_MAXIMPLS];
+	unsigned int rejected = 0, n, i;
+	struct bvmgr_class c;
+	struct bvbatch *batch;
+	enum bverror err, first = BVERR_NONE;
+	char *firstdesc = NULL;
+
+	batch = malloc(sizeof(*batch));
+	params->batch = NULL;
+	if (!batch)
+		return bvmgr_err(params, BVERR_OOM, "out of memory for batch");
+
+	bvmgr_classify(params, &c);
+	n = bvmgr_choose(&c, allowed, order);
+	for (i = 0; i < n; i++) {
+		err = bvmgr_fence(params, order[i]);
+		if (err == BVERR_NONE) {
+			params->implementation = 0;
+			err = bvmgr_impls[order[i]].blt(params);
+			params->implementation = implementation;
+			if (err == BVERR_NONE)
+				break;
+			bvmgr_dropbatch(params, order[i]);
+			rejected |= 1u << order[i];
+		}
+		if (!i) {
+			first = err;
+			firstdesc = params->errdesc;
+		}
+	}
+
+	if (i == n || !params->batch) {
+		free(batch);
+		return i == n ? bvmgr_err(params, first, firstdesc) :
+			BVERR_NONE;
+	}
+	batch->impl = order[i];
+	batch->batch = params->batch;
+	params->batch = batch;
+	for (i = 0; i < bvmgr_nimpls; i++)
+		if (rejected & (1u << i))
+			bvmgr_unsupported(&c, i);
+	return BVERR_NONE;
+}
+
+static enum bverror bvmgr_batch(struct bvbltparams *params)
+{
+	unsigned long implementation = params->implementation;
+	struct bvbatch *batch = params->batch;
+	enum bverror err;
+
+	if (!batch)
+		return bvmgr_err(params, BVERR_BATCH,
+				 "bvbltparams.batch required");
+
+	err = bvmgr_fence(params, batch->impl);
+	if (err != BVERR_NONE)
+		return err;
+	params->batch = batch->batch;
+	params->implementation = 0;
+	err = bvmgr_impls[batch->impl].blt(params);
+	params->implementation = implementation;
+
+	batch->batch = params->batch;
+	params->batch = batch;
+	if ((params->flags & BVFLAG_BATCH_MASK) == BVFLAG_BATCH_END) {
+		if (params->flags & BVFLAG_ASYNC)
+			bvmgr_pending = batch->impl + 1;
+		params->batch = NULL;
+		free(batch);
+	}
+	return err;
+}
+
+enum bverror bv_map(struct bvbuffdesc *buffdesc)
+{
+	enum bverror err, first = BVERR_NONE;
+	unsigned int i, pass, mapped = 0;
+
+	if (!bvmgr_nimpls)
+		return BVERR_RSRC;
+	if (!buffdesc)
+		return BVERR_BUFFERDESC;
+
+	/*
+	 * Any implementation may get the BLTs of the buffer.  Those that
+	 * cannot map it map it for each BLT, if they can at all.  Those
+	 * without bvbuffmap slots go first, so that the slot table ends up
+	 * in the head of the chain (see bvinternal.h).
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < bvmgr_nimpls; i++) {
+			if ((bvmgr_impls[i].mapslot != NULL) != pass)
+				continue;
+			err = bvmgr_impls[i].map(buffdesc);
+			if (err == BVERR_NONE)
+				mapped = 1;
+			else if (first == BVERR_NONE)
+				first = err;
+		}
+	}
+	return mapped ? BVERR_NONE : first;
+}
+
+enum bverror bv_blt(struct bvbltparams *bltparams)
+{
+	unsigned int order[BVMGR_MAXIMPLS];
+	unsigned int rejected = 0, allowed, n, i;
+	struct bvmgr_class c;
+	enum bverror err, first = BVERR_NONE;
+	char *firstdesc = NULL;
+
+	if (!bvmgr_nimpls)
+		return BVERR_RSRC;
+	if (!bltparams || bltparams->structsize < BVMGR_BLTPARAMS_MINSIZE)
+		return BVERR_BLTPARAMS_VERS;
+	bltparams->errdesc = NULL;
+
+	allowed = bvmgr_allowed(bltparams->implementation);
+	if (!allowed)
+		return bvmgr_err(bltparams, BVERR_IMPLEMENTATION,
+				 "no implementation selected is loaded");
+	if ((bltparams->flags & BVFLAG_BATCH_MASK) == BVFLAG_BATCH_BEGIN)
+		return bvmgr_batchbegin(bltparams, allowed);
+	if ((bltparams->flags & BVFLAG_BATCH_MASK) != BVFLAG_BATCH_NONE)
+		return bvmgr_batch(bltparams);
+
+	bvmgr_classify(bltparams, &c);
+	n = bvmgr_choose(&c, allowed, order);
+	for (i = 0; i < n; i++) {
+		/* those that cannot be fenced have not seen the BLT */
+		err = bvmgr_fence(bltparams, order[i]);
+		if (err == BVERR_NONE) {
+			err = bvmgr_bltimpl(bltparams, &c, order[i]);
+			if (err == BVERR_NONE)
+				break;
+			rejected |= 1u << order[i];
+		}
+		if (!i) {
+			first = err;
+			firstdesc = bltparams->errdesc;
+		}
+	}
+
+	/* a BLT no implementation takes is the client's error */
+	if (i == n)
+		return bvmgr_err(bltparams, first, firstdesc);
+	for (i = 0; i < bvmgr_nimpls; i++)
+		if (rejected & (1u << i))
+			bvmgr_unsupported(&c, i);
+	return BVERR_NONE;
+}
+
+enum bverror bv_unmap(struct bvbuffdesc *buffdesc)
+{
+	if (!bvmgr_nimpls)
+		return BVERR_RSRC;
+	if (!buffdesc)
+		return BVERR_BUFFERDESC;
+
+	/* One bv_unmap() releases the buffer from every implementation. */
+	if (buffdesc->map)
+		return buffdesc->map->bv_unmap(buffdesc);
+
+	return BVERR_NONE;
+}
+
+enum bverror bv_cache(struct bvcopparams *copparams)
+{
+	enum bverror err, first = BVERR_NONE;
+	unsigned int i;
+
+	if (!bvmgr_nimpls)
+		return BVERR_RSRC;
+
+	/* implementations without bv_cache() need no cache maintenance */
+	for (i = 0; i < bvmgr_nimpls; i++) {
+		if (!bvmgr_impls[i].cache)
+			continue;
+		err = bvmgr_impls[i].cache(copparams);
+		if (err != BVERR_NONE && first == BVERR_NONE)
+			first = err;
+	}
+	return first;
+}
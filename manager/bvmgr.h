@@ -0,0 +1,104 @@
+/*
+ * bvmgr.h
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the private definitions shared by the source files of
+ * the BLTsville manager (bltsville_mgr).  It should not be used by clients.
+ */
+
+#ifndef BVMGR_H
+#define BVMGR_H
+
+#include <stddef.h>
+
+#include "bltsville.h"
+#include "bventry.h"
+#include "bvinternal.h"
+
+/*
+ * Exported entry points (see bventry.h for the function types).
+ */
+enum bverror bv_map(struct bvbuffdesc *buffdesc);
+enum bverror bv_blt(struct bvbltparams *bltparams);
+enum bverror bv_unmap(struct bvbuffdesc *buffdesc);
+enum bverror bv_cache(struct bvcopparams *copparams);
+
+#define BVMGR_BLTPARAMS_MINSIZE	offsetof(struct bvbltparams, src2auxdstrect)
+
+/*
+ * BVMGR_MAXIMPLS - Implementations the manager can load, CPU and hardware
+ * together.
+ */
+#define BVMGR_MAXIMPLS		8
+
+/*
+ * bvmgr_impl - An implementation loaded by the manager.  id is its
+ * BVIMPL_* bit: CPU implementations take the bits from BVIMPL_FIRST_CPU
+ * leftwards, and hardware ones from BVIMPL_FIRST_HW rightwards, in the
+ * order they are configured.  Those exporting bv_mapslot() get bvbuffmap
+ * slots the same way (see bvinternal.h).
+ */
+struct bvmgr_impl {
+	void *lib;
+	unsigned long id;
+	BVFN_MAP map;
+	BVFN_BLT blt;
+	BVFN_UNMAP unmap;
+	BVFN_CACHE cache;		/* optional */
+	BVFN_MAPSLOT mapslot;		/* optional */
+};
+
+extern struct bvmgr_impl bvmgr_impls[BVMGR_MAXIMPLS];
+extern unsigned int bvmgr_nimpls;
+
+/*
+ * Cost table.
+ *
+ * bvmgr_class - What the cost of a BLT is assumed to depend on: the
+ * operation, the features used, the formats and the size of the
+ * destination rectangle, in powers of 2.
+ *
+ * bvmgr_choose() fills order with the implementations of allowed (a mask
+ * of indices into bvmgr_impls) to try for a BLT of a class, best first,
+ * and returns how many there are.  bvmgr_measured() records the time an
+ * implementation took, and bvmgr_unsupported() that it rejected a BLT
+ * another one accepted.
+ */
+struct bvmgr_class {
+	unsigned long flags;
+	unsigned long op;
+	unsigned int formats[3];	/* dst, src1, src2 */
+	unsigned int size;
+};
+
+void bvmgr_classify(const struct bvbltparams *params, struct bvmgr_class *c);
+unsigned int bvmgr_choose(const struct bvmgr_class *c, unsigned int allowed,
+			  unsigned int *order);
+void bvmgr_measured(const struct bvmgr_class *c, unsigned int impl,
+		    unsigned long ns);
+void bvmgr_unsupported(const struct bvmgr_class *c, unsigned int impl);
+unsigned long bvmgr_now(void);
+
+/*
+ * Error reporting.
+ */
+static inline enum bverror bvmgr_err(struct bvbltparams *params,
+				     enum bverror err, const char *desc)
+{
+	params->errdesc = (char *)desc;
+	return err;
+}
+
+#endif /* BVMGR_H */
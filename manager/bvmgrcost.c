@@ -0,0 +1,227 @@
+/*
+ * bvmgrcost.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file contains the table of the costs the manager has observed.
+ * BLTs are grouped into classes assumed to cost about the same, and each
+ * class keeps a moving average of the time each implementation took for
+ * it.  BLTs go to the implementation with the lowest average, once each
+ * one has been measured a few times; every so often one goes to the
+ * implementation measured least among the others, so that the table
+ * follows changes in load.  A BLT far slower than the average, say one
+ * whose thread was preempted, moves it by no more than an eighth.
+ *
+ * The table is a cache: a class displaces the class in its slot, which is
+ * measured again when it comes back.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "bvmgr.h"
+
+/*
+ * BVMGR_CLASSES - Slots in the table.
+ * BVMGR_PROBES - Times each implementation is measured before the costs of
+ * a class are trusted.
+ * BVMGR_REPROBE - One BLT in this many goes to the implementation measured
+ * least, other than the best.
+ * BVMGR_WEIGHT - Samples a moving average spans.
+ */
+#define BVMGR_CLASSES		256
+#define BVMGR_PROBES		3
+#define BVMGR_REPROBE		64
+#define BVMGR_WEIGHT		8
+
+/*
+ * bvmgr_cost - The costs of a class, in nanoseconds per BLT.
+ */
+struct bvmgr_cost {
+	struct bvmgr_class key;
+	int used;
+	unsigned long ns[BVMGR_MAXIMPLS];
+	unsigned int samples[BVMGR_MAXIMPLS];
+	unsigned int unsupported;	/* implementations rejecting it */
+	unsigned int blts;
+};
+
+static pthread_mutex_t bvmgr_costlock = PTHREAD_MUTEX_INITIALIZER;
+static struct bvmgr_cost bvmgr_costs[BVMGR_CLASSES];
+
+/*
+ * bvmgr_log2() - Index of the highest bit set in n, or 0.
+ */
+static unsigned int bvmgr_log2(unsigned long n)
+{
+	unsigned int l = 0;
+
+	while (n >>= 1)
+		l++;
+	return l;
+}
+
+void bvmgr_classify(const struct bvbltparams *params, struct bvmgr_class *c)
+{
+	unsigned int usessrc1 = 1, usessrc2 = 0;
+
+	memset(c, 0, sizeof(*c));
+	c->flags = params->flags &
+		(BVFLAG_OP_MASK | BVFLAG_KEY_SRC | BVFLAG_KEY_DST |
+		 BVFLAG_SRCMASK | BVFLAG_TILE_SRC1 | BVFLAG_TILE_SRC2 |
+		 BVFLAG_TILE_MASK | BVFLAG_ASYNC);
+	switch (params->flags & BVFLAG_OP_MASK) {
+	case BVFLAG_ROP:
+		c->op = params->op.rop;
+		usessrc1 = ((params->op.rop >> 2) ^ params->op.rop) & 0x3333;
+		usessrc2 = ((params->op.rop >> 4) ^ params->op.rop) & 0x0F0F;
+		break;
+	case BVFLAG_BLEND:
+		c->op = params->op.blend;
+		usessrc2 = 1;
+		break;
+	case BVFLAG_FILTER:
+		if (params->op.filter)
+			c->op = params->op.filter->filter;
+		break;
+	}
+
+	if (params->dstgeom)
+		c->formats[0] = params->dstgeom->format;
+	if (usessrc1 && params->src1geom)
+		c->formats[1] = params->src1geom->format;
+	if (usessrc2 && params->src2geom)
+		c->formats[2] = params->src2geom->format;
+	c->size = bvmgr_log2((unsigned long)params->dstrect.width *
+			     params->dstrect.height);
+	if (usessrc1 &&
+	    (params->src1rect.width != params->dstrect.width ||
+	     params->src1rect.height != params->dstrect.height))
+		c->size |= 0x80;	/* scaled */
+}
+
+/*
+ * bvmgr_costslot() - Find the slot of a class, taking it over if another
+ * class holds it.  Called with the lock held.
+ */
+static struct bvmgr_cost *bvmgr_costslot(const struct bvmgr_class *c)
+{
+	struct bvmgr_cost *cost;
+	unsigned long h;
+
+	h = c->flags * 0x9E3779B1ul;
+	h = (h ^ c->op) * 0x9E3779B1ul;
+	h = (h ^ c->formats[0]) * 0x9E3779B1ul;
+	h = (h ^ c->formats[1]) * 0x9E3779B1ul;
+	h = (h ^ c->formats[2]) * 0x9E3779B1ul;
+	h = (h ^ c->size) * 0x9E3779B1ul;
+	cost = &bvmgr_costs[(h >> 16) % BVMGR_CLASSES];
+
+	if (!cost->used || memcmp(&cost->key, c, sizeof(*c))) {
+		memset(cost, 0, sizeof(*cost));
+		memcpy(&cost->key, c, sizeof(*c));
+		cost->used = 1;
+	}
+	return cost;
+}
+
+/*
+ * bvmgr_costns() - Cost of a class on an implementation, 0 until it has
+ * been measured enough, so that it is tried first.
+ */
+static unsigned long bvmgr_costns(const struct bvmgr_cost *cost,
+				  unsigned int impl)
+{
+	return cost->samples[impl] < BVMGR_PROBES ? 0 : cost->ns[impl];
+}
+
+unsigned int bvmgr_choose(const struct bvmgr_class *c, unsigned int allowed,
+			  unsigned int *order)
+{
+	struct bvmgr_cost *cost;
+	unsigned int n = 0, tried = 0, least, i, j, k;
+
+	pthread_mutex_lock(&bvmgr_costlock);
+	cost = bvmgr_costslot(c);
+
+	for (i = 0; i < bvmgr_nimpls; i++) {
+		if (!(allowed & (1u << i)) || (cost->unsupported & (1u << i)))
+			continue;
+		for (j = n; j > 0; j--) {
+			k = order[j - 1];
+			if (bvmgr_costns(cost, k) <= bvmgr_costns(cost, i))
+				break;
+			order[j] = k;
+		}
+		order[j] = i;
+		n++;
+	}
+
+	if (n > 1 && ++cost->blts % BVMGR_REPROBE == 0) {
+		least = 1;
+		for (j = 2; j < n; j++)
+			if (cost->samples[order[j]] <
+			    cost->samples[order[least]])
+				least = j;
+		k = order[least];
+		for (j = least; j > 0; j--)
+			order[j] = order[j - 1];
+		order[0] = k;
+	}
+
+	/* those that rejected the class still get a chance, last */
+	for (i = 0; i < n; i++)
+		tried |= 1u << order[i];
+	for (i = 0; i < bvmgr_nimpls; i++)
+		if ((allowed & (1u << i)) && !(tried & (1u << i)))
+			order[n++] = i;
+
+	pthread_mutex_unlock(&bvmgr_costlock);
+	return n;
+}
+
+void bvmgr_measured(const struct bvmgr_class *c, unsigned int impl,
+		    unsigned long ns)
+{
+	struct bvmgr_cost *cost;
+
+	pthread_mutex_lock(&bvmgr_costlock);
+	cost = bvmgr_costslot(c);
+	if (!cost->samples[impl]++) {
+		cost->ns[impl] = ns;
+	} else {
+		if (ns > 2 * cost->ns[impl])
+			ns = 2 * cost->ns[impl];
+		cost->ns[impl] = (long)cost->ns[impl] +
+			((long)ns - (long)cost->ns[impl]) / BVMGR_WEIGHT;
+	}
+	pthread_mutex_unlock(&bvmgr_costlock);
+}
+
+void bvmgr_unsupported(const struct bvmgr_class *c, unsigned int impl)
+{
+	pthread_mutex_lock(&bvmgr_costlock);
+	bvmgr_costslot(c)->unsupported |= 1u << impl;
+	pthread_mutex_unlock(&bvmgr_costlock);
+}
+
+unsigned long bvmgr_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000000000ul +
+		(unsigned long)ts.tv_nsec;
+}
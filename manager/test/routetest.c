@@ -0,0 +1,391 @@
+/*
+ * routetest.c
+ *
+ * Copyright (C) 2012 Texas Instruments, Inc.
+ *
+ * This file is part of BLTsville, an open application programming interface
+ * (API) for accessing 2-D software or hardware implementations.
+ *
+ * This work is licensed under the Creative Commons Attribution-NoDerivs 3.0
+ * Unported License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nd/3.0/ or send a letter to
+ * Creative Commons, 444 Castro Street, Suite 900, Mountain View, California,
+ * 94041, USA.
+ */
+
+/*
+ * This file tests the routing of the BLTsville manager (bltsville_mgr)
+ * between two builds of the CPU implementation, a fast one built with -O2
+ * and a slow one built with -O0, named in that order by BVMGR_CPU and on
+ * the command line:
+ *
+ *	BVMGR_HW= BVMGR_CPU=fast.so:slow.so routetest fast.so slow.so
+ *
+ * It checks that:
+ * - BLTs sent through the manager synchronously, asynchronously and in
+ *   batches come out the same as from the fast build called directly;
+ * - bvbltparams.implementation sends BLTs to the build it names;
+ * - left to the manager, most BLTs go to the fast build;
+ * - each build has a bvbuffmap slot of its own.
+ *
+ * The test is linked with the manager, and counts the BLTs it sends each
+ * build by wrapping their bv_blt() in bvmgr_impls.
+ */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bvmgr.h"
+
+#define W		256
+#define H		256
+#define SIZE		(W * H * 4)
+
+#define ITERATIONS	200
+#define MAXBLTS		40
+#define TIMED		640
+
+static unsigned char src[SIZE], dst[SIZE], ref[SIZE], init[SIZE];
+static struct bvbuffdesc srcdesc = { sizeof(srcdesc) };
+static struct bvbuffdesc dstdesc = { sizeof(dstdesc) };
+static struct bvsurfgeom geom = { sizeof(geom) };
+static int callbacks;
+static int fails;
+
+/* bv_blt() of each build, and the BLTs the manager sent it */
+static BVFN_BLT implblt[2];
+static unsigned long implblts[2];
+
+static enum bverror countfast(struct bvbltparams *params)
+{
+	__atomic_fetch_add(&implblts[0], 1, __ATOMIC_RELAXED);
+	return implblt[0](params);
+}
+
+static enum bverror countslow(struct bvbltparams *params)
+{
+	__atomic_fetch_add(&implblts[1], 1, __ATOMIC_RELAXED);
+	return implblt[1](params);
+}
+
+static void callback(struct bvcallbackerror *err, unsigned long data)
+{
+	if (!err)
+		__atomic_fetch_add(&callbacks, (int)data, __ATOMIC_RELEASE);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fail(int it, const char *what, struct bvbltparams *params)
+{
+	printf("routetest: iteration %d: %s%s%s\n", it, what,
+	       params && params->errdesc ? ": " : "",
+	       params && params->errdesc ? params->errdesc : "");
+	fails++;
+}
+
+/*
+ * randrect() - A random rectangle of the surface, 8 to 207 pixels a side.
+ */
+static void randrect(struct bvrect *rect)
+{
+	rect->width = 8 + rand() % 200;
+	rect->height = 8 + rand() % 200;
+	rect->left = rand() % (W - rect->width);
+	rect->top = rand() % (H - rect->height);
+}
+
+/*
+ * randblt() - A random copy or SRC1OVER blend into dst, scaled.
+ */
+static void randblt(struct bvbltparams *params)
+{
+	memset(params, 0, sizeof(*params));
+	params->structsize = sizeof(*params);
+	params->dstdesc = &dstdesc;
+	params->dstgeom = &geom;
+	params->src1.desc = &srcdesc;
+	params->src1geom = &geom;
+	randrect(&params->dstrect);
+	randrect(&params->src1rect);
+	if (rand() % 2) {
+		params->flags = BVFLAG_BLEND;
+		params->op.blend = BVBLEND_SRC1OVER;
+		params->src2.desc = &dstdesc;
+		params->src2geom = &geom;
+		params->src2rect = params->dstrect;
+	} else {
+		params->flags = BVFLAG_ROP;
+		params->op.rop = 0xCCCC;
+	}
+}
+
+/*
+ * finish() - Wait for the asynchronous BLTs of the thread, and for
+ * expected callbacks.
+ */
+static void finish(int it, int expected)
+{
+	struct bvbltparams nop;
+	int wait;
+
+	randblt(&nop);
+	nop.flags = BVFLAG_ROP;
+	nop.op.rop = 0xAAAA;
+	if (bv_blt(&nop) != BVERR_NONE)
+		fail(it, "NOP rejected", &nop);
+	for (wait = 0; wait < 4000; wait++) {
+		if (__atomic_load_n(&callbacks, __ATOMIC_ACQUIRE) == expected)
+			break;
+		usleep(250);
+	}
+	if (callbacks != expected)
+		fail(it, "callbacks missing", NULL);
+}
+
+/*
+ * timedblt() - Send the BLT routed() times through the manager.
+ */
+static void timedblt(unsigned long implementation, int it)
+{
+	struct bvbltparams params;
+
+	memset(&params, 0, sizeof(params));
+	params.structsize = sizeof(params);
+	params.implementation = implementation;
+	params.flags = BVFLAG_BLEND;
+	params.op.blend = BVBLEND_SRC1OVER;
+	params.dstdesc = &dstdesc;
+	params.dstgeom = &geom;
+	params.src1.desc = &srcdesc;
+	params.src1geom = &geom;
+	params.src2.desc = &dstdesc;
+	params.src2geom = &geom;
+	params.src1rect.width = params.src1rect.height = 64;
+	params.dstrect.width = params.dstrect.height = 128;
+	params.src2rect = params.dstrect;
+	if (bv_blt(&params) != BVERR_NONE)
+		fail(it, "timed BLT rejected", &params);
+}
+
+/*
+ * routed() - Send BLTs like one another through the manager, and report
+ * how many went to each build and the time per BLT in us.
+ */
+static double routed(unsigned long implementation, unsigned long *uses)
+{
+	unsigned long before[2];
+	double start;
+	int i;
+
+	/* the first BLT may fence the build the last one went to */
+	timedblt(implementation, 0);
+	before[0] = implblts[0];
+	before[1] = implblts[1];
+	start = now();
+	for (i = 0; i < TIMED; i++)
+		timedblt(implementation, i);
+	start = (now() - start) / TIMED * 1e6;
+	for (i = 0; i < 2; i++)
+		uses[i] = implblts[i] - before[i];
+	return start;
+}
+
+/*
+ * checkslots() - Check that the builds were given bvbuffmap slots of their
+ * own, in the table at the head of the chain.
+ */
+static void checkslots(struct bvbuffdesc *desc)
+{
+	struct bvbuffmap *table = desc->map;
+	unsigned int i;
+
+	if (table->structsize < sizeof(struct bvbuffmap)) {
+		fail(0, "no slot table at the head of the chain", NULL);
+		return;
+	}
+	for (i = 0; i < 2; i++)
+		if (!table->slotmap[BVBUFFMAP_FIRST_CPU + i] ||
+		    table->slotmap[BVBUFFMAP_FIRST_CPU + i]->slot !=
+		    BVBUFFMAP_FIRST_CPU + i)
+			fail(0, "build without a slot of its own", NULL);
+	if (table->slotmap[BVBUFFMAP_FIRST_CPU] &&
+	    table->slotmap[BVBUFFMAP_FIRST_CPU + 1] &&
+	    table->slotmap[BVBUFFMAP_FIRST_CPU]->bv_unmap ==
+	    table->slotmap[BVBUFFMAP_FIRST_CPU + 1]->bv_unmap)
+		fail(0, "builds share a slot", NULL);
+}
+
+/*
+ * check() - Send random BLTs through the manager and to the fast build,
+ * and compare.
+ */
+static void check(BVFN_BLT refblt)
+{
+	struct bvbltparams blts[MAXBLTS], params;
+	struct bvbatch *batch;
+	int it, n, i, expected;
+
+	for (it = 0; it < ITERATIONS; it++) {
+		n = 1 + rand() % MAXBLTS;
+		for (i = 0; i < n; i++)
+			randblt(&blts[i]);
+
+		memcpy(ref, init, SIZE);
+		dstdesc.virtaddr = ref;
+		for (i = 0; i < n; i++) {
+			params = blts[i];
+			if (refblt(&params) != BVERR_NONE)
+				fail(it, "reference BLT rejected", &params);
+		}
+
+		memcpy(dst, init, SIZE);
+		dstdesc.virtaddr = dst;
+		callbacks = 0;
+		expected = 0;
+		if (it % 3 == 2) {
+			/* one batch, ended asynchronously without a BLT */
+			batch = NULL;
+			for (i = 0; i <= n; i++) {
+				if (i < n) {
+					params = blts[i];
+					params.batchflags = BVBATCH_OP |
+						BVBATCH_DST | BVBATCH_SRC1 |
+						BVBATCH_SRC2 |
+						BVBATCH_DSTRECT_ORIGIN |
+						BVBATCH_DSTRECT_SIZE |
+						BVBATCH_SRC1RECT_ORIGIN |
+						BVBATCH_SRC1RECT_SIZE |
+						BVBATCH_SRC2RECT_ORIGIN |
+						BVBATCH_SRC2RECT_SIZE;
+					params.flags |= i ?
+						BVFLAG_BATCH_CONTINUE :
+						BVFLAG_BATCH_BEGIN;
+				} else {
+					params.batchflags = BVBATCH_ENDNOP;
+					params.flags = (params.flags &
+							~BVFLAG_BATCH_MASK) |
+						BVFLAG_BATCH_END |
+						BVFLAG_ASYNC;
+					params.callbackfn = callback;
+					params.callbackdata = 1;
+					expected = 1;
+				}
+				params.batch = batch;
+				if (bv_blt(&params) != BVERR_NONE)
+					fail(it, "batched BLT rejected",
+					     &params);
+				batch = params.batch;
+			}
+		} else {
+			/* some sent to either build by name */
+			for (i = 0; i < n; i++) {
+				params = blts[i];
+				if (rand() % 3 == 0)
+					params.implementation = rand() % 2 ?
+						BVIMPL_FIRST_CPU :
+						BVIMPL_FIRST_CPU << 1;
+				if (it % 3 == 1) {
+					params.flags |= BVFLAG_ASYNC;
+					params.callbackfn = callback;
+					params.callbackdata = 1;
+					expected++;
+				}
+				if (bv_blt(&params) != BVERR_NONE)
+					fail(it, "BLT rejected", &params);
+			}
+		}
+		finish(it, expected);
+
+		if (memcmp(dst, ref, SIZE))
+			fail(it, "routed BLTs differ from the fast build",
+			     NULL);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long uses[2];
+	double fast, slow, best;
+	BVFN_BLT refblt;
+	void *lib[2];
+	unsigned int j;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s fast.so slow.so\n", argv[0]);
+		return 2;
+	}
+	for (i = 0; i < 2; i++) {
+		lib[i] = dlopen(argv[1 + i], RTLD_NOW | RTLD_NOLOAD);
+		for (j = 0; lib[i] && j < bvmgr_nimpls; j++)
+			if (bvmgr_impls[j].lib == lib[i])
+				break;
+		if (!lib[i] || j == bvmgr_nimpls) {
+			printf("routetest: %s not loaded by the manager\n",
+			       argv[1 + i]);
+			return 1;
+		}
+		implblt[i] = bvmgr_impls[j].blt;
+		bvmgr_impls[j].blt = i ? countslow : countfast;
+	}
+	refblt = (BVFN_BLT)dlsym(lib[0], "bv_blt");
+
+	srand(21);
+	for (i = 0; i < SIZE; i += 4) {
+		/* premultiplied */
+		src[i + 3] = rand();
+		src[i] = rand() % (src[i + 3] + 1);
+		src[i + 1] = rand() % (src[i + 3] + 1);
+		src[i + 2] = rand() % (src[i + 3] + 1);
+	}
+	for (i = 0; i < SIZE; i++)
+		init[i] = src[(i + 999) % SIZE];
+	srcdesc.virtaddr = src;
+	srcdesc.length = SIZE;
+	dstdesc.length = SIZE;
+	geom.format = OCDFMT_BGRA24;
+	geom.width = W;
+	geom.height = H;
+	geom.virtstride = W * 4;
+
+	if (bv_map(&srcdesc) != BVERR_NONE || !srcdesc.map ||
+	    !srcdesc.map->nextmap)
+		fail(0, "buffer not mapped by both builds", NULL);
+	else
+		checkslots(&srcdesc);
+
+	check(refblt);
+
+	dstdesc.virtaddr = dst;
+	fast = routed(BVIMPL_FIRST_CPU, uses);
+	if (!uses[0] || uses[1])
+		fail(0, "BVIMPL_FIRST_CPU not sent to the fast build", NULL);
+	slow = routed(BVIMPL_FIRST_CPU << 1, uses);
+	if (uses[0] || !uses[1])
+		fail(0, "BVIMPL_FIRST_CPU << 1 not sent to the slow build",
+		     NULL);
+	routed(0, uses);
+	best = routed(0, uses);
+	if (uses[1] * 4 > uses[0] + uses[1])
+		fail(0, "BLTs not sent to the fast build", NULL);
+	printf("routetest: fast %.1f us, slow %.1f us, routed %.1f us, "
+	       "%lu%% to fast\n", fast, slow, best,
+	       uses[0] * 100 / (uses[0] + uses[1] ? uses[0] + uses[1] : 1));
+
+	if (bv_unmap(&srcdesc) != BVERR_NONE || srcdesc.map)
+		fail(0, "buffer not unmapped", NULL);
+
+	printf("routetest: %d failures\n", fails);
+	return fails != 0;
+}